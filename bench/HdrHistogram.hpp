@@ -0,0 +1,151 @@
+#pragma once
+#ifndef WSOCKET__BENCH_HDR_HISTOGRAM_HPP
+#define WSOCKET__BENCH_HDR_HISTOGRAM_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace wsocket {
+namespace bench {
+
+/**
+ * High dynamic range histogram (after Gil Tene's HdrHistogram)
+ *
+ * Values are grouped into power-of-two buckets, each bucket is split into
+ * 2048 linear sub-buckets, which keeps a relative error below 0.1% over the
+ * whole range [1, 2^max_magnitude) while recording in O(1) without allocation.
+ */
+class HdrHistogram {
+    static constexpr int      SUB_BUCKET_HALF_COUNT_MAGNITUDE = 10;
+    static constexpr int64_t  SUB_BUCKET_HALF_COUNT           = int64_t(1) << SUB_BUCKET_HALF_COUNT_MAGNITUDE;
+    static constexpr int64_t  SUB_BUCKET_COUNT                = SUB_BUCKET_HALF_COUNT * 2;
+    static constexpr uint64_t SUB_BUCKET_MASK                 = SUB_BUCKET_COUNT - 1;
+
+public:
+    /**
+     * @param max_magnitude Largest trackable value is 2^max_magnitude - 1,
+     *                      the default (42) covers ~73 minutes in nanoseconds
+     */
+    explicit HdrHistogram(int max_magnitude = 42) {
+        bucket_count_ = std::max(1, max_magnitude - SUB_BUCKET_HALF_COUNT_MAGNITUDE);
+        max_value_    = (uint64_t(1) << max_magnitude) - 1;
+        counts_.resize(size_t(bucket_count_ + 1) * SUB_BUCKET_HALF_COUNT);
+    }
+
+    void Record(uint64_t value) { RecordN(value, 1); }
+
+    void RecordN(uint64_t value, uint64_t count) {
+        value = std::min(value, max_value_);
+        counts_[CountsIndex(value)] += count;
+        total_count_ += count;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+        sum_ += double(value) * double(count);
+    }
+
+    void Merge(const HdrHistogram &other) {
+        if(other.counts_.size() != counts_.size()) {
+            return;
+        }
+        for(size_t i = 0; i < counts_.size(); ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        total_count_ += other.total_count_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+        sum_ += other.sum_;
+    }
+
+    void Reset() {
+        std::fill(counts_.begin(), counts_.end(), 0);
+        total_count_ = 0;
+        min_         = std::numeric_limits<uint64_t>::max();
+        max_         = 0;
+        sum_         = 0;
+    }
+
+    uint64_t Count() const { return total_count_; }
+    uint64_t Min() const { return total_count_ ? min_ : 0; }
+    uint64_t Max() const { return max_; }
+    double   Mean() const { return total_count_ ? sum_ / double(total_count_) : 0; }
+
+    /**
+     * Value at the given percentile
+     * @param percentile In range [0, 100]
+     */
+    uint64_t Percentile(double percentile) const {
+        if(total_count_ == 0) {
+            return 0;
+        }
+        percentile     = std::min(std::max(percentile, 0.0), 100.0);
+        auto threshold = uint64_t(std::ceil(percentile / 100.0 * double(total_count_)));
+        threshold      = std::max<uint64_t>(threshold, 1);
+
+        uint64_t seen = 0;
+        for(size_t i = 0; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if(seen >= threshold) {
+                return std::min(HighestEquivalentValue(ValueFromIndex(i)), max_);
+            }
+        }
+        return max_;
+    }
+
+private:
+    static int BucketIndex(uint64_t value) {
+        // index of the highest set bit, the sub-bucket mask keeps small values in bucket 0
+        int pow2_ceiling = 64 - CountLeadingZeros(value | SUB_BUCKET_MASK);
+        return pow2_ceiling - (SUB_BUCKET_HALF_COUNT_MAGNITUDE + 1);
+    }
+
+    static size_t CountsIndex(uint64_t value) {
+        int     bucket     = BucketIndex(value);
+        int64_t sub_bucket = int64_t(value >> bucket);
+        return size_t(((int64_t(bucket) + 1) << SUB_BUCKET_HALF_COUNT_MAGNITUDE) + (sub_bucket - SUB_BUCKET_HALF_COUNT));
+    }
+
+    static uint64_t ValueFromIndex(size_t index) {
+        int64_t bucket     = int64_t(index >> SUB_BUCKET_HALF_COUNT_MAGNITUDE) - 1;
+        int64_t sub_bucket = int64_t(index & (SUB_BUCKET_HALF_COUNT - 1)) + SUB_BUCKET_HALF_COUNT;
+        if(bucket < 0) {
+            sub_bucket -= SUB_BUCKET_HALF_COUNT;
+            bucket = 0;
+        }
+        return uint64_t(sub_bucket) << bucket;
+    }
+
+    static uint64_t HighestEquivalentValue(uint64_t value) {
+        int bucket = BucketIndex(value);
+        return value + (uint64_t(1) << bucket) - 1;
+    }
+
+    static int CountLeadingZeros(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_clzll(value);
+#else
+        int n = 0;
+        for(uint64_t bit = uint64_t(1) << 63; bit && !(value & bit); bit >>= 1) {
+            ++n;
+        }
+        return n;
+#endif
+    }
+
+private:
+    int                   bucket_count_ = 0;
+    uint64_t              max_value_    = 0;
+    std::vector<uint64_t> counts_;
+
+    uint64_t total_count_ = 0;
+    uint64_t min_         = std::numeric_limits<uint64_t>::max();
+    uint64_t max_         = 0;
+    double   sum_         = 0;
+};
+
+} // namespace bench
+} // namespace wsocket
+
+#endif // WSOCKET__BENCH_HDR_HISTOGRAM_HPP
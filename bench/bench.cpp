@@ -0,0 +1,663 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/WSocketContext.hpp"
+#include "../include/ConflationQueue.hpp"
+#include "../include/Shm_WSocket.hpp"
+
+/**
+ * Microbenchmarks for the protocol core.
+ *
+ * Every benchmark is run repeatedly until it has been measured for at least
+ * `--min-time` milliseconds, the results are printed as a single JSON document
+ * on stdout so that runs can be diffed / stored by a regression job.
+ *
+ * Global operator new is counted: `allocs_per_op` reports the steady-state
+ * allocations of each benchmark and `--max-allocs-per-op` turns an increase
+ * into a failing exit code.
+ *
+ * usage: wsocket_bench [--filter <substring>] [--min-time <ms>] [--max-allocs-per-op <n>]
+ */
+
+std::atomic<uint64_t> g_allocations{0};
+
+void *operator new(size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if(void *data = std::malloc(size ? size : 1)) {
+        return data;
+    }
+    throw std::bad_alloc();
+}
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+void operator delete(void *data) noexcept { std::free(data); }
+void operator delete(void *data, size_t) noexcept { std::free(data); }
+
+namespace {
+
+// Keep the optimizer from dropping benchmarked work
+template <typename T>
+inline void DoNotOptimize(T const &value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void *sink;
+    sink = &value;
+#endif
+}
+
+struct Result {
+    std::string name;
+    uint64_t    iterations  = 0; // operations executed
+    double      seconds     = 0; // measured wall time
+    uint64_t    bytes       = 0; // payload bytes processed, 0 if not applicable
+    uint64_t    allocations = 0; // operator new calls while measured
+};
+
+class Runner {
+public:
+    Runner(std::string filter, std::chrono::milliseconds min_time) : filter_(std::move(filter)), min_time_(min_time) {}
+
+    /**
+     * Run a benchmark body until the minimum measuring time is reached
+     * @param name Benchmark name, used for filtering and reporting
+     * @param bytes_per_op Payload bytes processed by a single operation
+     * @param body Callable executing `n` operations
+     */
+    template <typename Body>
+    void Run(const std::string &name, uint64_t bytes_per_op, Body &&body) {
+        if(!filter_.empty() && name.find(filter_) == std::string::npos) {
+            return;
+        }
+
+        // warm up, also lets the body allocate its steady-state buffers
+        body(uint64_t(1));
+
+        uint64_t batch = 1;
+        Result   result;
+        result.name = name;
+
+        while(true) {
+            auto allocations = g_allocations.load(std::memory_order_relaxed);
+            auto start       = std::chrono::steady_clock::now();
+            body(batch);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            result.iterations += batch;
+            result.seconds += elapsed.count();
+            result.allocations += g_allocations.load(std::memory_order_relaxed) - allocations;
+
+            if(result.seconds * 1000 >= min_time_.count()) {
+                break;
+            }
+            if(elapsed.count() < 0.01) {
+                batch *= 2;
+            }
+        }
+        result.bytes = bytes_per_op * result.iterations;
+        results_.push_back(result);
+    }
+
+    void PrintJson(std::ostream &os) const {
+        os << "{\n";
+        os << "  \"context\": {\"min_time_ms\": " << min_time_.count() << ", \"zstd\": "
+#ifdef WITH_ZSTD
+           << "true"
+#else
+           << "false"
+#endif
+           << "},\n";
+        os << "  \"benchmarks\": [\n";
+        for(size_t i = 0; i < results_.size(); ++i) {
+            auto &r = results_[i];
+
+            double ns_per_op      = r.seconds * 1e9 / double(r.iterations);
+            double ops_per_second = double(r.iterations) / r.seconds;
+            double bytes_per_sec  = double(r.bytes) / r.seconds;
+
+            char line[512];
+            std::snprintf(line,
+                          sizeof(line),
+                          "    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.3f, \"ops_per_second\": %.1f, "
+                          "\"bytes_per_second\": %.1f, \"allocs_per_op\": %.3f}%s\n",
+                          r.name.c_str(),
+                          static_cast<unsigned long long>(r.iterations),
+                          ns_per_op,
+                          ops_per_second,
+                          bytes_per_sec,
+                          AllocsPerOp(r),
+                          i + 1 == results_.size() ? "" : ",");
+            os << line;
+        }
+        os << "  ]\n";
+        os << "}\n";
+    }
+
+    static double AllocsPerOp(const Result &r) { return double(r.allocations) / double(r.iterations); }
+
+    // Report the benchmarks allocating more than `max_allocs_per_op`, true if there are none
+    bool CheckAllocations(double max_allocs_per_op) const {
+        bool ok = true;
+        for(auto &r : results_) {
+            if(AllocsPerOp(r) > max_allocs_per_op) {
+                std::cerr << r.name << ": " << AllocsPerOp(r) << " allocations per op, limit " << max_allocs_per_op
+                          << std::endl;
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+private:
+    std::string               filter_;
+    std::chrono::milliseconds min_time_;
+    std::vector<Result>       results_;
+};
+
+std::vector<uint8_t> MakePayload(size_t len) {
+    static const char text[] = "The quick brown fox jumps over the lazy dog. 0123456789 WSocket benchmark payload. ";
+
+    std::vector<uint8_t> payload(len);
+    for(size_t i = 0; i < len; ++i) {
+        payload[i] = static_cast<uint8_t>(text[i % (sizeof(text) - 1)]);
+    }
+    return payload;
+}
+
+//============ FrameHeader ============//
+
+void BenchFrameHeader(Runner &runner) {
+    const uint64_t lengths[] = {100, 1000, 100000};
+    const char    *names[]   = {"short", "middle", "long"};
+
+    for(int i = 0; i < 3; ++i) {
+        uint64_t len = lengths[i];
+        runner.Run(std::string("frame_header/encode/") + names[i], 0, [len](uint64_t n) {
+            wsocket::FrameHeader header;
+            for(uint64_t k = 0; k < n; ++k) {
+                header.Length(len + (k & 1));
+                DoNotOptimize(header);
+            }
+        });
+
+        wsocket::FrameHeader encoded;
+        encoded.Length(len);
+        runner.Run(std::string("frame_header/decode/") + names[i], 0, [encoded](uint64_t n) {
+            for(uint64_t k = 0; k < n; ++k) {
+                auto header = encoded;
+                DoNotOptimize(header);
+                size_t total = header.HeaderLength() + header.Length();
+                DoNotOptimize(total);
+            }
+        });
+    }
+}
+
+//============ FrameParser ============//
+
+void BenchFrameParser(Runner &runner) {
+    // mixed sizes, dominated by small messages like real traffic
+    const size_t sizes[] = {16, 64, 200, 512, 1024, 4096, 300, 32, 70000, 128};
+
+    std::vector<uint8_t> stream;
+    size_t               frames = 0;
+    for(int round = 0; round < 16; ++round) {
+        for(auto size : sizes) {
+            auto payload = MakePayload(size);
+
+            wsocket::FrameHeader header;
+            header.Finished(true);
+            header.Type(wsocket::FrameHeader::Binary);
+            header.Length(payload.size());
+
+            auto *raw = reinterpret_cast<const uint8_t *>(&header);
+            stream.insert(stream.end(), raw, raw + header.HeaderLength());
+            stream.insert(stream.end(), payload.begin(), payload.end());
+            ++frames;
+        }
+    }
+
+    class Counter : public wsocket::FrameParser::Listener {
+    public:
+        void OnFrame(const wsocket::Frame &frame) override { bytes += frame.data.size; }
+        size_t bytes = 0;
+    };
+
+    // one op == parsing the whole stream
+    runner.Run("frame_parser/parse_one/mixed", stream.size(), [&](uint64_t n) {
+        Counter              counter;
+        wsocket::FrameParser parser(&counter);
+        parser.SetReceiveBufferSize(stream.size());
+        for(uint64_t k = 0; k < n; ++k) {
+            parser.Feed({stream.data(), stream.size()});
+            size_t parsed = 0;
+            while(parser.ParseOne()) {
+                ++parsed;
+            }
+            assert(parsed == frames);
+            DoNotOptimize(parsed);
+        }
+        DoNotOptimize(counter.bytes);
+    });
+}
+
+//============ SlidingBuffer ============//
+
+void BenchSlidingBuffer(Runner &runner) {
+    auto chunk = MakePayload(8 * 1024);
+
+    // a whole read is consumed at once, the common case for large frames
+    runner.Run("sliding_buffer/feed_consume_all/8k", chunk.size(), [&](uint64_t n) {
+        wsocket::SlidingBuffer buffer(chunk.size());
+        for(uint64_t k = 0; k < n; ++k) {
+            buffer.Feed({chunk.data(), chunk.size()});
+            buffer.Consume(chunk.size());
+        }
+        DoNotOptimize(buffer.GetDataLen());
+    });
+
+    // a read holds many small frames, each Consume moves the remaining bytes
+    runner.Run("sliding_buffer/feed_consume_small/8k_by_64", chunk.size(), [&](uint64_t n) {
+        wsocket::SlidingBuffer buffer(chunk.size());
+        for(uint64_t k = 0; k < n; ++k) {
+            buffer.Feed({chunk.data(), chunk.size()});
+            while(buffer.GetDataLen() > 0) {
+                buffer.Consume(64);
+            }
+        }
+        DoNotOptimize(buffer.GetDataLen());
+    });
+
+    // a partial frame is left over after every read
+    runner.Run("sliding_buffer/feed_consume_partial/8k_keep_100", chunk.size(), [&](uint64_t n) {
+        wsocket::SlidingBuffer buffer(chunk.size() * 2);
+        for(uint64_t k = 0; k < n; ++k) {
+            buffer.Feed({chunk.data(), chunk.size()});
+            buffer.Consume(buffer.GetDataLen() - 100);
+        }
+        DoNotOptimize(buffer.GetDataLen());
+    });
+
+    // the buffer starts empty and has to grow
+    runner.Run("sliding_buffer/feed_grow/64k", 64 * 1024, [&](uint64_t n) {
+        for(uint64_t k = 0; k < n; ++k) {
+            wsocket::SlidingBuffer buffer;
+            for(int i = 0; i < 8; ++i) {
+                buffer.Feed({chunk.data(), chunk.size()});
+            }
+            DoNotOptimize(buffer.GetDataLen());
+        }
+    });
+}
+
+//============ BufferPool ============//
+
+void BenchBufferPool(Runner &runner) {
+    // the send path: one short-lived buffer per frame
+    runner.Run("buffer_pool/allocate_free/1k", 1024, [&](uint64_t n) {
+        for(uint64_t k = 0; k < n; ++k) {
+            auto *block = wsocket::BufferPool::Allocate(1024);
+            DoNotOptimize(block);
+            wsocket::BufferPool::Free(block);
+        }
+    });
+    runner.Run("buffer_pool/new_delete/1k", 1024, [&](uint64_t n) {
+        for(uint64_t k = 0; k < n; ++k) {
+            auto *block = new uint8_t[1024];
+            DoNotOptimize(block);
+            delete[] block;
+        }
+    });
+
+    // allocated on one thread, freed on another, as for cross-thread posts
+    runner.Run("buffer_pool/remote_free/256", 256, [&](uint64_t n) {
+        std::vector<void *> blocks(n);
+        for(auto &block : blocks) {
+            block = wsocket::BufferPool::Allocate(256);
+        }
+        std::thread([&]() {
+            for(auto *block : blocks) {
+                wsocket::BufferPool::Free(block);
+            }
+        }).join();
+    });
+}
+
+//============ MemoryResource ============//
+
+void BenchMemoryResource(Runner &runner) {
+    wsocket::HugePagePool shared_pool;
+    wsocket::HugePagePool local_pool(false);
+
+    std::pair<const char *, std::pmr::memory_resource *> resources[] = {
+        {"buffer_pool", wsocket::BufferPoolResource::Instance()},
+        {"huge_page_pool", &shared_pool},
+        {"huge_page_pool_unsynchronized", &local_pool},
+        {"new_delete", std::pmr::new_delete_resource()},
+    };
+    for(auto &[name, resource] : resources) {
+        runner.Run(std::string("memory_resource/") + name + "/1k", 1024, [&](uint64_t n) {
+            for(uint64_t k = 0; k < n; ++k) {
+                auto *block = resource->allocate(1024, 16);
+                DoNotOptimize(block);
+                resource->deallocate(block, 1024, 16);
+            }
+        });
+    }
+
+    // per-message scratch: a few strings, dropped together
+    wsocket::MessageArena arena;
+    runner.Run("memory_resource/message_arena/8_strings", 8 * 100, [&](uint64_t n) {
+        for(uint64_t k = 0; k < n; ++k) {
+            for(int i = 0; i < 8; ++i) {
+                std::pmr::string text(100, 'a', &arena);
+                DoNotOptimize(text.data());
+            }
+            arena.Release();
+        }
+    });
+}
+
+//============ ZstdContext ============//
+
+void BenchZstd(Runner &runner) {
+#ifdef WITH_ZSTD
+    auto payload = MakePayload(16 * 1024);
+
+    for(int level : {1, 3, 9, 19}) {
+        auto ctx = std::dynamic_pointer_cast<wsocket::ZstdContext>(wsocket::ZstdContext().Create());
+        if(!ctx) {
+            std::cerr << "zstd context create failed" << std::endl;
+            return;
+        }
+        ctx->CompressionLevel(level);
+
+        auto name = std::to_string(level);
+        runner.Run("zstd/compress/level_" + name + "/16k", payload.size(), [&](uint64_t n) {
+            for(uint64_t k = 0; k < n; ++k) {
+                auto out = ctx->Compress({payload.data(), payload.size()});
+                DoNotOptimize(out.size);
+            }
+        });
+
+        auto                 compressed = ctx->Compress({payload.data(), payload.size()});
+        std::vector<uint8_t> copy(compressed.buf, compressed.buf + compressed.size);
+        runner.Run("zstd/decompress/level_" + name + "/16k", payload.size(), [&](uint64_t n) {
+            for(uint64_t k = 0; k < n; ++k) {
+                auto out = ctx->Decompress({copy.data(), copy.size()});
+                DoNotOptimize(out.size);
+            }
+        });
+    }
+#endif
+}
+
+//============ Utf8Validator ============//
+
+void BenchUtf8(Runner &runner) {
+    std::string ascii(64 * 1024, 'a');
+    std::string mixed;
+    while(mixed.size() < 64 * 1024) {
+        mixed += "websocket 文本帧 validation, ";
+    }
+
+    runner.Run("utf8/validate/ascii/64k", ascii.size(), [&](uint64_t n) {
+        for(uint64_t k = 0; k < n; ++k) {
+            bool ok = wsocket::Utf8Validator::Validate(reinterpret_cast<const uint8_t *>(ascii.data()), ascii.size());
+            DoNotOptimize(ok);
+        }
+    });
+    runner.Run("utf8/validate/mixed/64k", mixed.size(), [&](uint64_t n) {
+        for(uint64_t k = 0; k < n; ++k) {
+            bool ok = wsocket::Utf8Validator::Validate(reinterpret_cast<const uint8_t *>(mixed.data()), mixed.size());
+            DoNotOptimize(ok);
+        }
+    });
+}
+
+//============ ConflationQueue ============//
+
+void BenchConflation(Runner &runner) {
+    auto payload = MakePayload(64);
+
+    std::vector<std::string> keys;
+    for(int i = 0; i < 1000; ++i) {
+        keys.push_back("SYM" + std::to_string(i));
+    }
+
+    // a burst of updates over 1000 keys, drained once per 10000 updates
+    wsocket::ConflationQueue queue;
+    uint64_t                 counter = 0;
+    runner.Run("conflation/push/1000keys", payload.size(), [&](uint64_t n) {
+        for(uint64_t k = 0; k < n; ++k) {
+            queue.Push(keys[counter++ % keys.size()], payload.data(), payload.size(), false, {});
+            if(counter % 10000 == 0) {
+                while(auto *message = queue.Pop()) {
+                    DoNotOptimize(message);
+                }
+            }
+        }
+    });
+}
+
+//============ WSocketContext loopback ============//
+
+class LoopbackPeer : public wsocket::WSocketContext::Listener {
+public:
+    explicit LoopbackPeer(bool compress) : compress_(compress) {}
+
+    wsocket::CompressType OnHandshake(const std::vector<wsocket::CompressType> &request_compress_type) override {
+        if(compress_ && !request_compress_type.empty()) {
+            return request_compress_type[0];
+        }
+        return wsocket::CompressType::None;
+    }
+    void OnConnected() override { connected = true; }
+    void OnError(std::error_code code) override { errors++; }
+    void OnText(std::string_view text, bool finish) override {
+        messages++;
+        bytes += text.size();
+    }
+    void OnBinary(wsocket::Buffer buffer, bool finish) override {
+        messages++;
+        bytes += buffer.size;
+    }
+
+    bool     connected = false;
+    uint64_t messages  = 0;
+    uint64_t bytes     = 0;
+    uint64_t errors    = 0;
+
+private:
+    bool compress_;
+};
+
+void BenchLoopback(Runner &runner, bool compress) {
+    const char *suffix = compress ? "/zstd" : "";
+
+    for(size_t size : {64, 1024, 16 * 1024}) {
+        auto payload = MakePayload(size);
+
+        wsocket::WSocketContext client;
+        wsocket::WSocketContext server;
+        LoopbackPeer            client_peer(compress);
+        LoopbackPeer            server_peer(compress);
+
+        client.ResetListener(&client_peer);
+        server.ResetListener(&server_peer);
+        client.ResetSendHandler([&](const wsocket::Buffer &buffer) { server.Feed(buffer); });
+        server.ResetSendHandler([&](const wsocket::Buffer &buffer) { client.Feed(buffer); });
+
+        client.Handshake();
+        if(!client_peer.connected || !server_peer.connected) {
+            std::cerr << "loopback handshake failed" << std::endl;
+            return;
+        }
+
+        std::string_view text(reinterpret_cast<const char *>(payload.data()), payload.size());
+        auto             name = std::to_string(size);
+
+        runner.Run(std::string("loopback/text/") + name + suffix, size, [&](uint64_t n) {
+            for(uint64_t k = 0; k < n; ++k) {
+                client.SendText(text);
+            }
+        });
+        runner.Run(std::string("loopback/binary/") + name + suffix, size, [&](uint64_t n) {
+            for(uint64_t k = 0; k < n; ++k) {
+                client.SendBinary({payload.data(), payload.size()});
+            }
+        });
+        // the memcpy stands in for a serializer writing straight into the send buffer
+        runner.Run(std::string("loopback/binary_builder/") + name + suffix, size, [&](uint64_t n) {
+            for(uint64_t k = 0; k < n; ++k) {
+                auto builder = client.BuildBinary(payload.size());
+                memcpy(builder.Payload().buf, payload.data(), payload.size());
+                builder.Commit(payload.size());
+            }
+        });
+        if(size == 64) {
+            // bursts of small updates corked into one write per 100 messages
+            runner.Run(std::string("loopback/text/64/batch100") + suffix, size, [&](uint64_t n) {
+                for(uint64_t k = 0; k < n;) {
+                    wsocket::WSocketContext::BatchScope batch(client);
+                    for(uint64_t end = std::min<uint64_t>(n, k + 100); k < end; ++k) {
+                        client.SendText(text);
+                    }
+                }
+            });
+            runner.Run(std::string("loopback/ping_pong") + suffix, 0, [&](uint64_t n) {
+                for(uint64_t k = 0; k < n; ++k) {
+                    client.Ping();
+                    server.Pong();
+                }
+            });
+        }
+
+        if(server_peer.errors != 0 || client_peer.errors != 0) {
+            std::cerr << "loopback reported errors" << std::endl;
+        }
+    }
+}
+
+//============ shared memory round trip ============//
+
+#ifdef __linux__
+class ShmBenchPeer : public wsocket::ShmWSocket {
+public:
+    explicit ShmBenchPeer(wsocket::ShmSegment &&segment, bool echo) :
+        wsocket::ShmWSocket(std::move(segment)), echo_(echo) {}
+
+    void OnConnected() override { connected = true; }
+    void OnText(std::string_view text, bool finish) override {
+        messages++;
+        if(echo_) {
+            this->Text(text, finish);
+        }
+    }
+    void OnClose(int16_t code, const std::string &reason) override { this->Stop(); }
+
+    bool     connected = false;
+    uint64_t messages  = 0;
+
+private:
+    bool echo_;
+};
+
+void BenchShm(Runner &runner) {
+    auto             payload = MakePayload(64);
+    std::string_view text(reinterpret_cast<const char *>(payload.data()), payload.size());
+
+    // idle peers sleep on the futex, then the same with busy polling, which needs a core per peer
+    for(uint32_t spins : {0u, 100000u}) {
+        if(spins && std::thread::hardware_concurrency() < 2) {
+            break;
+        }
+        wsocket::ShmSegment server_segment;
+        wsocket::ShmSegment client_segment;
+        if(!server_segment.Create("") || !client_segment.Open(server_segment.Fd())) {
+            std::cerr << "shm segment: " << std::strerror(errno) << std::endl;
+            return;
+        }
+
+        ShmBenchPeer server(std::move(server_segment), true);
+        ShmBenchPeer client(std::move(client_segment), false);
+        server.SetBusyPoll(spins);
+        client.SetBusyPoll(spins);
+
+        std::thread server_thread([&]() { server.Run(); });
+        client.Handshake();
+        while(!client.connected) {
+            client.RunOnce();
+        }
+
+        runner.Run(std::string("shm/round_trip/64") + (spins ? "/busy_poll" : ""), 64, [&](uint64_t n) {
+            for(uint64_t k = 0; k < n; ++k) {
+                auto target = client.messages + 1;
+                client.Text(text);
+                while(client.messages < target) {
+                    client.RunOnce();
+                }
+            }
+        });
+
+        client.Close(wsocket::CloseCode::CLOSE_NORMAL);
+        client.Run();
+        server_thread.join();
+    }
+}
+#endif
+
+} // namespace
+
+int main(int argc, char **argv) {
+    std::string filter;
+    int64_t     min_time_ms       = 200;
+    double      max_allocs_per_op = -1; // unchecked
+
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if(arg == "--min-time" && i + 1 < argc) {
+            min_time_ms = std::strtoll(argv[++i], nullptr, 10);
+        } else if(arg == "--max-allocs-per-op" && i + 1 < argc) {
+            max_allocs_per_op = std::strtod(argv[++i], nullptr);
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--filter <substring>] [--min-time <ms>] [--max-allocs-per-op <n>]"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    Runner runner(filter, std::chrono::milliseconds(min_time_ms));
+
+    BenchFrameHeader(runner);
+    BenchFrameParser(runner);
+    BenchSlidingBuffer(runner);
+    BenchBufferPool(runner);
+    BenchMemoryResource(runner);
+    BenchZstd(runner);
+    BenchUtf8(runner);
+    BenchConflation(runner);
+    BenchLoopback(runner, false);
+#ifdef WITH_ZSTD
+    BenchLoopback(runner, true);
+#endif
+#ifdef __linux__
+    BenchShm(runner);
+#endif
+
+    runner.PrintJson(std::cout);
+    if(max_allocs_per_op >= 0 && !runner.CheckAllocations(max_allocs_per_op)) {
+        return 1;
+    }
+    return 0;
+}
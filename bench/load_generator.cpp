@@ -0,0 +1,789 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/ASIO_WSocket.hpp"
+#include "../include/ASIO_WSocketServer.hpp"
+#include "../include/Epoll_WSocket.hpp"
+#include "../include/IoUring_WSocket.hpp"
+#include "HdrHistogram.hpp"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+/**
+ * Many-connection load generator
+ *
+ * Opens N WSocket connections over loopback TCP or a unix socket against an
+ * echo server (in-process by default), sends messages either at a fixed rate
+ * per connection or as fast as the echo allows, and reports throughput and
+ * round-trip latency percentiles as JSON.
+ *
+ * Every message starts with a 16 hex digit send timestamp, the rest is filler
+ * text, so it can be sent as Text (and compressed) or Binary.
+ *
+ * On Linux the in-process echo server can run on the native epoll backend
+ * (`--server-backend epoll`), and with WITH_IO_URING on the io_uring one
+ * (`--server-backend uring`), to compare them with asio.
+ *
+ * `--zerocopy N` sends binary messages of N bytes and more with MSG_ZEROCOPY
+ * on the asio clients and echo server; sweeping `--size` with and without it
+ * across a real link shows the size where it starts to pay off.
+ */
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string transport   = "tcp"; // tcp | unix
+    std::string host        = "127.0.0.1";
+    uint16_t    port        = 12100;
+    std::string path        = "/tmp/wsocket_load_generator.sock";
+    bool        server      = true;  // run the in-process echo server
+    bool        client      = true;  // run the load generating clients
+    int         connections = 16;
+    int         threads     = 1;
+    double      rate        = 0;     // messages per second per connection, 0 = as fast as possible
+    int         pipeline    = 1;     // in-flight messages per connection when rate == 0
+    std::string size        = "256"; // N | uniform:MIN:MAX | exp:MEAN
+    bool        compress    = false;
+    bool        binary      = false;
+    double      warmup_s    = 1;
+    double      duration_s  = 5;
+    std::string capture;             // capture file prefix for the echo sessions, empty = off
+    int64_t     flush_window_us = 0; // WSocketBase::SetFlushWindow on both ends, 0 = off
+    std::string server_backend  = "asio"; // asio | epoll | uring
+    int         server_threads  = 0;      // asio backend on a WSocketServer with this many workers, 0 = shared
+    bool        idle_recv       = false;  // EnableIdleRecv on both ends
+    size_t      zerocopy        = 0;      // EnableZeroCopy threshold on the asio ends, 0 = off
+};
+
+// Message size distribution, parsed from `--size`
+class SizeDistribution {
+public:
+    bool Parse(const std::string &spec) {
+        if(spec.rfind("uniform:", 0) == 0) {
+            auto sep = spec.find(':', 8);
+            if(sep == std::string::npos) {
+                return false;
+            }
+            kind_ = Kind::Uniform;
+            min_  = std::strtoull(spec.c_str() + 8, nullptr, 10);
+            max_  = std::strtoull(spec.c_str() + sep + 1, nullptr, 10);
+            return min_ > 0 && max_ >= min_;
+        }
+        if(spec.rfind("exp:", 0) == 0) {
+            kind_ = Kind::Exponential;
+            mean_ = std::strtod(spec.c_str() + 4, nullptr);
+            return mean_ >= 1;
+        }
+        kind_ = Kind::Fixed;
+        min_ = max_ = std::strtoull(spec.c_str(), nullptr, 10);
+        return min_ > 0;
+    }
+
+    size_t Next(std::mt19937_64 &rng) const {
+        size_t size = min_;
+        if(kind_ == Kind::Uniform) {
+            size = std::uniform_int_distribution<size_t>(min_, max_)(rng);
+        } else if(kind_ == Kind::Exponential) {
+            size = size_t(std::exponential_distribution<double>(1.0 / mean_)(rng)) + 1;
+            size = std::min(size, Max());
+        }
+        return std::max(size, MIN_MESSAGE_SIZE);
+    }
+
+    size_t Max() const { return kind_ == Kind::Exponential ? size_t(mean_ * 32) : max_; }
+
+    static constexpr size_t MIN_MESSAGE_SIZE = 16; // room for the timestamp
+
+private:
+    enum class Kind { Fixed, Uniform, Exponential } kind_ = Kind::Fixed;
+    size_t min_  = 0;
+    size_t max_  = 0;
+    double mean_ = 0;
+};
+
+// Per io thread results, only touched by that thread
+struct ThreadStats {
+    wsocket::bench::HdrHistogram latency_ns;
+    uint64_t                     messages = 0;
+    uint64_t                     bytes    = 0;
+    uint64_t                     errors   = 0;
+
+    uint64_t zerocopy_sends  = 0; // client sends made with MSG_ZEROCOPY
+    uint64_t zerocopy_copied = 0; // of those, completed by copying after all
+};
+
+struct Shared {
+    Options          options;
+    SizeDistribution sizes;
+    std::string      filler;
+    Clock::time_point measure_start;
+    Clock::time_point measure_end;
+    std::atomic<int>  connected{0};
+};
+
+wsocket::CompressType ChooseCompress(bool compress, const std::vector<wsocket::CompressType> &request) {
+    if(compress && !request.empty()) {
+        return request[0];
+    }
+    return wsocket::CompressType::None;
+}
+
+//============ echo server ============//
+
+template <typename Protocol>
+class EchoSession : public wsocket::WSocketBase<Protocol> {
+    using base_type   = wsocket::WSocketBase<Protocol>;
+    using socket_type = typename Protocol::socket;
+
+protected:
+    EchoSession(socket_type &&socket, const Shared &shared) : base_type(std::move(socket)), shared_(shared) {}
+
+public:
+    static std::shared_ptr<EchoSession> Create(socket_type &&socket, const Shared &shared) {
+        return std::shared_ptr<EchoSession>(new EchoSession(std::move(socket), shared));
+    }
+
+private:
+    wsocket::CompressType OnHandshake(const std::vector<wsocket::CompressType> &request_compress_type) override {
+        return ChooseCompress(shared_.options.compress, request_compress_type);
+    }
+    void OnText(std::string_view text, bool finish) override { this->Text(text, finish); }
+    void OnBinary(wsocket::Buffer buffer, bool finish) override { this->Binary(buffer, finish); }
+    // with --zerocopy the received buffer itself is echoed
+    void OnMessage(wsocket::MessageHandle message) override { this->Send(std::move(message)); }
+
+    const Shared &shared_;
+};
+
+// Session settings shared by both asio echo servers
+template <typename Protocol>
+void ConfigureEchoSession(EchoSession<Protocol> &session, const Options &options) {
+    session.SetFlushWindow(std::chrono::microseconds(options.flush_window_us));
+    session.EnableIdleRecv(options.idle_recv);
+#ifdef __linux__
+    if(options.zerocopy > 0) {
+        session.EnableOwnedMessages(true);
+        session.EnableZeroCopy(options.zerocopy);
+    }
+#endif
+}
+
+template <typename Protocol>
+class EchoServer {
+    using acceptor_type = typename Protocol::acceptor;
+    using socket_type   = typename Protocol::socket;
+
+public:
+    EchoServer(asio::io_context &io_context, const typename Protocol::endpoint &endpoint, const Shared &shared) :
+        acceptor_(io_context, endpoint), shared_(shared) {}
+
+    void Start() {
+        acceptor_.async_accept([this](std::error_code ec, socket_type peer) {
+            if(ec) {
+                if(ec != asio::error::operation_aborted) {
+                    std::cerr << "accept error: " << ec.message() << std::endl;
+                }
+                return;
+            }
+            auto session = EchoSession<Protocol>::Create(std::move(peer), shared_);
+#ifndef _WIN32
+            if(!shared_.options.capture.empty()) {
+                auto path = shared_.options.capture + "." + std::to_string(accepted_) + ".wscap";
+                if(!session->EnableCapture(path)) {
+                    std::cerr << "capture open failed: " << path << std::endl;
+                }
+            }
+#endif
+            accepted_++;
+            ConfigureEchoSession(*session, shared_.options);
+            session->Start();
+            this->Start();
+        });
+    }
+
+    void Stop() {
+        asio::error_code ec;
+        std::ignore = acceptor_.close(ec);
+    }
+
+private:
+    acceptor_type acceptor_;
+    const Shared &shared_;
+    int           accepted_ = 0;
+};
+
+#ifdef WITH_IO_URING
+class UringEchoSession : public wsocket::IoUringWSocket {
+protected:
+    UringEchoSession(wsocket::IoUringLoop &loop, int fd, const Shared &shared) :
+        wsocket::IoUringWSocket(loop, fd), shared_(shared) {}
+
+public:
+    static std::shared_ptr<UringEchoSession> Create(wsocket::IoUringLoop &loop, int fd, const Shared &shared) {
+        return std::shared_ptr<UringEchoSession>(new UringEchoSession(loop, fd, shared));
+    }
+
+private:
+    wsocket::CompressType OnHandshake(const std::vector<wsocket::CompressType> &request_compress_type) override {
+        return ChooseCompress(shared_.options.compress, request_compress_type);
+    }
+    void OnText(std::string_view text, bool finish) override { this->Text(text, finish); }
+    void OnBinary(wsocket::Buffer buffer, bool finish) override { this->Binary(buffer, finish); }
+
+    const Shared &shared_;
+};
+
+// Echo server on its own io_uring loop thread, the ring is created on that thread
+class UringEchoServer {
+public:
+    explicit UringEchoServer(const Shared &shared) : shared_(shared) {}
+    ~UringEchoServer() { Stop(); }
+
+    bool Start(const sockaddr *address, socklen_t address_len) {
+        sockaddr_storage storage{};
+        std::memcpy(&storage, address, std::min<size_t>(address_len, sizeof(storage)));
+
+        std::promise<bool> ready;
+        auto               started = ready.get_future();
+        thread_                    = std::thread([this, storage, address_len, &ready]() {
+            wsocket::IoUringLoop     loop;
+            wsocket::IoUringAcceptor acceptor(loop);
+            if(!loop.Open() || !acceptor.Open(reinterpret_cast<const sockaddr *>(&storage), address_len)) {
+                std::cerr << "io_uring echo server: " << std::strerror(errno) << std::endl;
+                ready.set_value(false);
+                return;
+            }
+            acceptor.Start([this, &loop](int fd) { UringEchoSession::Create(loop, fd, shared_)->Start(); });
+
+            loop_ = &loop;
+            ready.set_value(true);
+            loop.Run();
+        });
+        return started.get();
+    }
+
+    void Stop() {
+        if(loop_) {
+            loop_->Stop();
+        }
+        if(thread_.joinable()) {
+            thread_.join();
+        }
+        loop_ = nullptr;
+    }
+
+private:
+    const Shared         &shared_;
+    std::thread           thread_;
+    wsocket::IoUringLoop *loop_ = nullptr;
+};
+#endif
+
+#ifdef __linux__
+class EpollEchoSession : public wsocket::EpollWSocket {
+protected:
+    EpollEchoSession(wsocket::EpollLoop &loop, int fd, const Shared &shared) :
+        wsocket::EpollWSocket(loop, fd), shared_(shared) {}
+
+public:
+    static std::unique_ptr<EpollEchoSession> Create(wsocket::EpollLoop &loop, int fd, const Shared &shared) {
+        return std::unique_ptr<EpollEchoSession>(new EpollEchoSession(loop, fd, shared));
+    }
+
+private:
+    wsocket::CompressType OnHandshake(const std::vector<wsocket::CompressType> &request_compress_type) override {
+        return ChooseCompress(shared_.options.compress, request_compress_type);
+    }
+    void OnText(std::string_view text, bool finish) override { this->Text(text, finish); }
+    void OnBinary(wsocket::Buffer buffer, bool finish) override { this->Binary(buffer, finish); }
+
+    const Shared &shared_;
+};
+
+// Echo server on its own epoll loop thread
+class EpollEchoServer {
+public:
+    explicit EpollEchoServer(const Shared &shared) : shared_(shared) {}
+    ~EpollEchoServer() { Stop(); }
+
+    bool Start(const sockaddr *address, socklen_t address_len) {
+        if(!loop_.Open() || !acceptor_.Open(address, address_len)) {
+            std::cerr << "epoll echo server: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        acceptor_.Start([this](int fd) {
+            auto session = EpollEchoSession::Create(loop_, fd, shared_);
+            session->EnableIdleRecv(shared_.options.idle_recv);
+            session->Start();
+            loop_.Adopt(std::move(session));
+        });
+        thread_ = std::thread([this]() { loop_.Run(); });
+        return true;
+    }
+
+    void Stop() {
+        loop_.Stop();
+        if(thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+private:
+    const Shared          &shared_;
+    wsocket::EpollLoop     loop_;
+    wsocket::EpollAcceptor acceptor_{loop_};
+    std::thread            thread_;
+};
+#endif
+
+//============ load client ============//
+
+template <typename Protocol>
+class LoadClient : public wsocket::WSocketBase<Protocol> {
+    using base_type = wsocket::WSocketBase<Protocol>;
+
+protected:
+    LoadClient(asio::io_context &io_context, Shared &shared, ThreadStats &stats, uint64_t seed) :
+        base_type(io_context.get_executor()), timer_(io_context), shared_(shared), stats_(stats), rng_(seed) {}
+
+public:
+    static std::shared_ptr<LoadClient> Create(asio::io_context &io_context,
+                                              Shared           &shared,
+                                              ThreadStats      &stats,
+                                              uint64_t          seed) {
+        return std::shared_ptr<LoadClient>(new LoadClient(io_context, shared, stats, seed));
+    }
+
+private:
+    wsocket::CompressType OnHandshake(const std::vector<wsocket::CompressType> &request_compress_type) override {
+        return ChooseCompress(shared_.options.compress, request_compress_type);
+    }
+
+    void OnConnected() override {
+        shared_.connected++;
+        if(shared_.options.rate > 0) {
+            interval_ = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / shared_.options.rate));
+            // spread the connections over one interval so they do not send in lock step
+            auto offset = std::uniform_int_distribution<int64_t>(0, interval_.count())(rng_);
+            next_send_  = Clock::now() + Clock::duration(offset);
+            this->ScheduleSend();
+        } else {
+            auto batch = this->Batch();
+            for(int i = 0; i < shared_.options.pipeline; ++i) {
+                this->SendOne(Clock::now());
+            }
+        }
+    }
+
+    void OnError(std::error_code code) override {
+        if(code != asio::error::operation_aborted) {
+            stats_.errors++;
+        }
+    }
+
+    void OnText(std::string_view text, bool finish) override { this->OnEcho(text.data(), text.size()); }
+    void OnBinary(wsocket::Buffer buffer, bool finish) override {
+        this->OnEcho(reinterpret_cast<const char *>(buffer.buf), buffer.size);
+    }
+
+    void OnEcho(const char *data, size_t size) {
+        auto now = Clock::now();
+
+        if(size >= SizeDistribution::MIN_MESSAGE_SIZE && now >= shared_.measure_start && now < shared_.measure_end) {
+            uint64_t sent_ns = std::strtoull(std::string(data, 16).c_str(), nullptr, 16);
+            uint64_t now_ns  = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+
+            stats_.latency_ns.Record(now_ns > sent_ns ? now_ns - sent_ns : 0);
+            stats_.messages++;
+            stats_.bytes += size;
+        }
+
+        if(shared_.options.rate <= 0 && now < shared_.measure_end) {
+            this->SendOne(now);
+        }
+    }
+
+    void ScheduleSend() {
+        timer_.expires_at(next_send_);
+        auto _this = std::static_pointer_cast<LoadClient>(this->shared_from_this());
+        timer_.async_wait([_this](std::error_code ec) {
+            if(ec) {
+                return;
+            }
+            // latency is measured from the intended send time, so a stalled
+            // sender is not hidden (coordinated omission)
+            auto now   = Clock::now();
+            auto batch = _this->Batch();
+            while(_this->next_send_ <= now) {
+                _this->SendOne(_this->next_send_);
+                _this->next_send_ += _this->interval_;
+            }
+            if(now < _this->shared_.measure_end) {
+                _this->ScheduleSend();
+            }
+        });
+    }
+
+    void SendOne(Clock::time_point intended) {
+        auto size = shared_.sizes.Next(rng_);
+        if(message_.size() < size) {
+            message_.resize(size);
+        }
+
+        auto intended_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(intended.time_since_epoch()).count();
+        char stamp[17];
+        std::snprintf(stamp, sizeof(stamp), "%016llx", static_cast<unsigned long long>(intended_ns));
+        std::memcpy(message_.data(), stamp, 16);
+        std::memcpy(message_.data() + 16, shared_.filler.data(), size - 16);
+
+        if(shared_.options.binary && shared_.options.zerocopy > 0) {
+            // built once into a pooled buffer the kernel reads from, instead of copying it to the socket
+            this->Send(wsocket::MessageHandle::Copy({reinterpret_cast<uint8_t *>(message_.data()), size}, true, true));
+        } else if(shared_.options.binary) {
+            this->Binary({reinterpret_cast<uint8_t *>(message_.data()), size});
+        } else {
+            this->Text(std::string_view(message_.data(), size));
+        }
+    }
+
+private:
+    asio::steady_timer timer_;
+    Shared            &shared_;
+    ThreadStats       &stats_;
+    std::mt19937_64    rng_;
+    std::string        message_;
+
+    Clock::duration   interval_{};
+    Clock::time_point next_send_;
+};
+
+//============ driver ============//
+
+void Usage(const char *name) {
+    std::cerr << "usage: " << name << " [options]\n"
+              << "  --transport tcp|unix     transport, default tcp\n"
+              << "  --host HOST --port PORT  tcp endpoint, default 127.0.0.1:12100\n"
+              << "  --path PATH              unix socket path\n"
+              << "  --server-only            only run the echo server\n"
+              << "  --client-only            only run the clients against an external echo server\n"
+              << "  --connections N          connection count, default 16\n"
+              << "  --threads N              io threads, default 1\n"
+              << "  --rate R                 messages/s per connection, 0 = as fast as possible\n"
+              << "  --pipeline N             in-flight messages per connection when rate is 0\n"
+              << "  --size SPEC              N | uniform:MIN:MAX | exp:MEAN, default 256\n"
+              << "  --compress               negotiate zstd (text messages only)\n"
+              << "  --binary                 send binary instead of text messages\n"
+              << "  --warmup S --duration S  seconds, default 1 and 5\n"
+              << "  --capture PREFIX         record echo server input to PREFIX.<n>.wscap for wsocket_replay\n"
+              << "  --flush-window US        coalesce frames sent within US microseconds into one write\n"
+              << "  --server-backend B       echo server on asio (default), epoll or uring\n"
+              << "  --server-threads N       asio echo server on its own N pinned io_contexts\n"
+              << "  --idle-recv              hold no receive buffer while a connection is idle (asio, epoll)\n"
+              << "  --zerocopy N             send binary messages of N bytes and more with MSG_ZEROCOPY (asio, Linux)"
+              << std::endl;
+}
+
+bool ParseOptions(int argc, char **argv, Options &options) {
+    for(int i = 1; i < argc; ++i) {
+        std::string arg  = argv[i];
+        auto        next = [&]() -> const char * { return i + 1 < argc ? argv[++i] : ""; };
+
+        if(arg == "--transport") {
+            options.transport = next();
+        } else if(arg == "--host") {
+            options.host = next();
+        } else if(arg == "--port") {
+            options.port = uint16_t(std::atoi(next()));
+        } else if(arg == "--path") {
+            options.path = next();
+        } else if(arg == "--server-only") {
+            options.client = false;
+        } else if(arg == "--client-only") {
+            options.server = false;
+        } else if(arg == "--connections") {
+            options.connections = std::atoi(next());
+        } else if(arg == "--threads") {
+            options.threads = std::max(1, std::atoi(next()));
+        } else if(arg == "--rate") {
+            options.rate = std::atof(next());
+        } else if(arg == "--pipeline") {
+            options.pipeline = std::max(1, std::atoi(next()));
+        } else if(arg == "--size") {
+            options.size = next();
+        } else if(arg == "--compress") {
+            options.compress = true;
+        } else if(arg == "--binary") {
+            options.binary = true;
+        } else if(arg == "--warmup") {
+            options.warmup_s = std::atof(next());
+        } else if(arg == "--duration") {
+            options.duration_s = std::atof(next());
+        } else if(arg == "--capture") {
+            options.capture = next();
+        } else if(arg == "--flush-window") {
+            options.flush_window_us = std::strtoll(next(), nullptr, 10);
+        } else if(arg == "--server-backend") {
+            options.server_backend = next();
+        } else if(arg == "--server-threads") {
+            options.server_threads = std::max(0, std::atoi(next()));
+        } else if(arg == "--idle-recv") {
+            options.idle_recv = true;
+        } else if(arg == "--zerocopy") {
+            options.zerocopy = std::strtoull(next(), nullptr, 10);
+        } else {
+            return false;
+        }
+    }
+#ifdef __linux__
+    if(options.server_backend == "epoll") {
+        return options.transport == "tcp" || options.transport == "unix";
+    }
+#endif
+#ifdef WITH_IO_URING
+    if(options.server_backend == "uring") {
+        return options.transport == "tcp" || options.transport == "unix";
+    }
+#endif
+    return options.server_backend == "asio" && (options.transport == "tcp" || options.transport == "unix");
+}
+
+void PrintReport(const Shared &shared, const std::vector<ThreadStats> &stats) {
+    wsocket::bench::HdrHistogram latency;
+    uint64_t                     messages        = 0;
+    uint64_t                     bytes           = 0;
+    uint64_t                     errors          = 0;
+    uint64_t                     zerocopy_sends  = 0;
+    uint64_t                     zerocopy_copied = 0;
+
+    for(auto &s : stats) {
+        latency.Merge(s.latency_ns);
+        messages += s.messages;
+        bytes += s.bytes;
+        errors += s.errors;
+        zerocopy_sends += s.zerocopy_sends;
+        zerocopy_copied += s.zerocopy_copied;
+    }
+
+    auto  &o       = shared.options;
+    double seconds = o.duration_s;
+
+    // peak resident memory of the whole process, server included when in-process
+    long max_rss_kb = 0;
+#ifndef _WIN32
+    rusage usage{};
+    if(::getrusage(RUSAGE_SELF, &usage) == 0) {
+        max_rss_kb = usage.ru_maxrss;
+    }
+#endif
+
+    char line[1024];
+    std::snprintf(line,
+                  sizeof(line),
+                  "{\n"
+                  "  \"config\": {\"transport\": \"%s\", \"connections\": %d, \"threads\": %d, \"rate\": %.1f, "
+                  "\"pipeline\": %d, \"size\": \"%s\", \"compress\": %s, \"binary\": %s, \"duration_s\": %.1f, "
+                  "\"flush_window_us\": %lld, "
+                  "\"server_backend\": \"%s\", \"server_threads\": %d, \"idle_recv\": %s, \"zerocopy\": %zu},\n"
+                  "  \"connected\": %d,\n"
+                  "  \"errors\": %llu,\n"
+                  "  \"messages\": %llu,\n"
+                  "  \"msgs_per_second\": %.1f,\n"
+                  "  \"mb_per_second\": %.3f,\n"
+                  "  \"rtt_us\": {\"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, \"p99\": %.3f, \"p99.9\": %.3f, "
+                  "\"max\": %.3f},\n"
+                  "  \"zerocopy\": {\"sends\": %llu, \"copied\": %llu},\n"
+                  "  \"max_rss_kb\": %ld\n"
+                  "}\n",
+                  o.transport.c_str(),
+                  o.connections,
+                  o.threads,
+                  o.rate,
+                  o.pipeline,
+                  o.size.c_str(),
+                  o.compress ? "true" : "false",
+                  o.binary ? "true" : "false",
+                  o.duration_s,
+                  static_cast<long long>(o.flush_window_us),
+                  o.server_backend.c_str(),
+                  o.server_threads,
+                  o.idle_recv ? "true" : "false",
+                  o.zerocopy,
+                  shared.connected.load(),
+                  static_cast<unsigned long long>(errors),
+                  static_cast<unsigned long long>(messages),
+                  double(messages) / seconds,
+                  double(bytes) / seconds / (1024 * 1024),
+                  latency.Min() / 1e3,
+                  latency.Mean() / 1e3,
+                  latency.Percentile(50) / 1e3,
+                  latency.Percentile(99) / 1e3,
+                  latency.Percentile(99.9) / 1e3,
+                  latency.Max() / 1e3,
+                  static_cast<unsigned long long>(zerocopy_sends),
+                  static_cast<unsigned long long>(zerocopy_copied),
+                  max_rss_kb);
+    std::cout << line;
+}
+
+template <typename Protocol>
+int Run(Shared &shared, const typename Protocol::endpoint &endpoint) {
+    auto &o = shared.options;
+
+    std::vector<std::unique_ptr<asio::io_context>> io_contexts;
+    for(int i = 0; i < o.threads; ++i) {
+        io_contexts.push_back(std::make_unique<asio::io_context>());
+    }
+
+    std::unique_ptr<EchoServer<Protocol>> server;
+#ifdef __linux__
+    std::unique_ptr<EpollEchoServer> epoll_server;
+    if(o.server && o.server_backend == "epoll") {
+        epoll_server = std::make_unique<EpollEchoServer>(shared);
+        if(!epoll_server->Start(endpoint.data(), static_cast<socklen_t>(endpoint.size()))) {
+            return 1;
+        }
+    }
+#endif
+#ifdef WITH_IO_URING
+    std::unique_ptr<UringEchoServer> uring_server;
+    if(o.server && o.server_backend == "uring") {
+        uring_server = std::make_unique<UringEchoServer>(shared);
+        if(!uring_server->Start(endpoint.data(), static_cast<socklen_t>(endpoint.size()))) {
+            return 1;
+        }
+    }
+#endif
+    std::unique_ptr<wsocket::WSocketServer<Protocol>> pool_server;
+    if(o.server && o.server_backend == "asio" && o.server_threads > 0) {
+        wsocket::WSocketServerOptions options;
+        options.threads     = size_t(o.server_threads);
+        options.pin_threads = true;
+        pool_server         = std::make_unique<wsocket::WSocketServer<Protocol>>(
+                [&shared](size_t worker, typename Protocol::socket &&socket) {
+                    auto session = EchoSession<Protocol>::Create(std::move(socket), shared);
+                    ConfigureEchoSession(*session, shared.options);
+                    return session;
+                },
+                options);
+        if(auto ec = pool_server->Start(endpoint)) {
+            std::cerr << "echo server: " << ec.message() << std::endl;
+            return 1;
+        }
+    } else if(o.server && o.server_backend == "asio") {
+        server = std::make_unique<EchoServer<Protocol>>(*io_contexts[0], endpoint, shared);
+        server->Start();
+    }
+
+    std::vector<ThreadStats>                          stats(io_contexts.size());
+    std::vector<std::shared_ptr<LoadClient<Protocol>>> clients;
+
+    auto now             = Clock::now();
+    shared.measure_start = now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(o.warmup_s));
+    shared.measure_end =
+            shared.measure_start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(o.duration_s));
+
+    if(o.client) {
+        for(int i = 0; i < o.connections; ++i) {
+            auto index  = size_t(i) % io_contexts.size();
+            auto client = LoadClient<Protocol>::Create(*io_contexts[index], shared, stats[index], uint64_t(i) + 1);
+            client->SetFlushWindow(std::chrono::microseconds(o.flush_window_us));
+            client->EnableIdleRecv(o.idle_recv);
+#ifdef __linux__
+            client->EnableZeroCopy(o.zerocopy);
+#endif
+            client->Handshake(endpoint);
+            clients.push_back(client);
+        }
+    }
+
+    std::vector<std::thread> threads;
+    for(auto &io_context : io_contexts) {
+        threads.emplace_back([&io_context]() {
+            auto guard = asio::make_work_guard(*io_context);
+            io_context->run();
+        });
+    }
+
+    if(o.client) {
+        std::this_thread::sleep_until(shared.measure_end);
+        // give in-flight echoes a moment to land so they do not show up as errors
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        for(auto &io_context : io_contexts) {
+            io_context->stop();
+        }
+    }
+    for(auto &thread : threads) {
+        thread.join();
+    }
+
+    if(o.client) {
+#ifdef __linux__
+        for(size_t i = 0; i < clients.size(); ++i) {
+            stats[i % stats.size()].zerocopy_sends += clients[i]->ZeroCopySends();
+            stats[i % stats.size()].zerocopy_copied += clients[i]->ZeroCopyCopied();
+        }
+#endif
+        PrintReport(shared, stats);
+    }
+    clients.clear();
+    server.reset();
+    pool_server.reset();
+#ifdef __linux__
+    epoll_server.reset();
+#endif
+#ifdef WITH_IO_URING
+    uring_server.reset();
+#endif
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Shared shared;
+    if(!ParseOptions(argc, argv, shared.options) || !shared.sizes.Parse(shared.options.size)) {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    shared.filler.resize(std::max<size_t>(shared.sizes.Max(), SizeDistribution::MIN_MESSAGE_SIZE));
+    for(size_t i = 0; i < shared.filler.size(); ++i) {
+        shared.filler[i] = char('a' + i % 26);
+    }
+
+    try {
+        if(shared.options.transport == "tcp") {
+            asio::ip::tcp::endpoint endpoint(asio::ip::make_address(shared.options.host), shared.options.port);
+            return Run<asio::ip::tcp>(shared, endpoint);
+        }
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+        if(shared.options.server) {
+            std::remove(shared.options.path.c_str());
+        }
+        asio::local::stream_protocol::endpoint endpoint(shared.options.path);
+        auto                                   res = Run<asio::local::stream_protocol>(shared, endpoint);
+        if(shared.options.server) {
+            std::remove(shared.options.path.c_str());
+        }
+        return res;
+#else
+        std::cerr << "unix sockets are not supported on this platform" << std::endl;
+        return 1;
+#endif
+    } catch(const std::exception &e) {
+        std::cerr << "exception: " << e.what() << std::endl;
+        return 1;
+    }
+}
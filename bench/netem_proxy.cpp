@@ -0,0 +1,305 @@
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <asio.hpp>
+
+/**
+ * Network condition emulation proxy
+ *
+ * A local TCP proxy that sits between two WSocket endpoints and delays the
+ * forwarded bytes the way a WAN link would:
+ *
+ * - latency:   fixed one-way delay added to every chunk
+ * - jitter:    uniform random delay in [-jitter, +jitter] on top of the latency,
+ *              chunks are never reordered (it is still a TCP stream)
+ * - bandwidth: the link serializes at most `bandwidth` bytes per second,
+ *              excess data queues up in a bounded "router buffer"; once the
+ *              buffer is full the proxy stops reading, so the sender sees
+ *              back pressure through TCP flow control
+ *
+ * The settings apply to each direction independently.
+ *
+ * usage: wsocket_netem_proxy --listen 127.0.0.1:12200 --target 127.0.0.1:12100
+ *                            [--latency MS] [--jitter MS] [--bandwidth RATE] [--buffer BYTES]
+ *        RATE accepts bit/s with an optional k/m/g suffix, e.g. 100m = 100 Mbit/s
+ */
+
+namespace {
+
+using tcp   = asio::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+struct LinkOptions {
+    std::chrono::microseconds latency{0};
+    std::chrono::microseconds jitter{0};
+    double                    bytes_per_second = 0;       // 0 = unlimited
+    size_t                    buffer_bytes     = 4 << 20; // queued bytes before reading pauses
+};
+
+// One direction of a proxied connection
+class Pipe : public std::enable_shared_from_this<Pipe> {
+    static constexpr size_t CHUNK_SIZE = 16 * 1024;
+
+    struct Chunk {
+        std::vector<uint8_t> data;
+        Clock::time_point    deliver_at;
+    };
+
+public:
+    using socket_ptr = std::shared_ptr<tcp::socket>;
+
+    Pipe(socket_ptr from, socket_ptr to, const LinkOptions &options, uint64_t seed) :
+        from_(std::move(from)), to_(std::move(to)), timer_(from_->get_executor()), options_(options), rng_(seed) {}
+
+    void Start() { this->Read(); }
+
+private:
+    void Read() {
+        if(closed_ || reading_ || queued_bytes_ >= options_.buffer_bytes) {
+            return;
+        }
+        reading_ = true;
+        read_buffer_.resize(CHUNK_SIZE);
+
+        auto _this = this->shared_from_this();
+        from_->async_read_some(asio::buffer(read_buffer_), [_this](std::error_code ec, size_t bytes_transferred) {
+            _this->reading_ = false;
+            if(ec) {
+                // peer finished sending, forward the half close once the queue drained
+                _this->eof_ = true;
+                _this->Write();
+                return;
+            }
+            _this->OnRead(bytes_transferred);
+        });
+    }
+
+    void OnRead(size_t bytes_transferred) {
+        auto now = Clock::now();
+
+        // serialization on the emulated link
+        auto depart = std::max(now, link_free_at_);
+        if(options_.bytes_per_second > 0) {
+            auto transmit = std::chrono::duration<double>(double(bytes_transferred) / options_.bytes_per_second);
+            depart += std::chrono::duration_cast<Clock::duration>(transmit);
+        }
+        link_free_at_ = depart;
+
+        // propagation delay
+        auto delay = options_.latency;
+        if(options_.jitter.count() > 0) {
+            auto jitter = std::uniform_int_distribution<int64_t>(-options_.jitter.count(), options_.jitter.count())(rng_);
+            delay       = std::max(std::chrono::microseconds(0), delay + std::chrono::microseconds(jitter));
+        }
+        auto deliver_at = std::max(depart + delay, last_deliver_at_);
+        last_deliver_at_ = deliver_at;
+
+        Chunk chunk;
+        chunk.data.assign(read_buffer_.begin(), read_buffer_.begin() + bytes_transferred);
+        chunk.deliver_at = deliver_at;
+
+        queued_bytes_ += bytes_transferred;
+        queue_.push_back(std::move(chunk));
+
+        this->Write();
+        this->Read();
+    }
+
+    void Write() {
+        if(closed_ || writing_) {
+            return;
+        }
+        if(queue_.empty()) {
+            if(eof_) {
+                asio::error_code ec;
+                std::ignore = to_->shutdown(tcp::socket::shutdown_send, ec);
+            }
+            return;
+        }
+
+        writing_   = true;
+        auto _this = this->shared_from_this();
+        timer_.expires_at(queue_.front().deliver_at);
+        timer_.async_wait([_this](std::error_code ec) {
+            if(ec) {
+                _this->writing_ = false;
+                return;
+            }
+            auto &chunk = _this->queue_.front();
+            asio::async_write(*_this->to_, asio::buffer(chunk.data), [_this](std::error_code ec, size_t bytes_transferred) {
+                _this->writing_ = false;
+                if(ec) {
+                    _this->closed_ = true;
+                    asio::error_code ignore_ec;
+                    std::ignore = _this->from_->close(ignore_ec);
+                    return;
+                }
+                _this->queued_bytes_ -= _this->queue_.front().data.size();
+                _this->queue_.pop_front();
+
+                _this->Write();
+                _this->Read();
+            });
+        });
+    }
+
+private:
+    socket_ptr          from_;
+    socket_ptr          to_;
+    asio::steady_timer  timer_;
+    const LinkOptions  &options_;
+    std::mt19937_64     rng_;
+
+    std::vector<uint8_t> read_buffer_;
+    std::deque<Chunk>    queue_;
+    size_t               queued_bytes_ = 0;
+
+    Clock::time_point link_free_at_;
+    Clock::time_point last_deliver_at_;
+
+    bool reading_ = false;
+    bool writing_ = false;
+    bool eof_     = false;
+    bool closed_  = false;
+};
+
+// Connects to the target and wires up both directions, the sockets are
+// shared by the two pipes and live as long as either of them is busy
+class Session : public std::enable_shared_from_this<Session> {
+public:
+    Session(tcp::socket &&client, const LinkOptions &options) :
+        client_(std::make_shared<tcp::socket>(std::move(client))),
+        server_(std::make_shared<tcp::socket>(client_->get_executor())), options_(options) {}
+
+    void Start(const tcp::endpoint &target) {
+        auto _this = this->shared_from_this();
+        server_->async_connect(target, [_this](std::error_code ec) {
+            if(ec) {
+                std::cerr << "connect target error: " << ec.message() << std::endl;
+                return;
+            }
+            asio::error_code ignore_ec;
+            std::ignore = _this->client_->set_option(tcp::no_delay(true), ignore_ec);
+            std::ignore = _this->server_->set_option(tcp::no_delay(true), ignore_ec);
+
+            std::random_device seed;
+            std::make_shared<Pipe>(_this->client_, _this->server_, _this->options_, seed())->Start();
+            std::make_shared<Pipe>(_this->server_, _this->client_, _this->options_, seed())->Start();
+        });
+    }
+
+private:
+    std::shared_ptr<tcp::socket> client_;
+    std::shared_ptr<tcp::socket> server_;
+    const LinkOptions           &options_;
+};
+
+bool ParseEndpoint(const std::string &text, tcp::endpoint &endpoint) {
+    auto sep = text.rfind(':');
+    if(sep == std::string::npos) {
+        return false;
+    }
+    asio::error_code ec;
+    auto             address = asio::ip::make_address(text.substr(0, sep), ec);
+    if(ec) {
+        return false;
+    }
+    endpoint = tcp::endpoint(address, uint16_t(std::atoi(text.c_str() + sep + 1)));
+    return true;
+}
+
+// "100m" -> 100 Mbit/s -> bytes per second
+double ParseRate(const std::string &text) {
+    char  *end   = nullptr;
+    double value = std::strtod(text.c_str(), &end);
+    switch(end ? *end : '\0') {
+    case 'k':
+    case 'K':
+        value *= 1e3;
+        break;
+    case 'm':
+    case 'M':
+        value *= 1e6;
+        break;
+    case 'g':
+    case 'G':
+        value *= 1e9;
+        break;
+    default:
+        break;
+    }
+    return value / 8;
+}
+
+void Accept(tcp::acceptor &acceptor, const tcp::endpoint &target, const LinkOptions &options) {
+    acceptor.async_accept([&acceptor, target, &options](std::error_code ec, tcp::socket peer) {
+        if(ec) {
+            std::cerr << "accept error: " << ec.message() << std::endl;
+            return;
+        }
+        auto session = std::make_shared<Session>(std::move(peer), options);
+        session->Start(target);
+        Accept(acceptor, target, options);
+    });
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    tcp::endpoint listen;
+    tcp::endpoint target;
+    LinkOptions   options;
+    bool          has_listen = false;
+    bool          has_target = false;
+
+    for(int i = 1; i < argc; ++i) {
+        std::string arg  = argv[i];
+        std::string next = i + 1 < argc ? argv[i + 1] : "";
+
+        if(arg == "--listen") {
+            has_listen = ParseEndpoint(next, listen);
+        } else if(arg == "--target") {
+            has_target = ParseEndpoint(next, target);
+        } else if(arg == "--latency") {
+            options.latency = std::chrono::microseconds(int64_t(std::atof(next.c_str()) * 1000));
+        } else if(arg == "--jitter") {
+            options.jitter = std::chrono::microseconds(int64_t(std::atof(next.c_str()) * 1000));
+        } else if(arg == "--bandwidth") {
+            options.bytes_per_second = ParseRate(next);
+        } else if(arg == "--buffer") {
+            options.buffer_bytes = std::strtoull(next.c_str(), nullptr, 10);
+        } else {
+            has_listen = false;
+            break;
+        }
+        ++i;
+    }
+
+    if(!has_listen || !has_target) {
+        std::cerr << "usage: " << argv[0]
+                  << " --listen HOST:PORT --target HOST:PORT [--latency MS] [--jitter MS] [--bandwidth RATE]"
+                     " [--buffer BYTES]"
+                  << std::endl;
+        return 1;
+    }
+
+    try {
+        asio::io_context io_context;
+        tcp::acceptor    acceptor(io_context, listen);
+        Accept(acceptor, target, options);
+
+        asio::signal_set signals(io_context, SIGINT, SIGTERM);
+        signals.async_wait([&](std::error_code, int) { io_context.stop(); });
+
+        io_context.run();
+    } catch(const std::exception &e) {
+        std::cerr << "exception: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,226 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../include/WSocketContext.hpp"
+#include "../include/CaptureRecorder.hpp"
+
+/**
+ * Replays a capture recorded by WSocketBase::EnableCapture into a
+ * WSocketContext as fast as possible, for profiling the parser and the
+ * decompression path against real traffic.
+ *
+ * usage: wsocket_replay CAPTURE [--chunks recorded|N|random:MIN:MAX] [--loops N]
+ *
+ * - recorded:       feed exactly the read boundaries seen on the live connection (default)
+ * - N:              re-chunk the stream into N byte reads
+ * - random:MIN:MAX: re-chunk into uniformly random read sizes
+ */
+
+namespace {
+
+class ReplayListener : public wsocket::WSocketContext::Listener {
+public:
+    // mirror whatever the recorded peer negotiated
+    wsocket::CompressType OnHandshake(const std::vector<wsocket::CompressType> &request_compress_type) override {
+        return request_compress_type.empty() ? wsocket::CompressType::None : request_compress_type[0];
+    }
+    void OnError(std::error_code code) override { errors++; }
+    void OnText(std::string_view text, bool finish) override {
+        messages++;
+        bytes += text.size();
+    }
+    void OnBinary(wsocket::Buffer buffer, bool finish) override {
+        messages++;
+        bytes += buffer.size;
+    }
+    void OnPing() override { messages++; }
+    void OnPong() override { messages++; }
+
+    uint64_t messages = 0;
+    uint64_t bytes    = 0;
+    uint64_t errors   = 0;
+};
+
+class MappedFile {
+public:
+    ~MappedFile() {
+        if(data_) {
+            ::munmap(data_, size_);
+        }
+        if(fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    bool Open(const std::string &path) {
+        fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd_ < 0) {
+            return false;
+        }
+        struct stat st {};
+        if(::fstat(fd_, &st) != 0 || st.st_size == 0) {
+            return false;
+        }
+        size_       = static_cast<size_t>(st.st_size);
+        void *data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if(data == MAP_FAILED) {
+            return false;
+        }
+        data_ = static_cast<uint8_t *>(data);
+        ::madvise(data_, size_, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    const uint8_t *Data() const { return data_; }
+    size_t         Size() const { return size_; }
+
+private:
+    int      fd_   = -1;
+    uint8_t *data_ = nullptr;
+    size_t   size_ = 0;
+};
+
+struct Chunking {
+    enum class Mode { Recorded, Fixed, Random } mode = Mode::Recorded;
+    size_t min = 0;
+    size_t max = 0;
+
+    bool Parse(const std::string &spec) {
+        if(spec == "recorded") {
+            mode = Mode::Recorded;
+            return true;
+        }
+        if(spec.rfind("random:", 0) == 0) {
+            auto sep = spec.find(':', 7);
+            if(sep == std::string::npos) {
+                return false;
+            }
+            mode = Mode::Random;
+            min  = std::strtoull(spec.c_str() + 7, nullptr, 10);
+            max  = std::strtoull(spec.c_str() + sep + 1, nullptr, 10);
+            return min > 0 && max >= min;
+        }
+        mode = Mode::Fixed;
+        min = max = std::strtoull(spec.c_str(), nullptr, 10);
+        return min > 0;
+    }
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+    if(argc < 2) {
+        std::cerr << "usage: " << argv[0] << " CAPTURE [--chunks recorded|N|random:MIN:MAX] [--loops N]" << std::endl;
+        return 1;
+    }
+
+    std::string path = argv[1];
+    std::string chunk_spec = "recorded";
+    int         loops      = 1;
+    for(int i = 2; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if(arg == "--chunks") {
+            chunk_spec = argv[i + 1];
+        } else if(arg == "--loops") {
+            loops = std::max(1, std::atoi(argv[i + 1]));
+        }
+    }
+
+    Chunking chunking;
+    if(!chunking.Parse(chunk_spec)) {
+        std::cerr << "invalid chunk spec: " << chunk_spec << std::endl;
+        return 1;
+    }
+
+    MappedFile file;
+    if(!file.Open(path) || file.Size() < wsocket::CaptureFormat::HEADER_SIZE ||
+       std::memcmp(file.Data(), wsocket::CaptureFormat::MAGIC, wsocket::CaptureFormat::HEADER_SIZE) != 0) {
+        std::cerr << "not a capture file: " << path << std::endl;
+        return 1;
+    }
+
+    // index the records once, the replay loop then only touches payload bytes
+    std::vector<wsocket::Buffer> records;
+    size_t                       stream_bytes = 0;
+    for(size_t pos = wsocket::CaptureFormat::HEADER_SIZE; pos + wsocket::CaptureFormat::RECORD_HEAD <= file.Size();) {
+        uint32_t len = 0;
+        std::memcpy(&len, file.Data() + pos, sizeof(len));
+        pos += wsocket::CaptureFormat::RECORD_HEAD;
+        if(len == 0 || pos + len > file.Size()) {
+            break;
+        }
+        records.push_back({const_cast<uint8_t *>(file.Data() + pos), len});
+        stream_bytes += len;
+        pos += len;
+    }
+
+    // re-chunked replays need the stream contiguous
+    std::vector<uint8_t> stream;
+    if(chunking.mode != Chunking::Mode::Recorded) {
+        stream.reserve(stream_bytes);
+        for(auto &record : records) {
+            stream.insert(stream.end(), record.buf, record.buf + record.size);
+        }
+    }
+
+    ReplayListener  listener;
+    std::mt19937_64 rng(42);
+    uint64_t        reads = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for(int loop = 0; loop < loops; ++loop) {
+        wsocket::WSocketContext context;
+        context.ResetListener(&listener);
+
+        if(chunking.mode == Chunking::Mode::Recorded) {
+            for(auto &record : records) {
+                context.Feed(record);
+                reads++;
+            }
+            continue;
+        }
+
+        for(size_t pos = 0; pos < stream.size();) {
+            size_t len = chunking.min;
+            if(chunking.mode == Chunking::Mode::Random) {
+                len = std::uniform_int_distribution<size_t>(chunking.min, chunking.max)(rng);
+            }
+            len = std::min(len, stream.size() - pos);
+            context.Feed({stream.data() + pos, len});
+            pos += len;
+            reads++;
+        }
+    }
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+
+    char line[1024];
+    std::snprintf(line,
+                  sizeof(line),
+                  "{\"capture\": \"%s\", \"chunks\": \"%s\", \"loops\": %d, \"records\": %zu, \"reads\": %llu, "
+                  "\"stream_bytes\": %zu, \"messages\": %llu, \"payload_bytes\": %llu, \"errors\": %llu, "
+                  "\"seconds\": %.6f, \"mb_per_second\": %.3f, \"msgs_per_second\": %.1f}\n",
+                  path.c_str(),
+                  chunk_spec.c_str(),
+                  loops,
+                  records.size(),
+                  static_cast<unsigned long long>(reads),
+                  stream_bytes,
+                  static_cast<unsigned long long>(listener.messages),
+                  static_cast<unsigned long long>(listener.bytes),
+                  static_cast<unsigned long long>(listener.errors),
+                  seconds.count(),
+                  double(stream_bytes) * loops / seconds.count() / (1024 * 1024),
+                  double(listener.messages) / seconds.count());
+    std::cout << line;
+    return listener.errors == 0 ? 0 : 2;
+}
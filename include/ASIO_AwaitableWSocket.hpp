@@ -0,0 +1,554 @@
+#pragma once
+#ifndef WSOCKET__ASIO_AWAITABLE_WSOCKET_HPP
+#define WSOCKET__ASIO_AWAITABLE_WSOCKET_HPP
+
+#ifdef WITH_ASIO
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "ASIO_WSocket.hpp"
+
+namespace wsocket {
+
+// A complete received message, fragments are already joined
+struct Message {
+    enum class Type : uint8_t {
+        Text,
+        Binary,
+    };
+
+    Type        type = Type::Text;
+    std::string data;
+
+    bool             IsText() const { return type == Type::Text; }
+    std::string_view Text() const { return data; }
+    Buffer           Binary() { return {reinterpret_cast<uint8_t *>(data.data()), data.size()}; }
+};
+
+namespace awaitable_detail {
+
+#ifdef ASIO_HAS_CO_AWAIT
+// `co_await ws->Receive()` inside an asio::awaitable without spelling out the token
+using DefaultToken = asio::use_awaitable_t<>;
+#else
+using DefaultToken = asio::default_completion_token_t<asio::any_io_executor>;
+#endif
+
+/**
+ * Holds the completion handler of one outstanding operation
+ *
+ * Handlers that fit INLINE_SIZE (asio::use_awaitable and ordinary lambdas do)
+ * are stored in place, larger ones are allocated with the handler's associated
+ * allocator. The handler is always invoked through a post to its associated
+ * executor, never from inside the WSocketContext callback that completed it.
+ */
+template <typename... Args>
+class CompletionSlot {
+    static constexpr size_t INLINE_SIZE = 256;
+
+    struct Op {
+        virtual ~Op() = default;
+        // Post the handler with the results and release the op
+        virtual void Complete(Args... args) = 0;
+        // Release the op without invoking the handler
+        virtual void Destroy() = 0;
+    };
+
+    template <typename Handler, bool Inline>
+    struct OpImpl final : Op {
+        using executor_type  = asio::associated_executor_t<Handler, asio::any_io_executor>;
+        using allocator_type = typename std::allocator_traits<
+            asio::associated_allocator_t<Handler>>::template rebind_alloc<OpImpl>;
+
+        OpImpl(Handler &&handler, const asio::any_io_executor &io_executor) :
+            handler_(std::move(handler)),
+            work_(asio::make_work_guard(asio::get_associated_executor(handler_, io_executor))) {}
+
+        void Complete(Args... args) override {
+            auto handler  = std::move(handler_);
+            auto work     = std::move(work_);
+            auto executor = work.get_executor();
+            // the slot may be re-armed by the handler, free it first
+            this->Release(asio::get_associated_allocator(handler));
+
+            auto results  = std::make_tuple(std::move(args)...);
+            asio::post(executor, [handler = std::move(handler), results = std::move(results)]() mutable {
+                std::apply(std::move(handler), std::move(results));
+            });
+        }
+
+        void Destroy() override { this->Release(asio::get_associated_allocator(handler_)); }
+
+        template <typename Allocator>
+        void Release(const Allocator &allocator) {
+            if constexpr(Inline) {
+                this->~OpImpl();
+            } else {
+                allocator_type alloc(allocator);
+                this->~OpImpl();
+                std::allocator_traits<allocator_type>::deallocate(alloc, this, 1);
+            }
+        }
+
+        Handler                                   handler_;
+        asio::executor_work_guard<executor_type> work_;
+    };
+
+public:
+    explicit CompletionSlot(asio::any_io_executor io_executor) : io_executor_(std::move(io_executor)) {}
+    ~CompletionSlot() { Reset(); }
+
+    CompletionSlot(const CompletionSlot &)            = delete;
+    CompletionSlot &operator=(const CompletionSlot &) = delete;
+
+    bool Pending() const { return op_ != nullptr; }
+
+    template <typename Handler>
+    void Emplace(Handler &&handler);
+
+    // Complete the outstanding operation, no-op when nothing is pending
+    void Complete(Args... args) {
+        if(auto *op = std::exchange(op_, nullptr)) {
+            op->Complete(std::move(args)...);
+        }
+    }
+
+    // Drop the outstanding operation without completing it
+    void Reset() {
+        if(auto *op = std::exchange(op_, nullptr)) {
+            op->Destroy();
+        }
+    }
+
+private:
+    asio::any_io_executor io_executor_;
+    Op                   *op_ = nullptr;
+
+    alignas(std::max_align_t) unsigned char storage_[INLINE_SIZE];
+};
+
+template <typename... Args>
+template <typename Handler>
+void CompletionSlot<Args...>::Emplace(Handler &&handler) {
+    using handler_type = std::decay_t<Handler>;
+    using inline_type  = OpImpl<handler_type, true>;
+    using heap_type    = OpImpl<handler_type, false>;
+
+    assert(op_ == nullptr);
+    if constexpr(sizeof(inline_type) <= INLINE_SIZE && alignof(inline_type) <= alignof(std::max_align_t)) {
+        op_ = new(storage_) inline_type(std::forward<Handler>(handler), io_executor_);
+    } else {
+        typename heap_type::allocator_type alloc(asio::get_associated_allocator(handler));
+        auto *op = std::allocator_traits<typename heap_type::allocator_type>::allocate(alloc, 1);
+        op_      = new(op) heap_type(std::forward<Handler>(handler), io_executor_);
+    }
+}
+
+} // namespace awaitable_detail
+
+/**
+ * WSocket with an asynchronous operation interface
+ *
+ * Every operation takes an asio completion token and defaults to
+ * asio::use_awaitable when the compiler supports coroutines:
+ *
+ *     auto ws = wsocket::AwaitableWSocket::Create(io_context.get_executor());
+ *     co_await ws->Connect(endpoint);
+ *     co_await ws->Send("hello");
+ *     auto message = co_await ws->Receive();
+ *     co_await ws->Close();
+ *
+ * Received messages are joined and queued in a bounded queue, reading from the
+ * socket pauses while the queue is full. A message handed out by Receive can be
+ * given back with Recycle, its storage is then reused for a later message so a
+ * steady request/response loop does not allocate. Awaitable frames come from
+ * asio's per-thread recycling allocator; with other tokens the handler's
+ * associated allocator is honoured.
+ *
+ * Operations must be started from the socket's executor (get_executor), e.g.
+ * co_spawn(ws->get_executor(), ...). Only one Connect, Receive and Close may be
+ * outstanding at a time.
+ */
+template <typename Protocol>
+class AwaitableWSocketBase : public WSocketBase<Protocol> {
+    using base_type     = WSocketBase<Protocol>;
+    using socket_type   = typename Protocol::socket;
+    using endpoint_type = typename Protocol::endpoint;
+
+    using DefaultToken = awaitable_detail::DefaultToken;
+
+public:
+    static constexpr size_t QUEUE_CAPACITY_DEFAULT = 64;
+
+    using executor_type = asio::any_io_executor;
+
+protected:
+    explicit AwaitableWSocketBase(asio::any_io_executor io_executor, size_t queue_capacity) :
+        base_type(std::move(io_executor)), connect_slot_(this->get_executor()), receive_slot_(this->get_executor()),
+        close_slot_(this->get_executor()) {
+        Initialize(queue_capacity);
+    }
+    explicit AwaitableWSocketBase(socket_type &&socket, size_t queue_capacity) :
+        base_type(std::move(socket)), connect_slot_(this->get_executor()), receive_slot_(this->get_executor()),
+        close_slot_(this->get_executor()) {
+        Initialize(queue_capacity);
+    }
+
+private:
+    void Initialize(size_t queue_capacity) {
+        capacity_ = queue_capacity > 0 ? queue_capacity : QUEUE_CAPACITY_DEFAULT;
+        queue_.resize(capacity_);
+    }
+
+public:
+    /**
+     * @param io_executor Executor the socket runs on
+     * @param queue_capacity Received messages buffered before reading pauses
+     */
+    static std::shared_ptr<AwaitableWSocketBase> Create(asio::any_io_executor io_executor,
+                                                        size_t queue_capacity = QUEUE_CAPACITY_DEFAULT) {
+        return std::shared_ptr<AwaitableWSocketBase>(new AwaitableWSocketBase(std::move(io_executor), queue_capacity));
+    }
+    // Wrap an accepted socket, call Start to begin the server side handshake
+    static std::shared_ptr<AwaitableWSocketBase> Create(socket_type &&socket,
+                                                        size_t        queue_capacity = QUEUE_CAPACITY_DEFAULT) {
+        return std::shared_ptr<AwaitableWSocketBase>(new AwaitableWSocketBase(std::move(socket), queue_capacity));
+    }
+
+    executor_type get_executor() { return this->get_raw_socket().get_executor(); }
+
+    using base_type::Close;
+
+    /**
+     * Connect and perform the WSocket handshake
+     * completion signature: void(std::error_code)
+     */
+    template <typename CompletionToken = DefaultToken>
+    auto Connect(const endpoint_type &endpoint, CompletionToken &&token = DefaultToken()) {
+        return asio::async_initiate<CompletionToken, void(std::error_code)>(
+            [this](auto handler, const endpoint_type &endpoint) {
+                this->InitiateConnect(std::move(handler), endpoint);
+            },
+            token,
+            endpoint);
+    }
+
+    /**
+     * Receive the next complete message
+     * completion signature: void(std::error_code, Message)
+     * asio::error::eof once the peer closed and the queue is drained
+     */
+    template <typename CompletionToken = DefaultToken>
+    auto Receive(CompletionToken &&token = DefaultToken()) {
+        return asio::async_initiate<CompletionToken, void(std::error_code, Message)>(
+            [this](auto handler) { this->InitiateReceive(std::move(handler)); }, token);
+    }
+
+    /**
+     * Send a text message
+     * completion signature: void(std::error_code), asio::error::would_block if EnableWouldBlock refused it
+     */
+    template <typename CompletionToken = DefaultToken>
+    auto Send(std::string_view text, CompletionToken &&token = DefaultToken()) {
+        return asio::async_initiate<CompletionToken, void(std::error_code)>(
+            [this](auto handler, std::string_view text) {
+                this->InitiateSend(std::move(handler), [this, text]() { return this->Text(text); });
+            },
+            token,
+            text);
+    }
+
+    /**
+     * Send a binary message
+     * completion signature: void(std::error_code), asio::error::would_block if EnableWouldBlock refused it
+     */
+    template <typename CompletionToken = DefaultToken>
+    auto Send(Buffer buffer, CompletionToken &&token = DefaultToken()) {
+        return asio::async_initiate<CompletionToken, void(std::error_code)>(
+            [this](auto handler, Buffer buffer) {
+                this->InitiateSend(std::move(handler), [this, buffer]() { return this->Binary(buffer); });
+            },
+            token,
+            buffer);
+    }
+
+    /**
+     * Start the close handshake and wait for the peer to answer it
+     * completion signature: void(std::error_code)
+     */
+    template <typename CompletionToken = DefaultToken>
+    auto Close(CompletionToken &&token = DefaultToken()) {
+        return asio::async_initiate<CompletionToken, void(std::error_code)>(
+            [this](auto handler) { this->InitiateClose(std::move(handler), CloseCode::CLOSE_NORMAL); }, token);
+    }
+
+    template <typename CompletionToken = DefaultToken>
+    auto Close(CloseCode code, CompletionToken &&token) {
+        return asio::async_initiate<CompletionToken, void(std::error_code)>(
+            [this](auto handler, CloseCode code) { this->InitiateClose(std::move(handler), code); }, token, code);
+    }
+
+    // Give a received message back so its storage is reused
+    void Recycle(Message &&message);
+
+    // Messages waiting to be received
+    size_t QueueSize() const { return queue_size_; }
+
+protected:
+    //============ WSocketContext::Listener start ============//
+    void OnError(std::error_code code) override;
+    void OnConnected() override;
+    void OnClose(int16_t code, const std::string &reason) override;
+    void OnText(std::string_view text, bool finish) override;
+    void OnBinary(Buffer buffer, bool finish) override;
+    //============ WSocketContext::Listener end ============//
+
+private:
+    template <typename Handler>
+    void InitiateConnect(Handler &&handler, const endpoint_type &endpoint);
+    template <typename Handler>
+    void InitiateReceive(Handler &&handler);
+    template <typename Handler, typename SendFn>
+    void InitiateSend(Handler &&handler, SendFn &&send);
+    template <typename Handler>
+    void InitiateClose(Handler &&handler, CloseCode code);
+
+    // Complete an operation right away, still through a post
+    template <typename Handler, typename... Args>
+    void PostCompletion(Handler &&handler, Args... args) {
+        awaitable_detail::CompletionSlot<Args...> slot(this->get_executor());
+        slot.Emplace(std::forward<Handler>(handler));
+        slot.Complete(std::move(args)...);
+    }
+
+    // Append a received fragment, a finished message goes to the waiting receiver or the queue
+    void Append(Message::Type type, const uint8_t *data, size_t size, bool finish);
+    // Hand the pending message to the receiver or the queue
+    void Deliver();
+    // Pick up recycled storage for the next partial message
+    void RefillPartial();
+
+    // Fail every outstanding operation
+    void Abort(std::error_code code);
+
+private:
+    awaitable_detail::CompletionSlot<std::error_code>          connect_slot_;
+    awaitable_detail::CompletionSlot<std::error_code, Message> receive_slot_;
+    awaitable_detail::CompletionSlot<std::error_code>          close_slot_;
+
+    // ring of received messages, may outgrow capacity_ by the frames of one socket read
+    std::vector<Message> queue_;
+    size_t               queue_head_ = 0;
+    size_t               queue_size_ = 0;
+    size_t               capacity_   = QUEUE_CAPACITY_DEFAULT;
+
+    Message                  partial_; // message being joined from fragments
+    std::vector<std::string> spare_;   // recycled message storage
+
+    bool            connected_ = false;
+    bool            closed_    = false;
+    std::error_code error_;
+};
+
+using AwaitableWSocket = AwaitableWSocketBase<asio::ip::tcp>;
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+using AwaitableUnixWSocket = AwaitableWSocketBase<asio::local::stream_protocol>;
+#endif
+
+template <typename Protocol>
+void AwaitableWSocketBase<Protocol>::Recycle(Message &&message) {
+    if(message.data.capacity() == 0 || spare_.size() >= capacity_) {
+        return;
+    }
+    message.data.clear();
+    spare_.push_back(std::move(message.data));
+}
+
+//============ WSocketContext::Listener start ============//
+
+template <typename Protocol>
+void AwaitableWSocketBase<Protocol>::OnError(std::error_code code) {
+    if(closed_ || error_) {
+        // socket errors after the close handshake are expected
+        return;
+    }
+    error_ = code;
+    this->Abort(code);
+    this->Stop();
+}
+
+template <typename Protocol>
+void AwaitableWSocketBase<Protocol>::OnConnected() {
+    connected_ = true;
+    connect_slot_.Complete(std::error_code());
+}
+
+template <typename Protocol>
+void AwaitableWSocketBase<Protocol>::OnClose(int16_t code, const std::string &reason) {
+    closed_ = true;
+    close_slot_.Complete(std::error_code());
+    this->Abort(asio::error::make_error_code(asio::error::eof));
+
+    // close handshake finished, nothing more to read
+    this->Stop();
+}
+
+template <typename Protocol>
+void AwaitableWSocketBase<Protocol>::OnText(std::string_view text, bool finish) {
+    this->Append(Message::Type::Text, reinterpret_cast<const uint8_t *>(text.data()), text.size(), finish);
+}
+
+template <typename Protocol>
+void AwaitableWSocketBase<Protocol>::OnBinary(Buffer buffer, bool finish) {
+    this->Append(Message::Type::Binary, buffer.buf, buffer.size, finish);
+}
+
+//============ WSocketContext::Listener end ============//
+
+template <typename Protocol>
+template <typename Handler>
+void AwaitableWSocketBase<Protocol>::InitiateConnect(Handler &&handler, const endpoint_type &endpoint) {
+    if(connect_slot_.Pending() || connected_) {
+        this->PostCompletion(std::forward<Handler>(handler),
+                             std::error_code(asio::error::make_error_code(asio::error::already_started)));
+        return;
+    }
+    connect_slot_.Emplace(std::forward<Handler>(handler));
+    this->Handshake(endpoint);
+}
+
+template <typename Protocol>
+template <typename Handler>
+void AwaitableWSocketBase<Protocol>::InitiateReceive(Handler &&handler) {
+    if(queue_size_ > 0) {
+        Message message;
+        std::swap(message, queue_[queue_head_]);
+        queue_head_ = (queue_head_ + 1) % queue_.size();
+        queue_size_--;
+        if(queue_size_ < capacity_) {
+            this->ResumeRecv();
+        }
+        this->PostCompletion(std::forward<Handler>(handler), std::error_code(), std::move(message));
+        return;
+    }
+
+    std::error_code ec;
+    if(closed_) {
+        ec = asio::error::make_error_code(asio::error::eof);
+    } else if(error_) {
+        ec = error_;
+    } else if(receive_slot_.Pending()) {
+        ec = asio::error::make_error_code(asio::error::already_started);
+    }
+    if(ec) {
+        this->PostCompletion(std::forward<Handler>(handler), ec, Message());
+        return;
+    }
+    receive_slot_.Emplace(std::forward<Handler>(handler));
+}
+
+template <typename Protocol>
+template <typename Handler, typename SendFn>
+void AwaitableWSocketBase<Protocol>::InitiateSend(Handler &&handler, SendFn &&send) {
+    std::error_code ec;
+    if(closed_) {
+        ec = asio::error::make_error_code(asio::error::shut_down);
+    } else if(error_) {
+        ec = error_;
+    } else if(!connected_) {
+        ec = asio::error::make_error_code(asio::error::not_connected);
+    } else if(!send()) {
+        // refused at the high watermark, nothing was queued
+        ec = asio::error::make_error_code(asio::error::would_block);
+    } else {
+        // the frame is written or queued right away, a send failure shows up in error_
+        ec = error_;
+    }
+    this->PostCompletion(std::forward<Handler>(handler), ec);
+}
+
+template <typename Protocol>
+template <typename Handler>
+void AwaitableWSocketBase<Protocol>::InitiateClose(Handler &&handler, CloseCode code) {
+    std::error_code ec;
+    if(closed_) {
+        ec = std::error_code();
+    } else if(error_) {
+        ec = error_;
+    } else if(close_slot_.Pending()) {
+        ec = asio::error::make_error_code(asio::error::already_started);
+    } else if(!connected_) {
+        ec = asio::error::make_error_code(asio::error::not_connected);
+    } else {
+        close_slot_.Emplace(std::forward<Handler>(handler));
+        base_type::Close(code);
+        return;
+    }
+    this->PostCompletion(std::forward<Handler>(handler), ec);
+}
+
+template <typename Protocol>
+void AwaitableWSocketBase<Protocol>::Append(Message::Type type, const uint8_t *data, size_t size, bool finish) {
+    if(closed_) {
+        return;
+    }
+    partial_.type = type;
+    partial_.data.append(reinterpret_cast<const char *>(data), size);
+    if(finish) {
+        this->Deliver();
+    }
+}
+
+template <typename Protocol>
+void AwaitableWSocketBase<Protocol>::Deliver() {
+    if(receive_slot_.Pending()) {
+        receive_slot_.Complete(std::error_code(), std::move(partial_));
+        partial_ = Message();
+        this->RefillPartial();
+        return;
+    }
+
+    if(queue_size_ == queue_.size()) {
+        // one read carried more messages than the queue holds, unroll the ring and grow it
+        std::rotate(queue_.begin(), queue_.begin() + queue_head_, queue_.end());
+        queue_head_ = 0;
+        queue_.resize(queue_.size() * 2);
+    }
+
+    // swapping hands the slot's previous storage to the next partial message
+    auto &slot = queue_[(queue_head_ + queue_size_) % queue_.size()];
+    std::swap(slot, partial_);
+    partial_.data.clear();
+    queue_size_++;
+    this->RefillPartial();
+
+    if(queue_size_ >= capacity_) {
+        this->PauseRecv();
+    }
+}
+
+template <typename Protocol>
+void AwaitableWSocketBase<Protocol>::RefillPartial() {
+    if(partial_.data.capacity() == 0 && !spare_.empty()) {
+        partial_.data = std::move(spare_.back());
+        spare_.pop_back();
+    }
+}
+
+template <typename Protocol>
+void AwaitableWSocketBase<Protocol>::Abort(std::error_code code) {
+    connect_slot_.Complete(code);
+    receive_slot_.Complete(code, Message());
+    close_slot_.Complete(code);
+}
+
+} // namespace wsocket
+
+#endif
+
+#endif // WSOCKET__ASIO_AWAITABLE_WSOCKET_HPP
@@ -4,10 +4,27 @@
 
 #ifdef WITH_ASIO
 
+#include <chrono>
+#include <deque>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
 #include <asio.hpp>
 
 #include "WSocketContext.hpp"
 #include "ASIO_KeepAliveManager.hpp"
+#include "CaptureRecorder.hpp"
+#include "ConflationQueue.hpp"
+#include "MpscQueue.hpp"
+#include "RateLimiter.hpp"
 
 namespace wsocket {
 
@@ -20,12 +37,22 @@ class WSocketBase : public WSocketContext::Listener,
     using endpoint_type = typename Protocol::endpoint;
 
 protected:
-    explicit WSocketBase(asio::any_io_executor io_executor) :
-        socket_(asio::make_strand(io_executor)), keep_alive_manager_(socket_.get_executor()) {
+    /**
+     * @param resource Where the receive buffer, send queue and compression buffers come from,
+     *        null for the BufferPoolResource; must outlive the socket
+     */
+    explicit WSocketBase(asio::any_io_executor io_executor, std::pmr::memory_resource *resource = nullptr) :
+        socket_(MakeStrand(io_executor)), keep_alive_manager_(socket_.get_executor()),
+        wsocket_context_(resource), flush_timer_(socket_.get_executor()),
+        send_queue_(wsocket_context_.MemoryResource()), send_inflight_(wsocket_context_.MemoryResource()),
+        recv_throttle_timer_(socket_.get_executor()), send_throttle_timer_(socket_.get_executor()) {
         Initialize();
     }
-    explicit WSocketBase(socket_type &&socket) :
-        socket_(std::move(socket)), keep_alive_manager_(socket_.get_executor()) {
+    explicit WSocketBase(socket_type &&socket, std::pmr::memory_resource *resource = nullptr) :
+        socket_(std::move(socket)), keep_alive_manager_(socket_.get_executor()), wsocket_context_(resource),
+        flush_timer_(socket_.get_executor()), send_queue_(wsocket_context_.MemoryResource()),
+        send_inflight_(wsocket_context_.MemoryResource()), recv_throttle_timer_(socket_.get_executor()),
+        send_throttle_timer_(socket_.get_executor()) {
         Initialize();
     }
 
@@ -33,12 +60,22 @@ private:
     // Initialize common settings
     void Initialize();
 
+    // A strand over the concrete io_context executor fits in any_io_executor's small buffer, one over
+    // any_io_executor does not and would be copied to the heap by every asynchronous operation
+    static asio::any_io_executor MakeStrand(const asio::any_io_executor &io_executor) {
+        if(auto *executor = io_executor.target<asio::io_context::executor_type>()) {
+            return asio::make_strand(*executor);
+        }
+        return asio::make_strand(io_executor);
+    }
+
 public:
-    static std::shared_ptr<WSocketBase> Create(asio::any_io_executor io_executor) {
-        return std::shared_ptr<WSocketBase>(new WSocketBase(std::move(io_executor)));
+    static std::shared_ptr<WSocketBase> Create(asio::any_io_executor      io_executor,
+                                               std::pmr::memory_resource *resource = nullptr) {
+        return std::shared_ptr<WSocketBase>(new WSocketBase(std::move(io_executor), resource));
     }
-    static std::shared_ptr<WSocketBase> Create(socket_type &&socket) {
-        return std::shared_ptr<WSocketBase>(new WSocketBase(std::move(socket)));
+    static std::shared_ptr<WSocketBase> Create(socket_type &&socket, std::pmr::memory_resource *resource = nullptr) {
+        return std::shared_ptr<WSocketBase>(new WSocketBase(std::move(socket), resource));
     }
 
     ~WSocketBase() override;
@@ -47,10 +84,28 @@ public:
      * Start WSocket operations (data reception and keep-alive management)
      */
     void Start() {
+        // sends try the kernel inline and queue what it does not take
+        asio::error_code ignore_ec;
+        std::ignore = socket_.non_blocking(true, ignore_ec);
+#ifdef __linux__
+        this->ApplyZeroCopy();
+#endif
+        recv_active_ = true;
         this->StartRecv();
         keep_alive_manager_.Start();
     }
 
+    /**
+     * Stop keep-alive management and shut the socket down once the send queue is written,
+     * which ends the receive loop
+     */
+    void Stop() {
+        keep_alive_manager_.Stop();
+        flush_timer_.cancel();
+        this->wsocket_context_.Flush();
+        this->ShutdownAfterWrite();
+    }
+
     // Set keep-alive expiration time
     void SetKeepAliveExpiredTime(int64_t expire_ms) {
         keep_alive_manager_.SetExpiredTimeMsec(expire_ms);
@@ -61,22 +116,248 @@ public:
     void Handshake(const endpoint_type &endpoint);
 
     // Send Ping frame
-    void Ping() { this->wsocket_context_.Ping(); }
+    void Ping() {
+        this->ArmFlushWindow();
+        this->wsocket_context_.Ping();
+    }
 
     // Send Pong frame
-    void Pong() { this->wsocket_context_.Pong(); }
+    void Pong() {
+        this->ArmFlushWindow();
+        this->wsocket_context_.Pong();
+    }
+
+    // Send text message, false if EnableWouldBlock is on and the send queue is at the high watermark
+    bool Text(std::string_view text, bool finish = true) {
+        if(this->WouldBlock()) {
+            return false;
+        }
+        this->ArmFlushWindow();
+        this->wsocket_context_.SendText(text, finish);
+        return true;
+    }
+
+    // Send binary message, false if EnableWouldBlock is on and the send queue is at the high watermark
+    bool Binary(Buffer buffer, bool finish = true) {
+        if(this->WouldBlock()) {
+            return false;
+        }
+        this->ArmFlushWindow();
+        this->wsocket_context_.SendBinary(buffer, finish);
+        return true;
+    }
+
+    /**
+     * Serialize a message straight into a pooled send buffer, see WSocketContext::FrameBuilder;
+     * unlike Text and Binary this does not check EnableWouldBlock
+     */
+    WSocketContext::FrameBuilder BuildBinary(size_t reserve) {
+        this->ArmFlushWindow();
+        return this->wsocket_context_.BuildBinary(reserve);
+    }
+    WSocketContext::FrameBuilder BuildText(size_t reserve) {
+        this->ArmFlushWindow();
+        return this->wsocket_context_.BuildText(reserve);
+    }
+
+    static constexpr uint64_t FILE_FRAGMENT_SIZE_DEFAULT = 1024 * 1024;
+
+#ifdef __linux__
+    /**
+     * Send `length` bytes of the file `fd` from `offset` as one binary message
+     *
+     * The frame headers are queued like any other frame and the payload is
+     * streamed by sendfile(2) from the page cache, with no user-space copy.
+     * Frames sent before the call go out first, frames sent after it wait
+     * for the whole file. `fd` is duplicated, the caller may close it at once.
+     * The unsent part of the file counts toward SendQueueSize.
+     * @return false if the connection is not open, EnableWouldBlock is on and the send queue is at
+     *         the high watermark, or `length` is 0 or `fd` cannot be duplicated
+     */
+    bool SendFile(int fd, uint64_t offset, uint64_t length);
+
+    // Payload bytes per frame of a SendFile message, bounding the receiver's buffer; 0 sends one frame
+    void SetFileFragmentSize(uint64_t size) { file_fragment_size_ = size; }
+
+    /**
+     * Send binary payloads of at least `threshold` bytes passed to Send with MSG_ZEROCOPY, 0 disables (default)
+     *
+     * The kernel then reads the payload from the handle's pages instead of
+     * copying it into the socket buffer, and the handle is held until the
+     * completion notification arrives on the socket's error queue. Pinning the
+     * pages and reading the notifications costs more than copying a small
+     * payload, see `wsocket_load_generator --zerocopy` for the crossover.
+     * Sockets without SO_ZEROCOPY, e.g. unix sockets, keep copying, and so does
+     * a connection once the kernel reports it copied a payload after all, as it
+     * does over loopback.
+     */
+    void EnableZeroCopy(size_t threshold) {
+        zerocopy_threshold_ = threshold;
+        if(socket_.is_open()) {
+            this->ApplyZeroCopy();
+        }
+    }
+
+    // Sends made with MSG_ZEROCOPY, and those the kernel completed by copying after all, e.g. over loopback
+    uint64_t ZeroCopySends() const { return zerocopy_sends_; }
+    uint64_t ZeroCopyCopied() const { return zerocopy_copied_; }
+    // Payloads written with MSG_ZEROCOPY and still held for the kernel
+    size_t ZeroCopyPending() const { return zerocopy_pending_.size(); }
+#endif
+
+    /**
+     * Send an owned message, e.g. one received with EnableOwnedMessages and forwarded
+     *
+     * With EnableZeroCopy a large binary payload is sent from the handle's
+     * buffer, which is why it is taken by value; anything else is copied
+     * like Text and Binary; until the kernel has taken it, a zero-copy
+     * payload counts toward SendQueueSize.
+     * @return false if EnableWouldBlock is on and the send queue is at the high watermark, `message` is empty,
+     *         or a zero-copy message finds the connection not open
+     */
+    bool Send(MessageHandle message);
+
+    // Hold outgoing frames back and send them as one write on the outermost Uncork
+    void Cork() { this->wsocket_context_.Cork(); }
+    void Uncork() { this->wsocket_context_.Uncork(); }
+
+    // Corks the socket for the lifetime of the returned scope
+    WSocketContext::BatchScope Batch() { return WSocketContext::BatchScope(this->wsocket_context_); }
 
-    // Send text message
-    void Text(std::string_view text, bool finish = true) { this->wsocket_context_.SendText(text, finish); }
+    /**
+     * Coalesce the frames sent within `window` after the first one into a single write
+     * @param window Flush window, zero (default) sends every frame immediately
+     */
+    void SetFlushWindow(std::chrono::microseconds window) { flush_window_ = window; }
+
+    // Close connection (using standard close code), unsent conflated messages are dropped
+    void Close(CloseCode code) {
+        conflation_.Clear();
+        this->wsocket_context_.Close(code);
+    }
+
+    // Close connection (using custom close code and reason), unsent conflated messages are dropped
+    void Close(int16_t code, std::string_view reason) {
+        conflation_.Clear();
+        this->wsocket_context_.Close(code, reason);
+    }
+
+    /**
+     * Thread safe sends, callable from any thread
+     *
+     * The message is copied into a queue node pushed with one atomic operation.
+     * The first push after a drain posts a single handler to the socket's
+     * executor, which sends everything queued by then as one corked write.
+     * Messages that reach the executor while the connection is not open, e.g.
+     * after a Close or a second PostClose, are dropped.
+     */
+    void PostText(std::string_view text) { this->Post(PostedFrame::Text, text.data(), text.size()); }
+    void PostBinary(Buffer buffer) { this->Post(PostedFrame::Binary, buffer.buf, buffer.size); }
+    void PostClose(CloseCode code) { this->Post(PostedFrame::Close, nullptr, 0, code); }
+
+    static constexpr size_t SEND_LOW_WATERMARK_DEFAULT  = 256 * 1024;
+    static constexpr size_t SEND_HIGH_WATERMARK_DEFAULT = 1024 * 1024;
+
+    /**
+     * Thresholds on SendQueueSize for OnSendQueueHigh and OnWritable
+     * @param low OnWritable fires once the queue drains to `low` after reaching `high`
+     * @param high OnSendQueueHigh fires when the queue reaches `high`
+     */
+    void SetSendWatermarks(size_t low, size_t high) {
+        send_low_watermark_  = std::min(low, high);
+        send_high_watermark_ = high;
+    }
+
+    // Bytes sent but not taken by the kernel yet: corked, queued, in flight and file or zero-copy payloads
+    size_t SendQueueSize() const {
+        return this->wsocket_context_.CorkedSize() + send_queue_.size() + send_inflight_.size() + segment_bytes_;
+    }
+
+    // Between OnSendQueueHigh and OnWritable
+    bool IsSendQueueHigh() const { return send_queue_high_; }
 
-    // Send binary message
-    void Binary(Buffer buffer, bool finish = true) { this->wsocket_context_.SendBinary(buffer, finish); }
+    // Text and Binary refuse (return false) instead of queuing more at the high watermark
+    void EnableWouldBlock(bool enable) { would_block_ = enable; }
+
+    /**
+     * Send a message that may be conflated or expire while the connection is backed up
+     *
+     * Goes out at once when nothing is queued, otherwise waits in a ConflationQueue
+     * that is drained as the send queue empties. Unsent messages are dropped once the
+     * connection closes.
+     * @param key A newer message replaces an unsent one with the same key, empty never conflates
+     * @param ttl Dropped if still unsent after this long, zero never expires
+     */
+    void ConflateText(std::string_view key, std::string_view text, std::chrono::microseconds ttl = {}) {
+        this->Conflate(key, reinterpret_cast<const uint8_t *>(text.data()), text.size(), false, ttl);
+    }
+    void ConflateBinary(std::string_view key, Buffer buffer, std::chrono::microseconds ttl = {}) {
+        this->Conflate(key, buffer.buf, buffer.size, true, ttl);
+    }
 
-    // Close connection (using standard close code)
-    void Close(CloseCode code) { this->wsocket_context_.Close(code); }
+    // Conflatable messages waiting, and how many were replaced or expired so far
+    size_t   ConflatedPending() const { return conflation_.Size(); }
+    uint64_t ConflatedReplaced() const { return conflation_.Replaced(); }
+    uint64_t ConflatedExpired() const { return conflation_.Expired(); }
 
-    // Close connection (using custom close code and reason)
-    void Close(int16_t code, const std::string &reason) { this->wsocket_context_.Close(code, reason); }
+    /**
+     * Messages and bytes per second this connection may receive, unlimited by default
+     *
+     * Once the budget is used up no receive is started until it refills, the
+     * kernel buffer fills and TCP flow control throttles the peer, so a chatty
+     * client cannot keep its io thread parsing.
+     */
+    void SetRecvRateLimit(const RateLimit &limit) { recv_limit_.SetLimit(limit); }
+
+    // Messages and bytes per second this connection may send, frames over budget wait in the send queue
+    void SetSendRateLimit(const RateLimit &limit) { send_limit_.SetLimit(limit); }
+
+    /**
+     * Budgets shared with other connections, e.g. all connections of a server, charged along with our own
+     * @param recv Shared receive budget, nullptr for none
+     * @param send Shared send budget, nullptr for none
+     */
+    void SetSharedRateLimits(std::shared_ptr<RateLimiter> recv, std::shared_ptr<RateLimiter> send) {
+        recv_limit_.SetParent(std::move(recv));
+        send_limit_.SetParent(std::move(send));
+    }
+
+    // Waiting for the receive or send budget to refill
+    bool IsRecvThrottled() const { return recv_throttled_; }
+    bool IsSendThrottled() const { return send_throttled_; }
+
+    /**
+     * Hold no receive buffer while idle: between messages wait for readability
+     * with a zero-byte wait, then borrow a buffer from the thread's pool and
+     * give it back once everything received is parsed. Memory then follows
+     * the active connections rather than all of them. Call before Start.
+     */
+    void EnableIdleRecv(bool enable) { idle_recv_ = enable; }
+
+    // Validate received text messages as UTF-8, invalid text fails the connection
+    void EnableUtf8Validation(bool enable) { this->wsocket_context_.EnableUtf8Validation(enable); }
+
+    // Deliver received text and binary frames to OnMessage as owned handles, see WSocketContext::EnableOwnedMessages
+    void EnableOwnedMessages(bool enable) { this->wsocket_context_.EnableOwnedMessages(enable); }
+
+    // Fail the connection on frames announcing more than `size` bytes, see WSocketContext::SetMaxFrameSize
+    void SetMaxFrameSize(size_t size) { this->wsocket_context_.SetMaxFrameSize(size); }
+
+    // Receive large binary payloads into OnBinaryDestination buffers, see WSocketContext::SetDirectReceiveThreshold
+    void SetDirectReceiveThreshold(size_t threshold) { this->wsocket_context_.SetDirectReceiveThreshold(threshold); }
+
+    // Write large binary messages to mmap'd temp files for OnSpilled, see WSocketContext::SetSpillThreshold
+    void SetSpillThreshold(size_t threshold, std::string directory = "/tmp") {
+        this->wsocket_context_.SetSpillThreshold(threshold, std::move(directory));
+    }
+
+#ifndef _WIN32
+    /**
+     * Record every received chunk into a capture file, which can be replayed by wsocket_replay
+     * @param path Capture file path, an empty path stops recording
+     */
+    bool EnableCapture(const std::string &path);
+#endif
 
 protected:
     //============ WSocketContext::Listener start ============//
@@ -84,12 +365,15 @@ protected:
     CompressType OnHandshake(const std::vector<CompressType> &request_compress_type) override {
         return CompressType::None;
     }
-    void OnConnected() override {}
-    void OnClose(int16_t code, const std::string &reason) override {}
-    void OnPing() override { this->wsocket_context_.Pong(); }
-    void OnPong() override {}
-    void OnText(std::string_view text, bool finish) override {}
-    void OnBinary(Buffer buffer, bool finish) override {}
+    void   OnConnected() override {}
+    void   OnClose(int16_t code, const std::string &reason) override {}
+    void   OnPing() override { this->wsocket_context_.Pong(); }
+    void   OnPong() override {}
+    void   OnText(std::string_view text, bool finish) override {}
+    void   OnBinary(Buffer buffer, bool finish) override {}
+    void   OnMessage(MessageHandle message) override {}
+    void   OnSpilled(SpilledMessage message) override {}
+    Buffer OnBinaryDestination(size_t size, bool finish) override { return {}; }
     //============ WSocketContext::Listener end ============//
 
     //============ KeepAliveManager::Listener start ============//
@@ -97,6 +381,26 @@ protected:
     void OnKeepAliveTimeout(std::error_code ec) override;
     //============ KeepAliveManager::Listener end ============//
 
+    //============ send queue start ============//
+    // The send queue reached the high watermark, throttle or shed load
+    virtual void OnSendQueueHigh(size_t queued) {}
+    // The send queue drained to the low watermark after OnSendQueueHigh
+    virtual void OnWritable() {}
+    //============ send queue end ============//
+
+    /**
+     * Stop reading from the socket once the in-flight receive completes, the
+     * kernel buffer then fills up and TCP flow control throttles the peer
+     */
+    void PauseRecv() { recv_paused_ = true; }
+    // Continue reading after PauseRecv
+    void ResumeRecv() {
+        recv_paused_ = false;
+        if(recv_active_ && !receiving_ && !recv_throttled_) {
+            this->StartRecv();
+        }
+    }
+
     socket_type       &get_raw_socket() { return socket_; }
     const socket_type &get_raw_socket() const { return socket_; }
 
@@ -108,17 +412,172 @@ private:
     }
     // Data receive completion callback
     void OnReceived(std::size_t bytes_transferred) {
+        if(this->Consume(bytes_transferred)) {
+            this->StartRecv();
+        }
+    }
+    // Parse received bytes, false if the receive loop ends or waits here
+    bool Consume(std::size_t bytes_transferred) {
+#ifndef _WIN32
+        if(capture_) {
+            auto buf = wsocket_context_.PrepareWrite();
+            capture_->Append({buf.buf, bytes_transferred});
+        }
+#endif
         this->wsocket_context_.CommitWrite(bytes_transferred);
-        this->StartRecv();
+        if(this->wsocket_context_.IsFailed()) {
+            // protocol error, the close frame is already queued
+            this->ShutdownAfterWrite();
+            recv_active_ = false;
+            return false;
+        }
+        if(recv_limit_.Enabled()) {
+            auto messages = this->wsocket_context_.MessagesReceived() - recv_messages_charged_;
+            recv_messages_charged_ += messages;
+            auto delay = recv_limit_.Charge(messages, bytes_transferred);
+            if(delay.count() > 0) {
+                this->ThrottleRecv(delay);
+                return false;
+            }
+        }
+        return !recv_paused_;
     }
 
     // Start asynchronous data reception
     void StartRecv();
+    // Idle receive: wait for readability without a buffer, then read inline until the socket is drained
+    void WaitRecv();
+    void ReadReady();
+
+    static constexpr int IDLE_READS_PER_WAKEUP = 16; // inline reads before waiting again, for fairness
+
+    // Receive again once the receive budget has refilled
+    void ThrottleRecv(RateLimiter::Clock::duration delay);
+
+    // Cork until the flush window expires, if a window is set and not already running
+    void ArmFlushWindow();
+
+    // Send handler: write inline, queue the rest behind a single async_write
+    void Write(const Buffer &buffer);
+    // Write the send queue now, or once the send budget has refilled
+    void FlushSendQueue();
+    void StartWrite();
+    // A write or a throttle wait ended, carry on with whatever is waiting
+    void ContinueWrite();
+    // Drop `len` bytes written from the front of send_queue_, segments keep their place
+    void PopQueued(size_t len);
+    // The write side failed, drop everything queued
+    void FailWrite(std::error_code ec);
+#ifdef __linux__
+    // Stream the segment at the head of the queue until the socket pushes back
+    void WriteSegment();
+    // Set SO_ZEROCOPY if EnableZeroCopy asked for it
+    void ApplyZeroCopy();
+    // Release the zero-copy payloads the kernel is done with, wait for more if any are left
+    void ReapZeroCopy();
+    // Read the error queue without waiting, true once no payload is pending
+    bool ReadZeroCopyCompletions();
+#endif
+    void ClearSegments();
+    void ShutdownAfterWrite();
+    void CheckWatermarks();
+    bool WouldBlock() const { return would_block_ && this->SendQueueSize() >= send_high_watermark_; }
+
+    void Conflate(std::string_view key, const uint8_t *data, size_t size, bool binary, std::chrono::microseconds ttl);
+    // Send conflated messages while the socket keeps up
+    void FlushConflated();
+
+    // Node of the cross-thread send queue, the payload follows it in the same allocation
+    struct PostedFrame {
+        enum Type : uint8_t { Text, Binary, Close };
+
+        PostedFrame *next = nullptr;
+        size_t       size = 0;
+        Type         type = Text;
+        CloseCode    code = CloseCode::CLOSE_NORMAL;
+
+        uint8_t *Data() { return reinterpret_cast<uint8_t *>(this + 1); }
+    };
+
+    void Post(typename PostedFrame::Type type,
+              const void                *data,
+              size_t                     size,
+              CloseCode                  code = CloseCode::CLOSE_NORMAL);
+    // Send the queued frames, runs on the socket's executor
+    void DrainPosted();
+    void FreePosted(PostedFrame *frame);
+
+    // A frame payload written on its own once the queued bytes ahead of it are out:
+    // a SendFile range, or a MessageHandle sent with MSG_ZEROCOPY
+    struct Segment {
+        int           fd        = -1;    // -1 for `buffer`
+        uint64_t      offset    = 0;
+        uint64_t      length    = 0;
+        size_t        queue_pos = 0;     // bytes at the front of send_queue_ that go first
+        bool          close_fd  = false; // last segment of its file
+        MessageHandle buffer;
+    };
+
+    /**
+     * Queue the frame header for `segment`, its payload is written once the header is out
+     * @return false when the context refuses to send, the segment is not queued then
+     */
+    bool QueueSegment(Segment &&segment, bool finish);
 
 private:
     socket_type      socket_;
     KeepAliveManager keep_alive_manager_;
     WSocketContext   wsocket_context_;
+
+    asio::steady_timer        flush_timer_;
+    std::chrono::microseconds flush_window_{0};
+    bool                      flush_armed_ = false;
+
+    MpscQueue<PostedFrame> posted_;
+
+    std::pmr::vector<uint8_t> send_queue_;    // waiting for the in-flight write
+    std::pmr::vector<uint8_t> send_inflight_; // owned by the running async_write
+
+    std::deque<Segment> segments_;
+    size_t              segment_bytes_      = 0; // payload of segments_ not sent yet
+    uint64_t            file_fragment_size_ = FILE_FRAGMENT_SIZE_DEFAULT;
+
+    // Zero-copy payloads in the kernel's hands, with the id of their last send
+    std::deque<std::pair<uint32_t, MessageHandle>> zerocopy_pending_;
+
+    size_t   zerocopy_threshold_ = 0;
+    bool     zerocopy_           = false; // SO_ZEROCOPY set and the route does not copy anyway
+    bool     zerocopy_waiting_   = false; // an error queue wait is in flight
+    uint32_t zerocopy_done_      = 0;     // sends before this id are complete
+    uint64_t zerocopy_sends_     = 0;     // the kernel numbers them from 0, modulo 2^32
+    uint64_t zerocopy_copied_    = 0;
+
+    bool                      writing_             = false;
+    bool                      shutdown_pending_    = false; // shut down when the queue is written
+    size_t                    send_low_watermark_  = SEND_LOW_WATERMARK_DEFAULT;
+    size_t                    send_high_watermark_ = SEND_HIGH_WATERMARK_DEFAULT;
+    bool                      send_queue_high_     = false;
+    bool                      would_block_         = false;
+
+    ConflationQueue conflation_;
+
+    RateLimiter        recv_limit_;
+    RateLimiter        send_limit_;
+    asio::steady_timer recv_throttle_timer_;
+    asio::steady_timer send_throttle_timer_;
+    bool               recv_throttled_        = false;
+    bool               send_throttled_        = false;
+    uint64_t           recv_messages_charged_ = 0;
+    uint64_t           send_messages_charged_ = 0;
+
+    bool recv_active_ = false; // receive loop started and not ended by an error
+    bool recv_paused_ = false; // PauseRecv requested
+    bool receiving_   = false; // an async_receive or async_wait is in flight
+    bool idle_recv_   = false; // EnableIdleRecv
+
+#ifndef _WIN32
+    std::unique_ptr<CaptureRecorder> capture_;
+#endif
 };
 
 using WSocket = WSocketBase<asio::ip::tcp>;
@@ -132,13 +591,7 @@ void WSocketBase<Protocol>::Initialize() {
     wsocket_context_.ResetListener(this);
 
     // Set send handler
-    wsocket_context_.ResetSendHandler([this](Buffer buffer) {
-        asio::error_code ec;
-        this->socket_.send(asio::buffer(buffer.buf, buffer.size), 0, ec);
-        if(ec) {
-            this->OnError(ec);
-        }
-    });
+    wsocket_context_.ResetSendHandler([this](Buffer buffer) { this->Write(buffer); });
 }
 
 template <typename Protocol>
@@ -146,6 +599,16 @@ WSocketBase<Protocol>::~WSocketBase() {
     wsocket_context_.ResetListener(nullptr);
     wsocket_context_.ResetSendHandler(nullptr);
     keep_alive_manager_.ResetListener(nullptr);
+    this->FreePosted(posted_.Drain());
+    this->ClearSegments();
+#ifdef __linux__
+    if(!zerocopy_pending_.empty() && socket_.is_open() && !this->ReadZeroCopyCompletions()) {
+        // the kernel still reads from payloads about to be freed, reset instead of
+        // lingering on them so the connection cannot send what reuses the memory
+        ::linger reset{1, 0};
+        ::setsockopt(socket_.native_handle(), SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    }
+#endif
 
     if(socket_.is_open()) {
         asio::error_code ec;
@@ -156,7 +619,7 @@ WSocketBase<Protocol>::~WSocketBase() {
 template <typename Protocol>
 void WSocketBase<Protocol>::Handshake(const endpoint_type &endpoint) {
     auto _this = this->shared_from_this();
-    socket_.async_connect(endpoint, [=](asio::error_code ec) {
+    socket_.async_connect(endpoint, [this, _this](asio::error_code ec) {
         if(ec) {
             this->OnError(ec);
             return;
@@ -165,6 +628,23 @@ void WSocketBase<Protocol>::Handshake(const endpoint_type &endpoint) {
     });
 }
 
+#ifndef _WIN32
+template <typename Protocol>
+bool WSocketBase<Protocol>::EnableCapture(const std::string &path) {
+    if(path.empty()) {
+        capture_.reset();
+        return true;
+    }
+
+    auto recorder = std::make_unique<CaptureRecorder>();
+    if(!recorder->Open(path)) {
+        return false;
+    }
+    capture_ = std::move(recorder);
+    return true;
+}
+#endif
+
 //============ KeepAliveManager::Listener start ============//
 
 template <typename Protocol>
@@ -193,17 +673,586 @@ void WSocketBase<Protocol>::OnKeepAliveTimeout(std::error_code ec) {
 
 template <typename Protocol>
 void WSocketBase<Protocol>::StartRecv() {
-    auto _this = this->shared_from_this();
-    auto buf   = wsocket_context_.PrepareWrite();
-    socket_.async_receive(asio::buffer(buf.buf, buf.size), [=](std::error_code ec, std::size_t bytes_transferred) {
+    if(idle_recv_ && this->wsocket_context_.ReleaseReceiveBuffer()) {
+        // no partial frame buffered, nothing to hold on to until the peer sends again
+        this->WaitRecv();
+        return;
+    }
+
+    auto _this   = this->shared_from_this();
+    auto buf     = wsocket_context_.PrepareWrite();
+    auto handler = [_this](std::error_code ec, std::size_t bytes_transferred) {
+        _this->receiving_ = false;
         if(ec) {
+            _this->recv_active_ = false;
             _this->OnError(ec);
             return;
         }
         _this->OnReceived(bytes_transferred);
+    };
+    receiving_ = true;
+    if(wsocket_context_.ReceivingDirect() && !recv_limit_.Enabled()) {
+        // the rest of a large payload, read into the application's buffer in one operation;
+        // a rate limited connection keeps reading in chunks so the limiter can pace it
+        asio::async_read(socket_, asio::buffer(buf.buf, buf.size), std::move(handler));
+        return;
+    }
+    socket_.async_receive(asio::buffer(buf.buf, buf.size), std::move(handler));
+}
+
+template <typename Protocol>
+void WSocketBase<Protocol>::WaitRecv() {
+    receiving_ = true;
+    socket_.async_wait(socket_type::wait_read, [_this = this->shared_from_this()](std::error_code ec) {
+        _this->receiving_ = false;
+        if(ec) {
+            _this->recv_active_ = false;
+            _this->OnError(ec);
+            return;
+        }
+        _this->ReadReady();
     });
 }
 
+template <typename Protocol>
+void WSocketBase<Protocol>::ReadReady() {
+    // the socket is non-blocking, read what is there straight away
+    for(int reads = 0; reads < IDLE_READS_PER_WAKEUP; ++reads) {
+        auto             buf = wsocket_context_.PrepareWrite();
+        asio::error_code ec;
+        auto             len = socket_.receive(asio::buffer(buf.buf, buf.size), 0, ec);
+        if(ec == asio::error::would_block || ec == asio::error::try_again) {
+            // drained, the buffer goes back and we wait again
+            break;
+        }
+        if(ec) {
+            this->wsocket_context_.ReleaseReceiveBuffer();
+            recv_active_ = false;
+            this->OnError(ec);
+            return;
+        }
+        if(!this->Consume(len)) {
+            return;
+        }
+    }
+    this->StartRecv();
+}
+
+template <typename Protocol>
+void WSocketBase<Protocol>::ThrottleRecv(RateLimiter::Clock::duration delay) {
+    recv_throttled_ = true;
+
+    auto _this = this->shared_from_this();
+    recv_throttle_timer_.expires_after(delay);
+    recv_throttle_timer_.async_wait([_this](std::error_code ec) {
+        _this->recv_throttled_ = false;
+        if(_this->recv_active_ && !_this->recv_paused_ && !_this->receiving_) {
+            _this->StartRecv();
+        }
+    });
+}
+
+template <typename Protocol>
+void WSocketBase<Protocol>::ArmFlushWindow() {
+    if(flush_window_.count() <= 0 || flush_armed_) {
+        return;
+    }
+    flush_armed_ = true;
+    wsocket_context_.Cork();
+
+    auto _this = this->shared_from_this();
+    flush_timer_.expires_after(flush_window_);
+    flush_timer_.async_wait([_this](std::error_code ec) {
+        // also on cancel, the cork must be balanced
+        _this->flush_armed_ = false;
+        _this->wsocket_context_.Uncork();
+        if(!ec) {
+            // conflated messages refused while the corked bytes held the queue at the watermark
+            _this->FlushConflated();
+        }
+    });
+}
+
+template <typename Protocol>
+void WSocketBase<Protocol>::Write(const Buffer &buffer) {
+    bool over_budget = false;
+    if(send_limit_.Enabled()) {
+        auto messages = this->wsocket_context_.MessagesSent() - send_messages_charged_;
+        send_messages_charged_ += messages;
+        over_budget = send_limit_.Charge(messages, buffer.size).count() > 0;
+    }
+
+    size_t sent = 0;
+    if(!writing_ && !send_throttled_ && !over_budget && segments_.empty()) {
+        // nothing queued, the kernel takes what fits without blocking
+        asio::error_code ec;
+        sent = socket_.send(asio::buffer(buffer.buf, buffer.size), 0, ec);
+        if(ec && ec != asio::error::would_block && ec != asio::error::try_again) {
+            this->OnError(ec);
+            return;
+        }
+    }
+    if(sent < buffer.size) {
+        send_queue_.insert(send_queue_.end(), buffer.buf + sent, buffer.buf + buffer.size);
+        this->FlushSendQueue();
+    }
+    this->CheckWatermarks();
+}
+
+template <typename Protocol>
+void WSocketBase<Protocol>::FlushSendQueue() {
+    if(writing_ || send_throttled_ || (send_queue_.empty() && segments_.empty())) {
+        return;
+    }
+    auto delay = send_limit_.Enabled() ? send_limit_.Delay() : RateLimiter::Clock::duration{};
+    if(delay.count() <= 0) {
+        this->StartWrite();
+        return;
+    }
+
+    // over budget, the queue keeps growing (and conflating) until the budget refills
+    send_throttled_ = true;
+    auto _this      = this->shared_from_this();
+    send_throttle_timer_.expires_after(delay);
+    send_throttle_timer_.async_wait([_this](std::error_code ec) {
+        _this->send_throttled_ = false;
+        _this->ContinueWrite();
+    });
+}
+
+template <typename Protocol>
+void WSocketBase<Protocol>::StartWrite() {
+#ifdef __linux__
+    if(!segments_.empty()) {
+        if(auto ahead = segments_.front().queue_pos) {
+            // MSG_MORE lets the frame header share a packet with the payload, written on its
+            // own it would wait for the peer's delayed ACK under Nagle's algorithm
+            auto len = ::send(socket_.native_handle(), send_queue_.data(), ahead, MSG_MORE | MSG_NOSIGNAL);
+            if(len > 0) {
+                this->PopQueued(size_t(len));
+            }
+        }
+        if(segments_.front().queue_pos == 0) {
+            this->WriteSegment();
+            return;
+        }
+    }
+#endif
+
+    // frames sent meanwhile gather in send_queue_ for the next write
+    writing_ = true;
+    if(segments_.empty()) {
+        send_inflight_.swap(send_queue_);
+    } else {
+        // only what goes ahead of the next segment
+        auto ahead = segments_.front().queue_pos;
+        send_inflight_.assign(send_queue_.begin(), send_queue_.begin() + ahead);
+        this->PopQueued(ahead);
+    }
+
+    auto _this = this->shared_from_this();
+    asio::async_write(socket_, asio::buffer(send_inflight_), [_this](std::error_code ec, std::size_t) {
+        _this->writing_ = false;
+        _this->send_inflight_.clear();
+        if(ec) {
+            _this->FailWrite(ec);
+            return;
+        }
+        _this->ContinueWrite();
+    });
+}
+
+template <typename Protocol>
+void WSocketBase<Protocol>::PopQueued(size_t len) {
+    send_queue_.erase(send_queue_.begin(), send_queue_.begin() + len);
+    for(auto &segment : segments_) {
+        segment.queue_pos -= len;
+    }
+}
+
+template <typename Protocol>
+void WSocketBase<Protocol>::FailWrite(std::error_code ec) {
+    send_queue_.clear();
+    this->ClearSegments();
+    this->OnError(ec);
+}
+
+template <typename Protocol>
+void WSocketBase<Protocol>::ClearSegments() {
+#ifdef __linux__
+    for(auto &segment : segments_) {
+        if(segment.close_fd) {
+            ::close(segment.fd);
+        }
+    }
+#endif
+    segments_.clear();
+    segment_bytes_ = 0;
+}
+
+template <typename Protocol>
+bool WSocketBase<Protocol>::Send(MessageHandle message) {
+    if(!message) {
+        return false;
+    }
+#ifdef __linux__
+    if(zerocopy_ && message.IsBinary() && message.Size() >= zerocopy_threshold_) {
+        if(this->WouldBlock()) {
+            return false;
+        }
+        Segment segment;
+        segment.length = message.Size();
+        segment.buffer = std::move(message);
+        bool finish    = segment.buffer.Finished();
+        if(!this->QueueSegment(std::move(segment), finish)) {
+            return false;
+        }
+        this->FlushSendQueue();
+        return true;
+    }
+#endif
+    if(message.IsBinary()) {
+        return this->Binary(message.GetBuffer(), message.Finished());
+    }
+    return this->Text(message.Text(), message.Finished());
+}
+
+template <typename Protocol>
+bool WSocketBase<Protocol>::QueueSegment(Segment &&segment, bool finish) {
+    FrameHeader header;
+    header.Length(segment.length);
+
+    // corked frames go first
+    this->wsocket_context_.Flush();
+
+    // queued first, so Write puts the header in the queue instead of sending it on its own
+    auto length       = segment.length;
+    segment.queue_pos = send_queue_.size() + header.HeaderLength();
+    segments_.push_back(std::move(segment));
+    segment_bytes_ += length;
+    if(!this->wsocket_context_.SendBinaryHeader(length, finish)) {
+        segment_bytes_ -= length;
+        segments_.pop_back();
+        return false;
+    }
+    return true;
+}
+
+#ifdef __linux__
+template <typename Protocol>
+bool WSocketBase<Protocol>::SendFile(int fd, uint64_t offset, uint64_t length) {
+    if(length == 0 || this->WouldBlock()) {
+        return false;
+    }
+    int file_fd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if(file_fd < 0) {
+        return false;
+    }
+
+    uint64_t fragment = file_fragment_size_ > 0 ? file_fragment_size_ : length;
+    for(uint64_t done = 0; done < length;) {
+        Segment segment;
+        segment.fd       = file_fd;
+        segment.offset   = offset + done;
+        segment.length   = std::min(fragment, length - done);
+        segment.close_fd = done + segment.length == length;
+        done += segment.length;
+        if(!this->QueueSegment(std::move(segment), done == length)) {
+            // the connection is not open, the last fragment would have closed the file
+            ::close(file_fd);
+            return false;
+        }
+    }
+    this->FlushSendQueue();
+    return true;
+}
+
+template <typename Protocol>
+void WSocketBase<Protocol>::WriteSegment() {
+    // bytes per sendfile call, below its 2 GiB limit; Start made the socket non-blocking
+    constexpr uint64_t SENDFILE_CHUNK = 1 << 30;
+
+    writing_      = true;
+    auto &segment = segments_.front();
+    bool  copy    = !zerocopy_; // a plain send
+    while(segment.length > 0) {
+        ssize_t len = 0;
+        if(segment.buffer) {
+            int flags = MSG_NOSIGNAL | (copy ? 0 : MSG_ZEROCOPY);
+            len = ::send(socket_.native_handle(), segment.buffer.Data() + segment.offset, segment.length, flags);
+            if(len > 0 && !copy) {
+                zerocopy_sends_++;
+            }
+        } else {
+            auto offset = off_t(segment.offset);
+            len = ::sendfile(socket_.native_handle(), segment.fd, &offset, std::min(segment.length, SENDFILE_CHUNK));
+        }
+        if(len > 0) {
+            segment.offset += len;
+            segment.length -= len;
+            segment_bytes_ -= size_t(len);
+            copy = !zerocopy_;
+            if(send_limit_.Enabled()) {
+                send_limit_.Charge(0, len);
+            }
+            continue;
+        }
+        if(len < 0 && errno == EINTR) {
+            continue;
+        }
+        if(len < 0 && errno == ENOBUFS && segment.buffer && !copy) {
+            // out of optmem for notifications, send this part normally
+            copy = true;
+            continue;
+        }
+        if(len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // the socket buffer is full, go on once it drains
+            socket_.async_wait(socket_type::wait_write, [_this = this->shared_from_this()](std::error_code ec) {
+                if(ec) {
+                    _this->writing_ = false;
+                    _this->FailWrite(ec);
+                    return;
+                }
+                _this->WriteSegment();
+            });
+            return;
+        }
+        // an error, or a file shorter than announced: the frame cannot be completed
+        writing_ = false;
+        auto ec  = len < 0 ? std::error_code(errno, std::system_category()) : std::make_error_code(std::errc::io_error);
+        this->FailWrite(ec);
+        asio::error_code ignore_ec;
+        std::ignore = socket_.shutdown(socket_type::shutdown_both, ignore_ec);
+        return;
+    }
+
+    if(segment.close_fd) {
+        ::close(segment.fd);
+    }
+    if(segment.buffer) {
+        // held until the kernel reports its last send complete
+        zerocopy_pending_.emplace_back(uint32_t(zerocopy_sends_ - 1), std::move(segment.buffer));
+    }
+    segments_.pop_front();
+    writing_ = false;
+    if(!zerocopy_pending_.empty()) {
+        this->ReapZeroCopy();
+    }
+    this->ContinueWrite();
+}
+
+template <typename Protocol>
+void WSocketBase<Protocol>::ApplyZeroCopy() {
+    if(zerocopy_threshold_ == 0) {
+        // SO_ZEROCOPY may stay set, it has no effect without MSG_ZEROCOPY
+        zerocopy_ = false;
+        return;
+    }
+    int one   = 1;
+    zerocopy_ = ::setsockopt(socket_.native_handle(), SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+}
+
+template <typename Protocol>
+void WSocketBase<Protocol>::ReapZeroCopy() {
+    if(this->ReadZeroCopyCompletions() || zerocopy_waiting_) {
+        return;
+    }
+    // notifications raise EPOLLERR; the wait does not keep the connection alive,
+    // the destructor deals with whatever is still pending
+    zerocopy_waiting_ = true;
+    socket_.async_wait(socket_type::wait_error, [weak = this->weak_from_this()](std::error_code ec) {
+        auto _this = weak.lock();
+        if(!_this) {
+            return;
+        }
+        _this->zerocopy_waiting_ = false;
+        if(!ec) {
+            _this->ReapZeroCopy();
+        }
+    });
+}
+
+template <typename Protocol>
+bool WSocketBase<Protocol>::ReadZeroCopyCompletions() {
+    while(true) {
+        while(!zerocopy_pending_.empty() && int32_t(zerocopy_pending_.front().first - zerocopy_done_) < 0) {
+            zerocopy_pending_.pop_front();
+        }
+        if(zerocopy_pending_.empty()) {
+            return true;
+        }
+
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(sock_extended_err)) * 2];
+        msghdr                msg{};
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+        if(::recvmsg(socket_.native_handle(), &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            return false;
+        }
+        for(auto *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if(!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+               !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            sock_extended_err err;
+            memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            if(err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            // sends ee_info to ee_data are complete, TCP completes them in order
+            if(err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                // the route copies anyway, zero-copy only adds the notification cost from here on
+                zerocopy_copied_ += err.ee_data - err.ee_info + 1;
+                zerocopy_ = false;
+            }
+            zerocopy_done_ = err.ee_data + 1;
+        }
+    }
+}
+#endif
+
+template <typename Protocol>
+void WSocketBase<Protocol>::ContinueWrite() {
+    if(!send_queue_.empty() || !segments_.empty()) {
+        this->FlushSendQueue();
+    } else if(shutdown_pending_) {
+        this->ShutdownAfterWrite();
+    } else {
+        this->FlushConflated();
+    }
+    this->CheckWatermarks();
+}
+
+template <typename Protocol>
+void WSocketBase<Protocol>::ShutdownAfterWrite() {
+    if(writing_ || send_throttled_) {
+        shutdown_pending_ = true;
+        return;
+    }
+    shutdown_pending_ = false;
+    asio::error_code ignore_ec;
+    std::ignore = socket_.shutdown(socket_type::shutdown_both, ignore_ec);
+}
+
+template <typename Protocol>
+void WSocketBase<Protocol>::CheckWatermarks() {
+    auto queued = this->SendQueueSize();
+    if(!send_queue_high_ && queued >= send_high_watermark_) {
+        send_queue_high_ = true;
+        this->OnSendQueueHigh(queued);
+    } else if(send_queue_high_ && queued <= send_low_watermark_) {
+        send_queue_high_ = false;
+        this->OnWritable();
+    }
+}
+
+template <typename Protocol>
+void WSocketBase<Protocol>::Conflate(std::string_view           key,
+                                     const uint8_t             *data,
+                                     size_t                     size,
+                                     bool                       binary,
+                                     std::chrono::microseconds ttl) {
+    if(this->wsocket_context_.IsClosed()) {
+        return;
+    }
+    if(!writing_ && !send_throttled_ && conflation_.Empty()) {
+        // the connection keeps up, nothing to conflate against
+        bool sent = binary ? this->Binary({const_cast<uint8_t *>(data), size})
+                           : this->Text({reinterpret_cast<const char *>(data), size});
+        if(sent) {
+            return;
+        }
+        // refused at the high watermark, e.g. by bytes corked in the flush window
+    }
+    conflation_.Push(key, data, size, binary, ttl);
+}
+
+template <typename Protocol>
+void WSocketBase<Protocol>::FlushConflated() {
+    // a few messages per write, stop as soon as the kernel pushes back so the rest can still conflate
+    constexpr int MESSAGES_PER_WRITE = 16;
+
+    if(!this->wsocket_context_.IsConnected()) {
+        // nothing may follow the close frame, before the handshake they wait for the next write
+        if(this->wsocket_context_.IsClosed()) {
+            conflation_.Clear();
+        }
+        return;
+    }
+
+    auto now = ConflationQueue::Clock::now();
+    while(!writing_ && !send_throttled_ && !conflation_.Empty()) {
+        auto batch = this->Batch();
+        for(int i = 0; i < MESSAGES_PER_WRITE; ++i) {
+            auto *message = conflation_.Pop(now);
+            if(!message) {
+                break;
+            }
+            if(message->binary) {
+                this->wsocket_context_.SendBinary(
+                        {reinterpret_cast<uint8_t *>(const_cast<char *>(message->data.data())), message->data.size()});
+            } else {
+                this->wsocket_context_.SendText(message->data);
+            }
+        }
+    }
+}
+
+template <typename Protocol>
+void WSocketBase<Protocol>::Post(typename PostedFrame::Type type, const void *data, size_t size, CloseCode code) {
+    // from the producer's pool, freed on the io thread through the pool's return queue
+    auto *frame = new(BufferPool::Allocate(sizeof(PostedFrame) + size)) PostedFrame();
+    frame->size = size;
+    frame->type = type;
+    frame->code = code;
+    if(size > 0) {
+        std::memcpy(frame->Data(), data, size);
+    }
+
+    // only the push onto an empty queue wakes the io thread, later ones ride along
+    if(posted_.Push(frame)) {
+        asio::post(socket_.get_executor(), [_this = this->shared_from_this()]() { _this->DrainPosted(); });
+    }
+}
+
+template <typename Protocol>
+void WSocketBase<Protocol>::DrainPosted() {
+    auto *frame = posted_.Drain();
+    if(!this->wsocket_context_.IsConnected()) {
+        // posted before the connection was up or after it closed, nothing may be sent
+        this->FreePosted(frame);
+        return;
+    }
+
+    this->ArmFlushWindow();
+    auto batch = this->Batch();
+    // frames posted behind a PostClose are dropped with it
+    for(auto *it = frame; it && this->wsocket_context_.IsConnected(); it = it->next) {
+        switch(it->type) {
+        case PostedFrame::Text:
+            this->wsocket_context_.SendText({reinterpret_cast<const char *>(it->Data()), it->size});
+            break;
+        case PostedFrame::Binary:
+            this->wsocket_context_.SendBinary({it->Data(), it->size});
+            break;
+        case PostedFrame::Close:
+            this->Close(it->code);
+            break;
+        }
+    }
+    this->FreePosted(frame);
+}
+
+template <typename Protocol>
+void WSocketBase<Protocol>::FreePosted(PostedFrame *frame) {
+    while(frame) {
+        auto *next = frame->next;
+        frame->~PostedFrame();
+        BufferPool::Free(frame);
+        frame = next;
+    }
+}
+
 } // namespace wsocket
 
 #endif
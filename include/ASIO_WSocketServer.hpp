@@ -0,0 +1,375 @@
+#pragma once
+#ifndef WSOCKET__ASIO_WSOCKET_SERVER_HPP
+#define WSOCKET__ASIO_WSOCKET_SERVER_HPP
+
+#ifdef WITH_ASIO
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <asio.hpp>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "ASIO_WSocket.hpp"
+
+namespace wsocket {
+
+struct WSocketServerOptions {
+    size_t           threads     = 0;     // 0: one per CPU the process may run on
+    bool             pin_threads = false; // bind worker i to cpus[i % cpus.size()], Linux only
+    int              numa_node   = -1;    // only use this node's CPUs (e.g. the NIC's), -1 for all
+    std::vector<int> cpus;                // explicit CPU list, overrides numa_node
+    bool             reuse_port  = true;  // one SO_REUSEPORT acceptor per worker where supported
+    int              backlog     = asio::socket_base::max_listen_connections;
+    RateLimit        recv_limit;          // budget shared by all connections, unlimited by default
+    RateLimit        send_limit;          // budget shared by all connections, unlimited by default
+};
+
+/**
+ * Multi-threaded WSocket server, one io_context per worker thread
+ *
+ * With SO_REUSEPORT (TCP on Linux and the BSDs) every worker listens on its
+ * own acceptor and the kernel spreads connections across them, otherwise
+ * worker 0 accepts and hands each socket to the workers round-robin. An
+ * accepted socket belongs to its worker's io_context for its whole life and
+ * needs no strand, nothing crosses threads after the accept.
+ *
+ * A worker pins itself (if asked) before creating its io_context, acceptor
+ * and sessions, so their memory is first touched on the worker's NUMA node.
+ *
+ * The recv and send limits of the options are budgets for the whole server,
+ * every session is charged against them on top of its own limits.
+ */
+template <typename Protocol>
+class WSocketServer {
+public:
+    using socket_type   = typename Protocol::socket;
+    using acceptor_type = typename Protocol::acceptor;
+    using endpoint_type = typename Protocol::endpoint;
+    using session_type  = WSocketBase<Protocol>;
+
+    /**
+     * Creates the session for an accepted socket on the worker's thread, the server calls Start on it
+     * @param worker Index of the worker owning the socket
+     * @param socket Accepted socket, bound to that worker's io_context; return nullptr to drop it
+     */
+    using Factory = std::function<std::shared_ptr<session_type>(size_t worker, socket_type &&socket)>;
+
+    WSocketServer(Factory factory, WSocketServerOptions options);
+    explicit WSocketServer(Factory factory) : WSocketServer(std::move(factory), WSocketServerOptions()) {}
+    ~WSocketServer() { this->Stop(); }
+
+    WSocketServer(const WSocketServer &)            = delete;
+    WSocketServer &operator=(const WSocketServer &) = delete;
+
+    /**
+     * Bind, listen and start the workers, returns once every worker is accepting
+     * @param endpoint Listen address, port 0 picks one port shared by all acceptors
+     */
+    std::error_code Start(const endpoint_type &endpoint);
+
+    // Close the acceptors, stop every io_context and join the workers, sessions are destroyed on their worker
+    void Stop();
+
+    size_t            Workers() const { return workers_.size(); }
+    asio::io_context &Context(size_t worker) { return *workers_[worker]->io_context; }
+    int               Cpu(size_t worker) const { return workers_[worker]->cpu; }
+    endpoint_type     LocalEndpoint() const { return local_endpoint_; }
+
+    // CPUs this process may run on, narrowed to `numa_node` when it is not -1
+    static std::vector<int> AvailableCpus(int numa_node = -1);
+
+private:
+    struct Worker {
+        size_t            index      = 0;
+        int               cpu        = -1;
+        asio::io_context *io_context = nullptr; // lives on the worker's stack
+        acceptor_type    *acceptor   = nullptr; // null for workers fed by worker 0
+        std::thread       thread;
+    };
+
+    void Run(Worker &worker, endpoint_type endpoint, bool listen, std::promise<std::error_code> &ready);
+    std::error_code Listen(acceptor_type &acceptor, const endpoint_type &endpoint);
+    void            Accept(Worker &worker);
+    void            Launch(size_t worker, socket_type &&socket);
+
+    static bool SupportsReusePort() {
+#ifdef SO_REUSEPORT
+        return std::is_same_v<Protocol, asio::ip::tcp>;
+#else
+        return false;
+#endif
+    }
+    static void             PinThread(int cpu);
+    static std::vector<int> ParseCpuList(const std::string &list);
+
+private:
+    Factory              factory_;
+    WSocketServerOptions options_;
+    bool                 reuse_port_ = false;
+    endpoint_type        local_endpoint_;
+    size_t               next_worker_ = 0; // round-robin target, touched by worker 0 only
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+
+    std::shared_ptr<RateLimiter> recv_limiter_; // null when unlimited
+    std::shared_ptr<RateLimiter> send_limiter_;
+};
+
+template <typename Protocol>
+WSocketServer<Protocol>::WSocketServer(Factory factory, WSocketServerOptions options) :
+    factory_(std::move(factory)), options_(std::move(options)) {
+    auto recv_limiter = std::make_shared<RateLimiter>(options_.recv_limit);
+    if(recv_limiter->Enabled()) {
+        recv_limiter_ = std::move(recv_limiter);
+    }
+    auto send_limiter = std::make_shared<RateLimiter>(options_.send_limit);
+    if(send_limiter->Enabled()) {
+        send_limiter_ = std::move(send_limiter);
+    }
+}
+
+template <typename Protocol>
+std::error_code WSocketServer<Protocol>::Start(const endpoint_type &endpoint) {
+    auto cpus = options_.cpus.empty() ? AvailableCpus(options_.numa_node) : options_.cpus;
+    if(cpus.empty()) {
+        return std::make_error_code(std::errc::invalid_argument);
+    }
+    size_t threads = options_.threads != 0 ? options_.threads : cpus.size();
+    reuse_port_    = options_.reuse_port && SupportsReusePort();
+
+    // start workers one by one, the first bind resolves port 0 for the rest
+    local_endpoint_ = endpoint;
+    for(size_t i = 0; i < threads; ++i) {
+        auto worker   = std::make_unique<Worker>();
+        worker->index = i;
+        worker->cpu   = options_.pin_threads ? cpus[i % cpus.size()] : -1;
+
+        std::promise<std::error_code> ready;
+        auto                          started = ready.get_future();
+        bool                          listen  = i == 0 || reuse_port_;
+        worker->thread = std::thread([this, w = worker.get(), bind = local_endpoint_, listen, &ready]() {
+            this->Run(*w, bind, listen, ready);
+        });
+        workers_.push_back(std::move(worker));
+
+        if(auto ec = started.get()) {
+            this->Stop();
+            return ec;
+        }
+        if(i == 0) {
+            local_endpoint_ = workers_[0]->acceptor->local_endpoint();
+        }
+    }
+
+    // accept only once every worker's io_context exists
+    for(auto &worker : workers_) {
+        if(worker->acceptor) {
+            asio::post(*worker->io_context, [this, w = worker.get()]() { this->Accept(*w); });
+        }
+    }
+    return {};
+}
+
+template <typename Protocol>
+void WSocketServer<Protocol>::Stop() {
+    for(auto &worker : workers_) {
+        if(worker->io_context) {
+            worker->io_context->stop();
+        }
+    }
+    for(auto &worker : workers_) {
+        if(worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+    workers_.clear();
+}
+
+template <typename Protocol>
+void WSocketServer<Protocol>::Run(Worker                        &worker,
+                                  endpoint_type                  endpoint,
+                                  bool                           listen,
+                                  std::promise<std::error_code> &ready) {
+    if(worker.cpu >= 0) {
+        PinThread(worker.cpu);
+    }
+
+    // concurrency hint 1: only this thread runs the context, asio can skip its locking
+    asio::io_context             io_context(1);
+    std::optional<acceptor_type> acceptor;
+    if(listen) {
+        acceptor.emplace(io_context);
+        if(auto ec = this->Listen(*acceptor, endpoint)) {
+            ready.set_value(ec);
+            return;
+        }
+        worker.acceptor = &*acceptor;
+    }
+
+    auto guard        = asio::make_work_guard(io_context);
+    worker.io_context = &io_context;
+    ready.set_value({});
+    io_context.run();
+
+    // the sessions still queued in handlers go away here, on their own thread
+    worker.acceptor = nullptr;
+}
+
+template <typename Protocol>
+std::error_code WSocketServer<Protocol>::Listen(acceptor_type &acceptor, const endpoint_type &endpoint) {
+    asio::error_code ec;
+    std::ignore = acceptor.open(endpoint.protocol(), ec);
+    if(ec) {
+        return ec;
+    }
+    if constexpr(std::is_same_v<Protocol, asio::ip::tcp>) {
+        std::ignore = acceptor.set_option(asio::socket_base::reuse_address(true), ec);
+#ifdef SO_REUSEPORT
+        if(reuse_port_) {
+            using reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+            std::ignore      = acceptor.set_option(reuse_port(true), ec);
+            if(ec) {
+                return ec;
+            }
+        }
+#endif
+    }
+    std::ignore = acceptor.bind(endpoint, ec);
+    if(ec) {
+        return ec;
+    }
+    std::ignore = acceptor.listen(options_.backlog, ec);
+    return ec;
+}
+
+template <typename Protocol>
+void WSocketServer<Protocol>::Accept(Worker &worker) {
+    if(reuse_port_) {
+        worker.acceptor->async_accept([this, &worker](std::error_code ec, socket_type peer) {
+            if(ec == asio::error::operation_aborted) {
+                return;
+            }
+            if(!ec) {
+                this->Launch(worker.index, std::move(peer));
+            }
+            this->Accept(worker);
+        });
+        return;
+    }
+
+    // shared acceptor: accept straight onto the target worker's io_context
+    auto &target = *workers_[next_worker_];
+    next_worker_ = (next_worker_ + 1) % workers_.size();
+    worker.acceptor->async_accept(*target.io_context, [this, &worker, &target](std::error_code ec, socket_type peer) {
+        if(ec == asio::error::operation_aborted) {
+            return;
+        }
+        if(!ec) {
+            asio::post(*target.io_context, [this, &target, peer = std::move(peer)]() mutable {
+                this->Launch(target.index, std::move(peer));
+            });
+        }
+        this->Accept(worker);
+    });
+}
+
+template <typename Protocol>
+void WSocketServer<Protocol>::Launch(size_t worker, socket_type &&socket) {
+    if(auto session = factory_(worker, std::move(socket))) {
+        if(recv_limiter_ || send_limiter_) {
+            session->SetSharedRateLimits(recv_limiter_, send_limiter_);
+        }
+        session->Start();
+    }
+}
+
+template <typename Protocol>
+std::vector<int> WSocketServer<Protocol>::AvailableCpus(int numa_node) {
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(::sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if(CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    if(numa_node >= 0) {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(numa_node) + "/cpulist");
+        std::string   list;
+        std::getline(file, list);
+        auto node_cpus = ParseCpuList(list);
+        cpus.erase(std::remove_if(cpus.begin(),
+                                  cpus.end(),
+                                  [&](int cpu) {
+                                      return std::find(node_cpus.begin(), node_cpus.end(), cpu) == node_cpus.end();
+                                  }),
+                   cpus.end());
+    }
+#endif
+    if(cpus.empty() && numa_node < 0) {
+        for(unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu) {
+            cpus.push_back(int(cpu));
+        }
+    }
+    return cpus;
+}
+
+template <typename Protocol>
+std::vector<int> WSocketServer<Protocol>::ParseCpuList(const std::string &list) {
+    // "0-3,8-11"
+    std::vector<int> cpus;
+    size_t           pos = 0;
+    while(pos < list.size()) {
+        auto end   = std::min(list.find(',', pos), list.size());
+        auto range = list.substr(pos, end - pos);
+        auto dash  = range.find('-');
+        try {
+            int first = std::stoi(range.substr(0, dash));
+            int last  = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for(int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        } catch(const std::exception &) {
+            // malformed entry, skip
+        }
+        pos = end + 1;
+    }
+    return cpus;
+}
+
+template <typename Protocol>
+void WSocketServer<Protocol>::PinThread(int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+#endif
+}
+
+using TcpWSocketServer = WSocketServer<asio::ip::tcp>;
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+using UnixWSocketServer = WSocketServer<asio::local::stream_protocol>;
+#endif
+
+} // namespace wsocket
+
+#endif // WITH_ASIO
+
+#endif // WSOCKET__ASIO_WSOCKET_SERVER_HPP
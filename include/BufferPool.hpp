@@ -0,0 +1,269 @@
+#pragma once
+#ifndef WSOCKET__BUFFER_POOL_HPP
+#define WSOCKET__BUFFER_POOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "MpscQueue.hpp"
+
+namespace wsocket {
+
+struct BufferPoolStats {
+    uint64_t allocations  = 0; // Allocate calls on this thread
+    uint64_t hits         = 0; // served from the cache
+    uint64_t oversized    = 0; // above the largest size class, straight from operator new
+    uint64_t remote_frees = 0; // blocks freed on other threads and returned here
+    size_t   cached_bytes = 0; // held in the free lists
+};
+
+/**
+ * Per-thread size-class buffer pool
+ *
+ * Sizes are rounded up to a power of two between 64 bytes and 1 MiB, larger
+ * buffers bypass the pool. Every block records its owning pool: a block
+ * freed on the owner thread goes straight back onto its free list, one freed
+ * on another thread is pushed onto the owner's lock-free return queue and
+ * picked up by the owner's next allocation. The io threads therefore never
+ * share an allocator lock in steady state.
+ *
+ * A pool outlives its thread: on thread exit it drops its cache and is
+ * handed to the next thread that starts allocating, so blocks still in
+ * flight always have a live pool to return to.
+ */
+class BufferPool {
+public:
+    static constexpr size_t MIN_CLASS_SHIFT          = 6;  // 64 bytes
+    static constexpr size_t MAX_CLASS_SHIFT          = 20; // 1 MiB
+    static constexpr size_t CLASSES                  = MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1;
+    static constexpr size_t MAX_CACHED_BYTES_DEFAULT = 16 * 1024 * 1024;
+
+    /**
+     * Allocate at least `size` bytes from the calling thread's pool, 16-byte aligned
+     * @param capacity Receives the usable size of the block, may be null
+     */
+    static void *Allocate(size_t size, size_t *capacity = nullptr);
+
+    // Free a block from Allocate, on any thread
+    static void Free(void *data);
+
+    // Usable size of a block from Allocate
+    static size_t Capacity(const void *data) { return Header(data)->capacity; }
+
+    // The calling thread's pool, null while its thread is exiting
+    static BufferPool *Local();
+
+    struct Deleter {
+        void operator()(uint8_t *data) const { BufferPool::Free(data); }
+    };
+    using Ptr = std::unique_ptr<uint8_t[], Deleter>;
+
+    // Allocate as an owning pointer, see Allocate
+    static Ptr Make(size_t size, size_t *capacity = nullptr) {
+        return Ptr(static_cast<uint8_t *>(Allocate(size, capacity)));
+    }
+
+    BufferPool(const BufferPool &)            = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    // Free blocks kept beyond this are released to the system
+    void SetMaxCachedBytes(size_t max_cached_bytes) { max_cached_bytes_ = max_cached_bytes; }
+
+    const BufferPoolStats &Stats() const { return stats_; }
+
+private:
+    struct alignas(16) BlockHeader {
+        BlockHeader *next       = nullptr; // free list or return queue
+        BufferPool  *owner      = nullptr; // null for oversized blocks
+        size_t       capacity   = 0;
+        uint32_t     size_class = 0;
+    };
+
+    BufferPool() = default;
+
+    static BlockHeader *Header(const void *data) {
+        return const_cast<BlockHeader *>(reinterpret_cast<const BlockHeader *>(data) - 1);
+    }
+    static size_t ClassOf(size_t size) {
+        size_t shift = MIN_CLASS_SHIFT;
+        while((size_t(1) << shift) < size) {
+            shift++;
+        }
+        return shift - MIN_CLASS_SHIFT;
+    }
+    static BlockHeader *NewBlock(size_t capacity) {
+        return new(::operator new(sizeof(BlockHeader) + capacity)) BlockHeader();
+    }
+    static void DeleteBlock(BlockHeader *block) {
+        block->~BlockHeader();
+        ::operator delete(block);
+    }
+
+    void *Take(size_t size, size_t *capacity);
+    void  Recycle(BlockHeader *block);
+    void  DrainReturned();
+    void  Retire();
+
+    // Pools of exited threads, waiting for a new thread
+    static std::vector<BufferPool *> &Retired(std::unique_lock<std::mutex> &lock);
+
+    struct LocalSlot {
+        BufferPool *pool   = nullptr;
+        bool        exited = false;
+    };
+    static LocalSlot &Slot() {
+        thread_local LocalSlot slot;
+        return slot;
+    }
+
+    // Adopts a pool for the thread on construction, retires it on thread exit
+    struct LocalHolder {
+        LocalHolder();
+        ~LocalHolder();
+    };
+
+private:
+    BlockHeader           *free_[CLASSES] = {};
+    MpscQueue<BlockHeader> returned_;
+    size_t                 max_cached_bytes_ = MAX_CACHED_BYTES_DEFAULT;
+    BufferPoolStats        stats_;
+};
+
+void *BufferPool::Allocate(size_t size, size_t *capacity) {
+    if(auto *pool = Local()) {
+        return pool->Take(size, capacity);
+    }
+    // thread exiting, unpooled
+    auto *block     = NewBlock(size);
+    block->capacity = size;
+    if(capacity) {
+        *capacity = size;
+    }
+    return block + 1;
+}
+
+void BufferPool::Free(void *data) {
+    if(!data) {
+        return;
+    }
+    auto *block = Header(data);
+    if(!block->owner) {
+        DeleteBlock(block);
+    } else if(block->owner == Slot().pool) {
+        block->owner->Recycle(block);
+    } else {
+        block->owner->returned_.Push(block);
+    }
+}
+
+BufferPool *BufferPool::Local() {
+    auto &slot = Slot();
+    if(!slot.pool && !slot.exited) {
+        thread_local LocalHolder holder;
+    }
+    return slot.pool;
+}
+
+void *BufferPool::Take(size_t size, size_t *capacity) {
+    stats_.allocations++;
+
+    BlockHeader *block = nullptr;
+    if(size > (size_t(1) << MAX_CLASS_SHIFT)) {
+        stats_.oversized++;
+        block           = NewBlock(size);
+        block->capacity = size;
+    } else {
+        auto size_class = ClassOf(size);
+        if(!free_[size_class] && !returned_.Empty()) {
+            this->DrainReturned();
+        }
+        if((block = free_[size_class]) != nullptr) {
+            free_[size_class] = block->next;
+            stats_.hits++;
+            stats_.cached_bytes -= block->capacity;
+        } else {
+            block             = NewBlock(size_t(1) << (size_class + MIN_CLASS_SHIFT));
+            block->capacity   = size_t(1) << (size_class + MIN_CLASS_SHIFT);
+            block->size_class = uint32_t(size_class);
+            block->owner      = this;
+        }
+        block->next = nullptr;
+    }
+
+    if(capacity) {
+        *capacity = block->capacity;
+    }
+    return block + 1;
+}
+
+void BufferPool::Recycle(BlockHeader *block) {
+    if(stats_.cached_bytes + block->capacity > max_cached_bytes_) {
+        DeleteBlock(block);
+        return;
+    }
+    block->next              = free_[block->size_class];
+    free_[block->size_class] = block;
+    stats_.cached_bytes += block->capacity;
+}
+
+void BufferPool::DrainReturned() {
+    auto *block = returned_.Drain();
+    while(block) {
+        auto *next = block->next;
+        stats_.remote_frees++;
+        this->Recycle(block);
+        block = next;
+    }
+}
+
+void BufferPool::Retire() {
+    this->DrainReturned();
+    for(auto &head : free_) {
+        while(head) {
+            auto *next = head->next;
+            DeleteBlock(head);
+            head = next;
+        }
+    }
+    stats_ = {};
+}
+
+std::vector<BufferPool *> &BufferPool::Retired(std::unique_lock<std::mutex> &lock) {
+    // never destroyed, blocks may be freed during static destruction
+    static auto *mutex   = new std::mutex();
+    static auto *retired = new std::vector<BufferPool *>();
+    lock                 = std::unique_lock<std::mutex>(*mutex);
+    return *retired;
+}
+
+BufferPool::LocalHolder::LocalHolder() {
+    std::unique_lock<std::mutex> lock;
+    auto                        &retired = Retired(lock);
+    BufferPool                  *pool    = nullptr;
+    if(retired.empty()) {
+        pool = new BufferPool();
+    } else {
+        pool = retired.back();
+        retired.pop_back();
+    }
+    Slot().pool = pool;
+}
+
+BufferPool::LocalHolder::~LocalHolder() {
+    auto &slot = Slot();
+    auto *pool = slot.pool;
+    slot.pool   = nullptr;
+    slot.exited = true;
+    pool->Retire();
+
+    std::unique_lock<std::mutex> lock;
+    Retired(lock).push_back(pool);
+}
+
+} // namespace wsocket
+
+#endif // WSOCKET__BUFFER_POOL_HPP
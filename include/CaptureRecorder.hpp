@@ -0,0 +1,162 @@
+#pragma once
+#ifndef WSOCKET__CAPTURE_RECORDER_HPP
+#define WSOCKET__CAPTURE_RECORDER_HPP
+
+#ifndef _WIN32
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <tuple>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "SlidingBuffer.hpp"
+
+namespace wsocket {
+
+/**
+ * Capture file layout
+ *
+ * - 8 bytes magic "WSCAP001"
+ * - records until the end of the file, each record is one socket read:
+ *   - 4 bytes record length (host byte order)
+ *   - record bytes
+ *
+ * Keeping the read boundaries lets a replay reproduce the exact chunking the
+ * parser saw on the live connection.
+ */
+struct CaptureFormat {
+    static constexpr char   MAGIC[8]    = {'W', 'S', 'C', 'A', 'P', '0', '0', '1'};
+    static constexpr size_t HEADER_SIZE = sizeof(MAGIC);
+    static constexpr size_t RECORD_HEAD = sizeof(uint32_t);
+};
+
+/**
+ * Appends raw received bytes to an mmap-backed capture file
+ *
+ * The file is grown in `grow_size` steps and written through a shared
+ * mapping, so a record costs one memcpy and no syscall in the common case.
+ * On Close the file is truncated to the bytes actually written.
+ */
+class CaptureRecorder {
+public:
+    static constexpr size_t GROW_SIZE_DEFAULT = 64 * 1024 * 1024; // 64M
+
+    CaptureRecorder() = default;
+    ~CaptureRecorder() { Close(); }
+
+    CaptureRecorder(const CaptureRecorder &)            = delete;
+    CaptureRecorder &operator=(const CaptureRecorder &) = delete;
+
+    /**
+     * Create (or truncate) the capture file
+     * @param path Capture file path
+     * @param grow_size File growth step in bytes
+     */
+    bool Open(const std::string &path, size_t grow_size = GROW_SIZE_DEFAULT);
+
+    bool IsOpen() const { return fd_ >= 0; }
+
+    // Append one received chunk as a record
+    bool Append(const Buffer &buf);
+
+    // Bytes written so far, including the file header
+    size_t Size() const { return used_; }
+
+    void Close();
+
+private:
+    bool Reserve(size_t len);
+
+private:
+    int      fd_        = -1;
+    uint8_t *map_       = nullptr;
+    size_t   mapped_    = 0;
+    size_t   used_      = 0;
+    size_t   grow_size_ = GROW_SIZE_DEFAULT;
+};
+
+
+bool CaptureRecorder::Open(const std::string &path, size_t grow_size) {
+    Close();
+
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd_ < 0) {
+        return false;
+    }
+    grow_size_ = grow_size > 0 ? grow_size : GROW_SIZE_DEFAULT;
+
+    if(!Reserve(CaptureFormat::HEADER_SIZE)) {
+        Close();
+        return false;
+    }
+    std::memcpy(map_, CaptureFormat::MAGIC, CaptureFormat::HEADER_SIZE);
+    used_ = CaptureFormat::HEADER_SIZE;
+    return true;
+}
+
+bool CaptureRecorder::Append(const Buffer &buf) {
+    if(fd_ < 0 || buf.size == 0 || buf.size > UINT32_MAX) {
+        return false;
+    }
+    if(!Reserve(CaptureFormat::RECORD_HEAD + buf.size)) {
+        return false;
+    }
+
+    auto len = static_cast<uint32_t>(buf.size);
+    std::memcpy(map_ + used_, &len, CaptureFormat::RECORD_HEAD);
+    std::memcpy(map_ + used_ + CaptureFormat::RECORD_HEAD, buf.buf, buf.size);
+    used_ += CaptureFormat::RECORD_HEAD + buf.size;
+    return true;
+}
+
+void CaptureRecorder::Close() {
+    if(map_) {
+        ::munmap(map_, mapped_);
+        map_    = nullptr;
+        mapped_ = 0;
+    }
+    if(fd_ >= 0) {
+        std::ignore = ::ftruncate(fd_, static_cast<off_t>(used_));
+        ::close(fd_);
+        fd_ = -1;
+    }
+    used_ = 0;
+}
+
+bool CaptureRecorder::Reserve(size_t len) {
+    if(used_ + len <= mapped_) {
+        return true;
+    }
+
+    size_t want = mapped_ + grow_size_;
+    while(want < used_ + len) {
+        want += grow_size_;
+    }
+    if(::ftruncate(fd_, static_cast<off_t>(want)) != 0) {
+        return false;
+    }
+
+    if(map_) {
+        ::munmap(map_, mapped_);
+        map_    = nullptr;
+        mapped_ = 0;
+    }
+    void *map = ::mmap(nullptr, want, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if(map == MAP_FAILED) {
+        return false;
+    }
+    map_    = static_cast<uint8_t *>(map);
+    mapped_ = want;
+    return true;
+}
+
+} // namespace wsocket
+
+#endif // !_WIN32
+
+#endif // WSOCKET__CAPTURE_RECORDER_HPP
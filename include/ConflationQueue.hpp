@@ -0,0 +1,135 @@
+#pragma once
+#ifndef WSOCKET__CONFLATION_QUEUE_HPP
+#define WSOCKET__CONFLATION_QUEUE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace wsocket {
+
+/**
+ * Outbound message queue with latest-value conflation and expiry
+ *
+ * A keyed message replaces the unsent message with the same key in place,
+ * so the key keeps the position of its oldest unsent update and a slow
+ * consumer gets the newest value per key instead of a backlog. Messages
+ * with a TTL are dropped when popped after their deadline.
+ *
+ * Each key owns one node for good and unkeyed nodes are recycled, so the
+ * steady state allocates nothing and memory is bounded by the number of
+ * keys plus the unkeyed messages alive within their TTL.
+ */
+class ConflationQueue {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Message {
+        std::string       key;
+        std::string       data;
+        bool              binary   = false;
+        Clock::time_point deadline = Clock::time_point::max();
+        bool              queued   = false;
+    };
+
+    /**
+     * @param key Empty for a message that never conflates
+     * @param ttl Zero for no expiry
+     */
+    void Push(std::string_view key, const uint8_t *data, size_t size, bool binary, Clock::duration ttl);
+
+    // Oldest live message or nullptr, expired ones are dropped; valid until the next Push
+    const Message *Pop(Clock::time_point now = Clock::now());
+
+    // Drop every unsent message, the nodes are kept for reuse
+    void Clear();
+
+    bool   Empty() const { return pending_.empty(); }
+    size_t Size() const { return pending_.size(); }
+
+    uint64_t Replaced() const { return replaced_; }
+    uint64_t Expired() const { return expired_; }
+
+private:
+    using List = std::list<Message>;
+
+    List pending_; // send order
+    List idle_;    // keyed nodes with nothing queued
+    List spare_;   // recycled unkeyed nodes
+
+    std::unordered_map<std::string, List::iterator> index_; // key -> its node, in pending_ or idle_
+    std::string                                     lookup_;
+
+    uint64_t replaced_ = 0;
+    uint64_t expired_  = 0;
+};
+
+void ConflationQueue::Push(std::string_view key, const uint8_t *data, size_t size, bool binary, Clock::duration ttl) {
+    List::iterator node;
+    if(key.empty()) {
+        if(spare_.empty()) {
+            spare_.emplace_back();
+        }
+        node = spare_.begin();
+        pending_.splice(pending_.end(), spare_, node);
+    } else {
+        lookup_.assign(key.data(), key.size());
+        auto found = index_.find(lookup_);
+        if(found == index_.end()) {
+            idle_.emplace_back();
+            idle_.back().key = lookup_;
+            found            = index_.emplace(lookup_, std::prev(idle_.end())).first;
+        }
+        node = found->second;
+        if(node->queued) {
+            // newer value, same place in line
+            replaced_++;
+        } else {
+            pending_.splice(pending_.end(), idle_, node);
+        }
+    }
+
+    node->data.assign(reinterpret_cast<const char *>(data), size);
+    node->binary   = binary;
+    node->deadline = ttl.count() > 0 ? Clock::now() + ttl : Clock::time_point::max();
+    node->queued   = true;
+}
+
+const ConflationQueue::Message *ConflationQueue::Pop(Clock::time_point now) {
+    while(!pending_.empty()) {
+        auto node    = pending_.begin();
+        node->queued = false;
+        if(node->key.empty()) {
+            spare_.splice(spare_.end(), pending_, node);
+        } else {
+            idle_.splice(idle_.end(), pending_, node);
+        }
+        if(node->deadline < now) {
+            expired_++;
+            continue;
+        }
+        return &*node;
+    }
+    return nullptr;
+}
+
+void ConflationQueue::Clear() {
+    for(auto &node : pending_) {
+        node.queued = false;
+    }
+    while(!pending_.empty()) {
+        auto node = pending_.begin();
+        if(node->key.empty()) {
+            spare_.splice(spare_.end(), pending_, node);
+        } else {
+            idle_.splice(idle_.end(), pending_, node);
+        }
+    }
+}
+
+} // namespace wsocket
+
+#endif // WSOCKET__CONFLATION_QUEUE_HPP
@@ -0,0 +1,701 @@
+#pragma once
+#ifndef WSOCKET__EPOLL_WSOCKET_HPP
+#define WSOCKET__EPOLL_WSOCKET_HPP
+
+#ifdef __linux__
+
+#include <atomic>
+#include <cerrno>
+#include <functional>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "WSocketContext.hpp"
+
+namespace wsocket {
+
+class EpollWSocket;
+
+// Registered with epoll, the event data points at it
+class EpollHandle {
+public:
+    virtual ~EpollHandle()                 = default;
+    virtual void OnEvents(uint32_t events) = 0;
+};
+
+/**
+ * Edge-triggered epoll loop for WSocketContext, one per thread
+ *
+ * Sockets are registered once for EPOLLIN | EPOLLOUT | EPOLLET and linked
+ * into intrusive lists, so the steady state makes no epoll_ctl calls and no
+ * heap allocations: reads land directly in the parser buffer, writes go out
+ * inline from the send handler and only the unsent tail is buffered. Frames
+ * sent from inside the callbacks are corked until the readable event is
+ * handled, so a burst of echoes costs one send.
+ *
+ * Open, Run and every socket call happen on the loop's thread, Stop may be
+ * called from anywhere.
+ */
+class EpollLoop {
+public:
+    static constexpr int MAX_EVENTS = 256;
+
+    EpollLoop() = default;
+    ~EpollLoop();
+
+    EpollLoop(const EpollLoop &)            = delete;
+    EpollLoop &operator=(const EpollLoop &) = delete;
+
+    // Create the epoll instance, false with errno set on failure
+    bool Open();
+
+    /**
+     * Dispatch events until Stop is called
+     * @param busy_poll Spin on epoll_wait without sleeping, trades a core for wakeup latency
+     */
+    void Run(bool busy_poll = false);
+
+    // Make Run return, thread safe
+    void Stop();
+
+    bool Add(int fd, uint32_t events, EpollHandle *handle);
+    void Remove(int fd);
+
+    // Hand `socket` over to the loop, it is destroyed once it disconnects or the loop goes away
+    void Adopt(std::unique_ptr<EpollWSocket> socket);
+
+private:
+    friend class EpollWSocket;
+
+    void Link(EpollWSocket *socket);
+    void Unlink(EpollWSocket *socket);
+
+    // `socket` used up its read budget, continue reading in the next iteration
+    void Schedule(EpollWSocket *socket);
+    // Take `socket` off the scheduled list before it goes away
+    void Unschedule(EpollWSocket *socket);
+    void RunScheduled();
+
+    // Destroy an adopted socket once the current batch of events is dispatched
+    void Retire(EpollWSocket *socket) { retired_.push_back(socket); }
+    void DestroyRetired();
+
+    struct Wakeup : EpollHandle {
+        void OnEvents(uint32_t events) override {
+            uint64_t value;
+            while(::read(fd_, &value, sizeof(value)) > 0) {
+            }
+        }
+        int fd_ = -1;
+    };
+
+private:
+    int               epoll_fd_ = -1;
+    Wakeup            wakeup_;
+    std::atomic<bool> stopped_{false};
+
+    EpollWSocket *sockets_        = nullptr; // every registered socket
+    EpollWSocket *scheduled_head_ = nullptr; // sockets with unread data
+    EpollWSocket *scheduled_tail_ = nullptr;
+    size_t        scheduled_size_ = 0;
+
+    std::vector<EpollWSocket *> retired_;
+};
+
+/**
+ * WSocket over EpollLoop
+ *
+ * Same surface as WSocketBase: override the WSocketContext::Listener
+ * callbacks, Handshake to connect, Start for accepted sockets.
+ * No keep-alive timer runs on this backend.
+ */
+class EpollWSocket : public WSocketContext::Listener, public EpollHandle {
+protected:
+    /**
+     * @param resource Where the receive buffer, output queue and compression buffers come from,
+     *        null for the BufferPoolResource; must outlive the socket
+     */
+    explicit EpollWSocket(EpollLoop &loop, std::pmr::memory_resource *resource = nullptr) :
+        loop_(loop), wsocket_context_(resource), output_(wsocket_context_.MemoryResource()) {
+        Initialize();
+    }
+    EpollWSocket(EpollLoop &loop, int fd, std::pmr::memory_resource *resource = nullptr) :
+        loop_(loop), fd_(fd), wsocket_context_(resource), output_(wsocket_context_.MemoryResource()) {
+        Initialize();
+    }
+
+private:
+    void Initialize();
+
+public:
+    static constexpr int MAX_READS_PER_EVENT = 16; // fairness between busy connections
+
+    static std::unique_ptr<EpollWSocket> Create(EpollLoop &loop, std::pmr::memory_resource *resource = nullptr) {
+        return std::unique_ptr<EpollWSocket>(new EpollWSocket(loop, resource));
+    }
+    // Wrap an accepted socket, call Start to begin the server side handshake
+    static std::unique_ptr<EpollWSocket> Create(EpollLoop                 &loop,
+                                                int                        fd,
+                                                std::pmr::memory_resource *resource = nullptr) {
+        return std::unique_ptr<EpollWSocket>(new EpollWSocket(loop, fd, resource));
+    }
+
+    ~EpollWSocket() override;
+
+    // Register with the loop and start receiving
+    void Start();
+
+    // Connect and perform the WSocket handshake
+    void Handshake(const sockaddr *address, socklen_t address_len);
+
+    // Shut the connection down once the buffered output is written
+    void Stop();
+
+    void Ping() { this->wsocket_context_.Ping(); }
+    void Pong() { this->wsocket_context_.Pong(); }
+    void Text(std::string_view text, bool finish = true) { this->wsocket_context_.SendText(text, finish); }
+    void Binary(Buffer buffer, bool finish = true) { this->wsocket_context_.SendBinary(buffer, finish); }
+
+    // Serialize a message straight into a pooled send buffer, see WSocketContext::FrameBuilder
+    WSocketContext::FrameBuilder BuildBinary(size_t reserve) { return this->wsocket_context_.BuildBinary(reserve); }
+    WSocketContext::FrameBuilder BuildText(size_t reserve) { return this->wsocket_context_.BuildText(reserve); }
+
+    void Close(CloseCode code) { this->wsocket_context_.Close(code); }
+    void Close(int16_t code, std::string_view reason) { this->wsocket_context_.Close(code, reason); }
+
+    void                       Cork() { this->wsocket_context_.Cork(); }
+    void                       Uncork() { this->wsocket_context_.Uncork(); }
+    WSocketContext::BatchScope Batch() { return WSocketContext::BatchScope(this->wsocket_context_); }
+
+    void EnableUtf8Validation(bool enable) { this->wsocket_context_.EnableUtf8Validation(enable); }
+
+    // Deliver received text and binary frames to OnMessage as owned handles, see WSocketContext::EnableOwnedMessages
+    void EnableOwnedMessages(bool enable) { this->wsocket_context_.EnableOwnedMessages(enable); }
+
+    // Fail the connection on frames announcing more than `size` bytes, see WSocketContext::SetMaxFrameSize
+    void SetMaxFrameSize(size_t size) { this->wsocket_context_.SetMaxFrameSize(size); }
+
+    // Receive large binary payloads into OnBinaryDestination buffers, see WSocketContext::SetDirectReceiveThreshold
+    void SetDirectReceiveThreshold(size_t threshold) { this->wsocket_context_.SetDirectReceiveThreshold(threshold); }
+
+    // Write large binary messages to mmap'd temp files for OnSpilled, see WSocketContext::SetSpillThreshold
+    void SetSpillThreshold(size_t threshold, std::string directory = "/tmp") {
+        this->wsocket_context_.SetSpillThreshold(threshold, std::move(directory));
+    }
+
+    // Give the receive buffer back to the thread's pool whenever the socket is drained between messages
+    void EnableIdleRecv(bool enable) { idle_recv_ = enable; }
+
+    int Fd() const { return fd_; }
+
+protected:
+    //============ WSocketContext::Listener start ============//
+    void         OnError(std::error_code code) override {}
+    CompressType OnHandshake(const std::vector<CompressType> &request_compress_type) override {
+        return CompressType::None;
+    }
+    void   OnConnected() override {}
+    void   OnClose(int16_t code, const std::string &reason) override {}
+    void   OnPing() override { this->wsocket_context_.Pong(); }
+    void   OnPong() override {}
+    void   OnText(std::string_view text, bool finish) override {}
+    void   OnBinary(Buffer buffer, bool finish) override {}
+    void   OnMessage(MessageHandle message) override {}
+    void   OnSpilled(SpilledMessage message) override {}
+    Buffer OnBinaryDestination(size_t size, bool finish) override { return {}; }
+    //============ WSocketContext::Listener end ============//
+
+    // The socket is closed and unregistered, an adopted socket is destroyed right after
+    virtual void OnDisconnected() {}
+
+private:
+    void OnEvents(uint32_t events) override;
+
+    void OnConnect();
+    void OnReadable();
+    void OnWritable();
+
+    void Write(const Buffer &buffer);
+    void Disconnect(std::error_code code);
+
+private:
+    friend class EpollLoop;
+
+    EpollLoop     &loop_;
+    int            fd_ = -1;
+    WSocketContext wsocket_context_;
+
+    std::pmr::vector<uint8_t> output_; // bytes the kernel did not take yet
+    size_t                    output_offset_ = 0;
+
+    bool connecting_      = false;
+    bool stop_requested_  = false;
+    bool adopted_         = false;
+    bool scheduled_       = false;
+    bool idle_recv_       = false; // EnableIdleRecv
+
+    // EpollLoop lists
+    EpollWSocket *prev_           = nullptr;
+    EpollWSocket *next_           = nullptr;
+    EpollWSocket *scheduled_next_ = nullptr;
+};
+
+/**
+ * Listening socket for EpollLoop, drains the accept queue on every edge
+ */
+class EpollAcceptor : public EpollHandle {
+public:
+    using AcceptHandler = std::function<void(int fd)>;
+
+    explicit EpollAcceptor(EpollLoop &loop) : loop_(loop) {}
+    ~EpollAcceptor() override { Close(); }
+
+    EpollAcceptor(const EpollAcceptor &)            = delete;
+    EpollAcceptor &operator=(const EpollAcceptor &) = delete;
+
+    // Bind and listen, false with errno set on failure
+    bool Open(const sockaddr *address, socklen_t address_len, int backlog = SOMAXCONN);
+
+    // Accept connections, `handler` owns each accepted non-blocking fd
+    void Start(AcceptHandler &&handler);
+
+    void Close();
+
+private:
+    void OnEvents(uint32_t events) override;
+
+private:
+    EpollLoop    &loop_;
+    int           fd_ = -1;
+    AcceptHandler handler_;
+};
+
+//============ EpollLoop start ============//
+
+EpollLoop::~EpollLoop() {
+    // adopted sockets are destroyed, the others are only detached
+    while(sockets_) {
+        sockets_->Disconnect({});
+    }
+    DestroyRetired();
+
+    if(wakeup_.fd_ >= 0) {
+        ::close(wakeup_.fd_);
+    }
+    if(epoll_fd_ >= 0) {
+        ::close(epoll_fd_);
+    }
+}
+
+bool EpollLoop::Open() {
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_fd_ < 0) {
+        return false;
+    }
+    wakeup_.fd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(wakeup_.fd_ < 0) {
+        return false;
+    }
+    retired_.reserve(64);
+    return Add(wakeup_.fd_, EPOLLIN | EPOLLET, &wakeup_);
+}
+
+void EpollLoop::Run(bool busy_poll) {
+    epoll_event events[MAX_EVENTS];
+
+    while(!stopped_.load(std::memory_order_acquire)) {
+        // sockets with unread data must not wait for a new edge
+        int timeout = (busy_poll || scheduled_head_) ? 0 : -1;
+        int count   = ::epoll_wait(epoll_fd_, events, MAX_EVENTS, timeout);
+        if(count < 0 && errno != EINTR) {
+            break;
+        }
+
+        for(int i = 0; i < count; ++i) {
+            static_cast<EpollHandle *>(events[i].data.ptr)->OnEvents(events[i].events);
+        }
+        this->RunScheduled();
+        this->DestroyRetired();
+    }
+}
+
+void EpollLoop::Stop() {
+    stopped_.store(true, std::memory_order_release);
+    uint64_t one = 1;
+    std::ignore  = ::write(wakeup_.fd_, &one, sizeof(one));
+}
+
+bool EpollLoop::Add(int fd, uint32_t events, EpollHandle *handle) {
+    epoll_event event{};
+    event.events   = events;
+    event.data.ptr = handle;
+    return ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+void EpollLoop::Remove(int fd) { ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr); }
+
+void EpollLoop::Adopt(std::unique_ptr<EpollWSocket> socket) {
+    auto *raw     = socket.release();
+    raw->adopted_ = true;
+    if(raw->fd_ < 0) {
+        // already gone
+        this->Retire(raw);
+    }
+}
+
+void EpollLoop::Link(EpollWSocket *socket) {
+    socket->prev_ = nullptr;
+    socket->next_ = sockets_;
+    if(sockets_) {
+        sockets_->prev_ = socket;
+    }
+    sockets_ = socket;
+}
+
+void EpollLoop::Unlink(EpollWSocket *socket) {
+    if(socket->prev_) {
+        socket->prev_->next_ = socket->next_;
+    } else if(sockets_ == socket) {
+        sockets_ = socket->next_;
+    }
+    if(socket->next_) {
+        socket->next_->prev_ = socket->prev_;
+    }
+    socket->prev_ = socket->next_ = nullptr;
+}
+
+void EpollLoop::Schedule(EpollWSocket *socket) {
+    if(socket->scheduled_) {
+        return;
+    }
+    socket->scheduled_      = true;
+    socket->scheduled_next_ = nullptr;
+    if(scheduled_tail_) {
+        scheduled_tail_->scheduled_next_ = socket;
+    } else {
+        scheduled_head_ = socket;
+    }
+    scheduled_tail_ = socket;
+    scheduled_size_++;
+}
+
+void EpollLoop::Unschedule(EpollWSocket *socket) {
+    if(!socket->scheduled_) {
+        return;
+    }
+    EpollWSocket *prev = nullptr;
+    for(auto *it = scheduled_head_; it != socket; it = it->scheduled_next_) {
+        prev = it;
+    }
+    if(prev) {
+        prev->scheduled_next_ = socket->scheduled_next_;
+    } else {
+        scheduled_head_ = socket->scheduled_next_;
+    }
+    if(scheduled_tail_ == socket) {
+        scheduled_tail_ = prev;
+    }
+    scheduled_size_--;
+    socket->scheduled_      = false;
+    socket->scheduled_next_ = nullptr;
+}
+
+void EpollLoop::RunScheduled() {
+    // one pass over the sockets queued so far, those that exhaust their budget again re-queue for the next round;
+    // popped one at a time so a callback may destroy any other socket, it unschedules itself
+    for(size_t round = scheduled_size_; round > 0 && scheduled_head_; --round) {
+        auto *socket = scheduled_head_;
+        this->Unschedule(socket);
+        if(socket->fd_ >= 0) {
+            socket->OnReadable();
+        }
+    }
+}
+
+void EpollLoop::DestroyRetired() {
+    for(auto *socket : retired_) {
+        delete socket;
+    }
+    retired_.clear();
+}
+
+//============ EpollLoop end ============//
+
+//============ EpollWSocket start ============//
+
+void EpollWSocket::Initialize() {
+    wsocket_context_.ResetListener(this);
+    wsocket_context_.ResetSendHandler([this](const Buffer &buffer) { this->Write(buffer); });
+}
+
+EpollWSocket::~EpollWSocket() {
+    wsocket_context_.ResetListener(nullptr);
+    wsocket_context_.ResetSendHandler(nullptr);
+    if(fd_ >= 0) {
+        loop_.Remove(fd_);
+        loop_.Unlink(this);
+        loop_.Unschedule(this);
+        ::close(fd_);
+    }
+}
+
+void EpollWSocket::Start() {
+    int one = 1;
+    ::setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if(!loop_.Add(fd_, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, this)) {
+        this->Disconnect(std::error_code(errno, std::system_category()));
+        return;
+    }
+    loop_.Link(this);
+    // data may have arrived before registering, the first edge was then missed
+    this->OnReadable();
+}
+
+void EpollWSocket::Handshake(const sockaddr *address, socklen_t address_len) {
+    fd_ = ::socket(address->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd_ < 0) {
+        this->OnError(std::error_code(errno, std::system_category()));
+        return;
+    }
+    if(::connect(fd_, address, address_len) != 0 && errno != EINPROGRESS) {
+        auto code = std::error_code(errno, std::system_category());
+        ::close(fd_);
+        fd_ = -1;
+        this->OnError(code);
+        return;
+    }
+
+    // EPOLLOUT reports the connect result
+    connecting_ = true;
+    if(!loop_.Add(fd_, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, this)) {
+        this->Disconnect(std::error_code(errno, std::system_category()));
+        return;
+    }
+    loop_.Link(this);
+}
+
+void EpollWSocket::Stop() {
+    stop_requested_ = true;
+    if(fd_ >= 0 && output_.empty()) {
+        ::shutdown(fd_, SHUT_RDWR);
+    }
+}
+
+void EpollWSocket::OnEvents(uint32_t events) {
+    if(fd_ < 0) {
+        return;
+    }
+    if(connecting_) {
+        if(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+            this->OnConnect();
+        }
+        return;
+    }
+    if(events & EPOLLOUT) {
+        this->OnWritable();
+    }
+    if(fd_ >= 0 && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+        this->OnReadable();
+    }
+}
+
+void EpollWSocket::OnConnect() {
+    connecting_ = false;
+
+    int       error = 0;
+    socklen_t len   = sizeof(error);
+    ::getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &len);
+    if(error != 0) {
+        this->Disconnect(std::error_code(error, std::system_category()));
+        return;
+    }
+
+    int one = 1;
+    ::setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    this->wsocket_context_.Handshake();
+    if(fd_ >= 0) {
+        this->OnReadable();
+    }
+}
+
+void EpollWSocket::OnReadable() {
+    // frames sent from the callbacks leave in one write per event
+    auto batch = this->Batch();
+    for(int reads = 0; reads < MAX_READS_PER_EVENT; ++reads) {
+        // read straight into the parser buffer
+        auto    buf = wsocket_context_.PrepareWrite();
+        ssize_t len = ::recv(fd_, buf.buf, buf.size, MSG_DONTWAIT);
+        if(len > 0) {
+            wsocket_context_.CommitWrite(static_cast<size_t>(len));
+            if(fd_ < 0) {
+                // a callback disconnected us
+                return;
+            }
+            if(wsocket_context_.IsFailed()) {
+                // protocol error, the close frame is already sent
+                this->Stop();
+                return;
+            }
+            continue;
+        }
+        if(len == 0) {
+            this->Disconnect(stop_requested_ ? std::error_code()
+                                             : std::make_error_code(std::errc::connection_aborted));
+            return;
+        }
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            if(idle_recv_) {
+                // the next edge borrows a buffer again
+                wsocket_context_.ReleaseReceiveBuffer();
+            }
+            return;
+        }
+        if(errno != EINTR) {
+            this->Disconnect(std::error_code(errno, std::system_category()));
+            return;
+        }
+    }
+    // budget used up with data possibly left, no new edge will come for it
+    loop_.Schedule(this);
+}
+
+void EpollWSocket::Write(const Buffer &buffer) {
+    if(fd_ < 0 || connecting_) {
+        return;
+    }
+
+    size_t sent = 0;
+    if(output_.empty()) {
+        // nothing queued, write inline
+        while(sent < buffer.size) {
+            ssize_t len = ::send(fd_, buffer.buf + sent, buffer.size - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if(len > 0) {
+                sent += static_cast<size_t>(len);
+                continue;
+            }
+            if(len < 0 && errno == EINTR) {
+                continue;
+            }
+            if(len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                this->Disconnect(std::error_code(errno, std::system_category()));
+                return;
+            }
+            break;
+        }
+    }
+
+    // the kernel buffer is full, EPOLLOUT writes the rest
+    output_.insert(output_.end(), buffer.buf + sent, buffer.buf + buffer.size);
+}
+
+void EpollWSocket::OnWritable() {
+    while(output_offset_ < output_.size()) {
+        ssize_t len = ::send(fd_,
+                             output_.data() + output_offset_,
+                             output_.size() - output_offset_,
+                             MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(len > 0) {
+            output_offset_ += static_cast<size_t>(len);
+            continue;
+        }
+        if(len < 0 && errno == EINTR) {
+            continue;
+        }
+        if(len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            this->Disconnect(std::error_code(errno, std::system_category()));
+        }
+        return;
+    }
+
+    output_.clear();
+    output_offset_ = 0;
+    if(stop_requested_) {
+        ::shutdown(fd_, SHUT_RDWR);
+    }
+}
+
+void EpollWSocket::Disconnect(std::error_code code) {
+    if(fd_ < 0) {
+        return;
+    }
+    loop_.Remove(fd_);
+    loop_.Unlink(this);
+    loop_.Unschedule(this);
+    ::close(fd_);
+    fd_         = -1;
+    connecting_ = false;
+
+    if(code) {
+        this->OnError(code);
+    }
+    this->OnDisconnected();
+    if(adopted_) {
+        loop_.Retire(this);
+    }
+}
+
+//============ EpollWSocket end ============//
+
+//============ EpollAcceptor start ============//
+
+bool EpollAcceptor::Open(const sockaddr *address, socklen_t address_len, int backlog) {
+    fd_ = ::socket(address->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd_ < 0) {
+        return false;
+    }
+    int one = 1;
+    ::setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(::bind(fd_, address, address_len) != 0 || ::listen(fd_, backlog) != 0) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void EpollAcceptor::Start(AcceptHandler &&handler) {
+    handler_ = std::move(handler);
+    loop_.Add(fd_, EPOLLIN | EPOLLET, this);
+    this->OnEvents(EPOLLIN);
+}
+
+void EpollAcceptor::Close() {
+    if(fd_ >= 0) {
+        loop_.Remove(fd_);
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+void EpollAcceptor::OnEvents(uint32_t events) {
+    while(fd_ >= 0) {
+        int fd = ::accept4(fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            // EAGAIN: queue drained; anything else (EMFILE...) retries on the next edge
+            return;
+        }
+        if(handler_) {
+            handler_(fd);
+        } else {
+            ::close(fd);
+        }
+    }
+}
+
+//============ EpollAcceptor end ============//
+
+} // namespace wsocket
+
+#endif // __linux__
+
+#endif // WSOCKET__EPOLL_WSOCKET_HPP
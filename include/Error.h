@@ -17,6 +17,8 @@ enum Error : int {
     DecompressError    = 6,
     PayloadTooLong     = 7,
     MessageEmpty       = 8,
+    InvalidUtf8        = 9,
+    SpillError         = 10,
 };
 
 class ErrorCategory : public std::error_category {
@@ -43,6 +45,10 @@ public:
             return "PayloadTooLong";
         case MessageEmpty:
             return "MessageEmpty";
+        case InvalidUtf8:
+            return "InvalidUtf8";
+        case SpillError:
+            return "SpillError";
         }
 
         return "Unknown error";
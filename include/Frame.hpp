@@ -104,7 +104,7 @@ public:
         if(header_.payload_length < 0b1111'1110) {
             // 2 bytes
             return basic_len;
-        } else if(header_.payload_length == 0b1111'1111) {
+        } else if(header_.payload_length == 0b1111'1110) {
             // 2 + 2 bytes
             return basic_len + sizeof(uint16_t);
         } else {
@@ -125,8 +125,8 @@ struct Frame {
     FrameHeader header;
     Buffer      data;
 
-    static size_t ShortPayload() { return 0b1111'1110; }
-    static size_t MiddlePayload() { return std::numeric_limits<uint16_t>::max(); }
+    static constexpr size_t ShortPayload() { return 0b1111'1110; }
+    static constexpr size_t MiddlePayload() { return std::numeric_limits<uint16_t>::max(); }
 };
 
 struct OwnedFrame : Frame {
@@ -143,18 +143,16 @@ enum class CloseCode : int {
     INTERNAL_ERROR       = 1011,
 };
 
-inline const char *CloseMessage(CloseCode code) {
-    static std::unordered_map<CloseCode, const char *> CloseMessageMap = {
-            {CloseCode::CLOSE_NORMAL, "close normal"},
-            {CloseCode::CLOSE_PROTOCOL_ERROR, "close protocol error"},
-            {CloseCode::INTERNAL_ERROR, "internal error"},
-    };
-
-    auto it = CloseMessageMap.find(code);
-    if(it == CloseMessageMap.end()) {
-        return nullptr;
+constexpr const char *CloseMessage(CloseCode code) {
+    switch(code) {
+    case CloseCode::CLOSE_NORMAL:
+        return "close normal";
+    case CloseCode::CLOSE_PROTOCOL_ERROR:
+        return "close protocol error";
+    case CloseCode::INTERNAL_ERROR:
+        return "internal error";
     }
-    return it->second;
+    return nullptr;
 }
 
 
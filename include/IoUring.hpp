@@ -0,0 +1,371 @@
+#pragma once
+#ifndef WSOCKET__IO_URING_HPP
+#define WSOCKET__IO_URING_HPP
+
+#if defined(__linux__) && defined(WITH_IO_URING)
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace wsocket {
+
+/**
+ * Minimal io_uring instance on top of the raw syscalls
+ *
+ * Only what the WSocket backend needs: queue SQEs, submit them together with
+ * waiting for completions in one io_uring_enter, and walk the CQ ring.
+ * Not thread safe, a ring belongs to the thread that drives it.
+ */
+class IoUring {
+public:
+    IoUring() = default;
+    ~IoUring() { Close(); }
+
+    IoUring(const IoUring &)            = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    /**
+     * Create the ring
+     * @param entries SQ size, the CQ is four times larger so multishot completions do not overflow
+     * @return false with errno set on failure
+     */
+    bool Open(unsigned entries);
+    void Close();
+
+    int Fd() const { return fd_; }
+
+    /**
+     * Next free SQE, already zeroed; submits the queued SQEs to make room when the SQ is full
+     * @return nullptr only when the kernel refuses to accept more submissions
+     */
+    io_uring_sqe *GetSqe();
+
+    /**
+     * Submit the queued SQEs and wait until at least `wait_nr` completions are available
+     * @return submitted count, or -errno
+     */
+    int SubmitAndWait(unsigned wait_nr);
+    int Submit() { return SubmitAndWait(0); }
+
+    // Call `fn(const io_uring_cqe &)` for each available completion and consume them
+    template <typename Fn>
+    unsigned ForEachCqe(Fn &&fn);
+
+    /**
+     * Register a provided buffer ring
+     * @param ring_addr Page aligned ring memory holding `entries` io_uring_buf
+     * @param entries Power of two
+     * @param group_id Buffer group referenced by IOSQE_BUFFER_SELECT SQEs
+     */
+    bool RegisterBufferRing(void *ring_addr, unsigned entries, uint16_t group_id);
+
+private:
+    int Enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+        int ret = static_cast<int>(::syscall(__NR_io_uring_enter, fd_, to_submit, min_complete, flags, nullptr, 0));
+        return ret < 0 ? -errno : ret;
+    }
+
+    // SQEs queued since the last submit
+    unsigned Pending() const { return sqe_tail_ - sqe_head_; }
+
+private:
+    int      fd_    = -1;
+    unsigned flags_ = 0;
+
+    void  *sq_map_      = nullptr;
+    size_t sq_map_size_ = 0;
+    void  *cq_map_      = nullptr;
+    size_t cq_map_size_ = 0;
+
+    io_uring_sqe *sqes_      = nullptr;
+    size_t        sqes_size_ = 0;
+
+    // SQ ring
+    unsigned *sq_head_    = nullptr;
+    unsigned *sq_tail_    = nullptr;
+    unsigned *sq_mask_    = nullptr;
+    unsigned *sq_entries_ = nullptr;
+    unsigned *sq_array_   = nullptr;
+    unsigned  sqe_head_   = 0; // first queued SQE not yet published
+    unsigned  sqe_tail_   = 0; // next SQE to hand out
+
+    // CQ ring
+    unsigned     *cq_head_ = nullptr;
+    unsigned     *cq_tail_ = nullptr;
+    unsigned     *cq_mask_ = nullptr;
+    io_uring_cqe *cqes_    = nullptr;
+};
+
+/**
+ * Buffer ring shared with the kernel (IORING_REGISTER_PBUF_RING)
+ *
+ * Multishot receives pick a buffer from the ring for every completion, the
+ * completion carries the buffer id and the buffer has to be handed back with
+ * Recycle once its bytes are consumed.
+ */
+class IoUringBufferRing {
+public:
+    IoUringBufferRing() = default;
+    ~IoUringBufferRing() { Close(); }
+
+    IoUringBufferRing(const IoUringBufferRing &)            = delete;
+    IoUringBufferRing &operator=(const IoUringBufferRing &) = delete;
+
+    /**
+     * Allocate the buffers and register them with the ring
+     * @param count Buffer count, rounded up to a power of two
+     * @param size Size of each buffer
+     */
+    bool Open(IoUring &ring, uint16_t group_id, unsigned count, unsigned size);
+    void Close();
+
+    uint16_t GroupId() const { return group_id_; }
+    unsigned BufferSize() const { return buffer_size_; }
+
+    uint8_t *Data(uint16_t buffer_id) { return buffers_ + size_t(buffer_id) * buffer_size_; }
+
+    // Hand a buffer back to the kernel
+    void Recycle(uint16_t buffer_id) {
+        auto &slot = ring_[tail_ & mask_];
+        slot.addr  = reinterpret_cast<uint64_t>(Data(buffer_id));
+        slot.len   = buffer_size_;
+        slot.bid   = buffer_id;
+        tail_++;
+        // the tail overlays bufs[0].resv
+        __atomic_store_n(&ring_[0].resv, tail_, __ATOMIC_RELEASE);
+    }
+
+private:
+    io_uring_buf *ring_         = nullptr;
+    size_t        ring_size_    = 0;
+    uint8_t      *buffers_      = nullptr;
+    size_t        buffers_size_ = 0;
+
+    unsigned buffer_size_ = 0;
+    uint16_t mask_        = 0;
+    uint16_t tail_        = 0;
+    uint16_t group_id_    = 0;
+};
+
+
+bool IoUring::Open(unsigned entries) {
+    Close();
+
+    io_uring_params params{};
+    params.flags      = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    params.cq_entries = entries * 4;
+    fd_               = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if(fd_ < 0 && errno == EINVAL) {
+        // kernels before 6.1 lack single issuer / deferred task running
+        params            = {};
+        params.flags      = IORING_SETUP_CQSIZE;
+        params.cq_entries = entries * 4;
+        fd_               = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    }
+    if(fd_ < 0) {
+        return false;
+    }
+    flags_ = params.flags;
+
+    sq_map_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_map_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_map_size_ = cq_map_size_ = std::max(sq_map_size_, cq_map_size_);
+    }
+
+    sq_map_ = ::mmap(nullptr, sq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if(sq_map_ == MAP_FAILED) {
+        sq_map_ = nullptr;
+        Close();
+        return false;
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_map_ = sq_map_;
+    } else {
+        cq_map_ =
+            ::mmap(nullptr, cq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+        if(cq_map_ == MAP_FAILED) {
+            cq_map_ = nullptr;
+            Close();
+            return false;
+        }
+    }
+
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+        Close();
+        return false;
+    }
+    sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+    auto *sq    = static_cast<uint8_t *>(sq_map_);
+    sq_head_    = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail_    = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask_    = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_entries_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+    sq_array_   = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    sqe_head_ = sqe_tail_ = *sq_tail_;
+
+    auto *cq = static_cast<uint8_t *>(cq_map_);
+    cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes_    = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    return true;
+}
+
+void IoUring::Close() {
+    if(sqes_) {
+        ::munmap(sqes_, sqes_size_);
+        sqes_ = nullptr;
+    }
+    if(cq_map_ && cq_map_ != sq_map_) {
+        ::munmap(cq_map_, cq_map_size_);
+    }
+    cq_map_ = nullptr;
+    if(sq_map_) {
+        ::munmap(sq_map_, sq_map_size_);
+        sq_map_ = nullptr;
+    }
+    if(fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+io_uring_sqe *IoUring::GetSqe() {
+    unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if(sqe_tail_ - head >= *sq_entries_) {
+        if(Submit() < 0) {
+            return nullptr;
+        }
+        head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if(sqe_tail_ - head >= *sq_entries_) {
+            return nullptr;
+        }
+    }
+
+    auto *sqe = &sqes_[sqe_tail_ & *sq_mask_];
+    sqe_tail_++;
+    std::memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int IoUring::SubmitAndWait(unsigned wait_nr) {
+    // publish the queued SQEs
+    unsigned mask = *sq_mask_;
+    unsigned tail = *sq_tail_;
+    for(unsigned n = Pending(); n > 0; --n) {
+        sq_array_[tail & mask] = sqe_head_ & mask;
+        tail++;
+        sqe_head_++;
+    }
+    unsigned to_submit = tail - *sq_tail_;
+    __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+    unsigned flags = 0;
+    if(wait_nr > 0 || (flags_ & IORING_SETUP_DEFER_TASKRUN)) {
+        // deferred task work only runs when asking for events
+        flags |= IORING_ENTER_GETEVENTS;
+    }
+    if(to_submit == 0 && flags == 0) {
+        return 0;
+    }
+
+    int ret;
+    do {
+        ret = Enter(to_submit, wait_nr, flags);
+    } while(ret == -EINTR);
+    return ret;
+}
+
+template <typename Fn>
+unsigned IoUring::ForEachCqe(Fn &&fn) {
+    unsigned head  = *cq_head_;
+    unsigned tail  = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    unsigned mask  = *cq_mask_;
+    unsigned count = 0;
+    while(head != tail) {
+        // copy out, the handler may queue new SQEs and the slot is released below
+        io_uring_cqe cqe = cqes_[head & mask];
+        head++;
+        count++;
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        fn(cqe);
+        tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    }
+    return count;
+}
+
+bool IoUring::RegisterBufferRing(void *ring_addr, unsigned entries, uint16_t group_id) {
+    io_uring_buf_reg reg{};
+    reg.ring_addr    = reinterpret_cast<uint64_t>(ring_addr);
+    reg.ring_entries = entries;
+    reg.bgid         = group_id;
+    return ::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PBUF_RING, &reg, 1) == 0;
+}
+
+
+bool IoUringBufferRing::Open(IoUring &ring, uint16_t group_id, unsigned count, unsigned size) {
+    Close();
+
+    unsigned entries = 1;
+    while(entries < count && entries < 32768) {
+        entries <<= 1;
+    }
+
+    ring_size_ = entries * sizeof(io_uring_buf);
+    void *map  = ::mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(map == MAP_FAILED) {
+        return false;
+    }
+    ring_ = static_cast<io_uring_buf *>(map);
+
+    buffers_size_ = size_t(entries) * size;
+    map           = ::mmap(nullptr, buffers_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(map == MAP_FAILED) {
+        Close();
+        return false;
+    }
+    buffers_ = static_cast<uint8_t *>(map);
+
+    buffer_size_ = size;
+    mask_        = static_cast<uint16_t>(entries - 1);
+    tail_        = 0;
+    group_id_    = group_id;
+
+    if(!ring.RegisterBufferRing(ring_, entries, group_id)) {
+        Close();
+        return false;
+    }
+    for(unsigned i = 0; i < entries; ++i) {
+        Recycle(static_cast<uint16_t>(i));
+    }
+    return true;
+}
+
+void IoUringBufferRing::Close() {
+    // the registration goes away with the ring itself
+    if(buffers_) {
+        ::munmap(buffers_, buffers_size_);
+        buffers_ = nullptr;
+    }
+    if(ring_) {
+        ::munmap(ring_, ring_size_);
+        ring_ = nullptr;
+    }
+}
+
+} // namespace wsocket
+
+#endif // __linux__ && WITH_IO_URING
+
+#endif // WSOCKET__IO_URING_HPP
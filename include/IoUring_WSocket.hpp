@@ -0,0 +1,713 @@
+#pragma once
+#ifndef WSOCKET__IO_URING_WSOCKET_HPP
+#define WSOCKET__IO_URING_WSOCKET_HPP
+
+#if defined(__linux__) && defined(WITH_IO_URING)
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "IoUring.hpp"
+#include "WSocketContext.hpp"
+
+namespace wsocket {
+
+class IoUringWSocket;
+
+// Completion target of one SQE, the SQE user_data points at it
+struct IoUringOperation {
+    virtual ~IoUringOperation()                      = default;
+    virtual void OnComplete(const io_uring_cqe &cqe) = 0;
+};
+
+/**
+ * Event loop driving one io_uring instance
+ *
+ * Each loop iteration first writes out the sends queued during the previous
+ * iteration, then submits every queued SQE and waits for completions in a
+ * single io_uring_enter. Receives are multishot and draw from a provided
+ * buffer ring shared by all connections of the loop.
+ *
+ * Run the loop on one thread, every socket and acceptor of the loop must only
+ * be used from that thread. Stop may be called from anywhere.
+ */
+class IoUringLoop {
+public:
+    struct Options {
+        unsigned entries      = 4096;      // SQ entries
+        unsigned buffer_count = 4096;      // provided receive buffers, shared by all connections
+        unsigned buffer_size  = 16 * 1024; // size of each receive buffer
+    };
+
+    static constexpr uint16_t BUFFER_GROUP_ID = 0;
+
+    IoUringLoop() = default;
+    ~IoUringLoop();
+
+    IoUringLoop(const IoUringLoop &)            = delete;
+    IoUringLoop &operator=(const IoUringLoop &) = delete;
+
+    // Create the ring and register the receive buffers, false with errno set on failure
+    bool Open(const Options &options);
+    bool Open() { return Open(Options()); }
+
+    // Process completions until Stop is called
+    void Run();
+
+    // Make Run return, thread safe
+    void Stop();
+
+    IoUring           &Ring() { return ring_; }
+    IoUringBufferRing &Buffers() { return buffers_; }
+
+    // Attach `op` to `sqe`
+    static void Prepare(io_uring_sqe *sqe, IoUringOperation *op) { sqe->user_data = reinterpret_cast<uint64_t>(op); }
+
+private:
+    friend class IoUringWSocket;
+
+    // Flush `socket` before the next submit
+    void ScheduleFlush(std::shared_ptr<IoUringWSocket> socket) { flush_queue_.push_back(std::move(socket)); }
+    void FlushSockets();
+
+    void ArmWakeup();
+
+    // Sockets with operations in flight, released when the loop goes away
+    void Link(IoUringWSocket *socket);
+    void Unlink(IoUringWSocket *socket);
+
+    struct WakeupOperation : IoUringOperation {
+        explicit WakeupOperation(IoUringLoop &loop) : loop_(loop) {}
+        void OnComplete(const io_uring_cqe &cqe) override { loop_.ArmWakeup(); }
+
+        IoUringLoop &loop_;
+        uint64_t     value_ = 0;
+    };
+
+private:
+    // buffers_ is declared first so the ring, and with it every in-flight receive, goes away before the memory
+    IoUringBufferRing buffers_;
+    IoUring           ring_;
+
+    int               event_fd_ = -1;
+    WakeupOperation   wakeup_{*this};
+    std::atomic<bool> stopped_{false};
+
+    std::vector<std::shared_ptr<IoUringWSocket>> flush_queue_;
+    std::vector<std::shared_ptr<IoUringWSocket>> flushing_;
+
+    IoUringWSocket *active_ = nullptr; // intrusive list head
+};
+
+/**
+ * WSocket over a dedicated io_uring loop
+ *
+ * Same surface as WSocketBase: override the WSocketContext::Listener
+ * callbacks, Handshake to connect, Start for accepted sockets.
+ *
+ * - receive: one multishot recv per connection, completions carry a provided
+ *   buffer that is fed to the parser and recycled right away
+ * - send: frames sent during one loop iteration are coalesced and go out as
+ *   one IORING_OP_SEND per connection, all connections' sends are submitted
+ *   with a single io_uring_enter; Stop links the final send and the shutdown
+ *
+ * The socket keeps itself alive while operations are in flight.
+ * No keep-alive timer runs on this backend.
+ */
+class IoUringWSocket : public WSocketContext::Listener, public std::enable_shared_from_this<IoUringWSocket> {
+protected:
+    /**
+     * @param resource Where the receive buffer, send queues and compression buffers come from,
+     *        null for the BufferPoolResource; must outlive the socket
+     */
+    explicit IoUringWSocket(IoUringLoop &loop, std::pmr::memory_resource *resource = nullptr) :
+        loop_(loop), wsocket_context_(resource), pending_(wsocket_context_.MemoryResource()),
+        writing_(wsocket_context_.MemoryResource()) {
+        Initialize();
+    }
+    IoUringWSocket(IoUringLoop &loop, int fd, std::pmr::memory_resource *resource = nullptr) :
+        loop_(loop), fd_(fd), wsocket_context_(resource), pending_(wsocket_context_.MemoryResource()),
+        writing_(wsocket_context_.MemoryResource()) {
+        Initialize();
+    }
+
+private:
+    void Initialize();
+
+public:
+    static std::shared_ptr<IoUringWSocket> Create(IoUringLoop &loop, std::pmr::memory_resource *resource = nullptr) {
+        return std::shared_ptr<IoUringWSocket>(new IoUringWSocket(loop, resource));
+    }
+    // Wrap an accepted socket, call Start to begin the server side handshake
+    static std::shared_ptr<IoUringWSocket> Create(IoUringLoop                &loop,
+                                                  int                         fd,
+                                                  std::pmr::memory_resource *resource = nullptr) {
+        return std::shared_ptr<IoUringWSocket>(new IoUringWSocket(loop, fd, resource));
+    }
+
+    ~IoUringWSocket() override;
+
+    // Start receiving
+    void Start();
+
+    // Connect and perform the WSocket handshake
+    void Handshake(const sockaddr *address, socklen_t address_len);
+
+    /**
+     * Shut the connection down once the queued frames are written, the send and
+     * the shutdown are submitted as one linked chain
+     */
+    void Stop();
+
+    void Ping() { this->wsocket_context_.Ping(); }
+    void Pong() { this->wsocket_context_.Pong(); }
+    void Text(std::string_view text, bool finish = true) { this->wsocket_context_.SendText(text, finish); }
+    void Binary(Buffer buffer, bool finish = true) { this->wsocket_context_.SendBinary(buffer, finish); }
+
+    // Serialize a message straight into a pooled send buffer, see WSocketContext::FrameBuilder
+    WSocketContext::FrameBuilder BuildBinary(size_t reserve) { return this->wsocket_context_.BuildBinary(reserve); }
+    WSocketContext::FrameBuilder BuildText(size_t reserve) { return this->wsocket_context_.BuildText(reserve); }
+
+    void Close(CloseCode code) { this->wsocket_context_.Close(code); }
+    void Close(int16_t code, std::string_view reason) { this->wsocket_context_.Close(code, reason); }
+
+    void                       Cork() { this->wsocket_context_.Cork(); }
+    void                       Uncork() { this->wsocket_context_.Uncork(); }
+    WSocketContext::BatchScope Batch() { return WSocketContext::BatchScope(this->wsocket_context_); }
+
+    void EnableUtf8Validation(bool enable) { this->wsocket_context_.EnableUtf8Validation(enable); }
+
+    // Deliver received text and binary frames to OnMessage as owned handles, see WSocketContext::EnableOwnedMessages
+    void EnableOwnedMessages(bool enable) { this->wsocket_context_.EnableOwnedMessages(enable); }
+
+    // Fail the connection on frames announcing more than `size` bytes, see WSocketContext::SetMaxFrameSize
+    void SetMaxFrameSize(size_t size) { this->wsocket_context_.SetMaxFrameSize(size); }
+
+    // Receive large binary payloads into OnBinaryDestination buffers, see WSocketContext::SetDirectReceiveThreshold
+    void SetDirectReceiveThreshold(size_t threshold) { this->wsocket_context_.SetDirectReceiveThreshold(threshold); }
+
+    // Write large binary messages to mmap'd temp files for OnSpilled, see WSocketContext::SetSpillThreshold
+    void SetSpillThreshold(size_t threshold, std::string directory = "/tmp") {
+        this->wsocket_context_.SetSpillThreshold(threshold, std::move(directory));
+    }
+
+    int Fd() const { return fd_; }
+
+protected:
+    //============ WSocketContext::Listener start ============//
+    void         OnError(std::error_code code) override {}
+    CompressType OnHandshake(const std::vector<CompressType> &request_compress_type) override {
+        return CompressType::None;
+    }
+    void   OnConnected() override {}
+    void   OnClose(int16_t code, const std::string &reason) override {}
+    void   OnPing() override { this->wsocket_context_.Pong(); }
+    void   OnPong() override {}
+    void   OnText(std::string_view text, bool finish) override {}
+    void   OnBinary(Buffer buffer, bool finish) override {}
+    void   OnMessage(MessageHandle message) override {}
+    void   OnSpilled(SpilledMessage message) override {}
+    Buffer OnBinaryDestination(size_t size, bool finish) override { return {}; }
+    //============ WSocketContext::Listener end ============//
+
+private:
+    using Handler = void (IoUringWSocket::*)(const io_uring_cqe &cqe);
+
+    // Routes a completion back to the socket and tracks in-flight operations
+    struct Operation : IoUringOperation {
+        Operation(IoUringWSocket *owner, Handler handler) : owner_(owner), handler_(handler) {}
+        void OnComplete(const io_uring_cqe &cqe) override;
+
+        IoUringWSocket *owner_;
+        Handler         handler_;
+    };
+
+    // Get an SQE for `op` and account for it
+    io_uring_sqe *PrepareOperation(Operation &op);
+
+    void OnConnect(const io_uring_cqe &cqe);
+    void OnRecv(const io_uring_cqe &cqe);
+    void OnSend(const io_uring_cqe &cqe);
+    void OnShutdown(const io_uring_cqe &cqe);
+
+    void ArmRecv();
+    // Called by the loop, write out the queued frames
+    void Flush();
+    void SubmitSend();
+    void RequestFlush();
+
+private:
+    friend class IoUringLoop;
+
+    IoUringLoop   &loop_;
+    int            fd_ = -1;
+    WSocketContext wsocket_context_;
+
+    Operation connect_op_{this, &IoUringWSocket::OnConnect};
+    Operation recv_op_{this, &IoUringWSocket::OnRecv};
+    Operation send_op_{this, &IoUringWSocket::OnSend};
+    Operation shutdown_op_{this, &IoUringWSocket::OnShutdown};
+
+    sockaddr_storage address_{};
+
+    std::pmr::vector<uint8_t> pending_; // frames queued since the last flush
+    std::pmr::vector<uint8_t> writing_; // frames owned by the in-flight send
+    size_t                    written_ = 0;
+
+    bool recv_armed_         = false;
+    bool send_in_flight_     = false;
+    bool flush_scheduled_    = false;
+    bool shutdown_requested_ = false;
+    bool shutdown_submitted_ = false;
+    bool shutdown_linked_    = false; // the in-flight send carries the shutdown
+
+    int                             outstanding_ = 0; // operations in flight
+    std::shared_ptr<IoUringWSocket> self_;            // held while operations are in flight
+
+    // IoUringLoop active list
+    IoUringWSocket *prev_ = nullptr;
+    IoUringWSocket *next_ = nullptr;
+};
+
+/**
+ * Listening socket accepting through one multishot accept
+ *
+ * Must outlive the loop's Run.
+ */
+class IoUringAcceptor : public IoUringOperation {
+public:
+    using AcceptHandler = std::function<void(int fd)>;
+
+    explicit IoUringAcceptor(IoUringLoop &loop) : loop_(loop) {}
+    ~IoUringAcceptor() override { Close(); }
+
+    IoUringAcceptor(const IoUringAcceptor &)            = delete;
+    IoUringAcceptor &operator=(const IoUringAcceptor &) = delete;
+
+    // Bind and listen, false with errno set on failure
+    bool Open(const sockaddr *address, socklen_t address_len, int backlog = SOMAXCONN);
+
+    // Accept connections, `handler` owns each accepted fd
+    void Start(AcceptHandler &&handler);
+
+    void Close();
+
+private:
+    void Arm();
+    void OnComplete(const io_uring_cqe &cqe) override;
+
+private:
+    IoUringLoop  &loop_;
+    int           fd_ = -1;
+    AcceptHandler handler_;
+};
+
+//============ IoUringLoop start ============//
+
+IoUringLoop::~IoUringLoop() {
+    flush_queue_.clear();
+    // closing the ring drops every in-flight operation, so nothing keeps the sockets alive anymore
+    ring_.Close();
+
+    std::vector<std::shared_ptr<IoUringWSocket>> release;
+    while(active_) {
+        auto *socket         = active_;
+        socket->outstanding_ = 0;
+        release.push_back(std::move(socket->self_));
+        this->Unlink(socket);
+    }
+    release.clear();
+
+    if(event_fd_ >= 0) {
+        ::close(event_fd_);
+    }
+}
+
+bool IoUringLoop::Open(const Options &options) {
+    if(!ring_.Open(options.entries)) {
+        return false;
+    }
+    if(!buffers_.Open(ring_, BUFFER_GROUP_ID, options.buffer_count, options.buffer_size)) {
+        return false;
+    }
+    event_fd_ = ::eventfd(0, EFD_CLOEXEC);
+    if(event_fd_ < 0) {
+        return false;
+    }
+    this->ArmWakeup();
+    return true;
+}
+
+void IoUringLoop::Run() {
+    while(!stopped_.load(std::memory_order_acquire)) {
+        this->FlushSockets();
+
+        int ret = ring_.SubmitAndWait(1);
+        if(ret < 0 && ret != -EBUSY && ret != -EAGAIN) {
+            break;
+        }
+        ring_.ForEachCqe([](const io_uring_cqe &cqe) {
+            if(auto *op = reinterpret_cast<IoUringOperation *>(cqe.user_data)) {
+                op->OnComplete(cqe);
+            }
+        });
+    }
+    this->FlushSockets();
+    ring_.Submit();
+}
+
+void IoUringLoop::Stop() {
+    stopped_.store(true, std::memory_order_release);
+    uint64_t one = 1;
+    std::ignore  = ::write(event_fd_, &one, sizeof(one));
+}
+
+void IoUringLoop::FlushSockets() {
+    // flushing may queue more work, drain a snapshot
+    while(!flush_queue_.empty()) {
+        flushing_.swap(flush_queue_);
+        for(auto &socket : flushing_) {
+            socket->Flush();
+        }
+        flushing_.clear();
+    }
+}
+
+void IoUringLoop::Link(IoUringWSocket *socket) {
+    socket->prev_ = nullptr;
+    socket->next_ = active_;
+    if(active_) {
+        active_->prev_ = socket;
+    }
+    active_ = socket;
+}
+
+void IoUringLoop::Unlink(IoUringWSocket *socket) {
+    if(socket->prev_) {
+        socket->prev_->next_ = socket->next_;
+    } else if(active_ == socket) {
+        active_ = socket->next_;
+    }
+    if(socket->next_) {
+        socket->next_->prev_ = socket->prev_;
+    }
+    socket->prev_ = socket->next_ = nullptr;
+}
+
+void IoUringLoop::ArmWakeup() {
+    if(stopped_.load(std::memory_order_acquire)) {
+        return;
+    }
+    auto *sqe = ring_.GetSqe();
+    if(sqe == nullptr) {
+        return;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd     = event_fd_;
+    sqe->addr   = reinterpret_cast<uint64_t>(&wakeup_.value_);
+    sqe->len    = sizeof(wakeup_.value_);
+    Prepare(sqe, &wakeup_);
+}
+
+//============ IoUringLoop end ============//
+
+//============ IoUringWSocket start ============//
+
+void IoUringWSocket::Initialize() {
+    wsocket_context_.ResetListener(this);
+
+    // queue the frames, the loop writes them out before its next submit
+    wsocket_context_.ResetSendHandler([this](const Buffer &buffer) {
+        pending_.insert(pending_.end(), buffer.buf, buffer.buf + buffer.size);
+        this->RequestFlush();
+    });
+}
+
+IoUringWSocket::~IoUringWSocket() {
+    wsocket_context_.ResetListener(nullptr);
+    wsocket_context_.ResetSendHandler(nullptr);
+    if(fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+void IoUringWSocket::Start() { this->ArmRecv(); }
+
+void IoUringWSocket::Handshake(const sockaddr *address, socklen_t address_len) {
+    fd_ = ::socket(address->sa_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd_ < 0) {
+        this->OnError(std::error_code(errno, std::system_category()));
+        return;
+    }
+    if(address->sa_family == AF_INET || address->sa_family == AF_INET6) {
+        int one = 1;
+        ::setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    // the kernel may read the address after the submit returns
+    std::memcpy(&address_, address, std::min<size_t>(address_len, sizeof(address_)));
+
+    auto *sqe = this->PrepareOperation(connect_op_);
+    if(sqe == nullptr) {
+        return;
+    }
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd     = fd_;
+    sqe->addr   = reinterpret_cast<uint64_t>(&address_);
+    sqe->off    = address_len;
+}
+
+void IoUringWSocket::Stop() {
+    shutdown_requested_ = true;
+    this->RequestFlush();
+}
+
+void IoUringWSocket::Operation::OnComplete(const io_uring_cqe &cqe) {
+    auto _this = owner_->shared_from_this();
+    (owner_->*handler_)(cqe);
+
+    // a multishot operation stays in flight while the kernel sets F_MORE
+    if(!(cqe.flags & IORING_CQE_F_MORE) && --_this->outstanding_ == 0) {
+        _this->loop_.Unlink(owner_);
+        _this->self_.reset();
+    }
+}
+
+io_uring_sqe *IoUringWSocket::PrepareOperation(Operation &op) {
+    auto *sqe = loop_.Ring().GetSqe();
+    if(sqe == nullptr) {
+        this->OnError(std::make_error_code(std::errc::resource_unavailable_try_again));
+        return nullptr;
+    }
+    IoUringLoop::Prepare(sqe, &op);
+    if(outstanding_++ == 0) {
+        self_ = this->shared_from_this();
+        loop_.Link(this);
+    }
+    return sqe;
+}
+
+void IoUringWSocket::OnConnect(const io_uring_cqe &cqe) {
+    if(cqe.res < 0) {
+        this->OnError(std::error_code(-cqe.res, std::system_category()));
+        return;
+    }
+    this->Start();
+    this->wsocket_context_.Handshake();
+}
+
+void IoUringWSocket::ArmRecv() {
+    auto *sqe = this->PrepareOperation(recv_op_);
+    if(sqe == nullptr) {
+        return;
+    }
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->fd        = fd_;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = loop_.Buffers().GroupId();
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    recv_armed_    = true;
+}
+
+void IoUringWSocket::OnRecv(const io_uring_cqe &cqe) {
+    if(!(cqe.flags & IORING_CQE_F_MORE)) {
+        recv_armed_ = false;
+    }
+
+    if(cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+        auto buffer_id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        // Feed copies into the parser, the buffer goes straight back to the kernel
+        this->wsocket_context_.Feed({loop_.Buffers().Data(buffer_id), static_cast<size_t>(cqe.res)});
+        loop_.Buffers().Recycle(buffer_id);
+
+        if(this->wsocket_context_.IsFailed()) {
+            // protocol error, the close frame is already queued
+            this->Stop();
+            return;
+        }
+    } else if(cqe.res == 0) {
+        if(!shutdown_submitted_) {
+            // peer went away without our Stop
+            this->OnError(std::make_error_code(std::errc::connection_aborted));
+        }
+        return;
+    } else if(cqe.res != -ENOBUFS) {
+        this->OnError(std::error_code(-cqe.res, std::system_category()));
+        return;
+    }
+
+    // multishot ended early (out of buffers or CQ overflow), keep reading
+    if(!recv_armed_ && !shutdown_submitted_) {
+        this->ArmRecv();
+    }
+}
+
+void IoUringWSocket::RequestFlush() {
+    if(flush_scheduled_) {
+        return;
+    }
+    flush_scheduled_ = true;
+    loop_.ScheduleFlush(this->shared_from_this());
+}
+
+void IoUringWSocket::Flush() {
+    flush_scheduled_ = false;
+    if(send_in_flight_ || fd_ < 0) {
+        // OnSend continues with the rest
+        return;
+    }
+
+    if(pending_.empty()) {
+        if(shutdown_requested_ && !shutdown_submitted_) {
+            auto *sqe = this->PrepareOperation(shutdown_op_);
+            if(sqe) {
+                sqe->opcode         = IORING_OP_SHUTDOWN;
+                sqe->fd             = fd_;
+                sqe->len            = SHUT_RDWR;
+                shutdown_submitted_ = true;
+            }
+        }
+        return;
+    }
+
+    writing_.swap(pending_);
+    pending_.clear();
+    written_ = 0;
+    this->SubmitSend();
+}
+
+void IoUringWSocket::SubmitSend() {
+    auto *sqe = this->PrepareOperation(send_op_);
+    if(sqe == nullptr) {
+        return;
+    }
+    sqe->opcode     = IORING_OP_SEND;
+    sqe->fd         = fd_;
+    sqe->addr       = reinterpret_cast<uint64_t>(writing_.data() + written_);
+    sqe->len        = static_cast<uint32_t>(writing_.size() - written_);
+    sqe->msg_flags  = MSG_NOSIGNAL;
+    send_in_flight_ = true;
+
+    if(shutdown_requested_ && pending_.empty()) {
+        // the last frames and the shutdown as one chain; WAITALL fails the chain on a short send
+        sqe->flags |= IOSQE_IO_LINK;
+        sqe->msg_flags |= MSG_WAITALL;
+
+        auto *shutdown = this->PrepareOperation(shutdown_op_);
+        if(shutdown) {
+            shutdown->opcode    = IORING_OP_SHUTDOWN;
+            shutdown->fd        = fd_;
+            shutdown->len       = SHUT_RDWR;
+            shutdown_submitted_ = true;
+            shutdown_linked_    = true;
+        } else {
+            // nothing to chain to, the shutdown follows from OnSend
+            sqe->flags &= ~IOSQE_IO_LINK;
+        }
+    }
+}
+
+void IoUringWSocket::OnSend(const io_uring_cqe &cqe) {
+    send_in_flight_ = false;
+    if(shutdown_linked_) {
+        shutdown_linked_ = false;
+        if(cqe.res < 0 || written_ + static_cast<size_t>(cqe.res) < writing_.size()) {
+            // the chain broke and the shutdown is cancelled, its CQE comes next; the resubmit links a new one
+            shutdown_submitted_ = false;
+        }
+    }
+    if(cqe.res < 0) {
+        this->OnError(std::error_code(-cqe.res, std::system_category()));
+        return;
+    }
+
+    written_ += static_cast<size_t>(cqe.res);
+    if(written_ < writing_.size()) {
+        this->SubmitSend();
+        return;
+    }
+    writing_.clear();
+    if(!pending_.empty() || (shutdown_requested_ && !shutdown_submitted_)) {
+        this->Flush();
+    }
+}
+
+void IoUringWSocket::OnShutdown(const io_uring_cqe &cqe) {
+    // -ECANCELED: the linked send came up short, OnSend already cleared shutdown_submitted_ and the
+    // resubmit may have linked a new shutdown, which this completion must not clear again
+}
+
+//============ IoUringWSocket end ============//
+
+//============ IoUringAcceptor start ============//
+
+bool IoUringAcceptor::Open(const sockaddr *address, socklen_t address_len, int backlog) {
+    fd_ = ::socket(address->sa_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd_ < 0) {
+        return false;
+    }
+    int one = 1;
+    ::setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(::bind(fd_, address, address_len) != 0 || ::listen(fd_, backlog) != 0) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void IoUringAcceptor::Start(AcceptHandler &&handler) {
+    handler_ = std::move(handler);
+    this->Arm();
+}
+
+void IoUringAcceptor::Close() {
+    if(fd_ >= 0) {
+        // fails the pending accept
+        ::shutdown(fd_, SHUT_RDWR);
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+void IoUringAcceptor::Arm() {
+    auto *sqe = loop_.Ring().GetSqe();
+    if(sqe == nullptr) {
+        return;
+    }
+    sqe->opcode       = IORING_OP_ACCEPT;
+    sqe->fd           = fd_;
+    sqe->ioprio       = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    IoUringLoop::Prepare(sqe, this);
+}
+
+void IoUringAcceptor::OnComplete(const io_uring_cqe &cqe) {
+    if(cqe.res >= 0) {
+        int one = 1;
+        ::setsockopt(cqe.res, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if(handler_) {
+            handler_(cqe.res);
+        } else {
+            ::close(cqe.res);
+        }
+    }
+    if(!(cqe.flags & IORING_CQE_F_MORE) && fd_ >= 0 && cqe.res != -EINVAL) {
+        this->Arm();
+    }
+}
+
+//============ IoUringAcceptor end ============//
+
+} // namespace wsocket
+
+#endif // __linux__ && WITH_IO_URING
+
+#endif // WSOCKET__IO_URING_WSOCKET_HPP
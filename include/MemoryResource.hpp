@@ -0,0 +1,379 @@
+#pragma once
+#ifndef WSOCKET__MEMORY_RESOURCE_HPP
+#define WSOCKET__MEMORY_RESOURCE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include "BufferPool.hpp"
+
+namespace wsocket {
+
+/**
+ * BufferPool as a std::pmr::memory_resource, the library default
+ *
+ * Stateless: blocks may be freed on any thread, as with BufferPool::Free.
+ */
+class BufferPoolResource : public std::pmr::memory_resource {
+public:
+    static constexpr size_t ALIGNMENT = 16;
+
+    static BufferPoolResource *Instance() {
+        // never destroyed, blocks may be freed during static destruction
+        static auto *instance = new BufferPoolResource();
+        return instance;
+    }
+
+private:
+    BufferPoolResource() = default;
+
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        if(alignment > ALIGNMENT) {
+            return ::operator new(bytes, std::align_val_t(alignment));
+        }
+        return BufferPool::Allocate(bytes);
+    }
+    void do_deallocate(void *data, size_t bytes, size_t alignment) override {
+        if(alignment > ALIGNMENT) {
+            ::operator delete(data, std::align_val_t(alignment));
+            return;
+        }
+        BufferPool::Free(data);
+    }
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+};
+
+// `resource`, or the BufferPoolResource when it is null
+inline std::pmr::memory_resource *ResourceOrDefault(std::pmr::memory_resource *resource) {
+    return resource ? resource : BufferPoolResource::Instance();
+}
+
+/**
+ * Owning byte buffer from a memory_resource, 16-byte aligned
+ *
+ * From the BufferPoolResource the whole size class is usable, so Size() may
+ * exceed the requested size.
+ */
+class ResourceBuffer {
+public:
+    ResourceBuffer() = default;
+    ResourceBuffer(size_t size, std::pmr::memory_resource *resource);
+    ~ResourceBuffer() { this->Reset(); }
+
+    ResourceBuffer(ResourceBuffer &&other) noexcept { this->Swap(other); }
+    ResourceBuffer &operator=(ResourceBuffer &&other) noexcept {
+        ResourceBuffer tmp(std::move(other));
+        this->Swap(tmp);
+        return *this;
+    }
+
+    uint8_t *Data() const { return data_; }
+    size_t   Size() const { return size_; }
+
+    explicit operator bool() const { return data_ != nullptr; }
+
+    // Give the storage back to its resource
+    void Reset();
+
+private:
+    void Swap(ResourceBuffer &other) noexcept {
+        std::swap(resource_, other.resource_);
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+    }
+
+private:
+    std::pmr::memory_resource *resource_ = nullptr;
+    uint8_t                   *data_     = nullptr;
+    size_t                     size_     = 0;
+};
+
+/**
+ * Monotonic arena for memory that lives as long as one message
+ *
+ * Allocation bumps a pointer and deallocation does nothing; Release drops
+ * everything at once and keeps the first block for the next message. Set on
+ * a WSocketContext it is released after each complete message has been
+ * delivered, so a callback can build pmr containers from it for free.
+ * Not thread safe.
+ */
+class MessageArena : public std::pmr::memory_resource {
+public:
+    static constexpr size_t INITIAL_SIZE_DEFAULT = 16 * 1024; // 16k
+
+    /**
+     * @param initial_size Bytes taken from `upstream` up front and kept across Release
+     * @param upstream Where blocks beyond the first come from, null for the BufferPoolResource
+     */
+    explicit MessageArena(size_t initial_size = INITIAL_SIZE_DEFAULT, std::pmr::memory_resource *upstream = nullptr)
+        : initial_(initial_size, ResourceOrDefault(upstream)),
+          arena_(initial_.Data(), initial_.Size(), ResourceOrDefault(upstream)) {}
+
+    MessageArena(const MessageArena &)            = delete;
+    MessageArena &operator=(const MessageArena &) = delete;
+
+    // Free everything allocated since the last Release
+    void Release() { arena_.release(); }
+
+private:
+    void *do_allocate(size_t bytes, size_t alignment) override { return arena_.allocate(bytes, alignment); }
+    void  do_deallocate(void *, size_t, size_t) override {}
+    bool  do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+
+private:
+    ResourceBuffer                      initial_;
+    std::pmr::monotonic_buffer_resource arena_;
+};
+
+/**
+ * Memory mapped in 2 MiB huge pages
+ *
+ * Uses explicit huge pages (MAP_HUGETLB) when the system has some reserved
+ * and 2 MiB aligned mappings advised for transparent huge pages otherwise.
+ * Requests above half a page get mappings of their own and are unmapped on
+ * deallocation; smaller ones are carved from a shared page and only given
+ * back when the resource is destroyed, which suits it as the upstream of a
+ * pool resource that keeps its chunks anyway. Other platforms get 2 MiB
+ * aligned heap blocks.
+ */
+class HugePageResource : public std::pmr::memory_resource {
+public:
+    static constexpr size_t PAGE_SIZE = 2 * 1024 * 1024; // 2M
+
+    HugePageResource() = default;
+    ~HugePageResource() override;
+
+    HugePageResource(const HugePageResource &)            = delete;
+    HugePageResource &operator=(const HugePageResource &) = delete;
+
+    // Bytes currently mapped
+    size_t MappedBytes() const { return mapped_bytes_.load(std::memory_order_relaxed); }
+    // Whether explicit huge pages were available, otherwise the mappings rely on transparent huge pages
+    bool HugeTlb() const { return hugetlb_.load(std::memory_order_relaxed); }
+
+private:
+    static size_t RoundUp(size_t size) { return (size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE; }
+
+    void *Map(size_t size);
+    void  Unmap(void *data, size_t size);
+
+    void *do_allocate(size_t bytes, size_t alignment) override;
+    void  do_deallocate(void *data, size_t bytes, size_t alignment) override;
+    bool  do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+
+private:
+    std::mutex             mutex_;
+    std::vector<uint8_t *> pages_;           // shared pages small requests are carved from
+    size_t                 page_offset_ = 0; // into pages_.back()
+
+    std::atomic<size_t> mapped_bytes_{0};
+    std::atomic<bool>   hugetlb_{false};
+    std::atomic<bool>   hugetlb_failed_{false}; // stop asking once MAP_HUGETLB failed
+};
+
+/**
+ * Pool resource whose chunks live in 2 MiB huge pages
+ *
+ * Receive buffers, send queues and compression buffers taken from it share
+ * a few huge pages instead of spreading over many 4 KiB pages, which keeps
+ * TLB misses down on servers with many connections.
+ */
+class HugePagePool : public std::pmr::memory_resource {
+public:
+    // larger blocks get huge pages of their own
+    static constexpr size_t LARGEST_POOLED_BLOCK = HugePageResource::PAGE_SIZE / 2;
+
+    /**
+     * @param synchronized Whether several threads allocate from the pool,
+     *        an unsynchronized pool suits one io thread
+     */
+    explicit HugePagePool(bool synchronized = true);
+
+    HugePagePool(const HugePagePool &)            = delete;
+    HugePagePool &operator=(const HugePagePool &) = delete;
+
+    const HugePageResource &Pages() const { return pages_; }
+
+private:
+    void *do_allocate(size_t bytes, size_t alignment) override { return pool_->allocate(bytes, alignment); }
+    void  do_deallocate(void *data, size_t bytes, size_t alignment) override {
+        pool_->deallocate(data, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+
+private:
+    HugePageResource                           pages_;
+    std::unique_ptr<std::pmr::memory_resource> pool_;
+};
+
+/**
+ * Forwards to an upstream resource and counts what is outstanding
+ *
+ * One per tenant gives per-tenant memory accounting, thread safe.
+ */
+class CountingResource : public std::pmr::memory_resource {
+public:
+    explicit CountingResource(std::pmr::memory_resource *upstream = nullptr)
+        : upstream_(ResourceOrDefault(upstream)) {}
+
+    size_t   BytesInUse() const { return bytes_in_use_.load(std::memory_order_relaxed); }
+    size_t   PeakBytes() const { return peak_bytes_.load(std::memory_order_relaxed); }
+    uint64_t Allocations() const { return allocations_.load(std::memory_order_relaxed); }
+
+private:
+    void *do_allocate(size_t bytes, size_t alignment) override;
+    void  do_deallocate(void *data, size_t bytes, size_t alignment) override {
+        upstream_->deallocate(data, bytes, alignment);
+        bytes_in_use_.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+
+private:
+    std::pmr::memory_resource *upstream_;
+    std::atomic<size_t>        bytes_in_use_{0};
+    std::atomic<size_t>        peak_bytes_{0};
+    std::atomic<uint64_t>      allocations_{0};
+};
+
+//============ ResourceBuffer start ============//
+
+ResourceBuffer::ResourceBuffer(size_t size, std::pmr::memory_resource *resource) : resource_(resource) {
+    if(resource_ == BufferPoolResource::Instance()) {
+        // the whole size class is usable
+        data_ = static_cast<uint8_t *>(BufferPool::Allocate(size, &size_));
+    } else {
+        data_ = static_cast<uint8_t *>(resource_->allocate(size, BufferPoolResource::ALIGNMENT));
+        size_ = size;
+    }
+}
+
+void ResourceBuffer::Reset() {
+    if(data_) {
+        resource_->deallocate(data_, size_, BufferPoolResource::ALIGNMENT);
+    }
+    data_ = nullptr;
+    size_ = 0;
+}
+
+//============ ResourceBuffer end ============//
+
+//============ HugePageResource start ============//
+
+HugePageResource::~HugePageResource() {
+    for(auto *page : pages_) {
+        this->Unmap(page, PAGE_SIZE);
+    }
+}
+
+void *HugePageResource::Map(size_t size) {
+#ifdef __linux__
+    void *data = MAP_FAILED;
+    if(!hugetlb_failed_) {
+        data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(data != MAP_FAILED) {
+            mapped_bytes_ += size;
+            hugetlb_ = true;
+            return data;
+        }
+        hugetlb_failed_ = true;
+    }
+
+    // no huge pages reserved, over-map to get a 2M aligned range for transparent huge pages
+    size_t span = size + PAGE_SIZE;
+    data        = ::mmap(nullptr, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(data == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    auto  *raw     = static_cast<uint8_t *>(data);
+    auto  *aligned = reinterpret_cast<uint8_t *>(RoundUp(reinterpret_cast<uintptr_t>(raw)));
+    size_t head    = aligned - raw;
+    if(head > 0) {
+        ::munmap(raw, head);
+    }
+    if(span - head - size > 0) {
+        ::munmap(aligned + size, span - head - size);
+    }
+    ::madvise(aligned, size, MADV_HUGEPAGE);
+    mapped_bytes_ += size;
+    return aligned;
+#else
+    auto *data = ::operator new(size, std::align_val_t(PAGE_SIZE));
+    mapped_bytes_ += size;
+    return data;
+#endif
+}
+
+void HugePageResource::Unmap(void *data, size_t size) {
+#ifdef __linux__
+    ::munmap(data, size);
+#else
+    ::operator delete(data, std::align_val_t(PAGE_SIZE));
+#endif
+    mapped_bytes_ -= size;
+}
+
+void *HugePageResource::do_allocate(size_t bytes, size_t alignment) {
+    if(bytes > PAGE_SIZE / 2 || alignment > PAGE_SIZE) {
+        return this->Map(RoundUp(bytes));
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t                      offset = (page_offset_ + alignment - 1) / alignment * alignment;
+    if(pages_.empty() || offset + bytes > PAGE_SIZE) {
+        pages_.push_back(static_cast<uint8_t *>(this->Map(PAGE_SIZE)));
+        offset = 0;
+    }
+    page_offset_ = offset + bytes;
+    return pages_.back() + offset;
+}
+
+void HugePageResource::do_deallocate(void *data, size_t bytes, size_t alignment) {
+    if(bytes > PAGE_SIZE / 2 || alignment > PAGE_SIZE) {
+        this->Unmap(data, RoundUp(bytes));
+    }
+    // carved from a shared page, reclaimed with the resource
+}
+
+//============ HugePageResource end ============//
+
+//============ HugePagePool start ============//
+
+HugePagePool::HugePagePool(bool synchronized) {
+    std::pmr::pool_options options;
+    options.largest_required_pool_block = LARGEST_POOLED_BLOCK;
+    if(synchronized) {
+        pool_ = std::make_unique<std::pmr::synchronized_pool_resource>(options, &pages_);
+    } else {
+        pool_ = std::make_unique<std::pmr::unsynchronized_pool_resource>(options, &pages_);
+    }
+}
+
+//============ HugePagePool end ============//
+
+//============ CountingResource start ============//
+
+void *CountingResource::do_allocate(size_t bytes, size_t alignment) {
+    auto *data = upstream_->allocate(bytes, alignment);
+    allocations_.fetch_add(1, std::memory_order_relaxed);
+    auto in_use = bytes_in_use_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    auto peak   = peak_bytes_.load(std::memory_order_relaxed);
+    while(in_use > peak && !peak_bytes_.compare_exchange_weak(peak, in_use, std::memory_order_relaxed)) {
+    }
+    return data;
+}
+
+//============ CountingResource end ============//
+
+} // namespace wsocket
+
+#endif // WSOCKET__MEMORY_RESOURCE_HPP
@@ -0,0 +1,141 @@
+#pragma once
+#ifndef WSOCKET__MESSAGE_HANDLE_HPP
+#define WSOCKET__MESSAGE_HANDLE_HPP
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <utility>
+
+#include "SlidingBuffer.hpp"
+
+namespace wsocket {
+
+/**
+ * Owned handle to a received text or binary frame
+ *
+ * The handle pins the storage the payload lives in, a receive or
+ * decompression buffer taken over from the connection, until the last
+ * reference is released. Handles are move-only, Share takes another
+ * reference explicitly, so a payload can be passed to another thread without
+ * copying it. The count is atomic and the storage may be released on any
+ * thread, provided its memory resource allows that; the default
+ * BufferPoolResource does.
+ */
+class MessageHandle {
+public:
+    MessageHandle() = default;
+    ~MessageHandle() { this->Reset(); }
+
+    MessageHandle(MessageHandle &&other) noexcept { this->Swap(other); }
+    MessageHandle &operator=(MessageHandle &&other) noexcept {
+        MessageHandle tmp(std::move(other));
+        this->Swap(tmp);
+        return *this;
+    }
+
+    MessageHandle(const MessageHandle &)            = delete;
+    MessageHandle &operator=(const MessageHandle &) = delete;
+
+    /**
+     * Take over `storage`, the payload is `size` bytes at `offset`
+     */
+    static MessageHandle Adopt(ResourceBuffer &&storage, size_t offset, size_t size, bool binary, bool finish);
+    // Copy `data` into a buffer from `resource`, null for the BufferPoolResource
+    static MessageHandle Copy(const Buffer &data, bool binary, bool finish,
+                              std::pmr::memory_resource *resource = nullptr);
+
+    // Another reference to the same payload
+    MessageHandle Share() const;
+
+    const uint8_t   *Data() const { return data_; }
+    size_t           Size() const { return size_; }
+    std::string_view Text() const { return std::string_view(reinterpret_cast<const char *>(data_), size_); }
+    Buffer           GetBuffer() const { return Buffer{data_, size_}; }
+
+    bool IsBinary() const { return binary_; }
+    bool IsText() const { return !binary_; }
+    // Last frame of the message
+    bool Finished() const { return finish_; }
+
+    // Handles sharing the payload, 0 for an empty handle
+    uint32_t UseCount() const { return block_ ? block_->refs.load(std::memory_order_relaxed) : 0; }
+
+    explicit operator bool() const { return block_ != nullptr; }
+
+    // Drop this reference, the last one gives the storage back to its resource
+    void Reset();
+
+private:
+    struct Block {
+        std::atomic<uint32_t> refs{1};
+        ResourceBuffer        storage;
+    };
+
+    void Swap(MessageHandle &other) noexcept {
+        std::swap(block_, other.block_);
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(binary_, other.binary_);
+        std::swap(finish_, other.finish_);
+    }
+
+private:
+    Block   *block_  = nullptr;
+    uint8_t *data_   = nullptr;
+    size_t   size_   = 0;
+    bool     binary_ = false;
+    bool     finish_ = false;
+};
+
+MessageHandle MessageHandle::Adopt(ResourceBuffer &&storage, size_t offset, size_t size, bool binary, bool finish) {
+    assert(offset + size <= storage.Size());
+
+    MessageHandle message;
+    // control blocks come from the pool too, they are freed on whichever thread drops the last reference
+    message.block_          = new(BufferPool::Allocate(sizeof(Block))) Block();
+    message.block_->storage = std::move(storage);
+    message.data_           = message.block_->storage.Data() + offset;
+    message.size_           = size;
+    message.binary_         = binary;
+    message.finish_         = finish;
+    return message;
+}
+
+MessageHandle MessageHandle::Copy(const Buffer &data, bool binary, bool finish, std::pmr::memory_resource *resource) {
+    ResourceBuffer storage(data.size, ResourceOrDefault(resource));
+    if(data.size > 0) {
+        std::memcpy(storage.Data(), data.buf, data.size);
+    }
+    return Adopt(std::move(storage), 0, data.size, binary, finish);
+}
+
+MessageHandle MessageHandle::Share() const {
+    MessageHandle message;
+    if(block_) {
+        block_->refs.fetch_add(1, std::memory_order_relaxed);
+        message.block_  = block_;
+        message.data_   = data_;
+        message.size_   = size_;
+        message.binary_ = binary_;
+        message.finish_ = finish_;
+    }
+    return message;
+}
+
+void MessageHandle::Reset() {
+    if(block_ && block_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        block_->~Block();
+        BufferPool::Free(block_);
+    }
+    block_ = nullptr;
+    data_  = nullptr;
+    size_  = 0;
+}
+
+} // namespace wsocket
+
+#endif // WSOCKET__MESSAGE_HANDLE_HPP
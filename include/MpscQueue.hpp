@@ -0,0 +1,57 @@
+#pragma once
+#ifndef WSOCKET__MPSC_QUEUE_HPP
+#define WSOCKET__MPSC_QUEUE_HPP
+
+#include <atomic>
+
+namespace wsocket {
+
+/**
+ * Intrusive lock-free multi-producer single-consumer queue
+ *
+ * Producers push with a single compare-exchange onto a stack, the consumer
+ * takes the whole stack with one exchange and reverses it to FIFO order.
+ * Push reports whether the queue was empty, which the first producer after
+ * a drain uses to schedule exactly one wakeup of the consumer.
+ *
+ * `Node` needs a `Node *next` member, nodes are owned by the caller.
+ */
+template <typename Node>
+class MpscQueue {
+public:
+    MpscQueue() = default;
+
+    MpscQueue(const MpscQueue &)            = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    // Thread safe, returns true if the queue was empty before
+    bool Push(Node *node) {
+        auto *head = head_.load(std::memory_order_relaxed);
+        do {
+            node->next = head;
+        } while(!head_.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+        return head == nullptr;
+    }
+
+    // Consumer only, detaches everything pushed so far, oldest first
+    Node *Drain() {
+        auto *node = head_.exchange(nullptr, std::memory_order_acquire);
+        Node *fifo = nullptr;
+        while(node) {
+            auto *next = node->next;
+            node->next = fifo;
+            fifo       = node;
+            node       = next;
+        }
+        return fifo;
+    }
+
+    bool Empty() const { return head_.load(std::memory_order_relaxed) == nullptr; }
+
+private:
+    std::atomic<Node *> head_{nullptr};
+};
+
+} // namespace wsocket
+
+#endif // WSOCKET__MPSC_QUEUE_HPP
@@ -0,0 +1,161 @@
+#pragma once
+#ifndef WSOCKET__RATE_LIMITER_HPP
+#define WSOCKET__RATE_LIMITER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+namespace wsocket {
+
+/**
+ * Token bucket, kept as the time the bucket is full again (GCRA)
+ *
+ * Charge always succeeds and may run the bucket into debt, it returns how
+ * long the caller should wait before the next charge conforms. The state is
+ * one atomic, so a bucket can be shared by connections on several threads.
+ */
+class TokenBucket {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    TokenBucket() = default;
+
+    TokenBucket(const TokenBucket &)            = delete;
+    TokenBucket &operator=(const TokenBucket &) = delete;
+
+    /**
+     * Not thread safe, configure before sharing the bucket
+     * @param rate Tokens per second, 0 disables the bucket
+     * @param burst Tokens a full bucket holds, 0 for one second worth
+     */
+    void Reset(double rate, double burst);
+
+    bool Enabled() const { return ns_per_token_ > 0; }
+
+    // Take `tokens`, returns the wait until the bucket is out of debt again, zero if it is not in debt
+    Clock::duration Charge(double tokens, Clock::time_point now);
+
+    // Wait until the bucket is out of debt, zero if it is not
+    Clock::duration Delay(Clock::time_point now) const;
+
+private:
+    static int64_t Nanos(Clock::time_point time) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    }
+
+private:
+    double               ns_per_token_ = 0;
+    int64_t              tolerance_ns_ = 0; // burst in time
+    std::atomic<int64_t> full_at_ns_{0};    // theoretical arrival time
+};
+
+struct RateLimit {
+    double messages_per_second = 0; // 0: unlimited
+    double bytes_per_second    = 0; // 0: unlimited
+    double message_burst       = 0; // 0: one second worth
+    double byte_burst          = 0; // 0: one second worth
+};
+
+/**
+ * Message and byte budgets for one direction of traffic
+ *
+ * An optional parent, e.g. one shared by all connections of a server, is
+ * charged along with the limiter and the longer of the two waits applies.
+ */
+class RateLimiter {
+public:
+    using Clock = TokenBucket::Clock;
+
+    RateLimiter() = default;
+    explicit RateLimiter(const RateLimit &limit) { this->SetLimit(limit); }
+
+    // Not thread safe, configure a shared limiter before handing it out
+    void SetLimit(const RateLimit &limit) {
+        messages_.Reset(limit.messages_per_second, limit.message_burst);
+        bytes_.Reset(limit.bytes_per_second, limit.byte_burst);
+    }
+    void SetParent(std::shared_ptr<RateLimiter> parent) { parent_ = std::move(parent); }
+
+    bool Enabled() const { return messages_.Enabled() || bytes_.Enabled() || (parent_ && parent_->Enabled()); }
+
+    // Charge the traffic here and in the parent, returns the wait before more conforms
+    Clock::duration Charge(uint64_t messages, uint64_t bytes, Clock::time_point now = Clock::now());
+
+    // Wait before more traffic conforms, zero if it does now
+    Clock::duration Delay(Clock::time_point now = Clock::now()) const;
+
+private:
+    TokenBucket                  messages_;
+    TokenBucket                  bytes_;
+    std::shared_ptr<RateLimiter> parent_;
+};
+
+//============ TokenBucket start ============//
+
+void TokenBucket::Reset(double rate, double burst) {
+    if(rate <= 0) {
+        ns_per_token_ = 0;
+        tolerance_ns_ = 0;
+        return;
+    }
+    ns_per_token_ = 1e9 / rate;
+    tolerance_ns_ = int64_t(ns_per_token_ * (burst > 0 ? burst : rate));
+    full_at_ns_.store(0, std::memory_order_relaxed);
+}
+
+TokenBucket::Clock::duration TokenBucket::Charge(double tokens, Clock::time_point now) {
+    if(!this->Enabled()) {
+        return {};
+    }
+    auto now_ns  = Nanos(now);
+    auto cost_ns = int64_t(tokens * ns_per_token_);
+    auto full_at = full_at_ns_.load(std::memory_order_relaxed);
+    auto next    = full_at;
+    do {
+        next = std::max(full_at, now_ns) + cost_ns;
+    } while(!full_at_ns_.compare_exchange_weak(full_at, next, std::memory_order_relaxed));
+    return std::chrono::nanoseconds(std::max<int64_t>(0, next - now_ns - tolerance_ns_));
+}
+
+TokenBucket::Clock::duration TokenBucket::Delay(Clock::time_point now) const {
+    if(!this->Enabled()) {
+        return {};
+    }
+    auto full_at = full_at_ns_.load(std::memory_order_relaxed);
+    return std::chrono::nanoseconds(std::max<int64_t>(0, full_at - Nanos(now) - tolerance_ns_));
+}
+
+//============ TokenBucket end ============//
+
+//============ RateLimiter start ============//
+
+RateLimiter::Clock::duration RateLimiter::Charge(uint64_t messages, uint64_t bytes, Clock::time_point now) {
+    Clock::duration delay{};
+    if(messages > 0) {
+        delay = std::max(delay, messages_.Charge(double(messages), now));
+    }
+    if(bytes > 0) {
+        delay = std::max(delay, bytes_.Charge(double(bytes), now));
+    }
+    if(parent_) {
+        delay = std::max(delay, parent_->Charge(messages, bytes, now));
+    }
+    return delay;
+}
+
+RateLimiter::Clock::duration RateLimiter::Delay(Clock::time_point now) const {
+    auto delay = std::max(messages_.Delay(now), bytes_.Delay(now));
+    if(parent_) {
+        delay = std::max(delay, parent_->Delay(now));
+    }
+    return delay;
+}
+
+//============ RateLimiter end ============//
+
+} // namespace wsocket
+
+#endif // WSOCKET__RATE_LIMITER_HPP
@@ -0,0 +1,357 @@
+#pragma once
+#ifndef WSOCKET__SHM_RING_HPP
+#define WSOCKET__SHM_RING_HPP
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace wsocket {
+
+// Producer and consumer indexes of one direction, each on its own cache line
+struct ShmRingHeader {
+    alignas(64) std::atomic<uint64_t> tail{0};           // bytes written, producer only
+    alignas(64) std::atomic<uint64_t> head{0};           // bytes read, consumer only
+    alignas(64) std::atomic<uint32_t> writer_blocked{0}; // producer has bytes that did not fit
+};
+
+// Wakeup state of one peer, the doorbell is a process-shared futex word
+struct ShmPeerHeader {
+    alignas(64) std::atomic<uint32_t> doorbell{0};
+    std::atomic<uint32_t> sleeping{0};
+    std::atomic<uint32_t> closed{0};
+};
+
+struct ShmSegmentHeader {
+    static constexpr uint32_t MAGIC   = 0x57534d31; // "WSM1"
+    static constexpr uint32_t VERSION = 1;
+
+    std::atomic<uint32_t> magic{0};
+    uint32_t              version  = VERSION;
+    uint64_t              capacity = 0;
+
+    ShmPeerHeader peers[2];
+    ShmRingHeader rings[2]; // ring i is written by peer i
+};
+
+/**
+ * Shared memory segment holding a pair of SPSC byte rings
+ *
+ * The creator is peer 0, it writes ring 0 and reads ring 1, the peer that
+ * opens the segment does the opposite. Rings carry the plain WSocket byte
+ * stream, so framing and handshake are unchanged.
+ *
+ * A named segment (shm_open) lets unrelated processes meet by name, an
+ * anonymous one (memfd) is shared by passing Fd() to a child or over a unix
+ * socket.
+ */
+class ShmSegment {
+public:
+    static constexpr size_t CAPACITY_DEFAULT = 1024 * 1024;
+
+    ShmSegment() = default;
+    ~ShmSegment() { this->Close(); }
+
+    ShmSegment(const ShmSegment &)            = delete;
+    ShmSegment &operator=(const ShmSegment &) = delete;
+    ShmSegment(ShmSegment &&other) noexcept { *this = std::move(other); }
+    ShmSegment &operator=(ShmSegment &&other) noexcept;
+
+    /**
+     * Create the segment as peer 0, false with errno set on failure
+     * @param name shm_open name such as "/wsocket-feed", empty for an anonymous memfd
+     * @param capacity bytes per direction, rounded up to a power of two
+     */
+    bool Create(const std::string &name, size_t capacity = CAPACITY_DEFAULT);
+
+    // Attach as peer 1
+    bool Open(const std::string &name);
+    bool Open(int fd);
+
+    // Remove the name, mapped segments stay valid
+    void Unlink();
+    void Close();
+
+    bool IsOpen() const { return header_ != nullptr; }
+    int  Fd() const { return fd_; }
+    int  Side() const { return side_; }
+
+    size_t            Capacity() const { return header_->capacity; }
+    ShmSegmentHeader &Header() { return *header_; }
+    ShmPeerHeader    &Self() { return header_->peers[side_]; }
+    ShmPeerHeader    &Peer() { return header_->peers[side_ ^ 1]; }
+    ShmRingHeader    &Outbound() { return header_->rings[side_]; }
+    ShmRingHeader    &Inbound() { return header_->rings[side_ ^ 1]; }
+    uint8_t          *OutboundData() { return data_ + size_t(side_) * header_->capacity; }
+    uint8_t          *InboundData() { return data_ + size_t(side_ ^ 1) * header_->capacity; }
+
+    static size_t DataOffset() { return (sizeof(ShmSegmentHeader) + 4095) & ~size_t(4095); }
+
+private:
+    bool Map(bool create, size_t capacity);
+
+private:
+    int               fd_     = -1;
+    int               side_   = 0;
+    void             *map_    = nullptr;
+    size_t            length_ = 0;
+    ShmSegmentHeader *header_ = nullptr;
+    uint8_t          *data_   = nullptr;
+    std::string       name_;
+};
+
+/**
+ * Lock-free writes and reads on one ring, wrap-around is hidden from callers
+ */
+class ShmRing {
+public:
+    ShmRing(ShmRingHeader &header, uint8_t *data, size_t capacity) :
+        header_(header), data_(data), mask_(capacity - 1) {}
+
+    // Producer side: copy as much of `data` as fits, returns the bytes written
+    size_t Write(const uint8_t *data, size_t len);
+    size_t Space() const;
+
+    // Consumer side: copy up to `len` bytes out, returns the bytes read
+    size_t Read(uint8_t *data, size_t len);
+    size_t Available() const;
+
+    ShmRingHeader &Header() { return header_; }
+
+private:
+    ShmRingHeader &header_;
+    uint8_t       *data_;
+    size_t         mask_;
+};
+
+/**
+ * Sleep and wake a peer through its doorbell futex
+ *
+ * The sleeper announces itself before the final check and the waker
+ * publishes its data before looking, with a full fence on both sides, so a
+ * wakeup cannot be lost. A waker that sees nobody asleep makes no syscall.
+ */
+namespace shm_doorbell {
+
+inline long Futex(std::atomic<uint32_t> &word, int op, uint32_t value) {
+    // process-shared: no FUTEX_PRIVATE_FLAG
+    return ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), op, value, nullptr, nullptr, 0);
+}
+
+inline void Ring(ShmPeerHeader &peer) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(peer.sleeping.load(std::memory_order_relaxed)) {
+        peer.doorbell.fetch_add(1, std::memory_order_release);
+        Futex(peer.doorbell, FUTEX_WAKE, 1);
+    }
+}
+
+// Block until rung unless `has_work` turns true after announcing the sleep
+template <typename HasWork>
+void Wait(ShmPeerHeader &self, HasWork &&has_work) {
+    uint32_t seq = self.doorbell.load(std::memory_order_acquire);
+    self.sleeping.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(!has_work()) {
+        Futex(self.doorbell, FUTEX_WAIT, seq);
+    }
+    self.sleeping.store(0, std::memory_order_relaxed);
+}
+
+} // namespace shm_doorbell
+
+//============ ShmSegment start ============//
+
+ShmSegment &ShmSegment::operator=(ShmSegment &&other) noexcept {
+    if(this != &other) {
+        this->Close();
+        fd_     = std::exchange(other.fd_, -1);
+        side_   = other.side_;
+        map_    = std::exchange(other.map_, nullptr);
+        length_ = std::exchange(other.length_, 0);
+        header_ = std::exchange(other.header_, nullptr);
+        data_   = std::exchange(other.data_, nullptr);
+        name_   = std::move(other.name_);
+    }
+    return *this;
+}
+
+bool ShmSegment::Create(const std::string &name, size_t capacity) {
+    size_t rounded = 4096;
+    while(rounded < capacity) {
+        rounded <<= 1;
+    }
+
+    if(name.empty()) {
+        fd_ = ::memfd_create("wsocket-shm", MFD_CLOEXEC);
+    } else {
+        fd_ = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+    }
+    if(fd_ < 0) {
+        return false;
+    }
+    name_ = name;
+    side_ = 0;
+
+    if(::ftruncate(fd_, off_t(DataOffset() + 2 * rounded)) != 0 || !this->Map(true, rounded)) {
+        int error = errno;
+        this->Unlink();
+        this->Close();
+        errno = error;
+        return false;
+    }
+    return true;
+}
+
+bool ShmSegment::Open(const std::string &name) {
+    int fd = ::shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+    if(fd < 0) {
+        return false;
+    }
+    bool opened = this->Open(fd);
+    ::close(fd);
+    return opened;
+}
+
+bool ShmSegment::Open(int fd) {
+    fd_ = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if(fd_ < 0) {
+        return false;
+    }
+    side_ = 1;
+    if(!this->Map(false, 0)) {
+        int error = errno;
+        this->Close();
+        errno = error;
+        return false;
+    }
+    return true;
+}
+
+bool ShmSegment::Map(bool create, size_t capacity) {
+    struct stat st {};
+    if(::fstat(fd_, &st) != 0) {
+        return false;
+    }
+    if(size_t(st.st_size) < DataOffset()) {
+        errno = EINVAL;
+        return false;
+    }
+
+    length_ = size_t(st.st_size);
+    map_    = ::mmap(nullptr, length_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if(map_ == MAP_FAILED) {
+        map_ = nullptr;
+        return false;
+    }
+    header_ = static_cast<ShmSegmentHeader *>(map_);
+    data_   = static_cast<uint8_t *>(map_) + DataOffset();
+
+    if(create) {
+        new(header_) ShmSegmentHeader();
+        header_->capacity = capacity;
+        // peer 1 only trusts the layout once the magic is visible
+        header_->magic.store(ShmSegmentHeader::MAGIC, std::memory_order_release);
+        return true;
+    }
+
+    auto capacity_ok = [&]() {
+        auto cap = header_->capacity;
+        return cap != 0 && (cap & (cap - 1)) == 0 && DataOffset() + 2 * cap <= length_;
+    };
+    if(header_->magic.load(std::memory_order_acquire) != ShmSegmentHeader::MAGIC ||
+       header_->version != ShmSegmentHeader::VERSION || !capacity_ok()) {
+        errno = EINVAL;
+        return false;
+    }
+    return true;
+}
+
+void ShmSegment::Unlink() {
+    if(!name_.empty()) {
+        ::shm_unlink(name_.c_str());
+        name_.clear();
+    }
+}
+
+void ShmSegment::Close() {
+    if(map_) {
+        ::munmap(map_, length_);
+        map_ = nullptr;
+    }
+    header_ = nullptr;
+    data_   = nullptr;
+    if(fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+//============ ShmSegment end ============//
+
+//============ ShmRing start ============//
+
+size_t ShmRing::Space() const {
+    auto tail = header_.tail.load(std::memory_order_relaxed);
+    auto head = header_.head.load(std::memory_order_acquire);
+    return mask_ + 1 - size_t(tail - head);
+}
+
+size_t ShmRing::Write(const uint8_t *data, size_t len) {
+    auto tail = header_.tail.load(std::memory_order_relaxed);
+    auto head = header_.head.load(std::memory_order_acquire);
+    len       = std::min(len, mask_ + 1 - size_t(tail - head));
+    if(len == 0) {
+        return 0;
+    }
+
+    size_t offset = size_t(tail) & mask_;
+    size_t first  = std::min(len, mask_ + 1 - offset);
+    std::memcpy(data_ + offset, data, first);
+    std::memcpy(data_, data + first, len - first);
+    header_.tail.store(tail + len, std::memory_order_release);
+    return len;
+}
+
+size_t ShmRing::Available() const {
+    auto head = header_.head.load(std::memory_order_relaxed);
+    auto tail = header_.tail.load(std::memory_order_acquire);
+    return size_t(tail - head);
+}
+
+size_t ShmRing::Read(uint8_t *data, size_t len) {
+    auto head = header_.head.load(std::memory_order_relaxed);
+    auto tail = header_.tail.load(std::memory_order_acquire);
+    len       = std::min(len, size_t(tail - head));
+    if(len == 0) {
+        return 0;
+    }
+
+    size_t offset = size_t(head) & mask_;
+    size_t first  = std::min(len, mask_ + 1 - offset);
+    std::memcpy(data, data_ + offset, first);
+    std::memcpy(data + first, data_, len - first);
+    header_.head.store(head + len, std::memory_order_release);
+    return len;
+}
+
+//============ ShmRing end ============//
+
+} // namespace wsocket
+
+#endif // __linux__
+
+#endif // WSOCKET__SHM_RING_HPP
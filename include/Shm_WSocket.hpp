@@ -0,0 +1,300 @@
+#pragma once
+#ifndef WSOCKET__SHM_WSOCKET_HPP
+#define WSOCKET__SHM_WSOCKET_HPP
+
+#ifdef __linux__
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "ShmRing.hpp"
+#include "WSocketContext.hpp"
+
+namespace wsocket {
+
+/**
+ * WSocket between two same-host peers over a ShmSegment
+ *
+ * Each direction is an SPSC byte ring carrying the ordinary frame stream,
+ * so one peer calls Handshake and the other answers exactly as over TCP.
+ * Writes copy straight into the ring and reads straight out of it into the
+ * parser buffer, no syscall is made while the peer is awake. An idle peer
+ * sleeps on a futex after an optional busy-poll spin.
+ *
+ * Single threaded per peer: Poll or Run, and every send, happen on one
+ * thread, only Stop may be called from another. A peer that dies without
+ * Stop is not detected.
+ */
+class ShmWSocket : public WSocketContext::Listener {
+protected:
+    explicit ShmWSocket(ShmSegment &&segment);
+
+public:
+    static constexpr int READS_PER_POLL = 16; // flush the sends corked by callbacks this often
+
+    static std::unique_ptr<ShmWSocket> Create(ShmSegment &&segment) {
+        return std::unique_ptr<ShmWSocket>(new ShmWSocket(std::move(segment)));
+    }
+
+    ~ShmWSocket() override;
+
+    // Start the WSocket handshake, the other peer only has to Poll or Run
+    void Handshake() { this->wsocket_context_.Handshake(); }
+
+    // Move whatever is ready in both directions without blocking, returns the bytes read
+    size_t Poll();
+
+    // Poll once, when nothing was ready spin and then sleep until something is
+    void RunOnce();
+
+    // RunOnce until disconnected
+    void Run();
+
+    // Close our side once the queued output is in the ring, thread safe
+    void Stop();
+
+    /**
+     * Spin before sleeping, 0 (default) sleeps at once
+     * @param spins polls of the rings before falling back to the futex
+     */
+    void SetBusyPoll(uint32_t spins) { busy_poll_spins_ = spins; }
+
+    void Ping() { this->wsocket_context_.Ping(); }
+    void Pong() { this->wsocket_context_.Pong(); }
+    void Text(std::string_view text, bool finish = true) { this->wsocket_context_.SendText(text, finish); }
+    void Binary(Buffer buffer, bool finish = true) { this->wsocket_context_.SendBinary(buffer, finish); }
+
+    // Serialize a message straight into a pooled send buffer, see WSocketContext::FrameBuilder
+    WSocketContext::FrameBuilder BuildBinary(size_t reserve) { return this->wsocket_context_.BuildBinary(reserve); }
+    WSocketContext::FrameBuilder BuildText(size_t reserve) { return this->wsocket_context_.BuildText(reserve); }
+
+    void Close(CloseCode code) { this->wsocket_context_.Close(code); }
+    void Close(int16_t code, std::string_view reason) { this->wsocket_context_.Close(code, reason); }
+
+    void                       Cork() { this->wsocket_context_.Cork(); }
+    void                       Uncork() { this->wsocket_context_.Uncork(); }
+    WSocketContext::BatchScope Batch() { return WSocketContext::BatchScope(this->wsocket_context_); }
+
+    void EnableUtf8Validation(bool enable) { this->wsocket_context_.EnableUtf8Validation(enable); }
+
+    // Deliver received text and binary frames to OnMessage as owned handles, see WSocketContext::EnableOwnedMessages
+    void EnableOwnedMessages(bool enable) { this->wsocket_context_.EnableOwnedMessages(enable); }
+
+    // Fail the connection on frames announcing more than `size` bytes, see WSocketContext::SetMaxFrameSize
+    void SetMaxFrameSize(size_t size) { this->wsocket_context_.SetMaxFrameSize(size); }
+
+    // Receive large binary payloads into OnBinaryDestination buffers, see WSocketContext::SetDirectReceiveThreshold
+    void SetDirectReceiveThreshold(size_t threshold) { this->wsocket_context_.SetDirectReceiveThreshold(threshold); }
+
+    // Write large binary messages to mmap'd temp files for OnSpilled, see WSocketContext::SetSpillThreshold
+    void SetSpillThreshold(size_t threshold, std::string directory = "/tmp") {
+        this->wsocket_context_.SetSpillThreshold(threshold, std::move(directory));
+    }
+
+    bool IsDisconnected() const { return disconnected_; }
+
+protected:
+    //============ WSocketContext::Listener start ============//
+    void         OnError(std::error_code code) override {}
+    CompressType OnHandshake(const std::vector<CompressType> &request_compress_type) override {
+        return CompressType::None;
+    }
+    void   OnConnected() override {}
+    void   OnClose(int16_t code, const std::string &reason) override {}
+    void   OnPing() override { this->wsocket_context_.Pong(); }
+    void   OnPong() override {}
+    void   OnText(std::string_view text, bool finish) override {}
+    void   OnBinary(Buffer buffer, bool finish) override {}
+    void   OnMessage(MessageHandle message) override {}
+    void   OnSpilled(SpilledMessage message) override {}
+    Buffer OnBinaryDestination(size_t size, bool finish) override { return {}; }
+    //============ WSocketContext::Listener end ============//
+
+    // Both sides are done with the segment
+    virtual void OnDisconnected() {}
+
+private:
+    void   Write(const Buffer &buffer);
+    size_t FlushPending();
+    bool   HasWork();
+    void   Shutdown();
+    void   Disconnect(std::error_code code);
+
+    static void Relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+private:
+    ShmSegment     segment_;
+    ShmRing        outbound_;
+    ShmRing        inbound_;
+    WSocketContext wsocket_context_;
+
+    std::vector<uint8_t> pending_; // bytes that did not fit in the ring yet
+    size_t               pending_offset_ = 0;
+
+    std::atomic<bool> stop_requested_{false};
+    bool              shutdown_        = false;
+    bool              disconnected_    = false;
+    uint32_t          busy_poll_spins_ = 0;
+};
+
+//============ ShmWSocket start ============//
+
+ShmWSocket::ShmWSocket(ShmSegment &&segment) :
+    segment_(std::move(segment)),
+    outbound_(segment_.Outbound(), segment_.OutboundData(), segment_.Capacity()),
+    inbound_(segment_.Inbound(), segment_.InboundData(), segment_.Capacity()) {
+    wsocket_context_.ResetListener(this);
+    wsocket_context_.ResetSendHandler([this](const Buffer &buffer) { this->Write(buffer); });
+}
+
+ShmWSocket::~ShmWSocket() {
+    wsocket_context_.ResetListener(nullptr);
+    wsocket_context_.ResetSendHandler(nullptr);
+    this->Shutdown();
+}
+
+size_t ShmWSocket::Poll() {
+    if(disconnected_) {
+        return 0;
+    }
+    if(!pending_.empty()) {
+        this->FlushPending();
+    }
+
+    size_t read = 0;
+    {
+        // frames sent from the callbacks go into the ring together
+        auto batch = this->Batch();
+        for(int i = 0; i < READS_PER_POLL && inbound_.Available() > 0; ++i) {
+            auto buf = wsocket_context_.PrepareWrite();
+            auto len = inbound_.Read(buf.buf, buf.size);
+            read += len;
+            wsocket_context_.CommitWrite(len);
+            if(disconnected_) {
+                return read;
+            }
+            if(wsocket_context_.IsFailed()) {
+                // protocol error, the close frame is already queued
+                stop_requested_.store(true, std::memory_order_relaxed);
+                break;
+            }
+        }
+    }
+
+    if(read > 0) {
+        // the peer may be asleep waiting for space
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(inbound_.Header().writer_blocked.load(std::memory_order_relaxed)) {
+            shm_doorbell::Ring(segment_.Peer());
+        }
+    }
+
+    if(stop_requested_.load(std::memory_order_acquire) && pending_.empty()) {
+        this->Disconnect({});
+    } else if(segment_.Peer().closed.load(std::memory_order_acquire) && inbound_.Available() == 0) {
+        this->Disconnect(std::make_error_code(std::errc::connection_aborted));
+    }
+    return read;
+}
+
+void ShmWSocket::RunOnce() {
+    if(this->Poll() > 0 || disconnected_) {
+        return;
+    }
+    bool ready = false;
+    for(uint32_t i = 0; i < busy_poll_spins_ && !(ready = this->HasWork()); ++i) {
+        Relax();
+    }
+    if(!ready) {
+        shm_doorbell::Wait(segment_.Self(), [this]() { return this->HasWork(); });
+    }
+}
+
+void ShmWSocket::Run() {
+    while(!disconnected_) {
+        this->RunOnce();
+    }
+}
+
+void ShmWSocket::Stop() {
+    stop_requested_.store(true, std::memory_order_release);
+    // wake our own Run
+    shm_doorbell::Ring(segment_.Self());
+}
+
+bool ShmWSocket::HasWork() {
+    return inbound_.Available() > 0 || (!pending_.empty() && outbound_.Space() > 0) ||
+           segment_.Peer().closed.load(std::memory_order_acquire) ||
+           stop_requested_.load(std::memory_order_acquire);
+}
+
+void ShmWSocket::Write(const Buffer &buffer) {
+    if(shutdown_) {
+        return;
+    }
+
+    size_t written = 0;
+    if(pending_.empty()) {
+        written = outbound_.Write(buffer.buf, buffer.size);
+        if(written > 0) {
+            shm_doorbell::Ring(segment_.Peer());
+        }
+    }
+    if(written < buffer.size) {
+        // ring full, Poll moves the rest as the peer reads
+        pending_.insert(pending_.end(), buffer.buf + written, buffer.buf + buffer.size);
+        outbound_.Header().writer_blocked.store(1, std::memory_order_relaxed);
+    }
+}
+
+size_t ShmWSocket::FlushPending() {
+    auto written = outbound_.Write(pending_.data() + pending_offset_, pending_.size() - pending_offset_);
+    if(written > 0) {
+        shm_doorbell::Ring(segment_.Peer());
+    }
+    pending_offset_ += written;
+    if(pending_offset_ == pending_.size()) {
+        pending_.clear();
+        pending_offset_ = 0;
+        outbound_.Header().writer_blocked.store(0, std::memory_order_relaxed);
+    }
+    return written;
+}
+
+void ShmWSocket::Shutdown() {
+    if(shutdown_ || !segment_.IsOpen()) {
+        return;
+    }
+    shutdown_ = true;
+    segment_.Self().closed.store(1, std::memory_order_release);
+    shm_doorbell::Ring(segment_.Peer());
+}
+
+void ShmWSocket::Disconnect(std::error_code code) {
+    if(disconnected_) {
+        return;
+    }
+    bool requested = stop_requested_.load(std::memory_order_acquire);
+    this->Shutdown();
+    disconnected_ = true;
+
+    if(code && !requested) {
+        this->OnError(code);
+    }
+    this->OnDisconnected();
+}
+
+//============ ShmWSocket end ============//
+
+} // namespace wsocket
+
+#endif // __linux__
+
+#endif // WSOCKET__SHM_WSOCKET_HPP
@@ -5,8 +5,10 @@
 #include <cassert>
 #include <cstring> // memcpy/memmove
 
+#include <algorithm>
 #include <memory>
 
+#include "MemoryResource.hpp"
 
 namespace wsocket {
 
@@ -21,7 +23,11 @@ struct Buffer {
 class SlidingBuffer {
 public:
     SlidingBuffer() = default;
-    explicit SlidingBuffer(size_t len) { Resize(len); }
+    // @param resource Where the storage comes from, null for the BufferPoolResource
+    explicit SlidingBuffer(std::pmr::memory_resource *resource) : resource_(resource) {}
+    explicit SlidingBuffer(size_t len, std::pmr::memory_resource *resource = nullptr) : resource_(resource) {
+        Resize(len);
+    }
     ~SlidingBuffer() = default;
 
     SlidingBuffer(const SlidingBuffer &)            = delete;
@@ -30,15 +36,21 @@ public:
     // Adjust buffer size, preserving existing data
     void Resize(size_t len);
 
+    // Return the storage to its resource, the buffer must hold no data
+    void Release() {
+        assert(buffer_used_ == 0);
+        buffer_.Reset();
+    }
+
     // Get current data in the buffer
-    Buffer GetData() const { return {buffer_.get(), buffer_used_}; }
+    Buffer GetData() const { return {buffer_.Data(), buffer_used_}; }
     // Get amount of used data in the buffer
     size_t GetDataLen() const { return buffer_used_; }
     // Get total buffer size
-    size_t GetSize() const { return buffer_size_; }
+    size_t GetSize() const { return buffer_.Size(); }
 
     // Prepare buffer space for writing
-    Buffer PrepareWrite() const { return Buffer{buffer_.get() + buffer_used_, buffer_size_ - buffer_used_}; }
+    Buffer PrepareWrite() const { return Buffer{buffer_.Data() + buffer_used_, buffer_.Size() - buffer_used_}; }
 
     // Commit written data to the buffer
     void CommitWrite(size_t len) { buffer_used_ += len; }
@@ -61,9 +73,15 @@ public:
      */
     void Consume(size_t start, size_t len);
 
+    /**
+     * Hand the storage over with the first `len` bytes at its start, the data
+     * after them moves to a new storage of at least `keep_size` bytes
+     */
+    ResourceBuffer Detach(size_t len, size_t keep_size);
+
 private:
-    std::unique_ptr<uint8_t[]> buffer_;
-    size_t                     buffer_size_ = 0;
+    std::pmr::memory_resource *resource_ = nullptr;
+    ResourceBuffer             buffer_;
     size_t                     buffer_used_ = 0;
 };
 
@@ -73,22 +91,21 @@ void SlidingBuffer::Resize(size_t len) {
         len = buffer_used_;
     }
 
-    std::unique_ptr<uint8_t[]> tmp = std::make_unique<uint8_t[]>(len);
+    ResourceBuffer tmp(len, ResourceOrDefault(resource_));
 
     if(buffer_ && buffer_used_ > 0) {
-        std::memcpy(tmp.get(), buffer_.get(), buffer_used_);
+        std::memcpy(tmp.Data(), buffer_.Data(), buffer_used_);
     }
 
-    std::swap(this->buffer_, tmp);
-    buffer_size_ = len;
+    this->buffer_ = std::move(tmp);
 }
 
 void SlidingBuffer::Feed(const Buffer &buf) {
-    if(buf.size + buffer_used_ > buffer_size_) {
+    if(buf.size + buffer_used_ > buffer_.Size()) {
         Resize(buf.size + buffer_used_);
     }
 
-    std::memcpy(buffer_.get() + buffer_used_, buf.buf, buf.size);
+    std::memcpy(buffer_.Data() + buffer_used_, buf.buf, buf.size);
     buffer_used_ += buf.size;
 }
 
@@ -96,7 +113,7 @@ void SlidingBuffer::Consume(size_t len) {
     buffer_used_ -= len;
 
     if(buffer_used_ > 0)
-        std::memmove(buffer_.get(), buffer_.get() + len, buffer_used_);
+        std::memmove(buffer_.Data(), buffer_.Data() + len, buffer_used_);
 }
 
 void SlidingBuffer::Consume(size_t start, size_t len) {
@@ -107,9 +124,24 @@ void SlidingBuffer::Consume(size_t start, size_t len) {
 
     buffer_used_ -= len;
     if(buffer_used_ > 0 && move_len > 0)
-        std::memmove(buffer_.get() + start, buffer_.get() + start + len, move_len);
+        std::memmove(buffer_.Data() + start, buffer_.Data() + start + len, move_len);
 }
 
+ResourceBuffer SlidingBuffer::Detach(size_t len, size_t keep_size) {
+    assert(buffer_used_ >= len);
+
+    size_t         rest     = buffer_used_ - len;
+    ResourceBuffer detached = std::move(buffer_);
+
+    // nothing left behind: the next write allocates lazily
+    buffer_used_ = 0;
+    if(rest > 0) {
+        buffer_ = ResourceBuffer(std::max(rest, keep_size), ResourceOrDefault(resource_));
+        std::memcpy(buffer_.Data(), detached.Data() + len, rest);
+        buffer_used_ = rest;
+    }
+    return detached;
+}
 
 } // namespace wsocket
 
@@ -0,0 +1,286 @@
+#pragma once
+#ifndef WSOCKET__SPILL_FILE_HPP
+#define WSOCKET__SPILL_FILE_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "SlidingBuffer.hpp"
+
+namespace wsocket {
+
+/**
+ * A received message assembled in a temporary file, mapped read-only
+ *
+ * The file has no name and goes away with the handle. Pages come from the
+ * page cache as the payload is read, so a message of several GB costs next
+ * to no resident memory until it is touched. Move-only; Fd() may be passed
+ * on, e.g. to WSocket::SendFile, or linked into the file system to keep it.
+ */
+class SpilledMessage {
+public:
+    SpilledMessage() = default;
+    ~SpilledMessage() { this->Reset(); }
+
+    SpilledMessage(SpilledMessage &&other) noexcept { this->Swap(other); }
+    SpilledMessage &operator=(SpilledMessage &&other) noexcept {
+        SpilledMessage tmp(std::move(other));
+        this->Swap(tmp);
+        return *this;
+    }
+
+    SpilledMessage(const SpilledMessage &)            = delete;
+    SpilledMessage &operator=(const SpilledMessage &) = delete;
+
+    const uint8_t *Data() const { return data_; }
+    size_t         Size() const { return size_; }
+    Buffer         GetBuffer() const { return Buffer{data_, size_}; }
+
+    // The file holding the message, owned by the handle
+    int Fd() const { return fd_; }
+
+    explicit operator bool() const { return fd_ >= 0; }
+
+    // Unmap and close the file
+    void Reset();
+
+private:
+    friend class SpillFile;
+
+    void Swap(SpilledMessage &other) noexcept {
+        std::swap(fd_, other.fd_);
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+    }
+
+private:
+    int      fd_   = -1;
+    uint8_t *data_ = nullptr;
+    size_t   size_ = 0;
+};
+
+/**
+ * Writes a message into an unnamed temporary file through mmap windows
+ *
+ * Every range is reserved with fallocate before it is mapped, so a full disk
+ * fails the reservation instead of raising SIGBUS on a write through the
+ * mapping. One window is mapped at a time and unmapped when the next one is
+ * mapped; its dirty pages stay in the page cache instead of in the process.
+ * POSIX only, Open fails on Windows.
+ */
+class SpillFile {
+public:
+    static constexpr size_t WINDOW_SIZE = 16 * 1024 * 1024; // 16M
+
+    SpillFile() = default;
+    ~SpillFile() { this->Reset(); }
+
+    SpillFile(const SpillFile &)            = delete;
+    SpillFile &operator=(const SpillFile &) = delete;
+
+    // Create the file in `directory`
+    bool Open(const std::string &directory);
+
+    bool IsOpen() const { return fd_ >= 0; }
+
+    // Bytes reserved so far
+    uint64_t Size() const { return size_; }
+
+    /**
+     * Reserve `len` more bytes at the end of the file
+     * @return The first window of the new range, empty on failure
+     */
+    Buffer Extend(size_t len);
+
+    // The window `offset` bytes into the range of the last Extend, empty on failure
+    Buffer Window(size_t offset);
+
+    // Copy `data` to the end of the file
+    bool Append(const Buffer &data);
+
+    // Map the whole file read-only and hand it over, the writer is reset afterwards
+    SpilledMessage Finish();
+
+    // Drop the file
+    void Reset();
+
+private:
+    void Unmap();
+
+private:
+    int      fd_           = -1;
+    uint64_t size_         = 0;
+    uint64_t extent_start_ = 0; // range of the last Extend
+    size_t   extent_len_   = 0;
+    uint8_t *map_          = nullptr; // current window, from the page it starts in
+    size_t   map_len_      = 0;
+};
+
+#ifndef _WIN32
+
+//============ SpilledMessage start ============//
+
+void SpilledMessage::Reset() {
+    if(data_) {
+        ::munmap(data_, size_);
+    }
+    if(fd_ >= 0) {
+        ::close(fd_);
+    }
+    fd_   = -1;
+    data_ = nullptr;
+    size_ = 0;
+}
+
+//============ SpilledMessage end ============//
+
+//============ SpillFile start ============//
+
+bool SpillFile::Open(const std::string &directory) {
+    this->Reset();
+#ifdef O_TMPFILE
+    fd_ = ::open(directory.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+#endif
+    if(fd_ < 0) {
+        // no O_TMPFILE on this system or file system, a named file unlinked at once
+        std::string path = directory + "/wsocket_spill_XXXXXX";
+        fd_              = ::mkstemp(&path[0]);
+        if(fd_ < 0) {
+            return false;
+        }
+        ::unlink(path.c_str());
+        ::fcntl(fd_, F_SETFD, FD_CLOEXEC);
+    }
+    return true;
+}
+
+Buffer SpillFile::Extend(size_t len) {
+    if(fd_ < 0 || len == 0) {
+        return {};
+    }
+    this->Unmap();
+
+    bool reserved = false;
+#ifdef __linux__
+    reserved = ::fallocate(fd_, 0, off_t(size_), off_t(len)) == 0;
+    if(!reserved && errno != EOPNOTSUPP) {
+        // ENOSPC and the like
+        return {};
+    }
+#endif
+    if(!reserved && ::ftruncate(fd_, off_t(size_ + len)) != 0) {
+        return {};
+    }
+    extent_start_ = size_;
+    extent_len_   = len;
+    size_ += len;
+    return this->Window(0);
+}
+
+Buffer SpillFile::Window(size_t offset) {
+    this->Unmap();
+    if(fd_ < 0 || offset >= extent_len_) {
+        return {};
+    }
+
+    static const uint64_t page = uint64_t(::sysconf(_SC_PAGESIZE));
+
+    uint64_t pos   = extent_start_ + offset;
+    uint64_t start = pos / page * page;
+    size_t   len   = std::min(WINDOW_SIZE, extent_len_ - offset);
+
+    void *map = ::mmap(nullptr, size_t(pos - start) + len, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, off_t(start));
+    if(map == MAP_FAILED) {
+        return {};
+    }
+    map_     = static_cast<uint8_t *>(map);
+    map_len_ = size_t(pos - start) + len;
+    return {map_ + (pos - start), len};
+}
+
+bool SpillFile::Append(const Buffer &data) {
+    auto window = this->Extend(data.size);
+    for(size_t done = 0; window.buf;) {
+        std::memcpy(window.buf, data.buf + done, window.size);
+        done += window.size;
+        if(done == data.size) {
+            this->Unmap();
+            return true;
+        }
+        window = this->Window(done);
+    }
+    return false;
+}
+
+SpilledMessage SpillFile::Finish() {
+    this->Unmap();
+
+    SpilledMessage message;
+    if(fd_ < 0 || size_ == 0) {
+        this->Reset();
+        return message;
+    }
+    void *map = ::mmap(nullptr, size_t(size_), PROT_READ, MAP_SHARED, fd_, 0);
+    if(map == MAP_FAILED) {
+        this->Reset();
+        return message;
+    }
+    ::madvise(map, size_t(size_), MADV_SEQUENTIAL);
+
+    message.fd_   = fd_;
+    message.data_ = static_cast<uint8_t *>(map);
+    message.size_ = size_t(size_);
+
+    fd_ = -1;
+    this->Reset();
+    return message;
+}
+
+void SpillFile::Reset() {
+    this->Unmap();
+    if(fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    size_         = 0;
+    extent_start_ = 0;
+    extent_len_   = 0;
+}
+
+void SpillFile::Unmap() {
+    if(map_) {
+        ::munmap(map_, map_len_);
+        map_     = nullptr;
+        map_len_ = 0;
+    }
+}
+
+//============ SpillFile end ============//
+
+#else
+
+void SpilledMessage::Reset() {}
+
+bool SpillFile::Open(const std::string &directory) { return false; }
+Buffer SpillFile::Extend(size_t len) { return {}; }
+Buffer SpillFile::Window(size_t offset) { return {}; }
+bool SpillFile::Append(const Buffer &data) { return false; }
+SpilledMessage SpillFile::Finish() { return {}; }
+void SpillFile::Reset() {}
+void SpillFile::Unmap() {}
+
+#endif
+
+} // namespace wsocket
+
+#endif // WSOCKET__SPILL_FILE_HPP
@@ -0,0 +1,395 @@
+#pragma once
+#ifndef WSOCKET__UTF8_VALIDATOR_HPP
+#define WSOCKET__UTF8_VALIDATOR_HPP
+
+#include <cstdint>
+#include <cstring>
+
+#if(defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define WSOCKET_UTF8_SIMD 1
+#include <immintrin.h>
+#endif
+
+#include "SlidingBuffer.hpp"
+
+namespace wsocket {
+
+/**
+ * Incremental UTF-8 validator
+ *
+ * Text messages may be split over several frames and a multi-byte sequence
+ * may be split between two of them, so the validator keeps the state of an
+ * unfinished sequence between calls to Feed.
+ *
+ * The bulk of every chunk is checked with the vectorized lookup algorithm of
+ * Keiser & Lemire ("Validating UTF-8 In Less Than One Instruction Per Byte"),
+ * AVX2 or SSE4 is selected at runtime on x86 with GCC/Clang, other compilers and
+ * targets use the scalar state machine. Only the (at most 3) bytes around fragment
+ * boundaries go through the scalar path.
+ */
+class Utf8Validator {
+public:
+    Utf8Validator() = default;
+
+    // Forget any unfinished sequence, call before validating a new message
+    void Reset() { need_ = 0; }
+
+    /**
+     * Validate the next chunk of a message
+     * @param buf Message bytes
+     * @param finish Whether this is the last chunk of the message
+     * @return false if the bytes are not valid UTF-8, or the message ends inside a sequence
+     */
+    bool Feed(const Buffer &buf, bool finish);
+
+    // Validate a complete message at once
+    static bool Validate(const uint8_t *data, size_t len) {
+        Utf8Validator validator;
+        return validator.Feed({const_cast<uint8_t *>(data), len}, true);
+    }
+
+private:
+    // Scalar state machine, returns false on an invalid byte
+    bool FeedScalar(const uint8_t *data, size_t len);
+
+    // Validate bytes that start and end on a character boundary
+    static bool ValidateComplete(const uint8_t *data, size_t len);
+
+    static bool ValidateCompleteScalar(const uint8_t *data, size_t len) {
+        Utf8Validator validator;
+        return validator.FeedScalar(data, len) && validator.need_ == 0;
+    }
+
+private:
+    int     need_ = 0;    // continuation bytes still expected
+    uint8_t low_  = 0x80; // accepted range of the next continuation byte
+    uint8_t high_ = 0xBF;
+};
+
+
+bool Utf8Validator::FeedScalar(const uint8_t *data, size_t len) {
+    size_t i = 0;
+    while(i < len) {
+        if(need_ == 0) {
+            // skip ascii 8 bytes at a time
+            while(i + 8 <= len) {
+                uint64_t word;
+                std::memcpy(&word, data + i, sizeof(word));
+                if(word & 0x8080808080808080ull) {
+                    break;
+                }
+                i += 8;
+            }
+            if(i >= len) {
+                break;
+            }
+
+            uint8_t c = data[i++];
+            if(c < 0x80) {
+                continue;
+            }
+            low_  = 0x80;
+            high_ = 0xBF;
+            if(c >= 0xC2 && c <= 0xDF) {
+                need_ = 1;
+            } else if(c >= 0xE0 && c <= 0xEF) {
+                need_ = 2;
+                if(c == 0xE0) {
+                    low_ = 0xA0; // overlong
+                } else if(c == 0xED) {
+                    high_ = 0x9F; // surrogates
+                }
+            } else if(c >= 0xF0 && c <= 0xF4) {
+                need_ = 3;
+                if(c == 0xF0) {
+                    low_ = 0x90; // overlong
+                } else if(c == 0xF4) {
+                    high_ = 0x8F; // above U+10FFFF
+                }
+            } else {
+                return false;
+            }
+            continue;
+        }
+
+        uint8_t c = data[i++];
+        if(c < low_ || c > high_) {
+            return false;
+        }
+        low_  = 0x80;
+        high_ = 0xBF;
+        need_--;
+    }
+    return true;
+}
+
+bool Utf8Validator::Feed(const Buffer &buf, bool finish) {
+    const uint8_t *data = buf.buf;
+    size_t         len  = buf.size;
+
+    // finish a sequence left over from the previous chunk
+    while(need_ > 0 && len > 0) {
+        if(!FeedScalar(data, 1)) {
+            return false;
+        }
+        data++;
+        len--;
+    }
+
+    if(len > 0) {
+        // cut before a trailing incomplete sequence, it is carried to the next chunk
+        size_t cut = len;
+        for(size_t back = 1; back <= 3 && back <= len; ++back) {
+            uint8_t c = data[len - back];
+            if((c & 0xC0) == 0x80) {
+                continue;
+            }
+            size_t seq = c < 0x80 ? 1 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+            if(seq > back) {
+                cut = len - back;
+            }
+            break;
+        }
+
+        if(!ValidateComplete(data, cut) || !FeedScalar(data + cut, len - cut)) {
+            Reset();
+            return false;
+        }
+    }
+
+    if(finish) {
+        bool complete = need_ == 0;
+        Reset();
+        return complete;
+    }
+    return true;
+}
+
+#ifdef WSOCKET_UTF8_SIMD
+
+namespace utf8_detail {
+
+// error classes of a (previous byte, current byte) pair, see Keiser & Lemire
+constexpr uint8_t TOO_SHORT      = 1 << 0; // 11______ 0_______ / 11______ 11______
+constexpr uint8_t TOO_LONG       = 1 << 1; // 0_______ 10______
+constexpr uint8_t OVERLONG_3     = 1 << 2; // 11100000 100_____
+constexpr uint8_t TOO_LARGE      = 1 << 3; // 11110100 1001____ ...
+constexpr uint8_t SURROGATE      = 1 << 4; // 11101101 101_____
+constexpr uint8_t OVERLONG_2     = 1 << 5; // 1100000_ 10______
+constexpr uint8_t TOO_LARGE_1000 = 1 << 6; // 11110101 1000____ ...
+constexpr uint8_t OVERLONG_4     = 1 << 6; // 11110000 1000____
+constexpr uint8_t TWO_CONTS      = 1 << 7; // 10______ 10______
+constexpr uint8_t CARRY          = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+#define WSOCKET_UTF8_BYTE_1_HIGH                                                                                       \
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TWO_CONTS, TWO_CONTS, TWO_CONTS,   \
+            TWO_CONTS, TOO_SHORT | OVERLONG_2, TOO_SHORT, TOO_SHORT | OVERLONG_3 | SURROGATE,                          \
+            TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+
+#define WSOCKET_UTF8_BYTE_1_LOW                                                                                        \
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, CARRY | OVERLONG_2, CARRY, CARRY, CARRY | TOO_LARGE,                 \
+            CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,                                    \
+            CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,                                    \
+            CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,                                    \
+            CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,                                    \
+            CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, CARRY | TOO_LARGE | TOO_LARGE_1000,                        \
+            CARRY | TOO_LARGE | TOO_LARGE_1000
+
+#define WSOCKET_UTF8_BYTE_2_HIGH                                                                                       \
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,                            \
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,                               \
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,                                                \
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,                                                 \
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+
+//============ SSE4 ============//
+
+struct Sse4 {
+    using vector = __m128i;
+    static constexpr size_t SIZE = 16;
+
+    struct State {
+        vector byte_1_high;
+        vector byte_1_low;
+        vector byte_2_high;
+        vector incomplete;
+
+        vector error;
+        vector prev_input;
+        vector prev_incomplete;
+    };
+
+    __attribute__((target("sse4.1"))) static vector High(vector v) {
+        return _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F));
+    }
+
+    __attribute__((target("sse4.1"))) static void Block(State &s, vector input) {
+        if(_mm_movemask_epi8(input) == 0) {
+            // ascii, only an unfinished sequence of the previous block can be wrong
+            s.error           = _mm_or_si128(s.error, s.prev_incomplete);
+            s.prev_incomplete = _mm_setzero_si128();
+            s.prev_input      = input;
+            return;
+        }
+        vector prev1 = _mm_alignr_epi8(input, s.prev_input, SIZE - 1);
+        vector sc    = _mm_and_si128(_mm_and_si128(_mm_shuffle_epi8(s.byte_1_high, High(prev1)),
+                                                   _mm_shuffle_epi8(s.byte_1_low, _mm_and_si128(prev1, _mm_set1_epi8(0x0F)))),
+                                     _mm_shuffle_epi8(s.byte_2_high, High(input)));
+
+        // a continuation byte is only legal as 2nd..4th byte of a sequence
+        vector prev2   = _mm_alignr_epi8(input, s.prev_input, SIZE - 2);
+        vector prev3   = _mm_alignr_epi8(input, s.prev_input, SIZE - 3);
+        vector third   = _mm_subs_epu8(prev2, _mm_set1_epi8(char(0xE0 - 0x80)));
+        vector fourth  = _mm_subs_epu8(prev3, _mm_set1_epi8(char(0xF0 - 0x80)));
+        vector must_23 = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8(char(0x80)));
+
+        s.error           = _mm_or_si128(s.error, _mm_xor_si128(must_23, sc));
+        s.prev_incomplete = _mm_subs_epu8(input, s.incomplete);
+        s.prev_input      = input;
+    }
+
+    __attribute__((target("sse4.1"))) static bool Validate(const uint8_t *data, size_t len) {
+        State s;
+        s.byte_1_high     = _mm_setr_epi8(WSOCKET_UTF8_BYTE_1_HIGH);
+        s.byte_1_low      = _mm_setr_epi8(WSOCKET_UTF8_BYTE_1_LOW);
+        s.byte_2_high     = _mm_setr_epi8(WSOCKET_UTF8_BYTE_2_HIGH);
+        s.incomplete      = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                          char(0xF0 - 1), char(0xE0 - 1), char(0xC0 - 1));
+        s.error           = _mm_setzero_si128();
+        s.prev_input      = _mm_setzero_si128();
+        s.prev_incomplete = _mm_setzero_si128();
+
+        size_t pos = 0;
+        for(; pos + SIZE <= len; pos += SIZE) {
+            Block(s, _mm_loadu_si128(reinterpret_cast<const vector *>(data + pos)));
+        }
+        if(pos < len) {
+            alignas(16) uint8_t tail[SIZE] = {};
+            std::memcpy(tail, data + pos, len - pos);
+            Block(s, _mm_load_si128(reinterpret_cast<const vector *>(tail)));
+        }
+        s.error = _mm_or_si128(s.error, s.prev_incomplete);
+        return _mm_testz_si128(s.error, s.error);
+    }
+};
+
+//============ AVX2 ============//
+
+struct Avx2 {
+    using vector = __m256i;
+    static constexpr size_t SIZE = 32;
+
+    struct State {
+        vector byte_1_high;
+        vector byte_1_low;
+        vector byte_2_high;
+        vector incomplete;
+
+        vector error;
+        vector prev_input;
+        vector prev_incomplete;
+    };
+
+    __attribute__((target("avx2"))) static vector High(vector v) {
+        return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+    }
+    // bytes of `input` shifted right by N, filled with the tail of `prev`
+    template <int N>
+    __attribute__((target("avx2"))) static vector Prev(vector input, vector prev) {
+        return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - N);
+    }
+
+    __attribute__((target("avx2"))) static void Block(State &s, vector input) {
+        if(_mm256_movemask_epi8(input) == 0) {
+            s.error           = _mm256_or_si256(s.error, s.prev_incomplete);
+            s.prev_incomplete = _mm256_setzero_si256();
+            s.prev_input      = input;
+            return;
+        }
+        vector prev1 = Prev<1>(input, s.prev_input);
+        vector sc    = _mm256_and_si256(
+                _mm256_and_si256(_mm256_shuffle_epi8(s.byte_1_high, High(prev1)),
+                                 _mm256_shuffle_epi8(s.byte_1_low, _mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)))),
+                _mm256_shuffle_epi8(s.byte_2_high, High(input)));
+
+        vector third   = _mm256_subs_epu8(Prev<2>(input, s.prev_input), _mm256_set1_epi8(char(0xE0 - 0x80)));
+        vector fourth  = _mm256_subs_epu8(Prev<3>(input, s.prev_input), _mm256_set1_epi8(char(0xF0 - 0x80)));
+        vector must_23 = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8(char(0x80)));
+
+        s.error           = _mm256_or_si256(s.error, _mm256_xor_si256(must_23, sc));
+        s.prev_incomplete = _mm256_subs_epu8(input, s.incomplete);
+        s.prev_input      = input;
+    }
+
+    __attribute__((target("avx2"))) static bool Validate(const uint8_t *data, size_t len) {
+        State s;
+        s.byte_1_high     = _mm256_setr_epi8(WSOCKET_UTF8_BYTE_1_HIGH, WSOCKET_UTF8_BYTE_1_HIGH);
+        s.byte_1_low      = _mm256_setr_epi8(WSOCKET_UTF8_BYTE_1_LOW, WSOCKET_UTF8_BYTE_1_LOW);
+        s.byte_2_high     = _mm256_setr_epi8(WSOCKET_UTF8_BYTE_2_HIGH, WSOCKET_UTF8_BYTE_2_HIGH);
+        s.incomplete      = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                             -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                             char(0xF0 - 1), char(0xE0 - 1), char(0xC0 - 1));
+        s.error           = _mm256_setzero_si256();
+        s.prev_input      = _mm256_setzero_si256();
+        s.prev_incomplete = _mm256_setzero_si256();
+
+        size_t pos = 0;
+        for(; pos + SIZE <= len; pos += SIZE) {
+            Block(s, _mm256_loadu_si256(reinterpret_cast<const vector *>(data + pos)));
+        }
+        if(pos < len) {
+            alignas(32) uint8_t tail[SIZE] = {};
+            std::memcpy(tail, data + pos, len - pos);
+            Block(s, _mm256_load_si256(reinterpret_cast<const vector *>(tail)));
+        }
+        s.error = _mm256_or_si256(s.error, s.prev_incomplete);
+        return _mm256_testz_si256(s.error, s.error);
+    }
+};
+
+#undef WSOCKET_UTF8_BYTE_1_HIGH
+#undef WSOCKET_UTF8_BYTE_1_LOW
+#undef WSOCKET_UTF8_BYTE_2_HIGH
+
+enum class Isa { Scalar, Sse4, Avx2 };
+
+inline Isa DetectIsa() {
+    static const Isa isa = []() {
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2")) {
+            return Isa::Avx2;
+        }
+        if(__builtin_cpu_supports("sse4.1")) {
+            return Isa::Sse4;
+        }
+        return Isa::Scalar;
+    }();
+    return isa;
+}
+
+} // namespace utf8_detail
+
+bool Utf8Validator::ValidateComplete(const uint8_t *data, size_t len) {
+    // short messages are not worth the vector setup
+    if(len < 16) {
+        return ValidateCompleteScalar(data, len);
+    }
+    switch(utf8_detail::DetectIsa()) {
+    case utf8_detail::Isa::Avx2:
+        return utf8_detail::Avx2::Validate(data, len);
+    case utf8_detail::Isa::Sse4:
+        return utf8_detail::Sse4::Validate(data, len);
+    default:
+        return ValidateCompleteScalar(data, len);
+    }
+}
+
+#else
+
+bool Utf8Validator::ValidateComplete(const uint8_t *data, size_t len) { return ValidateCompleteScalar(data, len); }
+
+#endif // WSOCKET_UTF8_SIMD
+
+} // namespace wsocket
+
+#endif // WSOCKET__UTF8_VALIDATOR_HPP
@@ -5,10 +5,13 @@
 #include <cstdint>
 #include <cstring>
 
+#include <algorithm>
 #include <optional>
 #include <unordered_set>
 #include <functional>
 #include <limits>
+#include <string>
+#include <vector>
 
 
 #ifdef _WIN32
@@ -25,9 +28,13 @@
 #endif
 
 
+#include "MemoryResource.hpp"
+#include "MessageHandle.hpp"
 #include "SlidingBuffer.hpp"
+#include "SpillFile.hpp"
 #include "Error.h"
 #include "Frame.hpp"
+#include "Utf8Validator.hpp"
 #include "compress/Compress.hpp"
 #include "compress/CompressManager.hpp"
 
@@ -40,17 +47,101 @@ public:
     public:
         virtual ~Listener() {}
         virtual void OnFrame(const Frame &frame) {}
+        // Where the payload of `header` should be received, an empty buffer keeps it in the receive buffer
+        virtual Buffer OnPayloadDestination(const FrameHeader &header) { return {}; }
+        // The next window of a payload whose destination is shorter than it, from `offset`; empty abandons the frame
+        virtual Buffer OnPayloadWindow(const FrameHeader &header, size_t offset) { return {}; }
+        // A frame above the maximum frame size was announced, parsing stops at it
+        virtual void OnFrameTooLong(const FrameHeader &header) {}
     };
 
-    explicit FrameParser(Listener *listener = nullptr) : listener_(listener) {}
+    static constexpr size_t MAX_FRAME_SIZE_DEFAULT = 8 * 1024 * 1024; // 8M
 
-    void   SetReceiveBufferSize(size_t len) { buffer_.Resize(len); }
-    Buffer PrepareWrite() const { return buffer_.PrepareWrite(); }
-    void   CommitWrite(size_t len) { buffer_.CommitWrite(len); }
+    /**
+     * @param resource Where the receive buffer comes from, null for the BufferPoolResource
+     */
+    explicit FrameParser(Listener *listener = nullptr, std::pmr::memory_resource *resource = nullptr)
+        : buffer_(resource), listener_(listener) {}
 
-    void Feed(const Buffer &buf) { buffer_.Feed(buf); }
+    // Receive buffer size, allocated on first use
+    void SetReceiveBufferSize(size_t len) {
+        receive_buffer_size_ = len;
+        if(buffer_.GetSize() > 0) {
+            buffer_.Resize(len);
+        }
+    }
+    /**
+     * Largest payload buffered in the receive buffer. A frame announcing more
+     * is reported to Listener::OnFrameTooLong as soon as its header is in,
+     * unless its payload goes to a listener destination; the buffer never
+     * grows beyond one such frame and its header.
+     */
+    void SetMaxFrameSize(size_t size) { max_frame_size_ = size; }
+
+    /**
+     * Offer frames with a payload of at least `threshold` bytes to
+     * Listener::OnPayloadDestination as soon as their header is in, 0 disables.
+     * A destination shorter than the payload is its first window, the rest
+     * come from Listener::OnPayloadWindow as each fills, and the frame is
+     * delivered with a null data pointer. A listener abandoning a frame must
+     * stop parsing, the rest of its payload cannot be told from frames.
+     */
+    void SetDirectThreshold(size_t threshold) { direct_threshold_ = threshold; }
+    // A payload is being received into a listener buffer, PrepareWrite hands out the rest of it
+    bool ReceivingDirect() const { return direct_.buf != nullptr; }
+
+    // Get writable space, the buffer grows when a pending frame does not fit
+    Buffer PrepareWrite() {
+        if(this->ReceivingDirect()) {
+            return {direct_.buf + direct_received_, direct_.size - direct_received_};
+        }
+        if(buffer_.GetSize() == 0 && receive_buffer_size_ > 0) {
+            buffer_.Resize(receive_buffer_size_);
+        } else if(buffer_.GetDataLen() == buffer_.GetSize()) {
+            this->Grow();
+        }
+        return buffer_.PrepareWrite();
+    }
+
+    /**
+     * Give the receive buffer back to its memory resource when it holds no partial frame,
+     * the next PrepareWrite borrows one of the configured size again
+     * @return true if no buffer is held afterwards and no payload is being received into a listener buffer
+     */
+    bool ReleaseBuffer() {
+        if(buffer_.GetDataLen() > 0) {
+            return false;
+        }
+        buffer_.Release();
+        return !this->ReceivingDirect();
+    }
+    void CommitWrite(size_t len) {
+        if(this->ReceivingDirect()) {
+            direct_received_ += len;
+            return;
+        }
+        buffer_.CommitWrite(len);
+    }
+
+    void Feed(Buffer buf) {
+        if(this->ReceivingDirect()) {
+            // the payload part goes to its destination, whatever follows it to the receive buffer
+            this->FillDirect(buf);
+            if(buf.size == 0) {
+                return;
+            }
+        }
+        if(buffer_.GetSize() == 0 && receive_buffer_size_ > 0) {
+            buffer_.Resize(receive_buffer_size_);
+        }
+        buffer_.Feed(buf);
+    }
 
     bool ParseOne() {
+        if(this->ReceivingDirect()) {
+            return this->FinishDirect();
+        }
+
         auto raw_data = buffer_.GetData();
 
         if(raw_data.size < 2) {
@@ -60,11 +151,27 @@ public:
 
         FrameHeader *header = reinterpret_cast<FrameHeader *>(raw_data.buf);
 
-        if(header->HeaderLength() > raw_data.size) {
+        if(size_t(header->HeaderLength()) > raw_data.size) {
             // need more data
             return false;
         }
 
+        if(direct_threshold_ > 0 && header->Length() >= direct_threshold_ && !offered_) {
+            if(this->StartDirect(raw_data)) {
+                return true;
+            }
+            // declined, the frame is buffered and not offered again
+            offered_ = true;
+        }
+
+        if(header->Length() > max_frame_size_) {
+            // the peer may announce up to 2^64 bytes, do not buffer on its word
+            if(this->listener_) {
+                listener_->OnFrameTooLong(*header);
+            }
+            return false;
+        }
+
         if(header->HeaderLength() + header->Length() > raw_data.size) {
             // need more data
             return false;
@@ -76,20 +183,143 @@ public:
         frame.data.size = header->Length();
         frame.data.buf  = raw_data.buf + header->HeaderLength();
 
+        frame_len_ = header->HeaderLength() + header->Length();
+        offered_   = false;
         if(this->listener_) {
             listener_->OnFrame(frame);
         }
 
-        buffer_.Consume(header->HeaderLength() + header->Length());
+        if(frame_len_ > 0) {
+            buffer_.Consume(frame_len_);
+        }
+        frame_len_ = 0;
 
         return true;
     }
 
+    /**
+     * From OnFrame only: take over the receive buffer holding the frame, which
+     * stays where it is, while data received after it moves to a new buffer.
+     * @return Empty when the frame fills less than half of the buffer and copying it out is cheaper
+     */
+    ResourceBuffer TakeFrame() {
+        if(frame_len_ == 0 || frame_len_ * 2 < buffer_.GetSize()) {
+            return {};
+        }
+        auto storage = buffer_.Detach(frame_len_, receive_buffer_size_);
+        frame_len_   = 0;
+        return storage;
+    }
+
     void ResetListener(Listener *listener) { listener_ = listener; }
 
+private:
+    // Ask for a destination for the frame at the start of `raw_data`, move what is already here into it
+    bool StartDirect(const Buffer &raw_data) {
+        FrameHeader header = *reinterpret_cast<FrameHeader *>(raw_data.buf);
+        if(!this->listener_) {
+            return false;
+        }
+        auto destination = listener_->OnPayloadDestination(header);
+        if(destination.buf == nullptr || destination.size == 0) {
+            return false;
+        }
+
+        direct_header_   = header;
+        direct_          = {destination.buf, std::min<size_t>(destination.size, header.Length())};
+        direct_offset_   = 0;
+        direct_received_ = 0;
+
+        Buffer have{raw_data.buf + header.HeaderLength(),
+                    std::min<size_t>(raw_data.size - header.HeaderLength(), header.Length())};
+        size_t len = have.size;
+        this->FillDirect(have);
+        buffer_.Consume(header.HeaderLength() + len - have.size);
+        return true;
+    }
+    // Deliver the direct frame once its payload is complete
+    bool FinishDirect() {
+        if(this->NextWindow() || !this->ReceivingDirect()) {
+            // need more data, or abandoned
+            return false;
+        }
+
+        Frame frame;
+        frame.header = direct_header_;
+        frame.data   = direct_;
+        if(direct_offset_ > 0 || direct_.size < direct_header_.Length()) {
+            // spread over windows
+            frame.data = {nullptr, direct_header_.Length()};
+        }
+
+        direct_          = {};
+        direct_offset_   = 0;
+        direct_received_ = 0;
+        if(this->listener_) {
+            listener_->OnFrame(frame);
+        }
+        return true;
+    }
+    // Copy the payload bytes at the start of `buf` to the destination, `buf` is left with the rest
+    void FillDirect(Buffer &buf) {
+        while(buf.size > 0 && this->NextWindow()) {
+            size_t len = std::min(buf.size, direct_.size - direct_received_);
+            memcpy(direct_.buf + direct_received_, buf.buf, len);
+            direct_received_ += len;
+            buf.buf += len;
+            buf.size -= len;
+        }
+    }
+    // Whether the destination has room, the next window is asked for when the current one is full
+    bool NextWindow() {
+        if(direct_received_ < direct_.size) {
+            return true;
+        }
+        size_t offset = direct_offset_ + direct_received_;
+        if(offset >= direct_header_.Length()) {
+            // complete
+            return false;
+        }
+        auto window = this->listener_ ? listener_->OnPayloadWindow(direct_header_, offset) : Buffer{};
+        if(window.buf == nullptr || window.size == 0) {
+            direct_          = {};
+            direct_offset_   = 0;
+            direct_received_ = 0;
+            return false;
+        }
+        direct_          = {window.buf, std::min<size_t>(window.size, direct_header_.Length() - offset)};
+        direct_offset_   = offset;
+        direct_received_ = 0;
+        return true;
+    }
+
+    void Grow() {
+        auto   raw_data = buffer_.GetData();
+        size_t want     = std::max<size_t>(buffer_.GetSize() * 2, 2 * sizeof(FrameHeader));
+
+        if(raw_data.size >= 2) {
+            auto *header = reinterpret_cast<FrameHeader *>(raw_data.buf);
+            if(size_t(header->HeaderLength()) <= raw_data.size && header->Length() <= max_frame_size_) {
+                // make room for the whole frame at once
+                want = std::max<size_t>(want, header->HeaderLength() + header->Length());
+            }
+        }
+        buffer_.Resize(std::max(buffer_.GetSize(), std::min(want, sizeof(FrameHeader) + max_frame_size_)));
+    }
+
 private:
     SlidingBuffer buffer_;
+    size_t        receive_buffer_size_ = 0;
+    size_t        frame_len_           = 0; // frame being delivered, 0 once taken
+    size_t        max_frame_size_      = MAX_FRAME_SIZE_DEFAULT;
     Listener     *listener_{nullptr};
+
+    size_t      direct_threshold_ = 0;
+    bool        offered_          = false; // the frame at the head of the buffer was declined by the listener
+    FrameHeader direct_header_;
+    Buffer      direct_;             // listener buffer or window of the payload being received
+    size_t      direct_offset_   = 0; // payload offset of direct_
+    size_t      direct_received_ = 0;
 };
 
 
@@ -106,12 +336,89 @@ class WSocketContext : public FrameParser::Listener {
     static constexpr int64_t RECEIVE_BUFFER_DEFAULT = 8 * 1024; // 8k
 
 public:
-    WSocketContext() : parser_(this) { parser_.SetReceiveBufferSize(RECEIVE_BUFFER_DEFAULT); }
+    /**
+     * @param resource Where receive, cork, frame and compression buffers come from,
+     *        null for the BufferPoolResource; must outlive the context
+     */
+    explicit WSocketContext(std::pmr::memory_resource *resource = nullptr)
+        : resource_(ResourceOrDefault(resource)), parser_(this, resource_), assembly_buffer_(resource_),
+          cork_buffer_(resource_) {
+        parser_.SetReceiveBufferSize(RECEIVE_BUFFER_DEFAULT);
+    }
     ~WSocketContext() override {}
 
     State GetState() const { return state_; }
+    // Whether the connection failed with a protocol error and should be dropped
+    bool IsFailed() const { return state_ == State::Error; }
+    // Whether the handshake is done and the connection is not closing, i.e. messages may be sent
+    bool IsConnected() const { return state_ == State::Connected; }
+    // Whether a close was sent or received or the connection failed, nothing may be sent anymore
+    bool IsClosed() const { return state_ == State::Closing || state_ == State::Closed || state_ == State::Error; }
+
+    /**
+     * Validate that received text messages are UTF-8, an invalid message is
+     * reported as Error::InvalidUtf8 and fails the connection with CLOSE_PROTOCOL_ERROR
+     */
+    void EnableUtf8Validation(bool enable) {
+        validate_utf8_ = enable;
+        utf8_validator_.Reset();
+    }
 
-    Buffer PrepareWrite() const { return parser_.PrepareWrite(); }
+    std::pmr::memory_resource *MemoryResource() const { return resource_; }
+
+    /**
+     * Release `arena` after each complete message has been delivered, so the
+     * callbacks can allocate from it for data that lives as long as the message
+     */
+    void SetMessageArena(MessageArena *arena) { message_arena_ = arena; }
+
+    /**
+     * Deliver text and binary frames to Listener::OnMessage as owned handles
+     * instead of OnText/OnBinary. A frame filling most of the receive buffer
+     * and the output of a compressor that hands it over are delivered without
+     * copying, the connection continues in a new pooled buffer.
+     */
+    void EnableOwnedMessages(bool enable) { owned_messages_ = enable; }
+
+    /**
+     * Largest frame payload held in memory, 8M by default. A peer announcing
+     * a larger frame is reported as Error::PayloadTooLong and the connection
+     * fails with CLOSE_PROTOCOL_ERROR, before anything is allocated for it.
+     * Frames received into OnBinaryDestination buffers or spill files are
+     * not limited.
+     */
+    void SetMaxFrameSize(size_t size) { parser_.SetMaxFrameSize(size); }
+
+    /**
+     * Uncompressed binary frames of at least `threshold` bytes are offered to
+     * Listener::OnBinaryDestination once their header is decoded, so the rest
+     * of the payload is received straight into the application's buffer
+     * instead of passing through the receive buffer. 0 (default) disables.
+     */
+    void SetDirectReceiveThreshold(size_t threshold) {
+        direct_threshold_ = threshold;
+        this->UpdateDirectThreshold();
+    }
+    /**
+     * Binary messages of at least `threshold` bytes are written to an unnamed
+     * temporary file in `directory` as they arrive, through fallocate'd mmap
+     * windows, and delivered to Listener::OnSpilled mapped from that file.
+     * Fragmented binary messages are reassembled, in memory while they stay
+     * below the threshold and delivered joined as one final fragment. A file
+     * that cannot be created or grown fails the connection with
+     * Error::SpillError. 0 (default) disables; POSIX only.
+     */
+    void SetSpillThreshold(size_t threshold, std::string directory = "/tmp") {
+        spill_threshold_ = threshold;
+        spill_directory_ = std::move(directory);
+        this->UpdateDirectThreshold();
+    }
+    // PrepareWrite points into an application buffer until the payload is complete
+    bool ReceivingDirect() const { return parser_.ReceivingDirect(); }
+
+    Buffer PrepareWrite() { return parser_.PrepareWrite(); }
+    // Return the receive buffer to its memory resource between messages, see FrameParser::ReleaseBuffer
+    bool ReleaseReceiveBuffer() { return parser_.ReleaseBuffer(); }
     void   CommitWrite(size_t len) {
         parser_.CommitWrite(len);
         ParseProcess();
@@ -122,39 +429,16 @@ public:
         this->ParseProcess();
     }
 
-    void Handshake() {
-        assert(state_ == State::Init);
-        this->state_               = State::Connecting;
-        auto supported_compressors = CompressManager::Instance().GetSupportedCompressors();
-
-        // send system handshake frame
-        Frame frame;
-        frame.header.Finished(true);
-        frame.header.Type(FrameHeader::System);
-        frame.header.Length(supported_compressors.size());
-
-        frame.data.buf  = reinterpret_cast<uint8_t *>(const_cast<char *>(supported_compressors.c_str()));
-        frame.data.size = supported_compressors.size();
-        this->SendFrame(frame);
-    }
+    void Handshake() { this->SendHandshake(CompressManager::Instance().GetSupportedCompressors()); }
     void Handshake(const std::vector<CompressType> &compressors) {
-        assert(state_ == State::Init);
-        this->state_               = State::Connecting;
-        auto supported_compressors = CompressManager::Instance().GetSupportedCompressors(compressors);
-
-        // send system handshake frame
-        Frame frame;
-        frame.header.Finished(true);
-        frame.header.Type(FrameHeader::System);
-        frame.header.Length(supported_compressors.size());
-
-        frame.data.buf  = reinterpret_cast<uint8_t *>(const_cast<char *>(supported_compressors.c_str()));
-        frame.data.size = supported_compressors.size();
-        this->SendFrame(frame);
+        this->SendHandshake(CompressManager::Instance().GetSupportedCompressors(compressors));
     }
 
-    void Close(CloseCode code) { this->Close(static_cast<int16_t>(code), CloseMessage(code)); }
-    void Close(int16_t code, const std::string &reason) {
+    void Close(CloseCode code) {
+        auto reason = CloseMessage(code);
+        this->Close(static_cast<int16_t>(code), reason ? reason : "");
+    }
+    void Close(int16_t code, std::string_view reason) {
         assert(state_ != State::Closed);
 
         state_ = State::Closing;
@@ -168,19 +452,122 @@ public:
         frame.header.Finished(true);
         frame.header.Type(FrameHeader::Close);
 
-        // set body
+        // set body, short enough for the stack
         auto total_len = 2 + reason.size();
         frame.header.Length(total_len);
-        std::unique_ptr<uint8_t[]> buffer = std::make_unique<uint8_t[]>(total_len);
-        memcpy(buffer.get(), &code, 2);
-        memcpy(buffer.get() + 2, reason.c_str(), reason.size());
+        uint8_t buffer[Frame::ShortPayload()];
+        memcpy(buffer, &code, 2);
+        memcpy(buffer + 2, reason.data(), reason.size());
 
-        frame.data.buf  = buffer.get();
+        frame.data.buf  = buffer;
         frame.data.size = 2 + reason.size();
 
         this->SendFrame(frame);
+        // nothing may follow a close frame, do not hold it back
+        this->Flush();
+    }
+
+    /**
+     * Hold outgoing frames back and coalesce them into one send handler call,
+     * corks nest and the frames go out when the outermost Uncork is reached
+     */
+    void Cork() { cork_depth_++; }
+    void Uncork() {
+        assert(cork_depth_ > 0);
+        if(--cork_depth_ == 0) {
+            this->Flush();
+        }
+    }
+    bool IsCorked() const { return cork_depth_ > 0; }
+
+    // Send the frames held back by Cork right away
+    void Flush() {
+        if(cork_buffer_.empty()) {
+            return;
+        }
+        SendRawData({cork_buffer_.data(), cork_buffer_.size()});
+        cork_buffer_.clear();
     }
 
+    // Bytes held back by Cork
+    size_t CorkedSize() const { return cork_buffer_.size(); }
+
+    // Complete text and binary messages received and sent so far, fragments count once
+    uint64_t MessagesReceived() const { return messages_received_; }
+    uint64_t MessagesSent() const { return messages_sent_; }
+
+    /**
+     * Corked bytes that trigger an early flush, bounding the memory and the
+     * latency of a long batch
+     */
+    void SetCorkLimit(size_t limit) { cork_limit_ = limit; }
+
+    // Corks the context for the lifetime of the scope
+    class BatchScope {
+    public:
+        explicit BatchScope(WSocketContext &context) : context_(context) { context_.Cork(); }
+        ~BatchScope() { context_.Uncork(); }
+
+        BatchScope(const BatchScope &)            = delete;
+        BatchScope &operator=(const BatchScope &) = delete;
+
+    private:
+        WSocketContext &context_;
+    };
+
+    /**
+     * Serialize a text or binary frame straight into a pooled send buffer
+     *
+     * Room for the longest header is kept in front of the payload; Commit
+     * encodes the 2, 4 or 10 byte header right before the payload and sends
+     * the frame from where it was written. A corked frame is appended to the
+     * cork buffer like any other; a compressed text frame goes through the
+     * compressor. Nothing else may be sent on the context while a builder is
+     * open, one dropped without Commit sends nothing.
+     */
+    class FrameBuilder {
+    public:
+        FrameBuilder(FrameBuilder &&other) noexcept = default;
+
+        FrameBuilder(const FrameBuilder &)            = delete;
+        FrameBuilder &operator=(const FrameBuilder &) = delete;
+
+        // Where the payload is written, at least the reserved size; empty after Commit
+        Buffer Payload() const {
+            if(!storage_) {
+                return {};
+            }
+            return {storage_.Data() + HEADER_ROOM, storage_.Size() - HEADER_ROOM};
+        }
+
+        // Make room for at least `size` payload bytes, keeping what was written; after Commit starts the next frame
+        void Reserve(size_t size);
+
+        /**
+         * Send the first `len` payload bytes as one frame, the builder is empty afterwards
+         * @param finish Last frame of the message
+         */
+        void Commit(size_t len, bool finish = true);
+
+    private:
+        friend class WSocketContext;
+
+        static constexpr size_t HEADER_ROOM = sizeof(FrameHeader);
+
+        FrameBuilder(WSocketContext &context, FrameHeader::FrameType type, size_t reserve) :
+            context_(&context), type_(type), storage_(HEADER_ROOM + reserve, context.resource_) {}
+
+    private:
+        WSocketContext        *context_;
+        FrameHeader::FrameType type_;
+        ResourceBuffer         storage_;
+    };
+
+    // Build a binary frame in place, `reserve` payload bytes up front
+    FrameBuilder BuildBinary(size_t reserve) { return FrameBuilder(*this, FrameHeader::Binary, reserve); }
+    // Build a text frame in place, `reserve` payload bytes up front
+    FrameBuilder BuildText(size_t reserve) { return FrameBuilder(*this, FrameHeader::Text, reserve); }
+
     void SendText(std::string_view text, bool finish = true) {
         assert(state_ == State::Connected);
 
@@ -206,9 +593,11 @@ public:
         frame.header.Type(FrameHeader::Text);
         frame.header.Length(buffer.size);
         frame.header.Finished(finish);
+        frame.header.Compressed(this->compress_context_ != nullptr);
 
         frame.data = buffer;
 
+        messages_sent_ += finish;
         this->SendFrame(frame);
     }
     void SendBinary(Buffer buffer, bool finish = true) {
@@ -225,8 +614,30 @@ public:
         frame.header.Finished(finish);
 
         frame.data = buffer;
+        messages_sent_ += finish;
         this->SendFrame(frame);
     }
+    /**
+     * Send only the header of a binary frame, the caller puts its `length`
+     * payload bytes on the transport right after it (e.g. with sendfile).
+     * Corked frames are flushed first, the header itself is never corked.
+     * @return false when the connection is not open for messages, nothing is sent then
+     */
+    bool SendBinaryHeader(uint64_t length, bool finish) {
+        if(state_ != State::Connected || length == 0) {
+            return false;
+        }
+        this->Flush();
+
+        FrameHeader header;
+        header.Type(FrameHeader::Binary);
+        header.Length(length);
+        header.Finished(finish);
+
+        messages_sent_ += finish;
+        SendRawData({reinterpret_cast<uint8_t *>(&header), size_t(header.HeaderLength())});
+        return true;
+    }
 
     void Ping() {
         Frame frame;
@@ -281,27 +692,98 @@ private:
         }
     }
 
+    Buffer OnPayloadDestination(const FrameHeader &header) override {
+        if(state_ == State::Closed || state_ == State::Error || !listener_) {
+            return {};
+        }
+        if(header.Type() != FrameHeader::Binary || header.Compressed()) {
+            // compressed payloads are decompressed out of the receive buffer anyway
+            return {};
+        }
+        if(spill_threshold_ > 0) {
+            if(this->SpillsFrame(header)) {
+                spill_direct_ = true;
+                return this->CheckSpill(spill_file_.Extend(header.Length()));
+            }
+            if(assembly_ != Assembly::None || !header.Finished() || state_ == State::Error) {
+                // part of a message being reassembled, or the spill failed
+                return {};
+            }
+        }
+        if(direct_threshold_ == 0 || header.Length() < direct_threshold_) {
+            return {};
+        }
+        auto destination = listener_->OnBinaryDestination(header.Length(), header.Finished());
+        if(destination.size < header.Length()) {
+            return {};
+        }
+        direct_buffer_ = destination.buf;
+        return destination;
+    }
+    void OnFrameTooLong(const FrameHeader &header) override {
+        if(state_ == State::Closed || state_ == State::Error) {
+            return;
+        }
+        this->NotifyError(Error::PayloadTooLong);
+        this->Close(CloseCode::CLOSE_PROTOCOL_ERROR);
+        // stop parsing, the rest of the stream is the oversized payload
+        state_ = State::Error;
+    }
+    Buffer OnPayloadWindow(const FrameHeader &header, size_t offset) override {
+        if(!spill_direct_ || state_ == State::Closed || state_ == State::Error) {
+            return {};
+        }
+        return this->CheckSpill(spill_file_.Window(offset));
+    }
+
+    // The parser hands uncompressed payloads above either threshold to OnPayloadDestination
+    void UpdateDirectThreshold() {
+        size_t threshold = direct_threshold_;
+        if(spill_threshold_ > 0 && (threshold == 0 || spill_threshold_ < threshold)) {
+            threshold = spill_threshold_;
+        }
+        parser_.SetDirectThreshold(threshold);
+    }
+
+    void SendHandshake(std::string_view compressors) {
+        assert(state_ == State::Init);
+        this->state_ = State::Connecting;
+
+        // send system handshake frame
+        Frame frame;
+        frame.header.Finished(true);
+        frame.header.Type(FrameHeader::System);
+        frame.header.Length(compressors.size());
+
+        frame.data.buf  = reinterpret_cast<uint8_t *>(const_cast<char *>(compressors.data()));
+        frame.data.size = compressors.size();
+        this->SendFrame(frame);
+    }
+
     void OnSystemFrame(const Frame &frame) {
-        auto str            = std::string(reinterpret_cast<const char *>(frame.data.buf), frame.data.size);
+        auto str            = std::string_view(reinterpret_cast<const char *>(frame.data.buf), frame.data.size);
         auto compress_types = CompressManager::Instance().GetSupportedCompressTypes(str);
 
         auto type               = NotifyHandshake(compress_types);
-        this->compress_context_ = CompressManager::Instance().GetCompressContext(type);
+        this->compress_context_ = CompressManager::Instance().GetCompressContext(type, resource_);
 
         if(this->state_ == State::Init) {
-            if(this->compress_context_) {
-                this->Handshake({this->compress_context_->Type()});
-            } else {
-                this->Handshake({CompressType::None});
-            }
+            // answer with the chosen compressor only, empty for none
+            this->SendHandshake(this->compress_context_ ? this->compress_context_->Name() : std::string_view(""));
         }
         this->state_ = State::Connected;
         this->NotifyConnected();
     }
 
-    void OnTextFrame(const Frame &frame) { this->NotifyText(frame); }
+    void OnTextFrame(const Frame &frame) {
+        messages_received_ += frame.header.Finished();
+        this->NotifyText(frame);
+    }
 
-    void OnBinaryFrame(const Frame &frame) { this->NotifyBinary(frame); }
+    void OnBinaryFrame(const Frame &frame) {
+        messages_received_ += frame.header.Finished();
+        this->NotifyBinary(frame);
+    }
 
     void OnPingFrame(const Frame &frame) { this->NotifyPing(); }
 
@@ -329,7 +811,8 @@ private:
     }
 
 private:
-    FrameParser parser_;
+    std::pmr::memory_resource *resource_;
+    FrameParser                parser_;
 
 
 public:
@@ -349,6 +832,16 @@ public:
 
         virtual void OnText(std::string_view text, bool finish) {}
         virtual void OnBinary(Buffer buffer, bool finish) {}
+        // Text and binary frames once EnableOwnedMessages is on, the handle may be kept past the call
+        virtual void OnMessage(MessageHandle message) {}
+        /**
+         * A binary frame above the direct receive threshold is arriving
+         * @return At least `size` bytes to receive the payload into, or an empty buffer to receive it as usual;
+         *         the frame is then delivered to OnBinary pointing into this buffer, in any delivery mode
+         */
+        virtual Buffer OnBinaryDestination(size_t size, bool finish) { return {}; }
+        // A binary message above the spill threshold, the file goes away with the handle
+        virtual void OnSpilled(SpilledMessage message) {}
     };
     void ResetListener(Listener *listener) { listener_ = listener; }
 
@@ -381,7 +874,7 @@ public:
     void NotifyText(Frame frame) {
         auto buf = frame.data;
 
-        if(this->compress_context_) {
+        if(frame.header.Compressed() && this->compress_context_) {
             buf = this->compress_context_->Decompress(buf);
             if(buf.buf == nullptr || buf.size == 0) {
                 this->NotifyError(Error::DecompressError);
@@ -389,14 +882,36 @@ public:
             }
         }
 
-        if(listener_) {
+        if(this->validate_utf8_ && !this->utf8_validator_.Feed(buf, frame.header.Finished())) {
+            this->NotifyError(Error::InvalidUtf8);
+            this->Close(CloseCode::CLOSE_PROTOCOL_ERROR);
+            // stop parsing, nothing after the broken message can be trusted
+            state_ = State::Error;
+            return;
+        }
+
+        if(listener_ && owned_messages_) {
+            listener_->OnMessage(this->TakeMessage(frame, buf, false));
+        } else if(listener_) {
             listener_->OnText(std::string_view(reinterpret_cast<char *>(buf.buf), buf.size), frame.header.Finished());
         }
+        if(message_arena_ && frame.header.Finished()) {
+            message_arena_->Release();
+        }
     }
     void NotifyBinary(Frame frame) {
+        if(spill_direct_) {
+            // already in the spill file
+            spill_direct_ = false;
+            if(frame.header.Finished()) {
+                this->FinishAssembly();
+            }
+            return;
+        }
+
         auto buf = frame.data;
 
-        if(this->compress_context_) {
+        if(frame.header.Compressed() && this->compress_context_) {
             buf = this->compress_context_->Decompress(buf);
             if(buf.buf == nullptr || buf.size == 0) {
                 this->NotifyError(Error::DecompressError);
@@ -404,9 +919,19 @@ public:
             }
         }
 
-        if(listener_) {
+        if(spill_threshold_ > 0 && buf.buf != direct_buffer_ && this->Assemble(buf, frame.header.Finished())) {
+            return;
+        }
+
+        if(listener_ && owned_messages_ && buf.buf != direct_buffer_) {
+            listener_->OnMessage(this->TakeMessage(frame, buf, true));
+        } else if(listener_) {
             listener_->OnBinary(buf, frame.header.Finished());
         }
+        direct_buffer_ = nullptr;
+        if(message_arena_ && frame.header.Finished()) {
+            message_arena_->Release();
+        }
     }
 
     void NotifyConnected() {
@@ -415,8 +940,148 @@ public:
         }
     }
 
+private:
+    // Take over the buffer `buf` lives in when possible, copy it otherwise
+    MessageHandle TakeMessage(const Frame &frame, const Buffer &buf, bool binary) {
+        bool finish = frame.header.Finished();
+        if(buf.buf != frame.data.buf) {
+            // decompressed
+            if(auto storage = this->compress_context_->TakeDecompressed()) {
+                size_t offset = buf.buf - storage.Data();
+                return MessageHandle::Adopt(std::move(storage), offset, buf.size, binary, finish);
+            }
+        } else if(auto storage = parser_.TakeFrame()) {
+            size_t offset = buf.buf - storage.Data();
+            return MessageHandle::Adopt(std::move(storage), offset, buf.size, binary, finish);
+        }
+        return MessageHandle::Copy(buf, binary, finish, resource_);
+    }
+
+    // Whether the binary frame of `header` goes straight into the spill file, which is opened for it if needed
+    bool SpillsFrame(const FrameHeader &header) {
+        if(assembly_ == Assembly::None && header.Length() >= spill_threshold_) {
+            return this->StartSpill();
+        }
+        if(assembly_ == Assembly::Memory && assembly_buffer_.size() + header.Length() >= spill_threshold_) {
+            return this->StartSpill();
+        }
+        return assembly_ == Assembly::Spill;
+    }
+
+    /**
+     * Collect a fragment, or a message at or above the spill threshold
+     * @return false to deliver `buf` as usual
+     */
+    bool Assemble(const Buffer &buf, bool finish) {
+        if(assembly_ == Assembly::None) {
+            if(finish && buf.size < spill_threshold_) {
+                return false;
+            }
+            assembly_ = Assembly::Memory;
+        }
+        if(assembly_ == Assembly::Memory && assembly_buffer_.size() + buf.size >= spill_threshold_) {
+            if(!this->StartSpill()) {
+                return true;
+            }
+        }
+
+        if(assembly_ == Assembly::Spill) {
+            if(!spill_file_.Append(buf)) {
+                this->FailSpill();
+                return true;
+            }
+        } else {
+            assembly_buffer_.insert(assembly_buffer_.end(), buf.buf, buf.buf + buf.size);
+        }
+        if(finish) {
+            this->FinishAssembly();
+        }
+        return true;
+    }
+
+    // Move to a spill file, taking along what was reassembled in memory
+    bool StartSpill() {
+        if(!spill_file_.Open(spill_directory_)) {
+            this->FailSpill();
+            return false;
+        }
+        if(!assembly_buffer_.empty() && !spill_file_.Append({assembly_buffer_.data(), assembly_buffer_.size()})) {
+            this->FailSpill();
+            return false;
+        }
+        assembly_buffer_.clear();
+        assembly_buffer_.shrink_to_fit();
+        assembly_ = Assembly::Spill;
+        return true;
+    }
+
+    // Deliver the reassembled message
+    void FinishAssembly() {
+        auto assembly = assembly_;
+        assembly_     = Assembly::None;
+
+        if(assembly == Assembly::Spill) {
+            auto message = spill_file_.Finish();
+            if(!message) {
+                this->FailSpill();
+                return;
+            }
+            if(listener_) {
+                listener_->OnSpilled(std::move(message));
+            }
+        } else {
+            Buffer joined{assembly_buffer_.data(), assembly_buffer_.size()};
+            if(listener_ && owned_messages_) {
+                listener_->OnMessage(MessageHandle::Copy(joined, true, true, resource_));
+            } else if(listener_) {
+                listener_->OnBinary(joined, true);
+            }
+            assembly_buffer_.clear();
+        }
+        if(message_arena_) {
+            message_arena_->Release();
+        }
+    }
+
+    // Fail the connection when the spill file could not provide `window`
+    Buffer CheckSpill(const Buffer &window) {
+        if(window.buf == nullptr) {
+            this->FailSpill();
+        }
+        return window;
+    }
+
+    void FailSpill() {
+        spill_file_.Reset();
+        assembly_buffer_.clear();
+        assembly_     = Assembly::None;
+        spill_direct_ = false;
+
+        this->NotifyError(Error::SpillError);
+        if(state_ != State::Closed && state_ != State::Error) {
+            this->Close(CloseCode::INTERNAL_ERROR);
+        }
+        // stop parsing, the rest of the message has nowhere to go
+        state_ = State::Error;
+    }
+
 private:
     Listener *listener_{nullptr};
+    bool      owned_messages_   = false;
+    uint8_t  *direct_buffer_    = nullptr; // from OnBinaryDestination, until its frame is delivered
+    size_t    direct_threshold_ = 0;
+
+    enum class Assembly {
+        None,
+        Memory, // fragments below the spill threshold, in assembly_buffer_
+        Spill,  // in spill_file_
+    } assembly_ = Assembly::None;
+
+    size_t                    spill_threshold_ = 0;
+    std::string               spill_directory_;
+    std::pmr::vector<uint8_t> assembly_buffer_;
+    SpillFile                 spill_file_;
+    bool                      spill_direct_ = false; // the frame being received is written into spill_file_
 
 public:
     using SendHandler = std::function<void(const Buffer &data)>;
@@ -426,33 +1091,36 @@ public:
 private:
     void SendFrame(const Frame &frame) {
         assert(frame.header.Length() == frame.data.size);
-        size_t total_len = frame.header.HeaderLength() + frame.header.Length();
 
-        std::unique_ptr<uint8_t[]> data(new uint8_t[total_len]);
+        if(cork_depth_ > 0) {
+            AppendCorked(frame);
+            if(cork_buffer_.size() >= cork_limit_) {
+                this->Flush();
+            }
+            return;
+        }
+
+        size_t         total_len = frame.header.HeaderLength() + frame.header.Length();
+        ResourceBuffer data(total_len, resource_);
 
-        memcpy(data.get(), &frame.header, frame.header.HeaderLength());
-        memcpy(data.get() + frame.header.HeaderLength(), frame.data.buf, frame.header.Length());
+        memcpy(data.Data(), &frame.header, frame.header.HeaderLength());
+        memcpy(data.Data() + frame.header.HeaderLength(), frame.data.buf, frame.header.Length());
 
-        SendRawData({data.get(), total_len});
+        SendRawData({data.Data(), total_len});
     }
     void SendFrames(const std::vector<Frame> &frames) {
-        size_t total_len = 0;
+        BatchScope batch(*this);
         for(auto &frame : frames) {
-            assert(frame.header.Length() == frame.data.size);
-            total_len += (frame.header.HeaderLength() + frame.data.size);
+            this->SendFrame(frame);
         }
-        std::unique_ptr<uint8_t[]> data(new uint8_t[total_len]);
-        size_t                     pos = 0;
-
-        for(auto &frame : frames) {
-            memcpy(&data[pos], &frame.header, frame.header.HeaderLength());
-            pos += frame.header.HeaderLength();
+    }
+    void AppendCorked(const Frame &frame) {
+        size_t pos = cork_buffer_.size();
+        cork_buffer_.resize(pos + frame.header.HeaderLength() + frame.data.size);
 
-            memcpy(&data[pos], frame.data.buf, frame.data.size);
-            pos += frame.data.size;
-        }
-        assert(pos == total_len);
-        SendRawData({data.get(), total_len});
+        memcpy(&cork_buffer_[pos], &frame.header, frame.header.HeaderLength());
+        pos += frame.header.HeaderLength();
+        memcpy(&cork_buffer_[pos], frame.data.buf, frame.data.size);
     }
 
     void SendRawData(const Buffer &data) {
@@ -461,11 +1129,92 @@ private:
         }
     }
 
+    // Send a frame encoded by a FrameBuilder
+    void SendBuilt(FrameHeader::FrameType type, uint8_t *payload, size_t len, bool finish) {
+        assert(state_ == State::Connected);
+
+        if(len == 0) {
+            this->NotifyError(Error::MessageEmpty);
+            return;
+        }
+
+        Frame frame;
+        frame.header.Type(type);
+        frame.header.Length(len);
+        frame.header.Finished(finish);
+        frame.data = {payload, len};
+
+        if(type == FrameHeader::Text && this->compress_context_) {
+            // the compressor output is a new buffer anyway
+            frame.data = this->compress_context_->Compress(frame.data);
+            if(frame.data.buf == nullptr || frame.data.size == 0) {
+                this->NotifyError(Error::CompressError);
+                Close(CloseCode::INTERNAL_ERROR);
+                return;
+            }
+            frame.header.Length(frame.data.size);
+            frame.header.Compressed(true);
+            messages_sent_ += finish;
+            this->SendFrame(frame);
+            return;
+        }
+
+        // the header goes right in front of the payload
+        size_t   header_len = frame.header.HeaderLength();
+        uint8_t *start      = payload - header_len;
+        memcpy(start, &frame.header, header_len);
+
+        messages_sent_ += finish;
+        if(cork_depth_ > 0) {
+            cork_buffer_.insert(cork_buffer_.end(), start, start + header_len + len);
+            if(cork_buffer_.size() >= cork_limit_) {
+                this->Flush();
+            }
+            return;
+        }
+        SendRawData({start, header_len + len});
+    }
+
 private:
     SendHandler                      send_handler_;
     std::shared_ptr<CompressContext> compress_context_;
+
+    bool          validate_utf8_ = false;
+    Utf8Validator utf8_validator_;
+
+    static constexpr size_t CORK_LIMIT_DEFAULT = 64 * 1024; // 64k
+
+    std::pmr::vector<uint8_t> cork_buffer_;
+    size_t                    cork_depth_ = 0;
+    size_t                    cork_limit_ = CORK_LIMIT_DEFAULT;
+
+    MessageArena *message_arena_ = nullptr;
+
+    uint64_t messages_received_ = 0;
+    uint64_t messages_sent_     = 0;
 };
 
+//============ WSocketContext::FrameBuilder start ============//
+
+void WSocketContext::FrameBuilder::Reserve(size_t size) {
+    if(HEADER_ROOM + size <= storage_.Size()) {
+        return;
+    }
+    ResourceBuffer grown(HEADER_ROOM + size, context_->resource_);
+    if(storage_.Size() > HEADER_ROOM) {
+        memcpy(grown.Data() + HEADER_ROOM, storage_.Data() + HEADER_ROOM, storage_.Size() - HEADER_ROOM);
+    }
+    storage_ = std::move(grown);
+}
+
+void WSocketContext::FrameBuilder::Commit(size_t len, bool finish) {
+    assert(storage_ && HEADER_ROOM + len <= storage_.Size());
+    context_->SendBuilt(type_, storage_.Data() + HEADER_ROOM, len, finish);
+    storage_.Reset();
+}
+
+//============ WSocketContext::FrameBuilder end ============//
+
 } // namespace wsocket
 
 #endif // WSOCKET__WSOCKET_CONTEXT_HPP
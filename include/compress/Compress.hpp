@@ -26,8 +26,14 @@ public:
     virtual std::string Configuration() const { return ""; }
     virtual bool        Configure(std::string const &config) { return true; }
 
+    // Where the output buffers come from, null for the BufferPoolResource
+    virtual void SetMemoryResource(std::pmr::memory_resource *resource) {}
+
     virtual Buffer Compress(const Buffer &buf)   = 0;
     virtual Buffer Decompress(const Buffer &buf) = 0;
+
+    // Hand over the buffer the last Decompress output lives in, empty if the context keeps it
+    virtual ResourceBuffer TakeDecompressed() { return {}; }
 };
 
 } // namespace wsocket
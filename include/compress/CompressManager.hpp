@@ -4,7 +4,9 @@
 
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
 #ifdef WITH_ZSTD
 #include "Zstd.hpp"
@@ -31,7 +33,7 @@ public:
     /**
      * @brief 返回支持的压缩算法名称字符串，多个名称以分号分隔
      */
-    std::string GetSupportedCompressors() { return supported_compressors_; }
+    const std::string &GetSupportedCompressors() const { return supported_compressors_; }
     /**
      * @brief 根据支持的压缩类型列表，返回对应的压缩算法名称字符串，多个名称以分号分隔
      */
@@ -39,13 +41,15 @@ public:
 
     /**
      * @brief 根据压缩类型获取对应的压缩上下文实例
+     * @param resource 输出缓冲区的内存来源，为空时使用 BufferPoolResource
      */
-    std::shared_ptr<CompressContext> GetCompressContext(CompressType type);
+    std::shared_ptr<CompressContext> GetCompressContext(CompressType type,
+                                                        std::pmr::memory_resource *resource = nullptr);
 
     /**
      * @brief 根据压缩算法名称字符串，返回对应的压缩类型列表
      */
-    std::vector<CompressType> GetSupportedCompressTypes(const std::string &message);
+    std::vector<CompressType> GetSupportedCompressTypes(std::string_view message);
 
 private:
     void RegisterCompressor(std::shared_ptr<CompressContext> cxt);
@@ -67,12 +71,17 @@ std::string CompressManager::GetSupportedCompressors(const std::vector<CompressT
     return s;
 }
 
-std::shared_ptr<CompressContext> CompressManager::GetCompressContext(CompressType type) {
+std::shared_ptr<CompressContext> CompressManager::GetCompressContext(CompressType                type,
+                                                                     std::pmr::memory_resource *resource) {
     auto it = compress_ctxs_.find(type);
     if(it == compress_ctxs_.end()) {
         return nullptr;
     }
-    return it->second->Create();
+    auto context = it->second->Create();
+    if(context && resource) {
+        context->SetMemoryResource(resource);
+    }
+    return context;
 }
 
 // 字符串分割辅助函数
@@ -86,15 +95,19 @@ inline std::vector<std::string> split(const std::string &str, char delimiter) {
     return tokens;
 }
 
-std::vector<CompressType> CompressManager::GetSupportedCompressTypes(const std::string &message) {
+std::vector<CompressType> CompressManager::GetSupportedCompressTypes(std::string_view message) {
     std::vector<CompressType> types;
 
-    // split with ';'
-    for(auto &s : split(message, ';')) {
-        auto it = compress_names_.find(s);
-        if(it != compress_names_.end()) {
-            types.push_back(it->second);
+    // split with ';', the few names are compared in place
+    while(!message.empty()) {
+        auto end  = message.find(';');
+        auto name = message.substr(0, end);
+        for(auto &[known, type] : compress_names_) {
+            if(known == name) {
+                types.push_back(type);
+            }
         }
+        message.remove_prefix(end == std::string_view::npos ? message.size() : end + 1);
     }
 
     return types;
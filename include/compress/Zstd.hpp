@@ -4,11 +4,10 @@
 
 #ifdef WITH_ZSTD
 
-#include <vector>
-
 #include <zstd.h>
 
 #include "Compress.hpp"
+#include "../MemoryResource.hpp"
 
 
 namespace wsocket {
@@ -33,8 +32,16 @@ public:
     std::string  Name() const override { return "zstd"; }
     CompressType Type() const override { return CompressType::Zstd; }
 
+    void SetMemoryResource(std::pmr::memory_resource *resource) override {
+        resource_ = resource;
+        cbuf_.Reset();
+        dbuf_.Reset();
+    }
+
     Buffer Compress(const Buffer &buf) override;
     Buffer Decompress(const Buffer &buf) override;
+    // the next Decompress allocates a fresh output buffer
+    ResourceBuffer TakeDecompressed() override { return std::move(dbuf_); }
     //============= CompressContext end =============//
 
 
@@ -42,8 +49,10 @@ private:
     ZSTD_CCtx *cctx_{nullptr};
     ZSTD_DCtx *dctx_{nullptr};
 
-    std::vector<uint8_t> cbuf_;
-    std::vector<uint8_t> dbuf_;
+    // output buffers, valid until the next call
+    std::pmr::memory_resource *resource_ = nullptr;
+    ResourceBuffer             cbuf_;
+    ResourceBuffer             dbuf_;
 };
 
 bool ZstdContext::Open() {
@@ -93,15 +102,15 @@ std::shared_ptr<CompressContext> ZstdContext::Create() {
 
 Buffer ZstdContext::Compress(const Buffer &buf) {
     auto want_len = ZSTD_compressBound(buf.size);
-    if(cbuf_.size() < want_len) {
-        cbuf_.resize(want_len);
+    if(cbuf_.Size() < want_len) {
+        cbuf_ = ResourceBuffer(want_len, ResourceOrDefault(resource_));
     }
-    auto real_len = ZSTD_compress2(cctx_, cbuf_.data(), cbuf_.size(), buf.buf, buf.size);
+    auto real_len = ZSTD_compress2(cctx_, cbuf_.Data(), cbuf_.Size(), buf.buf, buf.size);
     if(ZSTD_isError(real_len)) {
         printf("Zstd compress2 error: %s\n", ZSTD_getErrorName(real_len));
         return Buffer{};
     }
-    return Buffer{cbuf_.data(), real_len};
+    return Buffer{cbuf_.Data(), real_len};
 }
 
 Buffer ZstdContext::Decompress(const Buffer &buf) {
@@ -113,15 +122,15 @@ Buffer ZstdContext::Decompress(const Buffer &buf) {
         }
     }
 
-    if(dbuf_.size() < want_len) {
-        dbuf_.resize(want_len);
+    if(dbuf_.Size() < want_len) {
+        dbuf_ = ResourceBuffer(want_len, ResourceOrDefault(resource_));
     }
-    auto real_len = ZSTD_decompressDCtx(dctx_, dbuf_.data(), dbuf_.size(), buf.buf, buf.size);
+    auto real_len = ZSTD_decompressDCtx(dctx_, dbuf_.Data(), dbuf_.Size(), buf.buf, buf.size);
     if(ZSTD_isError(real_len)) {
         printf("Zstd decompress error: %s\n", ZSTD_getErrorName(real_len));
         return Buffer{};
     }
-    return Buffer{dbuf_.data(), real_len};
+    return Buffer{dbuf_.Data(), real_len};
 }
 
 //============= CompressContext end =============//
@@ -1,9 +1,38 @@
 ﻿#include <bitset>
 #include <cassert>
 #include <iostream>
+#include <thread>
 
 #include "include/WSocketContext.hpp"
 #include "include/ASIO_WSocket.hpp"
+#include "include/ASIO_AwaitableWSocket.hpp"
+#include "include/ASIO_WSocketServer.hpp"
+#include "include/IoUring_WSocket.hpp"
+#include "include/Epoll_WSocket.hpp"
+#include "include/Shm_WSocket.hpp"
+
+// Counts global operator new calls, the zero allocation tests compare it around a steady-state run
+std::atomic<uint64_t> g_allocations{0};
+
+void *operator new(size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if(void *data = std::malloc(size ? size : 1)) {
+        return data;
+    }
+    throw std::bad_alloc();
+}
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+void *operator new[](size_t size) { return ::operator new(size); }
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept { return ::operator new(size, tag); }
+
+// Not inlined: GCC would see free() on pointers from operator new and warn (-Wmismatched-new-delete)
+[[gnu::noinline]] void operator delete(void *data) noexcept { std::free(data); }
+[[gnu::noinline]] void operator delete(void *data, size_t) noexcept { std::free(data); }
+[[gnu::noinline]] void operator delete[](void *data) noexcept { std::free(data); }
+[[gnu::noinline]] void operator delete[](void *data, size_t) noexcept { std::free(data); }
 
 void testBasicHeader() {
     wsocket::BasicHeader header;
@@ -216,6 +245,17 @@ void testFrameHeader() {
 
         assert(header.Length() == 55169595);
     }
+    {
+        wsocket::FrameHeader header;
+        header.Length(253);
+        assert(header.HeaderLength() == 2);
+        header.Length(254);
+        assert(header.HeaderLength() == 4);
+        header.Length(65535);
+        assert(header.HeaderLength() == 4);
+        header.Length(65536);
+        assert(header.HeaderLength() == 10);
+    }
 }
 
 std::string to_string(const wsocket::Buffer &buffer) {
@@ -311,6 +351,649 @@ void test_WSocketContext() {
     std::cout << "================== test_WSocketContext ==================" << std::endl;
 }
 
+void test_Utf8Validator() {
+    auto valid = [](const char *text, size_t split) {
+        auto                  *data = reinterpret_cast<uint8_t *>(const_cast<char *>(text));
+        auto                   len  = std::strlen(text);
+        wsocket::Utf8Validator validator;
+        return validator.Feed({data, split}, false) && validator.Feed({data + split, len - split}, true);
+    };
+
+    const char *chinese = "这是一段用于测试的文本 with ascii, and more 文本 to cross 16/32 byte blocks";
+    for(size_t split = 0; split <= std::strlen(chinese); ++split) {
+        assert(valid(chinese, split));
+    }
+    assert(valid("\xF0\x9F\x98\x80", 2));              // U+1F600 split in the middle
+    assert(!valid("\xC0\xAF", 1));                      // overlong
+    assert(!valid("\xED\xA0\x80", 0));                 // surrogate
+    assert(!valid("\xF4\x90\x80\x80", 3));            // above U+10FFFF
+    assert(!valid("abcdefghijklmnopqrstuvwxyz\xE6\x96", 0)); // truncated at the end
+}
+
+class Utf8Client : public wsocket::WSocketContext::Listener {
+public:
+    void OnError(std::error_code code) override { error = code; }
+    void OnText(std::string_view text, bool finish) override { texts++; }
+
+    std::error_code error;
+    int             texts = 0;
+};
+
+void test_WSocketContext_utf8() {
+    wsocket::WSocketContext ctx1;
+    wsocket::WSocketContext ctx2;
+
+    Utf8Client client1;
+    Utf8Client client2;
+    ctx1.ResetListener(&client1);
+    ctx2.ResetListener(&client2);
+    ctx2.EnableUtf8Validation(true);
+
+    ctx1.ResetSendHandler([&](wsocket::Buffer buffer) { ctx2.Feed(buffer); });
+    ctx2.ResetSendHandler([&](wsocket::Buffer buffer) { ctx1.Feed(buffer); });
+
+    ctx1.Handshake();
+
+    // a multi-byte character split over two fragments is fine
+    ctx1.SendText("\xE6\x96", false);
+    ctx1.SendText("\x87", true);
+    assert(client2.texts == 2);
+    assert(!client2.error);
+
+    ctx1.SendText("bad \xFF text");
+    assert(client2.texts == 2);
+    assert(client2.error == wsocket::Error::InvalidUtf8);
+    assert(ctx2.IsFailed());
+}
+
+void test_WSocketContext_max_frame() {
+    // a header announcing 2^50 bytes, before the handshake: rejected, nothing allocated for it
+    {
+        wsocket::WSocketContext ctx;
+        Utf8Client              client;
+        ctx.ResetListener(&client);
+        ctx.ResetSendHandler([](wsocket::Buffer buffer) {});
+
+        wsocket::FrameHeader header;
+        header.Type(wsocket::FrameHeader::Binary);
+        header.Finished(true);
+        header.Length(uint64_t(1) << 50);
+        ctx.Feed({reinterpret_cast<uint8_t *>(&header), size_t(header.HeaderLength())});
+        assert(client.error == wsocket::Error::PayloadTooLong);
+        assert(ctx.IsFailed());
+        assert(ctx.PrepareWrite().size <= 64 * 1024);
+    }
+
+    wsocket::WSocketContext ctx1;
+    wsocket::WSocketContext ctx2;
+
+    Utf8Client client1;
+    Utf8Client client2;
+    ctx1.ResetListener(&client1);
+    ctx2.ResetListener(&client2);
+    ctx2.SetMaxFrameSize(1000);
+
+    ctx1.ResetSendHandler([&](wsocket::Buffer buffer) { ctx2.Feed(buffer); });
+    ctx2.ResetSendHandler([&](wsocket::Buffer buffer) { ctx1.Feed(buffer); });
+    ctx1.Handshake();
+
+    std::string text(1000, 'a');
+    ctx1.SendText(text);
+    assert(client2.texts == 1 && !client2.error);
+
+    text.push_back('a');
+    ctx1.SendText(text);
+    assert(client2.texts == 1 && client2.error == wsocket::Error::PayloadTooLong);
+    assert(ctx2.IsFailed());
+}
+
+void test_WSocketContext_cork() {
+    wsocket::WSocketContext ctx1;
+    wsocket::WSocketContext ctx2;
+
+    Utf8Client client1;
+    Utf8Client client2;
+    ctx1.ResetListener(&client1);
+    ctx2.ResetListener(&client2);
+
+    int writes = 0;
+    ctx1.ResetSendHandler([&](wsocket::Buffer buffer) {
+        writes++;
+        ctx2.Feed(buffer);
+    });
+    ctx2.ResetSendHandler([&](wsocket::Buffer buffer) { ctx1.Feed(buffer); });
+
+    ctx1.Handshake();
+    writes = 0;
+
+    {
+        wsocket::WSocketContext::BatchScope batch(ctx1);
+        for(int i = 0; i < 100; ++i) {
+            ctx1.SendText("tick");
+        }
+        // nested corks only flush on the outermost uncork
+        ctx1.Cork();
+        ctx1.Ping();
+        ctx1.Uncork();
+        assert(writes == 0);
+        assert(client2.texts == 0);
+    }
+    assert(writes == 1);
+    assert(client2.texts == 100);
+    assert(ctx1.CorkedSize() == 0);
+
+    // the limit flushes a long batch early
+    ctx1.SetCorkLimit(64);
+    ctx1.Cork();
+    for(int i = 0; i < 20; ++i) {
+        ctx1.SendText("tick");
+    }
+    assert(writes > 1);
+    ctx1.Uncork();
+    assert(client2.texts == 120);
+}
+
+void test_BufferPool() {
+    auto *pool = wsocket::BufferPool::Local();
+    assert(pool);
+    auto before = pool->Stats();
+
+    // rounded up to the size class, reused after a free; a class the other tests leave empty
+    size_t capacity = 0;
+    auto  *block    = wsocket::BufferPool::Allocate(400 * 1024, &capacity);
+    assert(capacity == 512 * 1024 && wsocket::BufferPool::Capacity(block) == 512 * 1024);
+    assert(reinterpret_cast<uintptr_t>(block) % 16 == 0);
+    wsocket::BufferPool::Free(block);
+    assert(pool->Stats().cached_bytes == before.cached_bytes + 512 * 1024);
+    auto *again = wsocket::BufferPool::Allocate(300 * 1024);
+    assert(again == block);
+    assert(pool->Stats().hits == before.hits + 1);
+
+    // freed on another thread, back through the return queue
+    std::thread([again]() { wsocket::BufferPool::Free(again); }).join();
+    wsocket::BufferPool::Free(wsocket::BufferPool::Allocate(512 * 1024));
+    assert(pool->Stats().remote_frees == before.remote_frees + 1);
+
+    // too large to pool
+    auto huge = wsocket::BufferPool::Make(2 * 1024 * 1024);
+    assert(pool->Stats().oversized == before.oversized + 1);
+    huge.reset();
+    assert(pool->Stats().cached_bytes == before.cached_bytes + 512 * 1024);
+}
+
+void test_WSocketContext_idle_buffer() {
+    wsocket::WSocketContext ctx1;
+    wsocket::WSocketContext ctx2;
+
+    Utf8Client client1;
+    Utf8Client client2;
+    ctx1.ResetListener(&client1);
+    ctx2.ResetListener(&client2);
+
+    std::vector<uint8_t> wire;
+    ctx1.ResetSendHandler([&](wsocket::Buffer buffer) { wire.assign(buffer.buf, buffer.buf + buffer.size); });
+    ctx2.ResetSendHandler([&](wsocket::Buffer buffer) { ctx1.Feed(buffer); });
+
+    ctx1.Handshake();
+    ctx2.Feed({wire.data(), wire.size()});
+
+    // nothing buffered, the buffer goes back to the pool and is borrowed again
+    auto &stats  = wsocket::BufferPool::Local()->Stats();
+    auto  cached = stats.cached_bytes;
+    assert(ctx2.ReleaseReceiveBuffer());
+    assert(stats.cached_bytes == cached + 8 * 1024);
+    assert(ctx2.ReleaseReceiveBuffer());
+
+    ctx1.SendText("hello");
+    ctx2.Feed({wire.data(), 3});
+    assert(stats.cached_bytes == cached);
+    // half a frame must stay
+    assert(!ctx2.ReleaseReceiveBuffer());
+    ctx2.Feed({wire.data() + 3, wire.size() - 3});
+    assert(client2.texts == 1);
+    assert(ctx2.ReleaseReceiveBuffer());
+    assert(stats.cached_bytes == cached + 8 * 1024);
+}
+
+class ArenaClient : public wsocket::WSocketContext::Listener {
+public:
+    explicit ArenaClient(wsocket::MessageArena &arena) : arena_(arena) {}
+
+    void OnText(std::string_view text, bool finish) override {
+        // scratch copy that lives as long as the message
+        std::pmr::string copy(text, &arena_);
+        copies.push_back(copy.data());
+    }
+
+    wsocket::MessageArena    &arena_;
+    std::vector<const char *> copies;
+};
+
+void test_MemoryResource() {
+    // receive, cork and frame buffers all come from the context's resource
+    wsocket::CountingResource counting;
+    {
+        wsocket::MessageArena   arena;
+        wsocket::WSocketContext ctx1(&counting);
+        wsocket::WSocketContext ctx2(&counting);
+
+        ArenaClient client(arena);
+        ctx2.ResetListener(&client);
+        ctx2.SetMessageArena(&arena);
+
+        ctx1.ResetSendHandler([&](wsocket::Buffer buffer) { ctx2.Feed(buffer); });
+        ctx2.ResetSendHandler([&](wsocket::Buffer buffer) { ctx1.Feed(buffer); });
+
+        ctx1.Handshake();
+        assert(counting.BytesInUse() >= 2 * 8 * 1024);
+        auto allocations = counting.Allocations();
+
+        // the arena is released after each complete message, not between fragments
+        std::string text(100, 'a');
+        ctx1.SendText(text);
+        ctx1.SendText(text);
+        assert(client.copies.size() == 2 && client.copies[0] == client.copies[1]);
+        ctx1.SendText(text, false);
+        ctx1.SendText(text, true);
+        assert(client.copies.size() == 4 && client.copies[2] != client.copies[3]);
+        assert(counting.Allocations() > allocations);
+
+        {
+            wsocket::WSocketContext::BatchScope batch(ctx1);
+            ctx1.SendText(text);
+            assert(ctx1.CorkedSize() > 0);
+        }
+        assert(client.copies.size() == 5);
+    }
+    assert(counting.BytesInUse() == 0);
+    assert(counting.PeakBytes() >= 2 * 8 * 1024);
+
+    // pooled blocks share huge pages, large ones get their own
+    constexpr size_t      PAGE = wsocket::HugePageResource::PAGE_SIZE;
+    wsocket::HugePagePool pool;
+    auto                 *small = pool.allocate(100, 16);
+    assert(pool.Pages().MappedBytes() > 0 && pool.Pages().MappedBytes() % PAGE == 0);
+    auto  mapped = pool.Pages().MappedBytes();
+    auto *large  = pool.allocate(3 * 1024 * 1024, 16);
+    assert(reinterpret_cast<uintptr_t>(large) % PAGE == 0);
+    assert(pool.Pages().MappedBytes() >= mapped + 2 * PAGE);
+    memset(large, 1, 3 * 1024 * 1024);
+    pool.deallocate(large, 3 * 1024 * 1024, 16);
+    assert(pool.Pages().MappedBytes() == mapped);
+    pool.deallocate(small, 100, 16);
+}
+
+class SteadyPeer : public wsocket::WSocketContext::Listener {
+public:
+    SteadyPeer(wsocket::WSocketContext &context, bool compress, bool echo) :
+        context_(context), compress_(compress), echo_(echo) {}
+
+    wsocket::CompressType OnHandshake(const std::vector<wsocket::CompressType> &request_compress_type) override {
+        return compress_ && !request_compress_type.empty() ? request_compress_type.front()
+                                                           : wsocket::CompressType::None;
+    }
+    void OnText(std::string_view text, bool finish) override {
+        texts++;
+        if(echo_) {
+            context_.SendText(text);
+        }
+    }
+    void OnBinary(wsocket::Buffer buffer, bool finish) override { binaries++; }
+    void OnPing() override { context_.Pong(); }
+    void OnPong() override { pongs++; }
+
+    wsocket::WSocketContext &context_;
+    bool                     compress_;
+    bool                     echo_;
+    int                      texts    = 0;
+    int                      binaries = 0;
+    int                      pongs    = 0;
+};
+
+void test_zero_allocation() {
+    // once warmed up, text echo, binary and ping/pong never reach operator new
+    for(bool compress : {false, true}) {
+        wsocket::WSocketContext ctx1;
+        wsocket::WSocketContext ctx2;
+
+        SteadyPeer peer1(ctx1, compress, false);
+        SteadyPeer peer2(ctx2, compress, true);
+        ctx1.ResetListener(&peer1);
+        ctx2.ResetListener(&peer2);
+        ctx1.ResetSendHandler([&](wsocket::Buffer buffer) { ctx2.Feed(buffer); });
+        ctx2.ResetSendHandler([&](wsocket::Buffer buffer) { ctx1.Feed(buffer); });
+
+        // the compressor list handed to OnHandshake is the only allocation, besides the compress context
+        auto handshake = g_allocations.load();
+        ctx1.Handshake();
+        assert(ctx1.GetState() == ctx2.GetState());
+        assert(compress || g_allocations.load() - handshake <= 1);
+
+        std::string          text(1000, 't');
+        std::vector<uint8_t> binary(1000, 'b');
+
+        auto round = [&]() {
+            peer1.texts = 0;
+            ctx1.SendText(text);
+            assert(peer1.texts == 1);
+            ctx1.SendBinary({binary.data(), binary.size()});
+            ctx1.Ping();
+        };
+        for(int i = 0; i < 16; i++) {
+            round();
+        }
+
+        auto before = g_allocations.load();
+        for(int i = 0; i < 1000; i++) {
+            round();
+        }
+        auto allocations = g_allocations.load() - before;
+        if(allocations != 0) {
+            std::cerr << "steady state allocations per message: " << double(allocations) / 3000 << std::endl;
+        }
+        assert(allocations == 0);
+        assert(peer2.binaries == 1016 && peer1.pongs == 1016);
+
+        before = g_allocations.load();
+        ctx1.Close(wsocket::CloseCode::CLOSE_NORMAL);
+        assert(g_allocations.load() == before);
+    }
+}
+
+class OwnedClient : public wsocket::WSocketContext::Listener {
+public:
+    wsocket::CompressType OnHandshake(const std::vector<wsocket::CompressType> &request_compress_type) override {
+        return request_compress_type.empty() ? wsocket::CompressType::None : request_compress_type.front();
+    }
+    void OnText(std::string_view text, bool finish) override { assert(false); }
+    void OnMessage(wsocket::MessageHandle message) override { messages.push_back(std::move(message)); }
+
+    std::vector<wsocket::MessageHandle> messages;
+};
+
+void test_owned_messages() {
+    for(bool compress : {false, true}) {
+        wsocket::WSocketContext ctx1;
+        wsocket::WSocketContext ctx2;
+
+        OwnedClient client1;
+        OwnedClient client2;
+        ctx1.ResetListener(&client1);
+        ctx2.ResetListener(&client2);
+        ctx2.EnableOwnedMessages(true);
+
+        // receive through PrepareWrite, as the sockets do, and remember where the bytes landed
+        const uint8_t *landed = nullptr;
+        ctx1.ResetSendHandler([&](wsocket::Buffer buffer) {
+            for(size_t pos = 0; pos < buffer.size;) {
+                auto   dst = ctx2.PrepareWrite();
+                size_t len = std::min(dst.size, buffer.size - pos);
+                memcpy(dst.buf, buffer.buf + pos, len);
+                if(pos == 0) {
+                    landed = dst.buf;
+                }
+                ctx2.CommitWrite(len);
+                pos += len;
+            }
+        });
+        ctx2.ResetSendHandler([&](wsocket::Buffer buffer) { ctx1.Feed(buffer); });
+        ctx1.Handshake();
+
+        std::string          small(100, 's');
+        std::vector<uint8_t> large(6000);
+        for(size_t i = 0; i < large.size(); i++) {
+            large[i] = uint8_t(i * 7);
+        }
+
+        ctx1.SendText(small);
+        ctx1.SendBinary({large.data(), large.size()});
+        const uint8_t *large_landed = landed;
+        large[0]++;
+        ctx1.SendBinary({large.data(), large.size()}, false);
+        ctx1.SendText(small);
+
+        // every handle still holds its own payload
+        auto &messages = client2.messages;
+        assert(messages.size() == 4);
+        assert(messages[0].IsText() && messages[0].Text() == small);
+        assert(messages[1].IsBinary() && messages[1].Finished() && messages[1].Size() == large.size());
+        assert(messages[1].Data()[0] == uint8_t(large[0] - 1));
+        assert(memcmp(messages[1].Data() + 1, large.data() + 1, large.size() - 1) == 0);
+        assert(messages[2].IsBinary() && !messages[2].Finished() && messages[2].Data()[0] == large[0]);
+        assert(messages[3].Text() == small);
+        if(!compress) {
+            // a frame filling the receive buffer is handed over in place
+            assert(messages[1].Data() > large_landed && messages[1].Data() <= large_landed + 10);
+        }
+
+        // hand a reference to another thread, the last release frees the buffer there
+        auto shared = messages[1].Share();
+        assert(messages[1].UseCount() == 2);
+        std::thread worker([message = std::move(shared), &large]() mutable {
+            assert(message.Size() == large.size());
+            message.Reset();
+        });
+        worker.join();
+        assert(messages[1].UseCount() == 1);
+        messages.clear();
+
+        ctx1.SendText(small);
+        assert(messages.size() == 1 && messages[0].Text() == small);
+    }
+}
+
+class DirectClient : public wsocket::WSocketContext::Listener {
+public:
+    wsocket::Buffer OnBinaryDestination(size_t size, bool finish) override {
+        offers++;
+        if(decline) {
+            return {};
+        }
+        destination.resize(size);
+        return {destination.data(), destination.size()};
+    }
+    void OnBinary(wsocket::Buffer buffer, bool finish) override { binaries.push_back(buffer); }
+    void OnText(std::string_view text, bool finish) override { texts.emplace_back(text); }
+
+    bool                         decline = false;
+    int                          offers  = 0;
+    std::vector<uint8_t>         destination;
+    std::vector<wsocket::Buffer> binaries;
+    std::vector<std::string>     texts;
+};
+
+void test_direct_receive() {
+    wsocket::WSocketContext ctx1;
+    wsocket::WSocketContext ctx2;
+
+    DirectClient client;
+    ctx2.ResetListener(&client);
+    ctx2.SetDirectReceiveThreshold(64 * 1024);
+
+    // trickle the bytes in through PrepareWrite, as a socket does, never more than asked for
+    size_t max_write = 0;
+    ctx1.ResetSendHandler([&](wsocket::Buffer buffer) {
+        for(size_t pos = 0; pos < buffer.size;) {
+            auto   dst = ctx2.PrepareWrite();
+            size_t len = std::min({dst.size, buffer.size - pos, size_t(3000)});
+            max_write  = std::max(max_write, dst.size);
+            memcpy(dst.buf, buffer.buf + pos, len);
+            ctx2.CommitWrite(len);
+            pos += len;
+        }
+    });
+    ctx2.ResetSendHandler([&](wsocket::Buffer buffer) { ctx1.Feed(buffer); });
+    ctx1.Handshake();
+
+    std::vector<uint8_t> large(1024 * 1024);
+    for(size_t i = 0; i < large.size(); i++) {
+        large[i] = uint8_t(i * 13);
+    }
+
+    // the payload lands in the application buffer, the receive buffer never grows for it
+    {
+        wsocket::WSocketContext::BatchScope batch(ctx1);
+        ctx1.SendBinary({large.data(), large.size()});
+        ctx1.SendText("after");
+    }
+    assert(client.binaries.size() == 1 && client.texts.size() == 1 && client.texts[0] == "after");
+    assert(client.binaries[0].buf == client.destination.data() && client.binaries[0].size == large.size());
+    assert(client.destination == large);
+    assert(max_write >= large.size() - 8 * 1024);
+    assert(!ctx2.ReceivingDirect());
+
+    // small frames and declined ones take the usual path
+    client.decline = true;
+    ctx1.SendBinary({large.data(), large.size()});
+    ctx1.SendBinary({large.data(), 1000});
+    assert(client.binaries.size() == 3);
+    assert(client.binaries[1].buf != client.destination.data() && client.binaries[1].size == large.size());
+    // asked once per frame, not on every read of a declined one
+    assert(client.offers == 2);
+}
+
+#ifndef _WIN32
+class SpillClient : public wsocket::WSocketContext::Listener {
+public:
+    void OnError(std::error_code code) override { errors.push_back(code); }
+    void OnSpilled(wsocket::SpilledMessage message) override { spilled.push_back(std::move(message)); }
+    void OnBinary(wsocket::Buffer buffer, bool finish) override {
+        assert(finish);
+        binaries.emplace_back(buffer.buf, buffer.buf + buffer.size);
+    }
+    void OnText(std::string_view text, bool finish) override { texts.emplace_back(text); }
+
+    std::vector<std::error_code>         errors;
+    std::vector<wsocket::SpilledMessage> spilled;
+    std::vector<std::vector<uint8_t>>    binaries;
+    std::vector<std::string>             texts;
+};
+
+void test_spill_receive() {
+    wsocket::WSocketContext ctx1;
+    wsocket::WSocketContext ctx2;
+
+    SpillClient client;
+    ctx2.ResetListener(&client);
+    ctx2.SetSpillThreshold(256 * 1024);
+
+    // through PrepareWrite in socket sized reads, or through Feed in large chunks
+    bool feed = false;
+    ctx1.ResetSendHandler([&](wsocket::Buffer buffer) {
+        for(size_t pos = 0; pos < buffer.size;) {
+            if(feed) {
+                size_t len = std::min(buffer.size - pos, size_t(5 * 1024 * 1024));
+                ctx2.Feed({buffer.buf + pos, len});
+                pos += len;
+                continue;
+            }
+            auto   dst = ctx2.PrepareWrite();
+            size_t len = std::min({dst.size, buffer.size - pos, size_t(64 * 1024)});
+            memcpy(dst.buf, buffer.buf + pos, len);
+            ctx2.CommitWrite(len);
+            pos += len;
+        }
+    });
+    ctx2.ResetSendHandler([&](wsocket::Buffer buffer) { ctx1.Feed(buffer); });
+    ctx1.Handshake();
+
+    // larger than one mapping window
+    std::vector<uint8_t> large(wsocket::SpillFile::WINDOW_SIZE + 3 * 1024 * 1024 + 17);
+    for(size_t i = 0; i < large.size(); i++) {
+        large[i] = uint8_t(i * 13 + i / 4096);
+    }
+
+    for(bool by_feed : {false, true}) {
+        feed = by_feed;
+        ctx1.SendBinary({large.data(), large.size()});
+        ctx1.SendText("after");
+        assert(client.spilled.size() == 1 && client.texts.size() == 1 && client.texts[0] == "after");
+        assert(client.spilled[0].Fd() >= 0 && client.spilled[0].Size() == large.size());
+        assert(memcmp(client.spilled[0].Data(), large.data(), large.size()) == 0);
+        assert(!ctx2.ReceivingDirect());
+        client.spilled.clear();
+        client.texts.clear();
+    }
+
+    // fragments crossing the threshold together arrive as one spilled message
+    feed = false;
+    ctx1.SendBinary({large.data(), 100 * 1024}, false);
+    ctx1.SendBinary({large.data() + 100 * 1024, 100 * 1024}, false);
+    ctx1.SendBinary({large.data() + 200 * 1024, 100 * 1024}, false);
+    ctx1.SendBinary({large.data() + 300 * 1024, 1000});
+    assert(client.spilled.size() == 1 && client.binaries.empty());
+    assert(client.spilled[0].Size() == 300 * 1024 + 1000);
+    assert(memcmp(client.spilled[0].Data(), large.data(), client.spilled[0].Size()) == 0);
+
+    // small fragments are joined in memory, small messages pass as usual
+    ctx1.SendBinary({large.data(), 1000}, false);
+    ctx1.SendBinary({large.data() + 1000, 1000});
+    ctx1.SendBinary({large.data(), 10});
+    assert(client.spilled.size() == 1 && client.binaries.size() == 2);
+    assert(client.binaries[0] == std::vector<uint8_t>(large.begin(), large.begin() + 2000));
+    assert(client.binaries[1].size() == 10);
+
+    // no file, no message: the connection fails
+    ctx2.ResetSendHandler([](wsocket::Buffer buffer) {});
+    ctx2.SetSpillThreshold(256 * 1024, "/nonexistent/wsocket");
+    ctx1.SendBinary({large.data(), 1024 * 1024});
+    assert(ctx2.IsFailed() && client.errors.size() == 1 && client.errors[0] == wsocket::Error::SpillError);
+    assert(client.spilled.size() == 1);
+}
+#endif
+
+void test_frame_builder() {
+    for(bool compress : {false, true}) {
+        wsocket::WSocketContext ctx1;
+        wsocket::WSocketContext ctx2;
+
+        SteadyPeer     peer1(ctx1, compress, false);
+        DirectClient   client;
+        const uint8_t *sent = nullptr;
+        ctx1.ResetListener(&peer1);
+        ctx2.ResetListener(&client);
+        client.decline = true;
+        ctx1.ResetSendHandler([&](wsocket::Buffer buffer) {
+            sent = buffer.buf;
+            ctx2.Feed(buffer);
+        });
+        ctx2.ResetSendHandler([&](wsocket::Buffer buffer) { ctx1.Feed(buffer); });
+        ctx1.Handshake();
+
+        // each header form is written right in front of the payload, which goes out where it was built
+        for(size_t size : {100, 1000, 100000}) {
+            auto builder = ctx1.BuildBinary(size);
+            auto payload = builder.Payload();
+            assert(payload.size >= size);
+            memset(payload.buf, int(size % 251), size);
+            builder.Commit(size);
+            size_t header = size < 254 ? 2 : size <= 65535 ? 4 : 10;
+            assert(sent == payload.buf - header);
+            assert(client.binaries.back().size == size && client.binaries.back().buf[size - 1] == size % 251);
+        }
+
+        // grown while writing, committed in fragments, dropped without sending
+        auto builder = ctx1.BuildText(4);
+        memcpy(builder.Payload().buf, "in p", 4);
+        builder.Reserve(100 * 1024);
+        memcpy(builder.Payload().buf + 4, "lace", 4);
+        {
+            wsocket::WSocketContext::BatchScope batch(ctx1);
+            builder.Commit(8, false);
+            assert(ctx1.CorkedSize() > 0 && client.texts.empty());
+            builder.Reserve(5);
+            memcpy(builder.Payload().buf, " text", 5);
+            builder.Commit(5);
+        }
+        assert((client.texts == std::vector<std::string>{"in place", " text"}));
+        assert(!builder.Payload().buf);
+        {
+            auto dropped = ctx1.BuildBinary(10);
+        }
+        assert(client.binaries.size() == 3 && ctx1.MessagesSent() == 4);
+    }
+}
+
 #ifdef WITH_ASIO
 class TestWSocket : public wsocket::WSocket {
 protected:
@@ -617,18 +1300,1367 @@ void test_asio_wsocket_zstd() {
     io_executor.run();
     std::cout << "================== test_asio_wsocket_zstd ==================" << std::endl;
 }
-#endif
+class TestServerSession : public wsocket::WSocket {
+protected:
+    explicit TestServerSession(asio::ip::tcp::socket &&socket) :
+        wsocket::WSocket(std::move(socket)), thread_(std::this_thread::get_id()) {}
 
-int main() {
-    std::cout << "================== start ==================" << std::endl;
-    try {
-        testBasicHeader();
-        testFrameHeader();
-        test_SlidingBuffer();
-        test_WSocketContext();
-        test_asio_wsocket();
-        test_asio_unix_wsocket();
-        test_asio_wsocket_zstd();
+public:
+    static std::shared_ptr<TestServerSession> Create(asio::ip::tcp::socket &&socket) {
+        return std::shared_ptr<TestServerSession>(new TestServerSession(std::move(socket)));
+    }
+
+private:
+    void OnText(std::string_view text, bool finish) override {
+        // sessions never leave the worker that accepted them
+        assert(std::this_thread::get_id() == thread_);
+        this->Text(text, finish);
+    }
+    void OnClose(int16_t code, const std::string &reason) override { this->Stop(); }
+
+    std::thread::id thread_;
+};
+
+class TestServerClient : public wsocket::WSocket {
+protected:
+    TestServerClient(asio::io_context &io_executor, int index) :
+        wsocket::WSocket(io_executor.get_executor()), index_(index) {}
+
+public:
+    static std::shared_ptr<TestServerClient> Create(asio::io_context &io_executor, int index) {
+        return std::shared_ptr<TestServerClient>(new TestServerClient(io_executor, index));
+    }
+
+    bool echoed = false;
+
+private:
+    void OnError(std::error_code code) override { std::cout << "OnError: " << code << std::endl; }
+    void OnConnected() override { this->Text("server " + std::to_string(index_)); }
+    void OnText(std::string_view text, bool finish) override {
+        assert(text == "server " + std::to_string(index_));
+        echoed = true;
+        this->Close(wsocket::CloseCode::CLOSE_NORMAL);
+    }
+    void OnClose(int16_t code, const std::string &reason) override { this->Stop(); }
+
+    int index_;
+};
+
+void test_asio_wsocket_server() {
+    std::cout << "================== test_asio_wsocket_server ==================" << std::endl;
+    using tcp = asio::ip::tcp;
+
+    // per-worker SO_REUSEPORT acceptors, then one acceptor feeding the workers
+    for(bool reuse_port : {true, false}) {
+        wsocket::WSocketServerOptions options;
+        options.threads     = 2;
+        options.pin_threads = true;
+        options.reuse_port  = reuse_port;
+
+        std::atomic<int>          accepted{0};
+        wsocket::TcpWSocketServer server(
+                [&](size_t worker, tcp::socket &&socket) {
+                    assert(worker < 2);
+                    accepted++;
+                    return TestServerSession::Create(std::move(socket));
+                },
+                options);
+        auto ec = server.Start(tcp::endpoint(asio::ip::make_address_v4("127.0.0.1"), 0));
+        assert(!ec);
+        assert(server.Workers() == 2);
+
+        asio::io_context                               io_executor;
+        std::vector<std::shared_ptr<TestServerClient>> clients;
+        for(int i = 0; i < 4; ++i) {
+            clients.push_back(TestServerClient::Create(io_executor, i));
+            clients.back()->Handshake(server.LocalEndpoint());
+        }
+        io_executor.run();
+
+        for(auto &client : clients) {
+            assert(client->echoed);
+        }
+        assert(accepted == 4);
+        server.Stop();
+    }
+    std::cout << "================== test_asio_wsocket_server ==================" << std::endl;
+}
+class TestPostClient : public wsocket::WSocket {
+protected:
+    explicit TestPostClient(asio::io_context &io_executor) : wsocket::WSocket(io_executor.get_executor()) {}
+
+public:
+    static std::shared_ptr<TestPostClient> Create(asio::io_context &io_executor) {
+        return std::shared_ptr<TestPostClient>(new TestPostClient(io_executor));
+    }
+
+    static constexpr int PRODUCERS = 4;
+    static constexpr int MESSAGES  = 1000;
+
+    std::atomic<bool> connected{false};
+    int               echoed = 0;
+    int               next[PRODUCERS]{};
+
+private:
+    void OnError(std::error_code code) override { std::cout << "OnError: " << code << std::endl; }
+    void OnConnected() override { connected = true; }
+    void OnText(std::string_view text, bool finish) override {
+        // "producer:sequence", every producer's messages arrive in order
+        auto producer = std::stoi(std::string(text.substr(0, text.find(':'))));
+        auto sequence = std::stoi(std::string(text.substr(text.find(':') + 1)));
+        assert(sequence == next[producer]++);
+        if(++echoed == PRODUCERS * MESSAGES) {
+            this->PostClose(wsocket::CloseCode::CLOSE_NORMAL);
+        }
+    }
+    void OnClose(int16_t code, const std::string &reason) override { this->Stop(); }
+};
+
+// Posts behind a close, none of it may reach the wire or close twice
+class TestPostAfterCloseClient : public wsocket::WSocket {
+protected:
+    explicit TestPostAfterCloseClient(asio::io_context &io_executor) : wsocket::WSocket(io_executor.get_executor()) {}
+
+public:
+    static std::shared_ptr<TestPostAfterCloseClient> Create(asio::io_context &io_executor) {
+        return std::shared_ptr<TestPostAfterCloseClient>(new TestPostAfterCloseClient(io_executor));
+    }
+
+    bool closed = false;
+
+private:
+    void OnConnected() override {
+        // drained together: the first close goes out, the rest is dropped
+        this->PostClose(wsocket::CloseCode::CLOSE_NORMAL);
+        this->PostText("after PostClose");
+        this->PostClose(wsocket::CloseCode::CLOSE_NORMAL);
+    }
+    void OnText(std::string_view text, bool finish) override { assert(false); }
+    void OnClose(int16_t code, const std::string &reason) override {
+        closed = true;
+        // drained after the close completed
+        this->PostText("after OnClose");
+        this->PostClose(wsocket::CloseCode::CLOSE_NORMAL);
+        this->Stop();
+    }
+};
+
+void test_asio_wsocket_post() {
+    std::cout << "================== test_asio_wsocket_post ==================" << std::endl;
+    using tcp = asio::ip::tcp;
+
+    asio::io_context io_executor;
+    tcp::acceptor    server(io_executor, tcp::endpoint(asio::ip::make_address_v4("127.0.0.1"), 0));
+    server.async_accept([&](asio::error_code ec, tcp::socket peer) {
+        assert(!ec);
+        TestServerSession::Create(std::move(peer))->Start();
+    });
+
+    auto client = TestPostClient::Create(io_executor);
+    client->Handshake(server.local_endpoint());
+    std::thread io_thread([&]() { io_executor.run(); });
+
+    while(!client->connected) {
+        std::this_thread::yield();
+    }
+    std::vector<std::thread> producers;
+    for(int p = 0; p < TestPostClient::PRODUCERS; ++p) {
+        producers.emplace_back([&, p]() {
+            for(int i = 0; i < TestPostClient::MESSAGES; ++i) {
+                client->PostText(std::to_string(p) + ":" + std::to_string(i));
+            }
+        });
+    }
+    for(auto &producer : producers) {
+        producer.join();
+    }
+    io_thread.join();
+    assert(client->echoed == TestPostClient::PRODUCERS * TestPostClient::MESSAGES);
+
+    server.async_accept([&](asio::error_code ec, tcp::socket peer) {
+        assert(!ec);
+        TestServerSession::Create(std::move(peer))->Start();
+    });
+    auto late = TestPostAfterCloseClient::Create(io_executor);
+    late->Handshake(server.local_endpoint());
+    io_executor.restart();
+    io_executor.run();
+    assert(late->closed);
+    std::cout << "================== test_asio_wsocket_post ==================" << std::endl;
+}
+class TestBackPressureClient : public wsocket::WSocket {
+protected:
+    explicit TestBackPressureClient(asio::io_context &io_executor) : wsocket::WSocket(io_executor.get_executor()) {}
+
+public:
+    static std::shared_ptr<TestBackPressureClient> Create(asio::io_context &io_executor) {
+        return std::shared_ptr<TestBackPressureClient>(new TestBackPressureClient(io_executor));
+    }
+
+    int  sent     = 0;
+    bool high     = false;
+    bool writable = false;
+
+private:
+    void OnError(std::error_code code) override { std::cout << "OnError: " << code << std::endl; }
+    void OnConnected() override {
+        this->SetSendWatermarks(64 * 1024, 256 * 1024);
+        this->EnableWouldBlock(true);
+
+        // the server shares this thread and reads nothing until we return, so the kernel buffers fill up
+        std::vector<uint8_t> chunk(64 * 1024, 'x');
+        while(this->Binary({chunk.data(), chunk.size()})) {
+            sent++;
+        }
+        assert(high && this->IsSendQueueHigh());
+        assert(this->SendQueueSize() >= 256 * 1024);
+    }
+    void OnSendQueueHigh(size_t queued) override { high = true; }
+    void OnWritable() override {
+        writable = true;
+        assert(this->SendQueueSize() <= 64 * 1024);
+        this->Close(wsocket::CloseCode::CLOSE_NORMAL);
+    }
+    void OnClose(int16_t code, const std::string &reason) override { this->Stop(); }
+};
+
+void test_asio_wsocket_back_pressure() {
+    std::cout << "================== test_asio_wsocket_back_pressure ==================" << std::endl;
+    using tcp = asio::ip::tcp;
+
+    asio::io_context io_executor;
+    tcp::acceptor    server(io_executor, tcp::endpoint(asio::ip::make_address_v4("127.0.0.1"), 0));
+    server.async_accept([&](asio::error_code ec, tcp::socket peer) {
+        assert(!ec);
+        TestServerSession::Create(std::move(peer))->Start();
+    });
+
+    auto client = TestBackPressureClient::Create(io_executor);
+    client->Handshake(server.local_endpoint());
+    io_executor.run();
+
+    assert(client->sent > 0 && client->high && client->writable);
+    assert(client->SendQueueSize() == 0);
+    std::cout << "================== test_asio_wsocket_back_pressure ==================" << std::endl;
+}
+class TestConflationClient : public wsocket::WSocket {
+protected:
+    explicit TestConflationClient(asio::io_context &io_executor) : wsocket::WSocket(io_executor.get_executor()) {}
+
+public:
+    static std::shared_ptr<TestConflationClient> Create(asio::io_context &io_executor) {
+        return std::shared_ptr<TestConflationClient>(new TestConflationClient(io_executor));
+    }
+
+    std::vector<std::string> received;
+
+private:
+    void OnError(std::error_code code) override { std::cout << "OnError: " << code << std::endl; }
+    void OnConnected() override {
+        // back the connection up, the server reads nothing until we return
+        std::vector<uint8_t> chunk(64 * 1024, 'x');
+        while(this->SendQueueSize() == 0) {
+            this->Binary({chunk.data(), chunk.size()});
+        }
+
+        this->ConflateText("A", "a1");
+        this->ConflateText("B", "b1");
+        this->ConflateText("A", "a2");
+        this->ConflateText("C", "c1", std::chrono::microseconds(1));
+        this->ConflateText("", "plain");
+        this->ConflateText("A", "a3");
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        assert(this->ConflatedPending() == 4);
+    }
+    void OnText(std::string_view text, bool finish) override {
+        received.emplace_back(text);
+        if(received.size() == 3) {
+            this->Close(wsocket::CloseCode::CLOSE_NORMAL);
+        }
+    }
+    void OnClose(int16_t code, const std::string &reason) override { this->Stop(); }
+};
+
+// Conflates while bytes corked in the flush window hold the queue at the watermark
+class TestCorkedConflationClient : public wsocket::WSocket {
+protected:
+    explicit TestCorkedConflationClient(asio::io_context &io_executor) :
+        wsocket::WSocket(io_executor.get_executor()) {}
+
+public:
+    static std::shared_ptr<TestCorkedConflationClient> Create(asio::io_context &io_executor) {
+        return std::shared_ptr<TestCorkedConflationClient>(new TestCorkedConflationClient(io_executor));
+    }
+
+    std::vector<std::string> received;
+
+private:
+    void OnConnected() override {
+        this->SetFlushWindow(std::chrono::milliseconds(1));
+        this->SetSendWatermarks(0, 16);
+        this->EnableWouldBlock(true);
+
+        assert(this->Text("corked past the high watermark"));
+        // refused by Text, kept for the flush instead of dropped
+        this->ConflateText("A", "a1");
+        assert(this->ConflatedPending() == 1);
+    }
+    void OnText(std::string_view text, bool finish) override {
+        received.emplace_back(text);
+        if(received.size() == 2) {
+            this->Close(wsocket::CloseCode::CLOSE_NORMAL);
+        }
+    }
+    void OnClose(int16_t code, const std::string &reason) override { this->Stop(); }
+};
+
+// Closes with conflated messages still waiting behind a backed up queue
+class TestClosingConflationClient : public wsocket::WSocket {
+protected:
+    explicit TestClosingConflationClient(asio::io_context &io_executor) :
+        wsocket::WSocket(io_executor.get_executor()) {}
+
+public:
+    static std::shared_ptr<TestClosingConflationClient> Create(asio::io_context &io_executor) {
+        return std::shared_ptr<TestClosingConflationClient>(new TestClosingConflationClient(io_executor));
+    }
+
+    bool closed = false;
+
+private:
+    void OnConnected() override {
+        this->SetFlushWindow(std::chrono::milliseconds(1));
+        std::vector<uint8_t> chunk(64 * 1024, 'x');
+        while(this->SendQueueSize() == 0) {
+            this->Binary({chunk.data(), chunk.size()});
+        }
+        this->ConflateText("A", "a1");
+        assert(this->ConflatedPending() == 1);
+
+        // neither the write completion nor the flush window may send after the close frame
+        this->Close(wsocket::CloseCode::CLOSE_NORMAL);
+        assert(this->ConflatedPending() == 0);
+        this->ConflateText("A", "a2");
+        assert(this->ConflatedPending() == 0);
+    }
+    void OnText(std::string_view text, bool finish) override { assert(false); }
+    void OnClose(int16_t code, const std::string &reason) override {
+        closed = true;
+        this->Stop();
+    }
+};
+
+void test_asio_wsocket_conflation() {
+    std::cout << "================== test_asio_wsocket_conflation ==================" << std::endl;
+    using tcp = asio::ip::tcp;
+
+    asio::io_context io_executor;
+    tcp::acceptor    server(io_executor, tcp::endpoint(asio::ip::make_address_v4("127.0.0.1"), 0));
+    server.async_accept([&](asio::error_code ec, tcp::socket peer) {
+        assert(!ec);
+        TestServerSession::Create(std::move(peer))->Start();
+    });
+
+    auto client = TestConflationClient::Create(io_executor);
+    client->Handshake(server.local_endpoint());
+    io_executor.run();
+
+    // A keeps its first place with the newest value, C expired
+    assert((client->received == std::vector<std::string>{"a3", "b1", "plain"}));
+    assert(client->ConflatedReplaced() == 2);
+    assert(client->ConflatedExpired() == 1);
+
+    server.async_accept([&](asio::error_code ec, tcp::socket peer) {
+        assert(!ec);
+        TestServerSession::Create(std::move(peer))->Start();
+    });
+    auto corked = TestCorkedConflationClient::Create(io_executor);
+    corked->Handshake(server.local_endpoint());
+    io_executor.restart();
+    io_executor.run();
+    assert((corked->received == std::vector<std::string>{"corked past the high watermark", "a1"}));
+
+    server.async_accept([&](asio::error_code ec, tcp::socket peer) {
+        assert(!ec);
+        TestServerSession::Create(std::move(peer))->Start();
+    });
+    auto closing = TestClosingConflationClient::Create(io_executor);
+    closing->Handshake(server.local_endpoint());
+    io_executor.restart();
+    io_executor.run();
+    assert(closing->closed);
+    std::cout << "================== test_asio_wsocket_conflation ==================" << std::endl;
+}
+class TestIdleRecvClient : public wsocket::WSocket {
+protected:
+    explicit TestIdleRecvClient(asio::io_context &io_executor) : wsocket::WSocket(io_executor.get_executor()) {}
+
+public:
+    static std::shared_ptr<TestIdleRecvClient> Create(asio::io_context &io_executor) {
+        return std::shared_ptr<TestIdleRecvClient>(new TestIdleRecvClient(io_executor));
+    }
+
+    std::vector<size_t> echoed;
+
+private:
+    void OnError(std::error_code code) override { std::cout << "OnError: " << code << std::endl; }
+    void OnConnected() override { this->Text("small"); }
+    void OnText(std::string_view text, bool finish) override {
+        echoed.push_back(text.size());
+        if(echoed.size() == 1) {
+            // larger than the receive buffer, grown for it and freed afterwards
+            this->Text(std::string(100 * 1024, 'x'));
+        } else if(echoed.size() == 2) {
+            this->Text("small again");
+        } else {
+            this->Close(wsocket::CloseCode::CLOSE_NORMAL);
+        }
+    }
+    void OnClose(int16_t code, const std::string &reason) override { this->Stop(); }
+};
+
+void test_asio_wsocket_idle_recv() {
+    std::cout << "================== test_asio_wsocket_idle_recv ==================" << std::endl;
+    using tcp = asio::ip::tcp;
+
+    asio::io_context io_executor;
+    tcp::acceptor    server(io_executor, tcp::endpoint(asio::ip::make_address_v4("127.0.0.1"), 0));
+    std::function<void()> accept = [&]() {
+        server.async_accept([&](asio::error_code ec, tcp::socket peer) {
+            if(ec) {
+                return;
+            }
+            auto session = TestServerSession::Create(std::move(peer));
+            session->EnableIdleRecv(true);
+            session->Start();
+            accept();
+        });
+    };
+    accept();
+
+    std::vector<std::shared_ptr<TestIdleRecvClient>> clients;
+    for(int i = 0; i < 8; ++i) {
+        clients.push_back(TestIdleRecvClient::Create(io_executor));
+        clients.back()->EnableIdleRecv(true);
+        clients.back()->Handshake(server.local_endpoint());
+    }
+    while(std::any_of(clients.begin(), clients.end(), [](auto &client) { return client->echoed.size() < 3; })) {
+        io_executor.run_one();
+    }
+    server.close();
+    io_executor.run();
+
+    for(auto &client : clients) {
+        assert((client->echoed == std::vector<size_t>{5, 100 * 1024, 11}));
+    }
+    // the idle connections handed their buffers back
+    assert(wsocket::BufferPool::Local()->Stats().cached_bytes > 0);
+    std::cout << "================== test_asio_wsocket_idle_recv ==================" << std::endl;
+}
+class TestDirectReceiver : public wsocket::WSocket {
+protected:
+    explicit TestDirectReceiver(asio::ip::tcp::socket &&socket) : wsocket::WSocket(std::move(socket)) {}
+
+public:
+    static std::shared_ptr<TestDirectReceiver> Create(asio::ip::tcp::socket &&socket) {
+        return std::shared_ptr<TestDirectReceiver>(new TestDirectReceiver(std::move(socket)));
+    }
+
+    std::vector<uint8_t> destination;
+    bool                 direct = false;
+
+private:
+    wsocket::Buffer OnBinaryDestination(size_t size, bool finish) override {
+        destination.resize(size);
+        return {destination.data(), destination.size()};
+    }
+    void OnBinary(wsocket::Buffer buffer, bool finish) override { direct = buffer.buf == destination.data(); }
+    void OnText(std::string_view text, bool finish) override { this->Close(wsocket::CloseCode::CLOSE_NORMAL); }
+    void OnClose(int16_t code, const std::string &reason) override { this->Stop(); }
+};
+
+class TestDirectSender : public wsocket::WSocket {
+protected:
+    TestDirectSender(asio::io_context &io_executor, const std::vector<uint8_t> &payload) :
+        wsocket::WSocket(io_executor.get_executor()), payload_(payload) {}
+
+public:
+    static std::shared_ptr<TestDirectSender> Create(asio::io_context           &io_executor,
+                                                    const std::vector<uint8_t> &payload) {
+        return std::shared_ptr<TestDirectSender>(new TestDirectSender(io_executor, payload));
+    }
+
+private:
+    void OnConnected() override {
+        this->Binary({const_cast<uint8_t *>(payload_.data()), payload_.size()});
+        this->Text("done");
+    }
+    void OnClose(int16_t code, const std::string &reason) override { this->Stop(); }
+
+    const std::vector<uint8_t> &payload_;
+};
+
+void test_asio_wsocket_direct_receive() {
+    std::cout << "================== test_asio_wsocket_direct_receive ==================" << std::endl;
+    using tcp = asio::ip::tcp;
+
+    std::vector<uint8_t> payload(4 * 1024 * 1024);
+    for(size_t i = 0; i < payload.size(); i++) {
+        payload[i] = uint8_t(i * 31);
+    }
+
+    asio::io_context                    io_executor;
+    tcp::acceptor                       server(io_executor, tcp::endpoint(asio::ip::make_address_v4("127.0.0.1"), 0));
+    std::shared_ptr<TestDirectReceiver> receiver;
+    server.async_accept([&](asio::error_code ec, tcp::socket peer) {
+        assert(!ec);
+        receiver = TestDirectReceiver::Create(std::move(peer));
+        receiver->SetDirectReceiveThreshold(64 * 1024);
+        receiver->Start();
+    });
+
+    auto sender = TestDirectSender::Create(io_executor, payload);
+    sender->Handshake(server.local_endpoint());
+    io_executor.run();
+
+    assert(receiver && receiver->direct);
+    assert(receiver->destination == payload);
+    std::cout << "================== test_asio_wsocket_direct_receive ==================" << std::endl;
+}
+#ifdef __linux__
+class TestFileReceiver : public wsocket::WSocket {
+protected:
+    explicit TestFileReceiver(asio::ip::tcp::socket &&socket) : wsocket::WSocket(std::move(socket)) {}
+
+public:
+    static std::shared_ptr<TestFileReceiver> Create(asio::ip::tcp::socket &&socket) {
+        return std::shared_ptr<TestFileReceiver>(new TestFileReceiver(std::move(socket)));
+    }
+
+    std::vector<std::string> events;
+    std::vector<uint8_t>     file;
+
+private:
+    void OnBinary(wsocket::Buffer buffer, bool finish) override {
+        file.insert(file.end(), buffer.buf, buffer.buf + buffer.size);
+        events.push_back(finish ? "file" : "fragment");
+    }
+    void OnText(std::string_view text, bool finish) override {
+        events.emplace_back(text);
+        if(text == "after") {
+            this->Close(wsocket::CloseCode::CLOSE_NORMAL);
+        }
+    }
+    void OnClose(int16_t code, const std::string &reason) override { this->Stop(); }
+};
+
+class TestFileSender : public wsocket::WSocket {
+protected:
+    TestFileSender(asio::io_context &io_executor, int fd, uint64_t offset, uint64_t length) :
+        wsocket::WSocket(io_executor.get_executor()), fd_(fd), offset_(offset), length_(length) {}
+
+public:
+    static std::shared_ptr<TestFileSender> Create(asio::io_context &io_executor,
+                                                  int               fd,
+                                                  uint64_t          offset,
+                                                  uint64_t          length) {
+        return std::shared_ptr<TestFileSender>(new TestFileSender(io_executor, fd, offset, length));
+    }
+
+private:
+    void OnConnected() override {
+        this->Text("before");
+        assert(this->SendFile(fd_, offset_, length_));
+        this->Text("after");
+    }
+    void OnClose(int16_t code, const std::string &reason) override { this->Stop(); }
+
+    int      fd_;
+    uint64_t offset_;
+    uint64_t length_;
+};
+
+void test_asio_wsocket_send_file() {
+    std::cout << "================== test_asio_wsocket_send_file ==================" << std::endl;
+    using tcp = asio::ip::tcp;
+
+    // the header goes through the context: refused until connected, counted as a message
+    {
+        wsocket::WSocketContext ctx1;
+        wsocket::WSocketContext ctx2;
+        DirectClient            client;
+        ctx2.ResetListener(&client);
+        ctx1.ResetSendHandler([&](wsocket::Buffer buffer) { ctx2.Feed(buffer); });
+        ctx2.ResetSendHandler([&](wsocket::Buffer buffer) { ctx1.Feed(buffer); });
+
+        assert(!ctx1.SendBinaryHeader(3, true));
+        ctx1.Handshake();
+        assert(ctx1.SendBinaryHeader(3, true) && ctx1.MessagesSent() == 1);
+        ctx2.Feed({reinterpret_cast<uint8_t *>(const_cast<char *>("abc")), 3});
+        assert(client.binaries.size() == 1 && client.binaries[0].size == 3);
+    }
+
+    std::vector<uint8_t> content(3 * 1024 * 1024 + 500);
+    for(size_t i = 0; i < content.size(); i++) {
+        content[i] = uint8_t(i * 17 + i / 251);
+    }
+    char path[] = "/tmp/wsocket_send_file_XXXXXX";
+    int  fd     = mkstemp(path);
+    assert(fd >= 0);
+    unlink(path);
+    assert(write(fd, content.data(), content.size()) == ssize_t(content.size()));
+
+    asio::io_context                  io_executor;
+    tcp::acceptor                     server(io_executor, tcp::endpoint(asio::ip::make_address_v4("127.0.0.1"), 0));
+    std::shared_ptr<TestFileReceiver> receiver;
+    server.async_accept([&](asio::error_code ec, tcp::socket peer) {
+        assert(!ec);
+        receiver = TestFileReceiver::Create(std::move(peer));
+        receiver->Start();
+    });
+
+    // 100 bytes in, fragmented at 1 MiB: three full fragments and the rest
+    auto sender = TestFileSender::Create(io_executor, fd, 100, content.size() - 100);
+    assert(!sender->SendFile(fd, 0, 100));
+    sender->Handshake(server.local_endpoint());
+    io_executor.run();
+    close(fd);
+
+    assert(receiver);
+    std::vector<std::string> expected{"before", "fragment", "fragment", "fragment", "file", "after"};
+    assert(receiver->events == expected);
+    assert(std::equal(receiver->file.begin(), receiver->file.end(), content.begin() + 100, content.end()));
+    std::cout << "================== test_asio_wsocket_send_file ==================" << std::endl;
+}
+
+class TestZeroCopySender : public wsocket::WSocket {
+protected:
+    TestZeroCopySender(asio::io_context &io_executor, const wsocket::MessageHandle &large) :
+        wsocket::WSocket(io_executor.get_executor()), large_(large.Share()) {
+        this->EnableZeroCopy(64 * 1024);
+    }
+
+public:
+    static std::shared_ptr<TestZeroCopySender> Create(asio::io_context             &io_executor,
+                                                      const wsocket::MessageHandle &large) {
+        return std::shared_ptr<TestZeroCopySender>(new TestZeroCopySender(io_executor, large));
+    }
+
+private:
+    void OnConnected() override {
+        uint8_t small[100] = {};
+        auto    copy       = wsocket::MessageHandle::Copy({small, sizeof(small)}, true, true);
+
+        // one message per millisecond: the large payload waits in the queue and counts toward the watermark
+        this->SetSendRateLimit({1000, 0, 1, 0});
+        this->Text("before");
+        assert(this->Send(std::move(large_)));
+        this->EnableWouldBlock(true);
+        assert(this->SendQueueSize() > 2 * 1024 * 1024 && !this->Send(copy.Share()));
+        this->EnableWouldBlock(false);
+
+        assert(this->Send(std::move(copy)));
+        this->Text("after");
+    }
+    void OnClose(int16_t code, const std::string &reason) override { this->Stop(); }
+
+    wsocket::MessageHandle large_;
+};
+
+void test_asio_wsocket_zero_copy() {
+    std::cout << "================== test_asio_wsocket_zero_copy ==================" << std::endl;
+    using tcp = asio::ip::tcp;
+
+    std::vector<uint8_t> payload(2 * 1024 * 1024);
+    for(size_t i = 0; i < payload.size(); i++) {
+        payload[i] = uint8_t(i * 13 + i / 509);
+    }
+    auto large = wsocket::MessageHandle::Copy({payload.data(), payload.size()}, true, true);
+
+    asio::io_context                  io_executor;
+    tcp::acceptor                     server(io_executor, tcp::endpoint(asio::ip::make_address_v4("127.0.0.1"), 0));
+    std::shared_ptr<TestFileReceiver> receiver;
+    server.async_accept([&](asio::error_code ec, tcp::socket peer) {
+        assert(!ec);
+        receiver = TestFileReceiver::Create(std::move(peer));
+        receiver->Start();
+    });
+
+    auto sender = TestZeroCopySender::Create(io_executor, large);
+    sender->Handshake(server.local_endpoint());
+    io_executor.run();
+
+    assert(receiver);
+    std::vector<std::string> expected{"before", "file", "file", "after"};
+    assert(receiver->events == expected);
+    assert(receiver->file.size() == payload.size() + 100);
+    assert(std::equal(payload.begin(), payload.end(), receiver->file.begin()));
+    // the large payload went out zero-copy and was released once the kernel completed it
+    assert(sender->ZeroCopySends() > 0);
+    assert(sender->ZeroCopyPending() == 0);
+    assert(large.UseCount() == 1);
+    std::cout << "================== test_asio_wsocket_zero_copy ==================" << std::endl;
+}
+#endif
+
+class TestSteadyClient : public wsocket::WSocket {
+protected:
+    explicit TestSteadyClient(asio::ip::tcp::socket &&socket) : wsocket::WSocket(std::move(socket)) {}
+
+public:
+    static std::shared_ptr<TestSteadyClient> Create(asio::ip::tcp::socket &&socket) {
+        return std::shared_ptr<TestSteadyClient>(new TestSteadyClient(std::move(socket)));
+    }
+
+    static constexpr int WARMUP   = 100;
+    static constexpr int MESSAGES = 1000;
+
+    int      echoed      = 0;
+    uint64_t allocations = 0;
+
+private:
+    void OnError(std::error_code code) override { std::cout << "OnError: " << code << std::endl; }
+    void OnConnected() override { this->Text(text_); }
+    void OnText(std::string_view text, bool finish) override {
+        echoed++;
+        if(echoed == WARMUP) {
+            allocations = g_allocations.load();
+        } else if(echoed == WARMUP + MESSAGES) {
+            allocations = g_allocations.load() - allocations;
+            this->Close(wsocket::CloseCode::CLOSE_NORMAL);
+            return;
+        }
+        this->Ping();
+        this->Text(text_);
+    }
+    void OnClose(int16_t code, const std::string &reason) override { this->Stop(); }
+
+    std::string text_ = std::string(1000, 's');
+};
+
+void test_asio_wsocket_zero_allocation() {
+    std::cout << "================== test_asio_wsocket_zero_allocation ==================" << std::endl;
+    using tcp = asio::ip::tcp;
+
+    asio::io_context io_executor;
+    tcp::acceptor    server(io_executor, tcp::endpoint(asio::ip::make_address_v4("127.0.0.1"), 0));
+    server.async_accept([&](asio::error_code ec, tcp::socket peer) {
+        assert(!ec);
+        TestServerSession::Create(std::move(peer))->Start();
+    });
+
+    // both ends on the plain io_context executor: whether asio stores a strand inline depends on its version
+    auto client = TestSteadyClient::Create(tcp::socket(io_executor));
+    client->Handshake(server.local_endpoint());
+    io_executor.run();
+
+    // echo round trips with pings on both ends of a warmed up connection
+    assert(client->echoed == TestSteadyClient::WARMUP + TestSteadyClient::MESSAGES);
+    if(client->allocations != 0) {
+        std::cerr << "steady state allocations per message: "
+                  << double(client->allocations) / TestSteadyClient::MESSAGES << std::endl;
+    }
+    assert(client->allocations == 0);
+    std::cout << "================== test_asio_wsocket_zero_allocation ==================" << std::endl;
+}
+void test_RateLimiter() {
+    std::cout << "================== test_RateLimiter ==================" << std::endl;
+    using namespace std::chrono_literals;
+
+    // 10 per second, 5 at once
+    auto                 now = wsocket::RateLimiter::Clock::now();
+    wsocket::RateLimiter limiter({10, 0, 5, 0});
+    assert(limiter.Enabled());
+    assert(limiter.Charge(5, 1000, now) == 0ns);
+    assert(limiter.Charge(1, 0, now) == 100ms);
+    assert(limiter.Delay(now + 50ms) == 50ms);
+    assert(limiter.Delay(now + 100ms) == 0ns);
+
+    // a shared parent throttles its children together
+    auto parent = std::make_shared<wsocket::RateLimiter>(wsocket::RateLimit{0, 1000, 0, 1000});
+    wsocket::RateLimiter first, second;
+    first.SetParent(parent);
+    second.SetParent(parent);
+    assert(first.Enabled() && second.Enabled());
+    assert(first.Charge(1, 1000, now) == 0ns);
+    assert(second.Charge(1, 500, now) == 500ms);
+
+    wsocket::RateLimiter unlimited;
+    assert(!unlimited.Enabled() && unlimited.Charge(1000, 1000, now) == 0ns);
+    std::cout << "================== test_RateLimiter ==================" << std::endl;
+}
+class TestRateLimitClient : public wsocket::WSocket {
+protected:
+    explicit TestRateLimitClient(asio::io_context &io_executor) : wsocket::WSocket(io_executor.get_executor()) {}
+
+public:
+    static std::shared_ptr<TestRateLimitClient> Create(asio::io_context &io_executor) {
+        return std::shared_ptr<TestRateLimitClient>(new TestRateLimitClient(io_executor));
+    }
+
+    static constexpr int MESSAGES = 30;
+
+    int                                   echoed = 0;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::duration   send_limited{};
+    std::chrono::steady_clock::duration   recv_limited{};
+
+private:
+    void OnError(std::error_code code) override { std::cout << "OnError: " << code << std::endl; }
+    void OnConnected() override {
+        // 10 go out at once, the other 20 at 100 per second
+        this->SetSendRateLimit({100, 0, 10, 0});
+        start = std::chrono::steady_clock::now();
+        for(int i = 0; i < MESSAGES; ++i) {
+            this->Text(std::to_string(i));
+        }
+        assert(this->IsSendThrottled());
+    }
+    void OnText(std::string_view text, bool finish) override {
+        if(++echoed == MESSAGES) {
+            send_limited = std::chrono::steady_clock::now() - start;
+
+            // the server has been charged 30 messages, it waits before reading this one
+            this->SetSendRateLimit({});
+            start = std::chrono::steady_clock::now();
+            this->Text("last");
+        } else if(echoed > MESSAGES) {
+            recv_limited = std::chrono::steady_clock::now() - start;
+            this->Close(wsocket::CloseCode::CLOSE_NORMAL);
+        }
+    }
+    void OnClose(int16_t code, const std::string &reason) override { this->Stop(); }
+};
+
+void test_asio_wsocket_rate_limit() {
+    std::cout << "================== test_asio_wsocket_rate_limit ==================" << std::endl;
+    using tcp = asio::ip::tcp;
+    using namespace std::chrono_literals;
+
+    // 100 messages per second across the whole server, 10 at once
+    wsocket::WSocketServerOptions options;
+    options.threads    = 1;
+    options.recv_limit = {100, 0, 10, 0};
+
+    wsocket::TcpWSocketServer server(
+            [](size_t worker, tcp::socket &&socket) { return TestServerSession::Create(std::move(socket)); }, options);
+    auto ec = server.Start(tcp::endpoint(asio::ip::make_address_v4("127.0.0.1"), 0));
+    assert(!ec);
+
+    asio::io_context io_executor;
+    auto             client = TestRateLimitClient::Create(io_executor);
+    client->Handshake(server.LocalEndpoint());
+    io_executor.run();
+    server.Stop();
+
+    assert(client->echoed == TestRateLimitClient::MESSAGES + 1);
+    assert(client->send_limited >= 150ms);
+    assert(client->recv_limited >= 40ms);
+    std::cout << "================== test_asio_wsocket_rate_limit ==================" << std::endl;
+}
+#endif
+
+#ifdef ASIO_HAS_CO_AWAIT
+asio::awaitable<void> awaitable_echo(std::shared_ptr<wsocket::AwaitableWSocket> ws) {
+    ws->Start();
+    try {
+        for(;;) {
+            auto message = co_await ws->Receive();
+            if(message.IsText()) {
+                co_await ws->Send(message.Text());
+            } else {
+                co_await ws->Send(message.Binary());
+            }
+            ws->Recycle(std::move(message));
+        }
+    } catch(const std::system_error &e) {
+        std::cout << "awaitable_echo: " << e.code().message() << std::endl;
+    }
+}
+
+asio::awaitable<void> awaitable_client(std::shared_ptr<wsocket::AwaitableWSocket> ws) {
+    co_await ws->Connect(asio::ip::tcp::endpoint(asio::ip::make_address_v4("127.0.0.1"), 12001));
+
+    for(int i = 0; i < 100; ++i) {
+        auto text = "awaitable " + std::to_string(i);
+        co_await ws->Send(text);
+        auto message = co_await ws->Receive();
+        assert(message.IsText());
+        assert(message.Text() == text);
+        ws->Recycle(std::move(message));
+    }
+
+    // fragments are joined before Receive completes
+    ws->Binary({(uint8_t *)"abc", 3}, false);
+    ws->Binary({(uint8_t *)"def", 3}, true);
+    auto message = co_await ws->Receive();
+    assert(!message.IsText());
+    assert(message.data == "abcdef");
+    ws->Recycle(std::move(message));
+
+    // a send refused at the high watermark completes with would_block, the corked one still goes out
+    ws->EnableWouldBlock(true);
+    ws->SetSendWatermarks(0, 1);
+    ws->SetFlushWindow(std::chrono::milliseconds(10));
+    co_await ws->Send(std::string("corked"));
+    bool would_block = false;
+    try {
+        co_await ws->Send(std::string("refused"));
+    } catch(const std::system_error &e) {
+        would_block = e.code() == asio::error::would_block;
+    }
+    assert(would_block);
+    message = co_await ws->Receive();
+    assert(message.IsText());
+    assert(message.Text() == "corked");
+    ws->Recycle(std::move(message));
+    ws->EnableWouldBlock(false);
+    ws->SetFlushWindow(std::chrono::microseconds(0));
+
+    co_await ws->Close();
+    bool eof = false;
+    try {
+        co_await ws->Receive();
+    } catch(const std::system_error &e) {
+        eof = e.code() == asio::error::eof;
+    }
+    assert(eof);
+    std::cout << "awaitable_client done" << std::endl;
+}
+
+void test_asio_awaitable_wsocket() {
+    std::cout << "================== test_asio_awaitable_wsocket ==================" << std::endl;
+    asio::io_context io_executor;
+
+    using tcp = asio::ip::tcp;
+    tcp::acceptor server(io_executor, tcp::endpoint(asio::ip::tcp::v4(), 12001));
+    server.async_accept([&](asio::error_code ec, asio::ip::tcp::socket peer) {
+        if(ec) {
+            std::cout << ec.message() << std::endl;
+            return;
+        }
+        auto ws = wsocket::AwaitableWSocket::Create(std::move(peer));
+        asio::co_spawn(ws->get_executor(), awaitable_echo(ws), asio::detached);
+    });
+
+    auto client = wsocket::AwaitableWSocket::Create(io_executor.get_executor());
+    asio::co_spawn(client->get_executor(), awaitable_client(client), [](std::exception_ptr e) {
+        if(e) {
+            std::rethrow_exception(e);
+        }
+    });
+
+    io_executor.run();
+    std::cout << "================== test_asio_awaitable_wsocket ==================" << std::endl;
+}
+#endif
+
+#ifdef WITH_IO_URING
+class TestUringEcho : public wsocket::IoUringWSocket {
+protected:
+    TestUringEcho(wsocket::IoUringLoop &loop, int fd) : wsocket::IoUringWSocket(loop, fd) {}
+
+public:
+    static std::shared_ptr<TestUringEcho> Create(wsocket::IoUringLoop &loop, int fd) {
+        return std::shared_ptr<TestUringEcho>(new TestUringEcho(loop, fd));
+    }
+
+private:
+    void OnText(std::string_view text, bool finish) override { this->Text(text, finish); }
+    void OnClose(int16_t code, const std::string &reason) override { this->Stop(); }
+};
+
+class TestUringClient : public wsocket::IoUringWSocket {
+protected:
+    explicit TestUringClient(wsocket::IoUringLoop &loop) : wsocket::IoUringWSocket(loop), loop_(loop) {}
+
+public:
+    static std::shared_ptr<TestUringClient> Create(wsocket::IoUringLoop &loop) {
+        return std::shared_ptr<TestUringClient>(new TestUringClient(loop));
+    }
+
+    int         echoed = 0;
+    std::string large;
+
+private:
+    void OnError(std::error_code code) override {
+        std::cout << "OnError: " << code << ":" << code.message() << std::endl;
+        loop_.Stop();
+    }
+    void OnConnected() override {
+        std::cout << "OnConnected" << std::endl;
+        auto batch = this->Batch();
+        for(int i = 0; i < 100; ++i) {
+            this->Text("uring " + std::to_string(i));
+        }
+    }
+    void OnText(std::string_view text, bool finish) override {
+        if(echoed < 100) {
+            assert(text == "uring " + std::to_string(echoed));
+        } else {
+            // larger than one provided buffer
+            assert(text == large);
+        }
+        if(++echoed == 100) {
+            large.assign(100 * 1024, 'x');
+            this->Text(large);
+        } else if(echoed == 101) {
+            this->Close(wsocket::CloseCode::CLOSE_NORMAL);
+        }
+    }
+    void OnClose(int16_t code, const std::string &reason) override {
+        std::cout << "OnClose: " << code << ":" << reason << std::endl;
+        this->Stop();
+        loop_.Stop();
+    }
+
+    wsocket::IoUringLoop &loop_;
+};
+
+void test_io_uring_wsocket() {
+    std::cout << "================== test_io_uring_wsocket ==================" << std::endl;
+    wsocket::IoUringLoop loop;
+    if(!loop.Open()) {
+        std::cout << "io_uring unavailable: " << std::strerror(errno) << std::endl;
+        return;
+    }
+
+    sockaddr_in address{};
+    address.sin_family      = AF_INET;
+    address.sin_port        = htons(12002);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    wsocket::IoUringAcceptor acceptor(loop);
+    bool                     listening = acceptor.Open(reinterpret_cast<sockaddr *>(&address), sizeof(address));
+    assert(listening);
+    acceptor.Start([&](int fd) { TestUringEcho::Create(loop, fd)->Start(); });
+
+    auto client = TestUringClient::Create(loop);
+    client->Handshake(reinterpret_cast<sockaddr *>(&address), sizeof(address));
+
+    loop.Run();
+    assert(client->echoed == 101);
+    std::cout << "================== test_io_uring_wsocket ==================" << std::endl;
+}
+#endif
+
+#ifdef __linux__
+class TestEpollEcho : public wsocket::EpollWSocket {
+protected:
+    TestEpollEcho(wsocket::EpollLoop &loop, int fd) : wsocket::EpollWSocket(loop, fd) {}
+
+public:
+    static std::unique_ptr<TestEpollEcho> Create(wsocket::EpollLoop &loop, int fd) {
+        return std::unique_ptr<TestEpollEcho>(new TestEpollEcho(loop, fd));
+    }
+
+private:
+    void OnText(std::string_view text, bool finish) override { this->Text(text, finish); }
+    void OnClose(int16_t code, const std::string &reason) override { this->Stop(); }
+};
+
+class TestEpollClient : public wsocket::EpollWSocket {
+protected:
+    explicit TestEpollClient(wsocket::EpollLoop &loop) : wsocket::EpollWSocket(loop), loop_(loop) {}
+
+public:
+    static std::unique_ptr<TestEpollClient> Create(wsocket::EpollLoop &loop) {
+        return std::unique_ptr<TestEpollClient>(new TestEpollClient(loop));
+    }
+
+    int         echoed = 0;
+    std::string large;
+
+private:
+    void OnError(std::error_code code) override {
+        std::cout << "OnError: " << code << ":" << code.message() << std::endl;
+        loop_.Stop();
+    }
+    void OnConnected() override {
+        std::cout << "OnConnected" << std::endl;
+        auto batch = this->Batch();
+        for(int i = 0; i < 100; ++i) {
+            this->Text("epoll " + std::to_string(i));
+        }
+    }
+    void OnText(std::string_view text, bool finish) override {
+        if(echoed < 100) {
+            assert(text == "epoll " + std::to_string(echoed));
+        } else {
+            // more than the socket buffer takes at once
+            assert(text == large);
+        }
+        if(++echoed == 100) {
+            large.assign(8 * 1024 * 1024, 'x');
+            this->Text(large);
+        } else if(echoed == 101) {
+            this->Close(wsocket::CloseCode::CLOSE_NORMAL);
+        }
+    }
+    void OnClose(int16_t code, const std::string &reason) override {
+        std::cout << "OnClose: " << code << ":" << reason << std::endl;
+        this->Stop();
+        loop_.Stop();
+    }
+
+    wsocket::EpollLoop &loop_;
+};
+
+void test_epoll_wsocket() {
+    std::cout << "================== test_epoll_wsocket ==================" << std::endl;
+    wsocket::EpollLoop loop;
+    bool               opened = loop.Open();
+    assert(opened);
+
+    sockaddr_in address{};
+    address.sin_family      = AF_INET;
+    address.sin_port        = htons(12003);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    wsocket::EpollAcceptor acceptor(loop);
+    bool                   listening = acceptor.Open(reinterpret_cast<sockaddr *>(&address), sizeof(address));
+    assert(listening);
+    acceptor.Start([&](int fd) {
+        auto session = TestEpollEcho::Create(loop, fd);
+        session->EnableIdleRecv(true);
+        session->Start();
+        loop.Adopt(std::move(session));
+    });
+
+    auto client = TestEpollClient::Create(loop);
+    client->Handshake(reinterpret_cast<sockaddr *>(&address), sizeof(address));
+
+    loop.Run();
+    assert(client->echoed == 101);
+    std::cout << "================== test_epoll_wsocket ==================" << std::endl;
+}
+
+// Answers "go" with more than one read budget of small messages
+class TestEpollBurst : public wsocket::EpollWSocket {
+protected:
+    TestEpollBurst(wsocket::EpollLoop &loop, int fd) : wsocket::EpollWSocket(loop, fd) {}
+
+public:
+    static std::unique_ptr<TestEpollBurst> Create(wsocket::EpollLoop &loop, int fd) {
+        return std::unique_ptr<TestEpollBurst>(new TestEpollBurst(loop, fd));
+    }
+
+private:
+    void OnText(std::string_view text, bool finish) override {
+        std::string message(1024, 'x');
+        auto        batch = this->Batch();
+        for(int i = 0; i < 4096; ++i) {
+            this->Text(message);
+        }
+    }
+};
+
+// Wakes `kill` while it still has unread data, i.e. is on the loop's scheduled list
+class TestEpollScheduledClient : public wsocket::EpollWSocket {
+protected:
+    TestEpollScheduledClient(wsocket::EpollLoop &loop, int kill) : wsocket::EpollWSocket(loop), kill_(kill) {}
+
+public:
+    static std::unique_ptr<TestEpollScheduledClient> Create(wsocket::EpollLoop &loop, int kill) {
+        return std::unique_ptr<TestEpollScheduledClient>(new TestEpollScheduledClient(loop, kill));
+    }
+
+    int received = 0;
+
+private:
+    void OnConnected() override { this->Text("go"); }
+    void OnText(std::string_view text, bool finish) override {
+        if(++received == 1) {
+            uint64_t one = 1;
+            std::ignore  = ::write(kill_, &one, sizeof(one));
+        }
+    }
+
+    int kill_;
+};
+
+// Destroys the client from another handler before the loop runs its scheduled sockets
+struct TestEpollKill : wsocket::EpollHandle {
+    void OnEvents(uint32_t events) override {
+        received = client->received;
+        client.reset();
+        loop->Stop();
+    }
+
+    wsocket::EpollLoop                       *loop = nullptr;
+    std::unique_ptr<TestEpollScheduledClient> client;
+    int                                       received = 0;
+};
+
+void test_epoll_wsocket_destroy_scheduled() {
+    std::cout << "================== test_epoll_wsocket_destroy_scheduled ==================" << std::endl;
+    wsocket::EpollLoop loop;
+    bool               opened = loop.Open();
+    assert(opened);
+
+    sockaddr_in address{};
+    address.sin_family      = AF_INET;
+    address.sin_port        = htons(12004);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    wsocket::EpollAcceptor acceptor(loop);
+    bool                   listening = acceptor.Open(reinterpret_cast<sockaddr *>(&address), sizeof(address));
+    assert(listening);
+    acceptor.Start([&](int fd) {
+        auto session = TestEpollBurst::Create(loop, fd);
+        session->Start();
+        loop.Adopt(std::move(session));
+    });
+
+    TestEpollKill kill;
+    int           kill_fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    assert(kill_fd >= 0);
+    kill.loop   = &loop;
+    kill.client = TestEpollScheduledClient::Create(loop, kill_fd);
+    loop.Add(kill_fd, EPOLLIN | EPOLLET, &kill);
+    kill.client->Handshake(reinterpret_cast<sockaddr *>(&address), sizeof(address));
+
+    loop.Run();
+    assert(!kill.client);
+    assert(kill.received > 0 && kill.received < 4096);
+    loop.Remove(kill_fd);
+    ::close(kill_fd);
+    std::cout << "================== test_epoll_wsocket_destroy_scheduled ==================" << std::endl;
+}
+#endif
+
+#ifdef __linux__
+class TestShmEcho : public wsocket::ShmWSocket {
+protected:
+    explicit TestShmEcho(wsocket::ShmSegment &&segment) : wsocket::ShmWSocket(std::move(segment)) {}
+
+public:
+    static std::unique_ptr<TestShmEcho> Create(wsocket::ShmSegment &&segment) {
+        return std::unique_ptr<TestShmEcho>(new TestShmEcho(std::move(segment)));
+    }
+
+private:
+    void OnText(std::string_view text, bool finish) override { this->Text(text, finish); }
+    void OnClose(int16_t code, const std::string &reason) override { this->Stop(); }
+};
+
+class TestShmClient : public wsocket::ShmWSocket {
+protected:
+    explicit TestShmClient(wsocket::ShmSegment &&segment) : wsocket::ShmWSocket(std::move(segment)) {}
+
+public:
+    static std::unique_ptr<TestShmClient> Create(wsocket::ShmSegment &&segment) {
+        return std::unique_ptr<TestShmClient>(new TestShmClient(std::move(segment)));
+    }
+
+    int         echoed = 0;
+    std::string large;
+
+private:
+    void OnError(std::error_code code) override {
+        std::cout << "OnError: " << code << ":" << code.message() << std::endl;
+        this->Stop();
+    }
+    void OnConnected() override {
+        std::cout << "OnConnected" << std::endl;
+        auto batch = this->Batch();
+        for(int i = 0; i < 100; ++i) {
+            this->Text("shm " + std::to_string(i));
+        }
+    }
+    void OnText(std::string_view text, bool finish) override {
+        if(echoed < 100) {
+            assert(text == "shm " + std::to_string(echoed));
+        } else {
+            // many times the ring capacity
+            assert(text == large);
+        }
+        if(++echoed == 100) {
+            large.assign(1024 * 1024, 'x');
+            this->Text(large);
+        } else if(echoed == 101) {
+            this->Close(wsocket::CloseCode::CLOSE_NORMAL);
+        }
+    }
+    void OnClose(int16_t code, const std::string &reason) override {
+        std::cout << "OnClose: " << code << ":" << reason << std::endl;
+        this->Stop();
+    }
+};
+
+void test_shm_wsocket() {
+    std::cout << "================== test_shm_wsocket ==================" << std::endl;
+    for(uint32_t spins : {0u, 1000u}) {
+        wsocket::ShmSegment server_segment;
+        bool                created = server_segment.Create("", 4096);
+        assert(created);
+        wsocket::ShmSegment client_segment;
+        bool                opened = client_segment.Open(server_segment.Fd());
+        assert(opened);
+
+        auto server = TestShmEcho::Create(std::move(server_segment));
+        auto client = TestShmClient::Create(std::move(client_segment));
+        server->SetBusyPoll(spins);
+        client->SetBusyPoll(spins);
+
+        std::thread server_thread([&]() { server->Run(); });
+        client->Handshake();
+        client->Run();
+        server_thread.join();
+        assert(client->echoed == 101);
+    }
+    std::cout << "================== test_shm_wsocket ==================" << std::endl;
+}
+#endif
+
+int main() {
+    std::cout << "================== start ==================" << std::endl;
+    try {
+        testBasicHeader();
+        testFrameHeader();
+        test_SlidingBuffer();
+        test_WSocketContext();
+        test_Utf8Validator();
+        test_WSocketContext_utf8();
+        test_WSocketContext_max_frame();
+        test_WSocketContext_cork();
+        test_BufferPool();
+        test_WSocketContext_idle_buffer();
+        test_MemoryResource();
+        test_zero_allocation();
+        test_owned_messages();
+        test_direct_receive();
+#ifndef _WIN32
+        test_spill_receive();
+#endif
+        test_frame_builder();
+        test_RateLimiter();
+        test_asio_wsocket();
+        test_asio_unix_wsocket();
+        test_asio_wsocket_zstd();
+        test_asio_wsocket_server();
+        test_asio_wsocket_post();
+        test_asio_wsocket_back_pressure();
+        test_asio_wsocket_conflation();
+        test_asio_wsocket_rate_limit();
+        test_asio_wsocket_idle_recv();
+        test_asio_wsocket_direct_receive();
+#ifdef __linux__
+        test_asio_wsocket_send_file();
+        test_asio_wsocket_zero_copy();
+#endif
+        test_asio_wsocket_zero_allocation();
+#ifdef ASIO_HAS_CO_AWAIT
+        test_asio_awaitable_wsocket();
+#endif
+#ifdef WITH_IO_URING
+        test_io_uring_wsocket();
+#endif
+#ifdef __linux__
+        test_epoll_wsocket();
+        test_epoll_wsocket_destroy_scheduled();
+        test_shm_wsocket();
+#endif
     } catch(const std::exception &e) {
         std::cout << "exception: " << e.what() << std::endl;
     }